@@ -34,66 +34,600 @@
  *------------------------------------------------------------------------------
  */
 
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <dirent.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/param.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <zlib.h>
 
 #include "OMEIS_Error.h"
 #include "Pixels.h"
+#include "File.h"
 #include "omeis.h"
+#include "cgi.h"
+#include "stream.h"
+#include "byteorder.h"
 #include "archive.h"
 
 #ifndef OMEIS_ROOT
 #define OMEIS_ROOT "."
 #endif
 
+/*
+  The archive is written as a stream: each member's local header, its data
+  and then a data descriptor carrying the CRC and sizes, followed by the
+  central directory once every member has been sent.  Nothing is ever
+  written to disk and the client starts receiving data immediately.
+
+  Members are cut into ZIP_BLOCK_SIZE blocks which are compressed by a pool
+  of threads.  Each block is deflated as its own raw stream, primed with the
+  previous block's last 32K as a dictionary and ended with a sync flush, so
+  the blocks concatenate into one valid deflate stream (the same trick pigz
+  uses).  Block CRCs are merged with crc32_combine().  The main thread reads
+  blocks and writes finished ones strictly in order; at most nJobs blocks
+  are in flight at any time, which bounds memory.
+
+  Stored (uncompressed) members are not copied at all: their blocks point
+  into a read-only mapping of the file, the threads only compute the CRCs,
+  and the data goes out through streamFD() (sendfile/splice).
+*/
+
+typedef struct {
+  OID fileID;
+  char path[MAXPATHLEN];
+  char *name;
+  u_int64_t size;
+  u_int64_t csize;
+  u_int64_t offset;
+  unsigned long crc;
+  u_int16_t dosTime;
+  u_int16_t dosDate;
+  char isZip64;
+  int fd;
+  unsigned char *map;
+  size_t mapLen;
+} zipEntry;
+
+typedef struct {
+  zipEntry *entry;
+  unsigned char *buf;
+  unsigned char *in;
+  unsigned char *out;
+  off_t fileOffset;
+  unsigned char dict[ZIP_DICT_SIZE];
+  size_t len;
+  size_t outLen;
+  size_t dictLen;
+  unsigned long crc;
+  char first;
+  char last;
+  char done;
+  char failed;
+} zipJob;
+
+typedef struct {
+  FILE *out;
+  u_int64_t offset;
+  int method;
+  int level;
+  zipJob *jobs;
+  int nJobs;
+  size_t outSize;
+  unsigned long head;   /* oldest job not yet written */
+  unsigned long next;   /* next job for a thread to pick up */
+  unsigned long tail;   /* jobs submitted so far */
+  int nThreads;
+  pthread_t *threads;
+  pthread_mutex_t lock;
+  pthread_cond_t workReady;
+  pthread_cond_t jobDone;
+  char shutdown;
+} zipStream;
+
+static int
+zipWrite (zipStream *zs, const void *buf, size_t len) {
+  if (len && fwrite (buf, 1, len, zs->out) != len)
+    return -1;
+  zs->offset += len;
+  return 0;
+}
+
+static void
+dosDateTime (time_t t, u_int16_t *dosTime, u_int16_t *dosDate) {
+  struct tm *tm = localtime (&t);
+
+  // DOS dates start in 1980
+  if (!tm || tm->tm_year < 80) {
+    *dosTime = 0;
+    *dosDate = (1 << 5) | 1;
+    return;
+  }
+  *dosTime = (tm->tm_hour << 11) | (tm->tm_min << 5) | (tm->tm_sec >> 1);
+  *dosDate = ((tm->tm_year - 80) << 9) | ((tm->tm_mon + 1) << 5) | tm->tm_mday;
+}
+
+static int
+writeLocalHeader (zipStream *zs, zipEntry *entry) {
+  unsigned char hdr[30], extra[20], *p;
+  size_t nameLen = strlen (entry->name);
+
+  entry->offset = zs->offset;
+
+  p = put32 (hdr, ZIP_LOCAL_SIG);
+  p = put16 (p, entry->isZip64 ? ZIP64_VERSION : ZIP_VERSION);
+  p = put16 (p, ZIP_FLAG_DESCRIPTOR);
+  p = put16 (p, zs->method);
+  p = put16 (p, entry->dosTime);
+  p = put16 (p, entry->dosDate);
+  p = put32 (p, 0);
+  p = put32 (p, entry->isZip64 ? 0xFFFFFFFF : 0);
+  p = put32 (p, entry->isZip64 ? 0xFFFFFFFF : 0);
+  p = put16 (p, nameLen);
+  p = put16 (p, entry->isZip64 ? sizeof (extra) : 0);
+
+  if (zipWrite (zs, hdr, sizeof (hdr)) || zipWrite (zs, entry->name, nameLen))
+    return -1;
+
+  // The real sizes follow in the (64-bit) data descriptor
+  if (entry->isZip64) {
+    p = put16 (extra, ZIP64_EXTRA_ID);
+    p = put16 (p, 16);
+    p = put64 (p, 0);
+    p = put64 (p, 0);
+    if (zipWrite (zs, extra, sizeof (extra)))
+      return -1;
+  }
+  return 0;
+}
+
+static int
+writeDescriptor (zipStream *zs, zipEntry *entry) {
+  unsigned char desc[24], *p;
+
+  p = put32 (desc, ZIP_DESCRIPTOR_SIG);
+  p = put32 (p, entry->crc);
+  if (entry->isZip64) {
+    p = put64 (p, entry->csize);
+    p = put64 (p, entry->size);
+  } else {
+    p = put32 (p, entry->csize);
+    p = put32 (p, entry->size);
+  }
+  return zipWrite (zs, desc, p - desc);
+}
+
+static int
+writeCentralEntry (zipStream *zs, zipEntry *entry) {
+  unsigned char hdr[46], extra[28], *p, *x;
+  size_t nameLen = strlen (entry->name);
+  int bigSizes, bigOffset;
+
+  bigSizes = entry->isZip64 || entry->size >= 0xFFFFFFFF || entry->csize >= 0xFFFFFFFF;
+  bigOffset = entry->offset >= 0xFFFFFFFF;
+
+  // Only the fields that don't fit go in the ZIP64 extra field, in this order
+  x = extra + 4;
+  if (bigSizes) {
+    x = put64 (x, entry->size);
+    x = put64 (x, entry->csize);
+  }
+  if (bigOffset)
+    x = put64 (x, entry->offset);
+  put16 (extra, ZIP64_EXTRA_ID);
+  put16 (extra + 2, (x - extra) - 4);
+
+  p = put32 (hdr, ZIP_CENTRAL_SIG);
+  p = put16 (p, (3 << 8) | ZIP64_VERSION);  // made by: UNIX
+  p = put16 (p, (bigSizes || bigOffset) ? ZIP64_VERSION : ZIP_VERSION);
+  p = put16 (p, ZIP_FLAG_DESCRIPTOR);
+  p = put16 (p, zs->method);
+  p = put16 (p, entry->dosTime);
+  p = put16 (p, entry->dosDate);
+  p = put32 (p, entry->crc);
+  p = put32 (p, bigSizes ? 0xFFFFFFFF : entry->csize);
+  p = put32 (p, bigSizes ? 0xFFFFFFFF : entry->size);
+  p = put16 (p, nameLen);
+  p = put16 (p, (bigSizes || bigOffset) ? x - extra : 0);
+  p = put16 (p, 0);                          // comment length
+  p = put16 (p, 0);                          // disk number
+  p = put16 (p, 0);                          // internal attributes
+  p = put32 (p, (u_int32_t)0100644 << 16);   // external attributes: -rw-r--r--
+  p = put32 (p, bigOffset ? 0xFFFFFFFF : entry->offset);
+
+  if (zipWrite (zs, hdr, sizeof (hdr)) || zipWrite (zs, entry->name, nameLen))
+    return -1;
+  if ((bigSizes || bigOffset) && zipWrite (zs, extra, x - extra))
+    return -1;
+  return 0;
+}
+
+static int
+writeCentralDirectory (zipStream *zs, zipEntry *entries, int num_files) {
+  unsigned char end[56], *p;
+  u_int64_t cdOffset, cdSize, zip64EndOffset;
+  int i, needZip64;
+
+  cdOffset = zs->offset;
+  for (i = 0; i < num_files; i++)
+    if (writeCentralEntry (zs, &entries[i]))
+      return -1;
+  cdSize = zs->offset - cdOffset;
+
+  needZip64 = num_files >= 0xFFFF || cdOffset >= 0xFFFFFFFF || cdSize >= 0xFFFFFFFF;
+  if (needZip64) {
+    zip64EndOffset = zs->offset;
+    p = put32 (end, ZIP64_END_SIG);
+    p = put64 (p, 44);                       // size of the rest of this record
+    p = put16 (p, (3 << 8) | ZIP64_VERSION);
+    p = put16 (p, ZIP64_VERSION);
+    p = put32 (p, 0);
+    p = put32 (p, 0);
+    p = put64 (p, num_files);
+    p = put64 (p, num_files);
+    p = put64 (p, cdSize);
+    p = put64 (p, cdOffset);
+    if (zipWrite (zs, end, p - end))
+      return -1;
+
+    p = put32 (end, ZIP64_LOCATOR_SIG);
+    p = put32 (p, 0);
+    p = put64 (p, zip64EndOffset);
+    p = put32 (p, 1);
+    if (zipWrite (zs, end, p - end))
+      return -1;
+  }
+
+  p = put32 (end, ZIP_END_SIG);
+  p = put16 (p, 0);
+  p = put16 (p, 0);
+  p = put16 (p, needZip64 ? 0xFFFF : num_files);
+  p = put16 (p, needZip64 ? 0xFFFF : num_files);
+  p = put32 (p, needZip64 ? 0xFFFFFFFF : cdSize);
+  p = put32 (p, needZip64 ? 0xFFFFFFFF : cdOffset);
+  p = put16 (p, 0);
+  return zipWrite (zs, end, p - end);
+}
+
+static void
+compressJob (zipStream *zs, zipJob *job) {
+  z_stream strm;
+  int ret;
+
+  job->crc = crc32 (crc32 (0L, Z_NULL, 0), job->in, job->len);
+
+  if (zs->method == ZIP_METHOD_STORE) {
+    job->outLen = job->len;
+    return;
+  }
+
+  memset (&strm, 0, sizeof (strm));
+  if (deflateInit2 (&strm, zs->level, Z_DEFLATED, -MAX_WBITS, 8,
+		    Z_DEFAULT_STRATEGY) != Z_OK) {
+    job->failed = 1;
+    return;
+  }
+  if (job->dictLen)
+    deflateSetDictionary (&strm, job->dict, job->dictLen);
+
+  strm.next_in = job->in;
+  strm.avail_in = job->len;
+  strm.next_out = job->out;
+  strm.avail_out = zs->outSize;
+
+  // Only the member's last block may set the final-block bit
+  ret = deflate (&strm, job->last ? Z_FINISH : Z_SYNC_FLUSH);
+  if (ret == Z_STREAM_ERROR || strm.avail_in != 0 ||
+      (job->last && ret != Z_STREAM_END))
+    job->failed = 1;
+  job->outLen = zs->outSize - strm.avail_out;
+
+  deflateEnd (&strm);
+}
+
+static void *
+compressThread (void *arg) {
+  zipStream *zs = (zipStream *) arg;
+  zipJob *job;
+
+  pthread_mutex_lock (&zs->lock);
+  for (;;) {
+    while (!zs->shutdown && zs->next == zs->tail)
+      pthread_cond_wait (&zs->workReady, &zs->lock);
+    if (zs->shutdown)
+      break;
+
+    job = &zs->jobs[zs->next % zs->nJobs];
+    zs->next++;
+    pthread_mutex_unlock (&zs->lock);
+
+    compressJob (zs, job);
+
+    pthread_mutex_lock (&zs->lock);
+    job->done = 1;
+    pthread_cond_broadcast (&zs->jobDone);
+  }
+  pthread_mutex_unlock (&zs->lock);
+
+  return NULL;
+}
+
+static int
+startCompression (zipStream *zs, int method, int nThreads) {
+  int i;
+
+  zs->method = method;
+  zs->level = Z_DEFAULT_COMPRESSION;
+  zs->nThreads = nThreads;
+  zs->nJobs = nThreads > 1 ? nThreads * ZIP_JOBS_PER_THREAD : 2;
+  // Room for a whole block plus the sync flush marker
+  zs->outSize = compressBound (ZIP_BLOCK_SIZE) + 64;
+
+  if ( !(zs->jobs = calloc (zs->nJobs, sizeof (zipJob))) )
+    return -1;
+  // Stored members are read straight from their mappings
+  for (i = 0; i < zs->nJobs && method == ZIP_METHOD_DEFLATE; i++) {
+    zs->jobs[i].buf = zs->jobs[i].in = malloc (ZIP_BLOCK_SIZE);
+    zs->jobs[i].out = malloc (zs->outSize);
+    if (!zs->jobs[i].buf || !zs->jobs[i].out)
+      return -1;
+  }
+
+  // A single thread compresses inline, in the main thread
+  if (nThreads <= 1)
+    return 0;
+
+  pthread_mutex_init (&zs->lock, NULL);
+  pthread_cond_init (&zs->workReady, NULL);
+  pthread_cond_init (&zs->jobDone, NULL);
+  if ( !(zs->threads = calloc (nThreads, sizeof (pthread_t))) )
+    return -1;
+  for (i = 0; i < nThreads; i++) {
+    if (pthread_create (&zs->threads[i], NULL, compressThread, zs)) {
+      zs->nThreads = i;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static void
+stopCompression (zipStream *zs) {
+  int i;
+
+  if (zs->threads) {
+    pthread_mutex_lock (&zs->lock);
+    zs->shutdown = 1;
+    pthread_cond_broadcast (&zs->workReady);
+    pthread_mutex_unlock (&zs->lock);
+    for (i = 0; i < zs->nThreads; i++)
+      pthread_join (zs->threads[i], NULL);
+    free (zs->threads);
+    pthread_mutex_destroy (&zs->lock);
+    pthread_cond_destroy (&zs->workReady);
+    pthread_cond_destroy (&zs->jobDone);
+  }
+
+  if (zs->jobs) {
+    for (i = 0; i < zs->nJobs; i++) {
+      if (zs->jobs[i].buf) free (zs->jobs[i].buf);
+      if (zs->jobs[i].out) free (zs->jobs[i].out);
+    }
+    free (zs->jobs);
+  }
+}
+
+static void
+releaseEntry (zipEntry *entry) {
+  if (entry->map) munmap (entry->map, entry->mapLen);
+  if (entry->fd >= 0) close (entry->fd);
+  entry->map = NULL;
+  entry->fd = -1;
+}
+
+// Waits for the oldest job in flight and sends it, with headers as needed
+static int
+writeOldestJob (zipStream *zs) {
+  zipJob *job = &zs->jobs[zs->head % zs->nJobs];
+  zipEntry *entry = job->entry;
+
+  if (zs->threads) {
+    pthread_mutex_lock (&zs->lock);
+    while (!job->done)
+      pthread_cond_wait (&zs->jobDone, &zs->lock);
+    pthread_mutex_unlock (&zs->lock);
+  }
+  zs->head++;
+
+  if (job->failed)
+    return -1;
+
+  if (job->first) {
+    entry->crc = crc32 (0L, Z_NULL, 0);
+    entry->size = 0;
+    entry->csize = 0;
+    if (writeLocalHeader (zs, entry))
+      return -1;
+  }
+
+  if (zs->method == ZIP_METHOD_STORE) {
+    if (streamFD (zs->out, entry->fd, job->fileOffset, job->len) != (ssize_t) job->len)
+      return -1;
+    zs->offset += job->len;
+  } else if (zipWrite (zs, job->out, job->outLen))
+    return -1;
+  entry->crc = crc32_combine (entry->crc, job->crc, job->len);
+  entry->size += job->len;
+  entry->csize += job->outLen;
+
+  if (job->last) {
+    releaseEntry (entry);
+    if (writeDescriptor (zs, entry))
+      return -1;
+  }
+  return 0;
+}
+
+// Returns a free job slot, writing out the oldest job if they're all in use
+static zipJob *
+nextJob (zipStream *zs) {
+  zipJob *job;
+
+  if (zs->tail - zs->head == (unsigned long) zs->nJobs && writeOldestJob (zs))
+    return NULL;
+
+  job = &zs->jobs[zs->tail % zs->nJobs];
+  job->done = 0;
+  job->failed = 0;
+  return job;
+}
+
+static void
+submitJob (zipStream *zs, zipJob *job) {
+  if (!zs->threads) {
+    compressJob (zs, job);
+    job->done = 1;
+    zs->tail++;
+    return;
+  }
+
+  pthread_mutex_lock (&zs->lock);
+  zs->tail++;
+  pthread_cond_signal (&zs->workReady);
+  pthread_mutex_unlock (&zs->lock);
+}
+
+static ssize_t
+readBlock (int fd, unsigned char *buf, size_t len) {
+  ssize_t nRead;
+  size_t total = 0;
+
+  while (total < len) {
+    if ((nRead = read (fd, buf + total, len - total)) < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    if (nRead == 0) break;
+    total += nRead;
+  }
+  return total;
+}
+
+// Queues the blocks of one member; its last block is the first one short of a full block
+static int
+queueEntry (zipStream *zs, zipEntry *entry, int fd) {
+  zipJob *job, *prev = NULL;
+  ssize_t nRead;
+
+  do {
+    if ( !(job = nextJob (zs)) )
+      return -1;
+    job->entry = entry;
+    job->first = (prev == NULL);
+    job->dictLen = 0;
+    if (prev && zs->method == ZIP_METHOD_DEFLATE) {
+      job->dictLen = ZIP_DICT_SIZE;
+      memcpy (job->dict, prev->in + prev->len - ZIP_DICT_SIZE, ZIP_DICT_SIZE);
+    }
+
+    if ((nRead = readBlock (fd, job->in, ZIP_BLOCK_SIZE)) < 0)
+      return -1;
+    job->len = nRead;
+    job->last = (job->len < ZIP_BLOCK_SIZE);
+
+    submitJob (zs, job);
+    prev = job;
+  } while (!job->last);
+
+  return 0;
+}
+
+// Queues a stored member as blocks of a read-only mapping; the entry keeps fd until it's written
+static int
+queueMappedEntry (zipStream *zs, zipEntry *entry, int fd, size_t size) {
+  zipJob *job;
+  size_t offset = 0;
+
+  entry->fd = fd;
+  if (size > 0) {
+    if ((entry->map = mmap (NULL, size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+      entry->map = NULL;
+      return -1;
+    }
+    entry->mapLen = size;
+    madvise (entry->map, size, MADV_SEQUENTIAL);
+  }
+
+  do {
+    if ( !(job = nextJob (zs)) )
+      return -1;
+    job->entry = entry;
+    job->first = (offset == 0);
+    job->dictLen = 0;
+    job->in = entry->map + offset;
+    job->fileOffset = offset;
+    job->len = size - offset > ZIP_BLOCK_SIZE ? ZIP_BLOCK_SIZE : size - offset;
+    offset += job->len;
+    job->last = (offset == size);
+
+    submitJob (zs, job);
+  } while (!job->last);
+
+  return 0;
+}
+
+static int
+defaultThreads (void) {
+  long nCPU = sysconf (_SC_NPROCESSORS_ONLN);
+
+  if (nCPU < 1) return 1;
+  return nCPU > ZIP_MAX_THREADS ? ZIP_MAX_THREADS : (int) nCPU;
+}
+
 int 
 zipFiles(char **param) {
+  zipStream zs;
+  zipEntry *entries = NULL, *entry;
+  FileRep *theFile;
+  struct stat fStat;
+  char *theParam;
   char *paramPiece;
-  OID *zipFileID;
-  OID fileID;
-  OID ID=0;
-  int offset = 0;
-  int length = 0;
-  int num_files = 0;
-  char *file_path;
-  char *temp_path;
-  char *orig_path;
-  char *symlink_path;
-  char *zip_path;
-  char *file_name;
-  char *zip_cmd = "zip -j -q ";
-  char *old_zip_cmd;
   char *orig_name;
-  FILE *zip_file;
-  DIR* tmp_dir;
-  struct dirent *tmp_entry;
-  char *byteBuf = malloc(BUF_SIZE);
-  int error_happened = 0;
-  int i;
-  unsigned long long scan_ID;
-  char *theParam;
+  char *file_name;
   char *method = "ZipFiles";
+  unsigned long long scan_ID;
+  int num_files = 0;
+  int error_happened = 0;
+  int zip_method, nThreads;
+  int fd, i;
+
+  memset (&zs, 0, sizeof (zs));
 
-  file_path = malloc(MAX_PATH_LENGTH);
-  strcpy(file_path, "Files/");
-  
   // switch for convenience of break
   switch (0) { 
     case 0:
     // Getting the FileID parameter
     if ( (theParam = get_param(param,"FileID")) ) {
-      zipFileID = malloc(sizeof(OID) * strlen(theParam));
+      entries = calloc (strlen (theParam) / 2 + 1, sizeof (zipEntry));
       paramPiece = strtok(theParam, ",");
       while (paramPiece != NULL) {
-	sscanf (paramPiece,"%llu",&scan_ID);
-	zipFileID[num_files] = (OID)scan_ID;
+	if (sscanf (paramPiece,"%llu",&scan_ID) == 1) {
+	  entries[num_files].fd = -1;
+	  entries[num_files++].fileID = (OID)scan_ID;
+	}
 	paramPiece = strtok(NULL, ",");
-	num_files++;
       }
-    } else {
-      OMEIS_ReportError (method, NULL, ID,"FileID must be specified!");
+    }
+    if (num_files == 0) {
+      OMEIS_ReportError (method, NULL, (OID)0,"FileID must be specified!");
       error_happened = 1;
       break;
     }
@@ -105,137 +639,120 @@ zipFiles(char **param) {
     else {
       orig_name = "images";
     }
-    
-    //Creating the temporary directory
-    temp_path = malloc(strlen(OMEIS_ROOT)+1+strlen(file_path)+strlen("tmp.XXXXXX")+1);
-    strcpy(temp_path, OMEIS_ROOT);
-    strcat(temp_path,"/");
-    strcat(temp_path,file_path);
-    strcat(temp_path,"tmp.XXXXXX");
-
-    // The "XXXXXX" of the tmp directory will be filled with random chars
-    if (mkdtemp(temp_path) == NULL) {
-      OMEIS_ReportError(method, NULL, ID,"Temporary directory could not be created");
-      error_happened = 1;
-      break;
-    }
-    
-    // Adding the original name to the zip command
-    old_zip_cmd = zip_cmd;
-    zip_cmd = malloc(strlen(old_zip_cmd)+strlen(temp_path)+1+strlen(orig_name)+strlen(".zip ")+1);
-    strcpy(zip_cmd, old_zip_cmd);
-    strcat(zip_cmd, temp_path);
-    strcat(zip_cmd, "/");
-    strcat(zip_cmd, orig_name);
-    strcat(zip_cmd, ".zip ");
 
+    // Resolve every file before sending anything, so errors can still be reported
     for (i = 0; i < num_files; i++) {
-      fileID = zipFileID[i];
-      strcpy(file_path, "Files/");
-      if (! getRepPath (fileID,file_path,0)) {
-	OMEIS_ReportError (method, "FileID", fileID, "getRepPath failed");
+      entry = &entries[i];
+      strcpy (entry->path, "Files/");
+      if (! getRepPath (entry->fileID, entry->path, 0)) {
+	OMEIS_ReportError (method, "FileID", entry->fileID, "getRepPath failed");
+	error_happened = 1;
+	break;
+      }
+
+      if ( !(theFile = newFileRep (entry->fileID)) ) {
+	OMEIS_ReportError (method, "FileID", entry->fileID, "newFileRep failed");
 	error_happened = 1;
 	break;
       }
-      
-      //Constructing the Full local path of the original image file
-      orig_path = malloc(strlen(OMEIS_ROOT) + 1 + strlen(file_path) + 1);
-      strcpy(orig_path, OMEIS_ROOT);
-      strcat(orig_path, "/");
-      strcat(orig_path, file_path);
-      
-      //Constructing the new symlink path
-      file_name = GetFileRep(fileID,0,0)->file_info.name;
-      symlink_path = malloc(strlen(temp_path) + 1 + strlen(file_name) + 1);
-      strcpy(symlink_path,temp_path);
-      strcat(symlink_path,"/");
-      strcat(symlink_path,file_name);
-      
-      //Adding to the zip command
-      old_zip_cmd = zip_cmd;
-      zip_cmd = malloc(strlen(old_zip_cmd) + 1 + strlen(symlink_path) + 1);
-      strcpy(zip_cmd, old_zip_cmd);
-      strcat(zip_cmd, " ");
-      strcat(zip_cmd, symlink_path);
-      
-      if (symlink(orig_path, symlink_path)) {
-	OMEIS_ReportError (method, "FileID", fileID, "symlink failed");
+      if (GetFileInfo (theFile) < 0) {
+	OMEIS_ReportError (method, "FileID", entry->fileID, "Could not get file info");
+	freeFileRep (theFile);
 	error_happened = 1;
-	free(orig_path);
-	free(symlink_path);
-	free(old_zip_cmd);
 	break;
       }
-      free(orig_path);
-      free(symlink_path);
-      free(old_zip_cmd);
+
+      // Like zip -j, members are stored without their directory names
+      file_name = strrchr (theFile->file_info.name, '/');
+      file_name = file_name ? file_name + 1 : theFile->file_info.name;
+      entry->name = strdup (file_name);
+      freeFileRep (theFile);
     }
     
     // Test if an error happened
     if (error_happened) break;
-    
-    // System call: Does the actual zipping
-    if (system(zip_cmd)) {
-      OMEIS_ReportError(method, NULL, ID, "system call failed");
-      error_happened = 1;
-      break;
+
+    // Store-only is best for formats that are already compressed
+    zip_method = ZIP_METHOD_DEFLATE;
+    if ( (theParam = get_lc_param (param,"Compression")) ) {
+      if (!strcmp (theParam,"store") || !strcmp (theParam,"none") || !strcmp (theParam,"0"))
+	zip_method = ZIP_METHOD_STORE;
+      else if (strcmp (theParam,"deflate") && strcmp (theParam,"1")) {
+	OMEIS_ReportError (method, NULL, (OID)0, "Compression must be 'store' or 'deflate', not '%s'", theParam);
+	error_happened = 1;
+	break;
+      }
     }
-    
-    // Printing the Zip file to the browser
-    zip_path = malloc(strlen(temp_path) + 1 + strlen(orig_name) + strlen(".zip") + 1);
-    strcpy(zip_path, temp_path);
-    strcat(zip_path, "/");
-    strcat(zip_path, orig_name);
-    strcat(zip_path, ".zip");
-    if ((zip_file = fopen(zip_path, "r")) == NULL) {
-      OMEIS_ReportError(method, NULL, ID, "zip file open failed");
+
+    nThreads = defaultThreads ();
+    if ( (theParam = get_param (param,"Threads")) ) {
+      sscanf (theParam,"%d",&nThreads);
+      if (nThreads < 1) nThreads = 1;
+      if (nThreads > ZIP_MAX_THREADS) nThreads = ZIP_MAX_THREADS;
+    }
+
+    zs.out = stdout;
+    if (startCompression (&zs, zip_method, nThreads)) {
+      OMEIS_ReportError (method, NULL, (OID)0, "Could not set up compression");
       error_happened = 1;
       break;
     }
-    
+
     if (getenv("REQUEST_METHOD") ) {
       fprintf (stdout,"Content-Disposition: attachment; filename=\"%s.zip\"\r\n",orig_name);
     }
     
     HTTP_ResultType ("application/octet-stream");
-        
-    while ((i = fread(byteBuf,1, BUF_SIZE, zip_file)) > 0){
-      fwrite ((u_int8_t *)byteBuf,1,i,stdout);
-    }
-    
-    
-  }
-
-  // CLEANUP
-  //Clearing out the directory and deleting it
-  tmp_dir = opendir(temp_path);
-  orig_path = malloc(strlen(temp_path) + NAME_LIMIT);
-  strcpy(orig_path, temp_path);
-  strcat(orig_path, "/");
-  
-  file_name = orig_path + strlen(temp_path) + 1;
-  
 
-  // Remove temporary files in the tmp directory
-  while ((tmp_entry = readdir(tmp_dir)) != NULL) {
-    if (strcmp(tmp_entry->d_name, ".") && strcmp(tmp_entry->d_name,"..")) {
-      strcpy(file_name, tmp_entry->d_name);
-      if (unlink(orig_path)) {
-	OMEIS_ReportError(method, NULL, ID, "Temporary files were not removed");
+    /*
+      From here on the archive is going out to the client, so an error
+      can't be reported sensibly.  We just stop, and the client is left
+      with a truncated archive that won't pass its integrity check.
+    */
+    for (i = 0; i < num_files && !error_happened; i++) {
+      entry = &entries[i];
+      if ((fd = openRepFile (entry->path, O_RDONLY)) < 0) {
+	error_happened = 1;
+	break;
+      }
+      if (fstat (fd, &fStat) < 0) {
+	close (fd);
 	error_happened = 1;
 	break;
       }
+      dosDateTime (fStat.st_mtime, &entry->dosTime, &entry->dosDate);
+      entry->isZip64 = (u_int64_t)fStat.st_size >= ZIP64_ENTRY_LIMIT;
+
+      if (zip_method == ZIP_METHOD_STORE) {
+	if (queueMappedEntry (&zs, entry, fd, fStat.st_size))
+	  error_happened = 1;
+      } else {
+	if (queueEntry (&zs, entry, fd))
+	  error_happened = 1;
+	close (fd);
+      }
     }
+
+    // Write out whatever is still in flight
+    while (!error_happened && zs.head != zs.tail)
+      if (writeOldestJob (&zs))
+	error_happened = 1;
+
+    if (!error_happened && writeCentralDirectory (&zs, entries, num_files))
+      error_happened = 1;
+    fflush (stdout);
   }
 
-  // Removing the tmp directory
-  rmdir(temp_path);
-  
-  // Freeing up the memory
-  if (zipFileID) free(zipFileID);
-  if (zip_cmd) free(zip_cmd);
-  if (zip_path) free(zip_path);
-  if (temp_path) free(temp_path);
+  // CLEANUP
+  // The threads must be gone before the mappings they read are released
+  stopCompression (&zs);
+  if (entries) {
+    for (i = 0; i < num_files; i++) {
+      releaseEntry (&entries[i]);
+      if (entries[i].name) free (entries[i].name);
+    }
+    free (entries);
+  }
   
   if (error_happened) 
     return -1;
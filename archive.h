@@ -36,9 +36,28 @@
 #ifndef archive_h
 #define archive_h
 
-#define BUF_SIZE 4096
-#define NAME_LIMIT 100
-#define MAX_PATH_LENGTH 100
+/* ZIP record signatures */
+#define ZIP_LOCAL_SIG        0x04034b50
+#define ZIP_DESCRIPTOR_SIG   0x08074b50
+#define ZIP_CENTRAL_SIG      0x02014b50
+#define ZIP64_END_SIG        0x06064b50
+#define ZIP64_LOCATOR_SIG    0x07064b50
+#define ZIP_END_SIG          0x06054b50
+
+#define ZIP_METHOD_STORE     0
+#define ZIP_METHOD_DEFLATE   8
+#define ZIP_FLAG_DESCRIPTOR  0x0008  /* sizes and CRC follow the data */
+#define ZIP_VERSION          20
+#define ZIP64_VERSION        45
+
+#define ZIP_BLOCK_SIZE       (128*1024)  /* unit of work for the compression threads */
+#define ZIP_DICT_SIZE        (32*1024)   /* deflate window primed from the previous block */
+#define ZIP_MAX_THREADS      16
+#define ZIP_JOBS_PER_THREAD  2           /* blocks in flight, bounds memory use */
+
+/* Entries larger than this get ZIP64 sizes, leaving room for deflate overhead */
+#define ZIP64_ENTRY_LIMIT    0xFF000000ULL
+#define ZIP64_EXTRA_ID       0x0001
 
 int zipFiles(char **param);
 
@@ -0,0 +1,384 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif  /* HAVE_CONFIG_H */
+
+#include <string.h>
+#include <sys/types.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define B64_X86 1
+#include <immintrin.h>
+#endif
+
+#include "b64stream.h"
+
+static const char b64Chars[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* Character classes for the decoder: 0-63 are values, the rest are these */
+#define B64_SPACE 64
+#define B64_PAD   65
+#define B64_BAD   255
+
+static unsigned char b64Values[256];
+static int haveValues;
+
+static
+void initValues (void) {
+int i;
+
+	haveValues = 1;
+	memset (b64Values,B64_BAD,sizeof (b64Values));
+	for (i = 0; i < 64; i++) b64Values[(unsigned char) b64Chars[i]] = i;
+	b64Values[' '] = b64Values['\t'] = b64Values['\n'] = b64Values['\r'] = B64_SPACE;
+	b64Values['='] = B64_PAD;
+}
+
+/*
+  Bulk kernels.  They take whole blocks from the front of the input and
+  return how much they took: encoders a multiple of 3 bytes, decoders a
+  multiple of 4 characters.  A decoder stops at the first block holding
+  anything but the 64 values (whitespace, padding, junk), which the
+  scalar code then deals with.  Loads and stores run a few bytes past
+  the block, so each only takes a block with that much room after it.
+*/
+typedef size_t (*b64_kernel)(const unsigned char *in, size_t n, unsigned char *out);
+
+static
+size_t encodeBulk_scalar (const unsigned char *in, size_t n, unsigned char *out) {
+	return (0);
+}
+
+static
+size_t decodeBulk_scalar (const unsigned char *in, size_t n, unsigned char *out) {
+	return (0);
+}
+
+#ifdef B64_X86
+
+/*
+  Encoding after Mula: spread each 3 bytes over 4 lanes of 6 bits with two
+  multiplies, then add the offset from each sextet to its character.
+*/
+__attribute__((target("ssse3")))
+static inline
+__m128i encodeSextets_ssse3 (__m128i in) {
+__m128i t0, t1, t2, t3, idx, sel;
+const __m128i shift = _mm_setr_epi8 ('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+	'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+	in = _mm_shuffle_epi8 (in,_mm_setr_epi8 (1,0,2,1, 4,3,5,4, 7,6,8,7, 10,9,11,10));
+	t0 = _mm_and_si128 (in,_mm_set1_epi32 (0x0fc0fc00));
+	t1 = _mm_mulhi_epu16 (t0,_mm_set1_epi32 (0x04000040));
+	t2 = _mm_and_si128 (in,_mm_set1_epi32 (0x003f03f0));
+	t3 = _mm_mullo_epi16 (t2,_mm_set1_epi32 (0x01000010));
+	idx = _mm_or_si128 (t1,t3);
+
+	sel = _mm_subs_epu8 (idx,_mm_set1_epi8 (51));
+	sel = _mm_or_si128 (sel,_mm_and_si128 (_mm_cmpgt_epi8 (_mm_set1_epi8 (26),idx),_mm_set1_epi8 (13)));
+	return (_mm_add_epi8 (idx,_mm_shuffle_epi8 (shift,sel)));
+}
+
+/* 12 bytes to 16 characters; reads 16 */
+__attribute__((target("ssse3")))
+static
+size_t encodeBulk_ssse3 (const unsigned char *in, size_t n, unsigned char *out) {
+size_t i;
+
+	for (i = 0; i + 16 <= n; i += 12, out += 16)
+		_mm_storeu_si128 ((__m128i *)out,encodeSextets_ssse3 (_mm_loadu_si128 ((const __m128i *)(in + i))));
+	return (i);
+}
+
+__attribute__((target("avx2")))
+static
+size_t encodeBulk_avx2 (const unsigned char *in, size_t n, unsigned char *out) {
+__m256i v, t0, t1, t2, t3, idx, sel;
+const __m256i shift = _mm256_setr_epi8 ('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+	'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+	'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+	'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+const __m256i spread = _mm256_setr_epi8 (1,0,2,1, 4,3,5,4, 7,6,8,7, 10,9,11,10,
+	1,0,2,1, 4,3,5,4, 7,6,8,7, 10,9,11,10);
+size_t i;
+
+	/* 24 bytes to 32 characters, 12 to each lane; reads 28 */
+	for (i = 0; i + 28 <= n; i += 24, out += 32) {
+		v = _mm256_inserti128_si256 (_mm256_castsi128_si256 (_mm_loadu_si128 ((const __m128i *)(in + i))),
+			_mm_loadu_si128 ((const __m128i *)(in + i + 12)),1);
+		v = _mm256_shuffle_epi8 (v,spread);
+		t0 = _mm256_and_si256 (v,_mm256_set1_epi32 (0x0fc0fc00));
+		t1 = _mm256_mulhi_epu16 (t0,_mm256_set1_epi32 (0x04000040));
+		t2 = _mm256_and_si256 (v,_mm256_set1_epi32 (0x003f03f0));
+		t3 = _mm256_mullo_epi16 (t2,_mm256_set1_epi32 (0x01000010));
+		idx = _mm256_or_si256 (t1,t3);
+		sel = _mm256_subs_epu8 (idx,_mm256_set1_epi8 (51));
+		sel = _mm256_or_si256 (sel,_mm256_and_si256 (_mm256_cmpgt_epi8 (_mm256_set1_epi8 (26),idx),_mm256_set1_epi8 (13)));
+		_mm256_storeu_si256 ((__m256i *)out,_mm256_add_epi8 (idx,_mm256_shuffle_epi8 (shift,sel)));
+	}
+	/* The SSSE3 tail isn't VEX-encoded; dirty upper halves would make every instruction of it stall */
+	_mm256_zeroupper ();
+	return (i + encodeBulk_ssse3 (in + i,n - i,out));
+}
+
+/*
+  Decoding, also after Mula: the low and high nibble of each character
+  look up bit masks that only overlap for characters outside the
+  alphabet; the high nibble (and '/') then picks the offset back to the
+  sextet, and two multiply-adds pack 4 sextets into 3 bytes.
+*/
+__attribute__((target("ssse3")))
+static
+size_t decodeBulk_ssse3 (const unsigned char *in, size_t n, unsigned char *out) {
+const __m128i lutLo = _mm_setr_epi8 (0x15,0x11,0x11,0x11,0x11,0x11,0x11,0x11,0x11,0x11,0x13,0x1A,0x1B,0x1B,0x1B,0x1A);
+const __m128i lutHi = _mm_setr_epi8 (0x10,0x10,0x01,0x02,0x04,0x08,0x04,0x08,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x10);
+const __m128i lutRoll = _mm_setr_epi8 (0,16,19,4,-65,-65,-71,-71,0,0,0,0,0,0,0,0);
+const __m128i pack = _mm_setr_epi8 (2,1,0,6,5,4,10,9,8,14,13,12,-1,-1,-1,-1);
+__m128i v, hi, bad, roll;
+size_t i;
+
+	/* 16 characters to 12 bytes; writes 16, so leaves 20 characters of room */
+	for (i = 0; i + 20 <= n; i += 16, out += 12) {
+		v = _mm_loadu_si128 ((const __m128i *)(in + i));
+		hi = _mm_and_si128 (_mm_srli_epi32 (v,4),_mm_set1_epi8 (0x0F));
+		bad = _mm_and_si128 (_mm_shuffle_epi8 (lutLo,_mm_and_si128 (v,_mm_set1_epi8 (0x0F))),_mm_shuffle_epi8 (lutHi,hi));
+		if (_mm_movemask_epi8 (_mm_cmpeq_epi8 (bad,_mm_setzero_si128 ())) != 0xFFFF) break;
+		roll = _mm_shuffle_epi8 (lutRoll,_mm_add_epi8 (_mm_cmpeq_epi8 (v,_mm_set1_epi8 ('/')),hi));
+		v = _mm_add_epi8 (v,roll);
+		v = _mm_maddubs_epi16 (v,_mm_set1_epi32 (0x01400140));
+		v = _mm_madd_epi16 (v,_mm_set1_epi32 (0x00011000));
+		_mm_storeu_si128 ((__m128i *)out,_mm_shuffle_epi8 (v,pack));
+	}
+	return (i);
+}
+
+__attribute__((target("avx2")))
+static
+size_t decodeBulk_avx2 (const unsigned char *in, size_t n, unsigned char *out) {
+const __m256i lutLo = _mm256_setr_epi8 (0x15,0x11,0x11,0x11,0x11,0x11,0x11,0x11,0x11,0x11,0x13,0x1A,0x1B,0x1B,0x1B,0x1A,
+	0x15,0x11,0x11,0x11,0x11,0x11,0x11,0x11,0x11,0x11,0x13,0x1A,0x1B,0x1B,0x1B,0x1A);
+const __m256i lutHi = _mm256_setr_epi8 (0x10,0x10,0x01,0x02,0x04,0x08,0x04,0x08,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x10,
+	0x10,0x10,0x01,0x02,0x04,0x08,0x04,0x08,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x10);
+const __m256i lutRoll = _mm256_setr_epi8 (0,16,19,4,-65,-65,-71,-71,0,0,0,0,0,0,0,0,
+	0,16,19,4,-65,-65,-71,-71,0,0,0,0,0,0,0,0);
+const __m256i pack = _mm256_setr_epi8 (2,1,0,6,5,4,10,9,8,14,13,12,-1,-1,-1,-1,
+	2,1,0,6,5,4,10,9,8,14,13,12,-1,-1,-1,-1);
+__m256i v, hi, bad, roll;
+size_t i;
+
+	/* 32 characters to 24 bytes; writes 32, so leaves 44 characters of room */
+	for (i = 0; i + 44 <= n; i += 32, out += 24) {
+		v = _mm256_loadu_si256 ((const __m256i *)(in + i));
+		hi = _mm256_and_si256 (_mm256_srli_epi32 (v,4),_mm256_set1_epi8 (0x0F));
+		bad = _mm256_and_si256 (_mm256_shuffle_epi8 (lutLo,_mm256_and_si256 (v,_mm256_set1_epi8 (0x0F))),_mm256_shuffle_epi8 (lutHi,hi));
+		if (!_mm256_testz_si256 (bad,bad)) break;
+		roll = _mm256_shuffle_epi8 (lutRoll,_mm256_add_epi8 (_mm256_cmpeq_epi8 (v,_mm256_set1_epi8 ('/')),hi));
+		v = _mm256_add_epi8 (v,roll);
+		v = _mm256_maddubs_epi16 (v,_mm256_set1_epi32 (0x01400140));
+		v = _mm256_madd_epi16 (v,_mm256_set1_epi32 (0x00011000));
+		v = _mm256_shuffle_epi8 (v,pack);
+		_mm256_storeu_si256 ((__m256i *)out,_mm256_permutevar8x32_epi32 (v,_mm256_setr_epi32 (0,1,2,4,5,6,7,7)));
+	}
+	_mm256_zeroupper ();
+	return (i + decodeBulk_ssse3 (in + i,n - i,out));
+}
+
+#endif /* B64_X86 */
+
+static b64_kernel encodeBulk = NULL, decodeBulk = NULL;
+static const char *kernelName = "scalar";
+
+/* Racing callers all pick the same kernels, so no locking is needed */
+static
+void selectKernels (void) {
+b64_kernel enc = encodeBulk_scalar, dec = decodeBulk_scalar;
+
+#ifdef B64_X86
+	__builtin_cpu_init ();
+	if (__builtin_cpu_supports ("avx2")) {
+		enc = encodeBulk_avx2;
+		dec = decodeBulk_avx2;
+		kernelName = "avx2";
+	} else if (__builtin_cpu_supports ("ssse3")) {
+		enc = encodeBulk_ssse3;
+		dec = decodeBulk_ssse3;
+		kernelName = "ssse3";
+	}
+#endif
+	decodeBulk = dec;
+	encodeBulk = enc;
+}
+
+const char *b64KernelName (void) {
+	if (!encodeBulk) selectKernels ();
+	return (kernelName);
+}
+
+void b64EncodeInit (b64Encoder *enc) {
+	if (!encodeBulk) selectKernels ();
+	enc->nCarry = 0;
+}
+
+static
+char *encodeGroup (const unsigned char *p, char *out) {
+u_int32_t v = ((u_int32_t) p[0] << 16) | ((u_int32_t) p[1] << 8) | p[2];
+
+	out[0] = b64Chars[v >> 18];
+	out[1] = b64Chars[(v >> 12) & 0x3F];
+	out[2] = b64Chars[(v >> 6) & 0x3F];
+	out[3] = b64Chars[v & 0x3F];
+	return (out + 4);
+}
+
+/*
+  Encodes n bytes to out, which must have room for B64_ENCODED_MAX(n).
+  Returns the number of characters written; bytes that don't complete a
+  group are kept for the next call.
+*/
+size_t b64Encode (b64Encoder *enc, const unsigned char *in, size_t n, char *out) {
+char *o = out;
+unsigned char group[3];
+size_t i = 0, n3;
+
+	if (enc->nCarry) {
+		if (enc->nCarry + n < 3) {
+			memcpy (enc->carry + enc->nCarry,in,n);
+			enc->nCarry += n;
+			return (0);
+		}
+		memcpy (group,enc->carry,enc->nCarry);
+		i = 3 - enc->nCarry;
+		memcpy (group + enc->nCarry,in,i);
+		o = encodeGroup (group,o);
+		enc->nCarry = 0;
+	}
+	n3 = encodeBulk (in + i,n - i,(unsigned char *) o);
+	o += n3 / 3 * 4;
+	i += n3;
+	for (; i + 3 <= n; i += 3) o = encodeGroup (in + i,o);
+	enc->nCarry = n - i;
+	memcpy (enc->carry,in + i,enc->nCarry);
+	return (o - out);
+}
+
+/* Writes what was carried, padded, and resets the encoder */
+size_t b64EncodeEnd (b64Encoder *enc, char *out) {
+u_int32_t v;
+
+	if (!enc->nCarry) return (0);
+	v = (u_int32_t) enc->carry[0] << 16;
+	if (enc->nCarry > 1) v |= (u_int32_t) enc->carry[1] << 8;
+	out[0] = b64Chars[v >> 18];
+	out[1] = b64Chars[(v >> 12) & 0x3F];
+	out[2] = enc->nCarry > 1 ? b64Chars[(v >> 6) & 0x3F] : '=';
+	out[3] = '=';
+	enc->nCarry = 0;
+	return (4);
+}
+
+void b64DecodeInit (b64Decoder *dec) {
+	if (!haveValues) initValues ();
+	if (!decodeBulk) selectKernels ();
+	dec->bits = 0;
+	dec->nChars = 0;
+	dec->nPad = 0;
+}
+
+/*
+  Decodes n characters to out, which must have room for
+  B64_DECODED_MAX(n).  Returns the number of bytes written, or -1 if the
+  input isn't base64.
+*/
+ssize_t b64Decode (b64Decoder *dec, const char *in, size_t n, unsigned char *out) {
+const unsigned char *p = (const unsigned char *) in, *end = p + n;
+unsigned char *o = out;
+u_int32_t bits = dec->bits, a, b, c, d;
+size_t n4;
+int nChars = dec->nChars;
+unsigned char v;
+
+	while (p < end) {
+		/* Whole groups with nothing unusual in them */
+		if (!nChars && !dec->nPad) {
+			n4 = decodeBulk (p,end - p,o);
+			p += n4;
+			o += n4 / 4 * 3;
+			while (end - p >= 4 &&
+				(a = b64Values[p[0]]) < 64 && (b = b64Values[p[1]]) < 64 &&
+				(c = b64Values[p[2]]) < 64 && (d = b64Values[p[3]]) < 64) {
+				bits = (a << 18) | (b << 12) | (c << 6) | d;
+				o[0] = bits >> 16;
+				o[1] = bits >> 8;
+				o[2] = bits;
+				o += 3;
+				p += 4;
+			}
+			if (p == end) break;
+		}
+
+		v = b64Values[*p++];
+		if (v == B64_SPACE) continue;
+		if (v == B64_BAD || (dec->nPad && v != B64_PAD)) return (-1);
+		if (v == B64_PAD) {
+			/* Padding completes a group of two or three characters, once */
+			if (nChars + dec->nPad < 2 || nChars + dec->nPad >= 4) return (-1);
+			if (nChars + ++dec->nPad == 4) {
+				if (nChars == 2) *o++ = bits >> 4;
+				else {
+					*o++ = bits >> 10;
+					*o++ = bits >> 2;
+				}
+				nChars = 0;
+				bits = 0;
+				dec->nPad = 4;
+			}
+			continue;
+		}
+		bits = (bits << 6) | v;
+		if (++nChars == 4) {
+			o[0] = bits >> 16;
+			o[1] = bits >> 8;
+			o[2] = bits;
+			o += 3;
+			nChars = 0;
+			bits = 0;
+		}
+	}
+	dec->bits = bits;
+	dec->nChars = nChars;
+	return (o - out);
+}
+
+/* Returns 0 if the input ended on a whole group, -1 if not */
+int b64DecodeEnd (b64Decoder *dec) {
+	return (dec->nChars ? -1 : 0);
+}
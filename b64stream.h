@@ -0,0 +1,71 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifndef b64stream_h
+#define b64stream_h
+
+#include <sys/types.h>
+
+/*
+  Incremental base64, for BinData that is encoded or decoded as it
+  streams past.  Input can arrive in pieces of any size: the encoder
+  carries up to two bytes between calls and the decoder up to three
+  characters, so no piece has to line up with a 3-byte group.  The
+  decoder skips whitespace and stops at padding.  Runs of whole groups go
+  through SSSE3 or AVX2 kernels where the CPU has them.
+*/
+
+/* Most characters b64Encode writes for n bytes, including what it carried */
+#define B64_ENCODED_MAX(n) ((((n) + 2) / 3 + 1) * 4)
+
+/* Most bytes b64Decode writes for n characters, including what it carried */
+#define B64_DECODED_MAX(n) (((n) + 3) / 4 * 3 + 3)
+
+typedef struct {
+	unsigned char carry[2];
+	int nCarry;
+} b64Encoder;
+
+typedef struct {
+	u_int32_t bits;
+	int nChars;    /* sextets in bits */
+	int nPad;      /* '=' seen; nothing but whitespace and '=' may follow */
+} b64Decoder;
+
+const char *b64KernelName (void);
+
+void b64EncodeInit (b64Encoder *enc);
+size_t b64Encode (b64Encoder *enc, const unsigned char *in, size_t n, char *out);
+size_t b64EncodeEnd (b64Encoder *enc, char *out);
+
+void b64DecodeInit (b64Decoder *dec);
+ssize_t b64Decode (b64Decoder *dec, const char *in, size_t n, unsigned char *out);
+int b64DecodeEnd (b64Decoder *dec);
+
+#endif
@@ -0,0 +1,223 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+/*
+  BinData base64 throughput.  The reference is a codec that does one
+  group at a time through lookup tables, as base64.c does.  b64stream is
+  checked against it first: the same text for every length up to a few
+  blocks, fed in pieces of every size, and the same bytes back, with and
+  without line breaks.  Then both are timed on one 1024x1024 16-bit plane
+  of noise, encoding, decoding plain text, and decoding text broken into
+  76-character lines as other writers send it.
+
+    b64bench [planes]    planes per timing (default 64)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "b64stream.h"
+#include "benchutil.h"
+
+#define PLANE_BYTES (1024*1024*2)
+#define LINE_CHARS  76
+
+static const char b64Chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static signed char b64Values[256];
+
+static size_t
+refEncode (const unsigned char *in, size_t n, char *out)
+{
+	char *o = out;
+	size_t i;
+
+	for (i = 0; i + 3 <= n; i += 3) {
+		*o++ = b64Chars[in[i] >> 2];
+		*o++ = b64Chars[((in[i] & 0x03) << 4) | (in[i+1] >> 4)];
+		*o++ = b64Chars[((in[i+1] & 0x0f) << 2) | (in[i+2] >> 6)];
+		*o++ = b64Chars[in[i+2] & 0x3f];
+	}
+	if (n - i == 1) {
+		*o++ = b64Chars[in[i] >> 2];
+		*o++ = b64Chars[(in[i] & 0x03) << 4];
+		*o++ = '=';
+		*o++ = '=';
+	} else if (n - i == 2) {
+		*o++ = b64Chars[in[i] >> 2];
+		*o++ = b64Chars[((in[i] & 0x03) << 4) | (in[i+1] >> 4)];
+		*o++ = b64Chars[(in[i+1] & 0x0f) << 2];
+		*o++ = '=';
+	}
+	return (o - out);
+}
+
+/* Skips anything that isn't a base64 character, and stops at padding */
+static size_t
+refDecode (const char *in, size_t n, unsigned char *out)
+{
+	unsigned char *o = out;
+	unsigned int bits = 0;
+	int nChars = 0, v;
+	size_t i;
+
+	for (i = 0; i < n && in[i] != '='; i++) {
+		if ( (v = b64Values[(unsigned char) in[i]]) < 0) continue;
+		bits = (bits << 6) | v;
+		if (++nChars == 4) {
+			*o++ = bits >> 16;
+			*o++ = bits >> 8;
+			*o++ = bits;
+			bits = nChars = 0;
+		}
+	}
+	if (nChars == 2) *o++ = bits >> 4;
+	else if (nChars == 3) {
+		*o++ = bits >> 10;
+		*o++ = bits >> 2;
+	}
+	return (o - out);
+}
+
+/* Breaks text into lines of LINE_CHARS */
+static size_t
+breakLines (const char *text, size_t n, char *out)
+{
+	char *o = out;
+	size_t i, len;
+
+	for (i = 0; i < n; i += len) {
+		len = n - i < LINE_CHARS ? n - i : LINE_CHARS;
+		memcpy (o,text + i,len);
+		o += len;
+		*o++ = '\n';
+	}
+	return (o - out);
+}
+
+static size_t
+streamEncode (const unsigned char *in, size_t n, size_t piece, char *out)
+{
+	b64Encoder enc;
+	size_t i, len = 0;
+
+	b64EncodeInit (&enc);
+	for (i = 0; i < n; i += piece)
+		len += b64Encode (&enc,in + i,n - i < piece ? n - i : piece,out + len);
+	return (len + b64EncodeEnd (&enc,out + len));
+}
+
+static ssize_t
+streamDecode (const char *in, size_t n, size_t piece, unsigned char *out)
+{
+	b64Decoder dec;
+	size_t i, len = 0;
+	ssize_t got;
+
+	b64DecodeInit (&dec);
+	for (i = 0; i < n; i += piece) {
+		if ( (got = b64Decode (&dec,in + i,n - i < piece ? n - i : piece,out + len)) < 0) return (-1);
+		len += got;
+	}
+	return (b64DecodeEnd (&dec) < 0 ? -1 : (ssize_t) len);
+}
+
+static int
+checkCodec (void)
+{
+	unsigned char in[1000], back[1000];
+	char want[2000], got[2000], lines[2100];
+	size_t n, piece, len, nLines;
+	int bad = 0;
+
+	for (n = 0; n < sizeof (in); n++) in[n] = rand ();
+	for (n = 0; n <= sizeof (in); n += n < 200 ? 1 : 53) {
+		len = refEncode (in,n,want);
+		nLines = breakLines (want,len,lines);
+		for (piece = 1; piece <= n + 1; piece += piece < 16 ? 1 : 61) {
+			if (streamEncode (in,n,piece,got) != len || memcmp (got,want,len)) bad++;
+			if (streamDecode (want,len,piece,back) != (ssize_t) n || memcmp (back,in,n)) bad++;
+			if (streamDecode (lines,nLines,piece,back) != (ssize_t) n || memcmp (back,in,n)) bad++;
+		}
+	}
+	return (bad);
+}
+
+int
+main (int argc, char **argv)
+{
+	int nPlanes = argc > 1 ? atoi (argv[1]) : 64, i, p, bad;
+	size_t textLen, linesLen;
+	unsigned char *plane, *back;
+	char *text, *lines;
+	double t[6];
+
+	memset (b64Values,-1,sizeof (b64Values));
+	for (i = 0; i < 64; i++) b64Values[(unsigned char) b64Chars[i]] = i;
+	if ( (bad = checkCodec ()) ) {
+		printf ("b64stream differs from the reference in %d cases\n",bad);
+		return (1);
+	}
+
+	if (! (plane = (unsigned char *) malloc (PLANE_BYTES)) || ! (back = (unsigned char *) malloc (PLANE_BYTES)) ||
+		! (text = (char *) malloc (B64_ENCODED_MAX (PLANE_BYTES))) ||
+		! (lines = (char *) malloc (B64_ENCODED_MAX (PLANE_BYTES) * 2)) ) return (1);
+	for (i = 0; i < PLANE_BYTES; i++) plane[i] = rand () & (i & 1 ? 0x0f : 0xff);
+	textLen = refEncode (plane,PLANE_BYTES,text);
+	linesLen = breakLines (text,textLen,lines);
+
+	t[0] = benchNow ();
+	for (p = 0; p < nPlanes; p++) refEncode (plane,PLANE_BYTES,text);
+	t[1] = benchNow ();
+	for (p = 0; p < nPlanes; p++) refDecode (text,textLen,back);
+	t[2] = benchNow ();
+	for (p = 0; p < nPlanes; p++) refDecode (lines,linesLen,back);
+	t[3] = benchNow ();
+	printf ("%d planes of %d KB, MB/s of pixels\n",nPlanes,PLANE_BYTES >> 10);
+	printf ("  %-16s %8s %8s %12s\n","","encode","decode","decode lines");
+	printf ("  %-16s %8.0f %8.0f %12.0f\n","reference",nPlanes * 2.0 / (t[1] - t[0]),
+		nPlanes * 2.0 / (t[2] - t[1]),nPlanes * 2.0 / (t[3] - t[2]));
+
+	t[0] = benchNow ();
+	for (p = 0; p < nPlanes; p++) streamEncode (plane,PLANE_BYTES,PLANE_BYTES,text);
+	t[1] = benchNow ();
+	for (p = 0; p < nPlanes; p++) streamDecode (text,textLen,textLen,back);
+	t[2] = benchNow ();
+	for (p = 0; p < nPlanes; p++) streamDecode (lines,linesLen,linesLen,back);
+	t[3] = benchNow ();
+	printf ("  %-16s %8.0f %8.0f %12.0f\n",b64KernelName (),nPlanes * 2.0 / (t[1] - t[0]),
+		nPlanes * 2.0 / (t[2] - t[1]),nPlanes * 2.0 / (t[3] - t[2]));
+
+	free (plane);
+	free (back);
+	free (text);
+	free (lines);
+	return (0);
+}
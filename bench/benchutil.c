@@ -0,0 +1,141 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  /* F_SETPIPE_SZ */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "benchutil.h"
+
+#define BENCH_IO_SIZE (1024*1024)
+
+double benchNow (void) {
+struct timespec t;
+
+	clock_gettime (CLOCK_MONOTONIC,&t);
+	return (t.tv_sec + t.tv_nsec * 1e-9);
+}
+
+/*
+  A file of size bytes of noise, mostly in the low bits, like the dark
+  background of a microscope image.  Returns 0, or -1.
+*/
+int makeBenchFile (const char *path, size_t size) {
+unsigned char *buf;
+unsigned int seed = 12345;
+size_t done, n, i;
+FILE *file;
+int rc = 0;
+
+	if (! (buf = (unsigned char *) malloc (BENCH_IO_SIZE)) ) return (-1);
+	if (! (file = fopen (path,"w")) ) {
+		free (buf);
+		return (-1);
+	}
+	for (done = 0; done < size && rc == 0; done += n) {
+		n = size - done < BENCH_IO_SIZE ? size - done : BENCH_IO_SIZE;
+		for (i = 0; i < n; i++) {
+			seed = seed * 1103515245 + 12345;
+			buf[i] = (seed >> 16) & ((seed >> 28) ? 0x07 : 0xff);
+		}
+		if (fwrite (buf,1,n,file) != n) rc = -1;
+	}
+	if (fclose (file) != 0) rc = -1;
+	free (buf);
+	return (rc);
+}
+
+/* Reads the file through once, so that it is all in the page cache */
+void warmBenchFile (const char *path) {
+char *buf;
+int fd;
+
+	if ( (fd = open (path,O_RDONLY)) < 0) return;
+	if ( (buf = (char *) malloc (BENCH_IO_SIZE)) )
+		while (read (fd,buf,BENCH_IO_SIZE) > 0) ;
+	free (buf);
+	close (fd);
+}
+
+/*
+  Drops the file from the page cache, so that the next read comes from
+  the device.  As root, the rest of the cache goes too.
+*/
+void dropBenchFile (const char *path) {
+FILE *drop;
+int fd;
+
+	if ( (fd = open (path,O_RDONLY)) >= 0) {
+		fdatasync (fd);
+		posix_fadvise (fd,0,0,POSIX_FADV_DONTNEED);
+		close (fd);
+	}
+	if ( (drop = fopen ("/proc/sys/vm/drop_caches","w")) ) {
+		fputs ("1",drop);
+		fclose (drop);
+	}
+}
+
+/* Starts a client that reads everything sent to sink->out.  Returns 0, or -1 */
+int openBenchSink (benchSink *sink, int kind) {
+int fds[2];
+char *buf;
+
+	if (kind == SINK_SOCKET ? socketpair (AF_UNIX,SOCK_STREAM,0,fds) : pipe (fds)) return (-1);
+#ifdef F_SETPIPE_SZ
+	if (kind == SINK_PIPE) fcntl (fds[1],F_SETPIPE_SZ,BENCH_IO_SIZE);
+#endif
+	if ( (sink->pid = fork ()) < 0) return (-1);
+	if (sink->pid == 0) {
+		close (fds[1]);
+		if ( (buf = (char *) malloc (BENCH_IO_SIZE)) )
+			while (read (fds[0],buf,BENCH_IO_SIZE) > 0) ;
+		_exit (0);
+	}
+	close (fds[0]);
+	sink->fd = fds[1];
+	if (! (sink->out = fdopen (fds[1],"w")) ) return (-1);
+	return (0);
+}
+
+/* Waits for the client to take everything */
+void closeBenchSink (benchSink *sink) {
+	fclose (sink->out);
+	waitpid (sink->pid,NULL,0);
+}
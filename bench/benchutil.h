@@ -0,0 +1,61 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifndef benchutil_h
+#define benchutil_h
+
+#include <stdio.h>
+#include <sys/types.h>
+
+/*
+  What the benchmarks share: a clock, a test file, the page cache, and a
+  client to send to.  The client is a child process on the other end of a
+  pipe or a socket, reading and throwing away what it gets, as a web
+  server would read a CGI's output.  Files are made under the current
+  directory, so run the benchmarks from a scratch directory on the
+  filesystem being measured.
+*/
+
+#define SINK_PIPE    0
+#define SINK_SOCKET  1
+
+typedef struct {
+	FILE *out;
+	int fd;
+	pid_t pid;
+} benchSink;
+
+double benchNow (void);
+int makeBenchFile (const char *path, size_t size);
+void warmBenchFile (const char *path);
+void dropBenchFile (const char *path);
+int openBenchSink (benchSink *sink, int kind);
+void closeBenchSink (benchSink *sink);
+
+#endif
@@ -0,0 +1,224 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+/*
+  GetROI and plane latency from the plain XYZCT layout and from chunked
+  copies, with a cold page cache.  A 1024x1024x64x2x1 16-bit Pixels file
+  gets copies in 64x64x16 and 256x256x1 bricks, which are checked against
+  the plain file over random ROIs.  Then each case is read:
+    - from the plain file a row at a time, as DoROI does;
+    - from the plain file with plannedROI();
+    - from each chunked copy with chunkedROI(), which turns down ROIs the
+      plain file serves better ("-").
+  Times are ms, the mean of five cold reads.
+
+    chunkbench
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "Pixels.h"
+#include "chunked.h"
+#include "roiio.h"
+#include "benchutil.h"
+
+#define BENCH_ID    1
+#define BENCH_PATH  "Pixels/1"
+#define BENCH_REPS  5
+#define NUM_SPECS   2
+
+static int specs[NUM_SPECS][3] = { {64,64,16}, {256,256,1} };
+
+typedef struct {
+	const char *name;
+	int x0, y0, z0, x1, y1, z1;
+} roiCase;
+
+static roiCase cases[] = {
+	{"32x32 box, all Z",   500, 500,  0,  531,  531, 63},
+	{"64x64 box, all Z",   512, 512,  0,  575,  575, 63},
+	{"256x256x16",         256, 256, 16,  511,  511, 31},
+	{"one row, all Z",       0, 700,  0, 1023,  700, 63},
+	{"whole plane",          0,   0, 10, 1023, 1023, 10}
+};
+#define NUM_CASES (sizeof (cases) / sizeof (roiCase))
+
+static pixHeader head;
+static PixelsRep thePixels;
+
+/* ms for each case: rows, planned, then each brick size */
+static double table[NUM_CASES][NUM_SPECS + 2];
+
+static size_t
+pixOffset (int x, int y, int z, int c, int t)
+{
+	return ((((((size_t)t * head.dc + c) * head.dz + z) * head.dy + y) * head.dx + x) * head.bp);
+}
+
+/* One pread per row, in XYZCT order */
+static long long
+rowROI (int fd, int x0, int y0, int z0, int c0, int t0, int x1, int y1, int z1, int c1, int t1, unsigned char *buf, FILE *out)
+{
+	size_t len = (size_t)(x1 - x0 + 1) * head.bp;
+	long long nPix = 0;
+	int y, z, c, t;
+
+	for (t = t0; t <= t1; t++)
+		for (c = c0; c <= c1; c++)
+			for (z = z0; z <= z1; z++)
+				for (y = y0; y <= y1; y++) {
+					if (pread (fd,buf,len,pixOffset (x0,y,z,c,t)) != (ssize_t)len) return (-1);
+					fwrite (buf,1,len,out);
+					nPix += x1 - x0 + 1;
+				}
+	return (nPix);
+}
+
+/* Random ROIs from the chunked copy must match the plain file */
+static int
+checkChunked (int fd, unsigned char *want, unsigned char *got, size_t cap)
+{
+	int k, x0, y0, z0, c0, x1, y1, z1, c1, bad = 0;
+	long long nPix;
+	FILE *mem;
+
+	for (k = 0; k < 200; k++) {
+		x0 = rand () % head.dx; x1 = x0 + rand () % (head.dx - x0);
+		y0 = rand () % head.dy; y1 = y0 + rand () % (head.dy - y0 < 64 ? head.dy - y0 : 64);
+		z0 = rand () % head.dz; z1 = z0 + rand () % (head.dz - z0);
+		c0 = rand () % head.dc; c1 = c0 + rand () % (head.dc - c0);
+		if (! (mem = fmemopen (got,cap,"w")) ) return (-1);
+		nPix = chunkedROI (&thePixels,x0,y0,z0,c0,0,x1,y1,z1,c1,0,mem);
+		fclose (mem);
+		if (nPix < 0) continue;
+		if (! (mem = fmemopen (want,cap,"w")) ) return (-1);
+		if (rowROI (fd,x0,y0,z0,c0,0,x1,y1,z1,c1,0,got + cap,mem) != nPix) bad++;
+		fclose (mem);
+		if (memcmp (want,got,nPix * head.bp)) bad++;
+	}
+	return (bad);
+}
+
+/* Mean cold time in ms, or -1 if the method turned the ROI down */
+static double
+timeCase (int method, int fd, const roiCase *roi, unsigned char *buf)
+{
+	double t, total = 0;
+	long long nPix = 0;
+	FILE *out;
+	int rep;
+
+	for (rep = 0; rep < BENCH_REPS; rep++) {
+		dropBenchFile (BENCH_PATH);
+		dropBenchFile (BENCH_PATH CHUNK_SUFFIX);
+		if (! (out = fopen ("/dev/null","w")) ) return (-1);
+		thePixels.IO_stream = out;
+		t = benchNow ();
+		if (method == 0) nPix = rowROI (fd,roi->x0,roi->y0,roi->z0,0,0,roi->x1,roi->y1,roi->z1,0,0,buf,out);
+		else if (method == 1) nPix = plannedROI (&thePixels,roi->x0,roi->y0,roi->z0,0,0,roi->x1,roi->y1,roi->z1,0,0,'r');
+		else nPix = chunkedROI (&thePixels,roi->x0,roi->y0,roi->z0,0,0,roi->x1,roi->y1,roi->z1,0,0,out);
+		fclose (out);
+		total += benchNow () - t;
+		if (nPix < 0) return (-1);
+	}
+	return (total / BENCH_REPS * 1e3);
+}
+
+int
+main (int argc, char **argv)
+{
+	size_t cap = 64*1024*1024;
+	unsigned char *want, *got;
+	double t, buildTime[NUM_SPECS];
+	char label[32];
+	int s, fd, bad;
+	size_t k;
+
+	head.dx = 1024; head.dy = 1024; head.dz = 64; head.dc = 2; head.dt = 1; head.bp = 2;
+	thePixels.ID = BENCH_ID;
+	thePixels.head = &head;
+	mkdir ("Pixels",0755);
+	if (makeBenchFile (BENCH_PATH,pixOffset (0,0,0,0,head.dt)) < 0 || (fd = open (BENCH_PATH,O_RDONLY)) < 0) {
+		fprintf (stderr,"Could not make %s\n",BENCH_PATH);
+		return (1);
+	}
+	if (! (want = (unsigned char *) malloc (cap)) || ! (got = (unsigned char *) malloc (2 * cap)) ) return (1);
+
+	printf ("%dx%dx%dx%dx%d, %d-byte pixels; cold ms, mean of %d\n",head.dx,head.dy,head.dz,head.dc,head.dt,head.bp,BENCH_REPS);
+	printf ("  %-18s %9s %9s","","rows","planned");
+	for (s = 0; s < NUM_SPECS; s++) {
+		snprintf (label,sizeof (label),"%dx%dx%d",specs[s][0],specs[s][1],specs[s][2]);
+		printf (" %9s",label);
+	}
+	printf ("\n");
+
+	/* There is one chunked copy at a time, so every case is read from each in turn */
+	for (s = 0; s < NUM_SPECS; s++) {
+		setChunkSpec (BENCH_ID,specs[s][0],specs[s][1],specs[s][2]);
+		t = benchNow ();
+		if (buildChunkedCopy (&thePixels) < 0) {
+			fprintf (stderr,"Could not build the %dx%dx%d copy\n",specs[s][0],specs[s][1],specs[s][2]);
+			return (1);
+		}
+		buildTime[s] = benchNow () - t;
+		if ( (bad = checkChunked (fd,want,got,cap)) ) {
+			printf ("%dx%dx%d bricks differ from the plain file in %d ROIs\n",specs[s][0],specs[s][1],specs[s][2],bad);
+			return (1);
+		}
+		for (k = 0; k < NUM_CASES; k++) {
+			if (s == 0) {
+				table[k][0] = timeCase (0,fd,cases + k,got);
+				table[k][1] = timeCase (1,fd,cases + k,got);
+			}
+			table[k][s + 2] = timeCase (2,fd,cases + k,got);
+		}
+	}
+
+	for (k = 0; k < NUM_CASES; k++) {
+		printf ("  %-18s %9.2f %9.2f",cases[k].name,table[k][0],table[k][1]);
+		for (s = 0; s < NUM_SPECS; s++) {
+			if (table[k][s + 2] < 0) printf (" %9s","-");
+			else printf (" %9.2f",table[k][s + 2]);
+		}
+		printf ("\n");
+	}
+	for (s = 0; s < NUM_SPECS; s++)
+		printf ("  building the %dx%dx%d copy took %.2f s\n",specs[s][0],specs[s][1],specs[s][2],buildTime[s]);
+
+	close (fd);
+	removeChunkedCopy (BENCH_ID);
+	unlink (BENCH_PATH);
+	rmdir ("Pixels");
+	return (0);
+}
@@ -0,0 +1,212 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+/*
+  How Convert scales with the Threads parameter.  convert.c is built with
+  OMEIS_STATS_KERNEL, and a 1024x1024x16x1x8 16-bit Pixels (256 MB) is
+  converted from a file in memory at 1, 2, 4 and 8 threads, the best of
+  three each.  ConvertFile is a stand-in that copies the pixels, the
+  serial part: every batch is converted on the calling thread and only
+  the stats go to the workers.  So the copy alone and the two stats
+  passes alone are timed too, and each thread count is shown against
+  the most it could do, copy + (first pass + second pass) / threads with
+  the first pass hidden under the copy where it fits:
+
+    max (copy, pass 1 / threads) + pass 2 / threads
+
+  A real ConvertFile writes into the Pixels file's map, which costs more
+  than this memcpy, so on a server the copy is an even larger share.
+
+    convertbench
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "Pixels.h"
+#include "File.h"
+#include "statskern.h"
+#include "convert.h"
+#include "benchutil.h"
+
+#define BENCH_REPS  3
+
+static const int threadCounts[] = {1, 2, 4, 8};
+#define NUM_COUNTS (sizeof (threadCounts) / sizeof (threadCounts[0]))
+
+/* Stand-ins for the Pixels.c that convert.c calls */
+
+size_t GetOffset (PixelsRep *thePixels, int theX, int theY, int theZ, int theC, int theT) {
+pixHeader *head = thePixels->head;
+
+	return (((((size_t)theT*head->dc + theC)*head->dz + theZ)*head->dy + theY)*head->dx + theX) * head->bp;
+}
+
+size_t ConvertFile (PixelsRep *thePixels, FileRep *theFile, size_t file_offset,
+	size_t pix_offset, size_t nPix, char writeRec) {
+
+	memcpy ((char *) thePixels->pixels + pix_offset,(char *) theFile->file_buf + file_offset,
+		nPix * thePixels->head->bp);
+	return (nPix);
+}
+
+int DoPlaneStats (PixelsRep *thePixels, ome_coord theZ, ome_coord theC, ome_coord theT) { return (0); }
+int DoStackStats (PixelsRep *thePixels, ome_coord theC, ome_coord theT) { return (0); }
+int FinishStats (PixelsRep *thePixels, char force) { return (0); }
+
+static pixHeader head;
+static PixelsRep thePixels;
+static FileRep theFile;
+static size_t nPix, planePix;
+
+/* The two stats passes over every plane, on this thread alone */
+static void
+statsPasses (double *pass1, double *pass2)
+{
+	pixelSums sums;
+	pixelHist hist;
+	pixelLogSums logs;
+	size_t plane, nPlanes = (size_t)head.dz * head.dc * head.dt;
+	const unsigned char *pix;
+	double t0, t1;
+
+	t0 = benchNow ();
+	for (plane = 0; plane < nPlanes; plane++) {
+		pix = (const unsigned char *) theFile.file_buf + plane * planePix * head.bp;
+		sumPlanePixels (pix,head.dx,head.dy,head.bp,head.isSigned,head.isFloat,&sums);
+	}
+	t1 = benchNow ();
+	for (plane = 0; plane < nPlanes; plane++) {
+		pix = (const unsigned char *) theFile.file_buf + plane * planePix * head.bp;
+		sumPlanePixels (pix,head.dx,head.dy,head.bp,head.isSigned,head.isFloat,&sums);
+		hist.min = sums.min;
+		hist.max = sums.max;
+		histPlanePixels (pix,planePix,head.bp,head.isSigned,head.isFloat,&hist,NULL,&logs);
+	}
+	*pass1 = t1 - t0;
+	*pass2 = benchNow () - t1 - *pass1;
+}
+
+static double
+timeCopy (void)
+{
+	double t0, best = 0;
+	int rep;
+
+	for (rep = 0; rep < BENCH_REPS; rep++) {
+		t0 = benchNow ();
+		ConvertFile (&thePixels,&theFile,0,0,nPix,1);
+		t0 = benchNow () - t0;
+		if (!rep || t0 < best) best = t0;
+	}
+	return (best);
+}
+
+static double
+timeConvert (int nThreads)
+{
+	char threads[16];
+	double t0, best = 0;
+	int rep;
+
+	sprintf (threads,"%d",nThreads);
+	for (rep = 0; rep < BENCH_REPS; rep++) {
+		t0 = benchNow ();
+		if (convertPlanes (&thePixels,&theFile,0,0,nPix,-1,-1,bigEndian (),threads) != nPix)
+			return (-1);
+		t0 = benchNow () - t0;
+		if (!rep || t0 < best) best = t0;
+	}
+	return (best);
+}
+
+int
+main (void)
+{
+	size_t nBytes, nPlanes, i;
+	double copy, pass1, pass2, t, t1 = 0, bound;
+	unsigned char *src;
+	u_int16_t *pix;
+	size_t k;
+
+	head.dx = head.dy = 1024;
+	head.dz = 16;
+	head.dc = 1;
+	head.dt = 8;
+	head.bp = 2;
+	planePix = (size_t)head.dx * head.dy;
+	nPlanes = (size_t)head.dz * head.dc * head.dt;
+	nPix = planePix * nPlanes;
+	nBytes = nPix * head.bp;
+
+	thePixels.head = &head;
+	thePixels.pixels = malloc (nBytes);
+	thePixels.planeInfos = (planeInfo *) calloc (nPlanes,sizeof (planeInfo));
+	thePixels.stackInfos = (stackInfo *) calloc ((size_t)head.dc * head.dt,sizeof (stackInfo));
+	theFile.file_buf = src = (unsigned char *) malloc (nBytes);
+	theFile.size_rep = nBytes;
+	if (!thePixels.pixels || !thePixels.planeInfos || !thePixels.stackInfos || !src) {
+		fprintf (stderr,"Out of memory\n");
+		return (1);
+	}
+
+	/* Dark noise, mostly in the low 12 bits */
+	pix = (u_int16_t *) src;
+	for (i = 0, k = 1; i < nPix; i++) {
+		k = k * 1103515245 + 12345;
+		pix[i] = (u_int16_t) ((k >> 16) & (i % 97 ? 0x3FF : 0xFFF));
+	}
+	memset (thePixels.pixels,0,nBytes);
+
+	copy = timeCopy ();
+	statsPasses (&pass1,&pass2);
+	printf ("Convert, %dx%dx%dx%dx%d 16-bit pixels (%lu MB), statskern (%s), %ld CPUs\n",
+		head.dx,head.dy,head.dz,head.dc,head.dt,(unsigned long) (nBytes >> 20),statsKernelName (),
+		sysconf (_SC_NPROCESSORS_ONLN));
+	printf ("  copy alone %7.1f ms  stats pass 1 %7.1f ms  pass 2 %7.1f ms\n",
+		copy*1e3,pass1*1e3,pass2*1e3);
+	printf ("  threads      ms    MB/s  speedup  bound ms\n");
+	for (i = 0; i < NUM_COUNTS; i++) {
+		if ( (t = timeConvert (threadCounts[i])) < 0) {
+			fprintf (stderr,"convertPlanes failed\n");
+			return (1);
+		}
+		if (!i) t1 = t;
+		bound = (copy > pass1 / threadCounts[i] ? copy : pass1 / threadCounts[i]) + pass2 / threadCounts[i];
+		printf ("  %7d %7.1f %7.0f %8.2f %9.1f\n",threadCounts[i],t*1e3,
+			nBytes / t / (1024*1024),t1 / t,bound*1e3);
+	}
+	printf ("  the copy alone caps Convert at %.0f MB/s, %.2fx one thread\n",
+		nBytes / copy / (1024*1024),t1 / copy);
+
+	return (0);
+}
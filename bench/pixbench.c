@@ -0,0 +1,226 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+/*
+  GetPixels, GetStack and GetPlane from the plain Pixels file, the way
+  DoPixelIO did it (fwrite from a map of the file) and with readPixels(),
+  to a client on a pipe.  A 1024x1024x32x2x4 16-bit Pixels file (512 MB)
+  is streamed whole, unswapped and through openSwapWriter(); a stack is
+  read from the middle; and 64 planes are read from scattered offsets.
+  readPixels() is first checked against the file, cold and warm, in
+  streams and in planes.  Each is timed with a cold and a warm page cache,
+  the best of three.  Cold numbers mean most on the storage omeis serves
+  from: run it from a scratch directory there.
+
+    pixbench
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "Pixels.h"
+#include "pixread.h"
+#include "pixswap.h"
+#include "benchutil.h"
+
+#define BENCH_ID      1
+#define BENCH_PATH    "Pixels/1"
+#define BENCH_REPS    3
+#define BENCH_PLANES  64
+
+#define BENCH_COLD  0
+#define BENCH_WARM  1
+
+#define READ_PIXELS  0
+#define READ_STACK   1
+#define READ_PLANES  2
+
+static const char *methodNames[] = {"map", "readPixels"};
+
+static pixHeader head;
+static PixelsRep thePixels;
+static size_t planeSize, stackSize, fileSize;
+
+/* What DoPixelIO did: fwrite straight from a map of the file */
+static long long
+mappedRead (size_t offset, size_t nPix, FILE *out)
+{
+	size_t length = nPix * head.bp, sent;
+	unsigned char *map;
+	int fd;
+
+	if ( (fd = open (BENCH_PATH,O_RDONLY)) < 0) return (-1);
+	map = (unsigned char *) mmap (NULL,offset + length,PROT_READ,MAP_SHARED,fd,0);
+	close (fd);
+	if (map == (unsigned char *) MAP_FAILED) return (-1);
+	sent = fwrite (map + offset,1,length,out);
+	munmap (map,offset + length);
+	return (sent / head.bp);
+}
+
+static long long
+readRange (int method, size_t offset, size_t nPix, FILE *out)
+{
+	if (method == 0) return (mappedRead (offset,nPix,out));
+	return (readPixels (&thePixels,offset,nPix,out));
+}
+
+/* The offset of the k-th of the planes read: scattered over the file */
+static size_t
+planeOffset (int k)
+{
+	return ((size_t)((k * 37) % (head.dz * head.dc * head.dt)) * planeSize);
+}
+
+/*
+  readPixels() must send what the file has, cold or warm, streamed or not.
+  The output goes to a memstream: fmemopen() overwrites the last byte of
+  a full buffer with a NUL.
+*/
+static int
+checkReads (unsigned char *want)
+{
+	size_t offsets[] = {0, planeSize / 3, 5 * stackSize / 2 + 1000};
+	size_t lengths[] = {stackSize, planeSize, 1000};
+	size_t gotLength;
+	char *got;
+	FILE *file, *mem;
+	int i, mode, bad = 0;
+
+	if (! (file = fopen (BENCH_PATH,"r")) ) return (-1);
+	for (mode = BENCH_COLD; mode <= BENCH_WARM; mode++)
+		for (i = 0; i < 3; i++) {
+			if (mode == BENCH_COLD) dropBenchFile (BENCH_PATH);
+			else warmBenchFile (BENCH_PATH);
+			if (! (mem = open_memstream (&got,&gotLength)) ) return (-1);
+			if (readPixels (&thePixels,offsets[i],lengths[i] / head.bp,mem) != (long long)(lengths[i] / head.bp)) bad++;
+			fclose (mem);
+			if (fseeko (file,offsets[i],SEEK_SET) != 0 || fread (want,1,lengths[i],file) != lengths[i]) return (-1);
+			if (gotLength != lengths[i] || memcmp (want,got,lengths[i])) bad++;
+			free (got);
+		}
+	fclose (file);
+	return (bad);
+}
+
+/* Best time in seconds for one read, or -1 if something was short */
+static double
+timeRead (int method, int mode, int what, int swap)
+{
+	size_t nPix = (what == READ_PIXELS ? fileSize : what == READ_STACK ? stackSize : planeSize) / head.bp;
+	double t, best = 1e9;
+	benchSink sink;
+	FILE *out;
+	int rep, k, nReads = what == READ_PLANES ? BENCH_PLANES : 1;
+	long long sent;
+
+	for (rep = 0; rep < BENCH_REPS; rep++) {
+		if (mode == BENCH_COLD) dropBenchFile (BENCH_PATH);
+		else warmBenchFile (BENCH_PATH);
+		if (openBenchSink (&sink,SINK_PIPE) < 0) return (-1);
+		out = swap ? openSwapWriter (sink.out,head.bp) : sink.out;
+		t = benchNow ();
+		for (k = 0; k < nReads; k++) {
+			if (what == READ_PIXELS) sent = readRange (method,0,nPix,out);
+			else if (what == READ_STACK) sent = readRange (method,2 * stackSize,nPix,out);
+			else sent = readRange (method,planeOffset (k),nPix,out);
+			if (sent != (long long)nPix) break;
+		}
+		if (swap) fclose (out);
+		fflush (sink.out);
+		t = benchNow () - t;
+		closeBenchSink (&sink);
+		if (k < nReads) return (-1);
+		if (t < best) best = t;
+	}
+	return (best);
+}
+
+int
+main (int argc, char **argv)
+{
+	unsigned char *want;
+	double t[2][2];
+	int method, mode, bad;
+
+	head.dx = 1024; head.dy = 1024; head.dz = 32; head.dc = 2; head.dt = 4; head.bp = 2;
+	thePixels.ID = BENCH_ID;
+	thePixels.head = &head;
+	planeSize = (size_t)head.dx * head.dy * head.bp;
+	stackSize = planeSize * head.dz;
+	fileSize = stackSize * head.dc * head.dt;
+	mkdir ("Pixels",0755);
+	if (makeBenchFile (BENCH_PATH,fileSize) < 0) {
+		fprintf (stderr,"Could not make %s\n",BENCH_PATH);
+		return (1);
+	}
+	if (! (want = (unsigned char *) malloc (stackSize)) ) return (1);
+	if ( (bad = checkReads (want)) ) {
+		printf ("readPixels differs from the file in %d reads\n",bad);
+		return (1);
+	}
+	free (want);
+
+	printf ("%dx%dx%dx%dx%d, %d-byte pixels, to a pipe; best of %d\n",head.dx,head.dy,head.dz,head.dc,head.dt,head.bp,BENCH_REPS);
+	printf ("  %-26s %10s %10s %10s %10s\n","","cold","","warm","");
+	printf ("  %-26s %10s %10s %10s %10s\n","",methodNames[0],methodNames[1],methodNames[0],methodNames[1]);
+
+	for (mode = BENCH_COLD; mode <= BENCH_WARM; mode++)
+		for (method = 0; method < 2; method++)
+			t[mode][method] = timeRead (method,mode,READ_PIXELS,0);
+	printf ("  %-26s %10.0f %10.0f %10.0f %10.0f\n","GetPixels, MB/s",
+		fileSize / 1e6 / t[0][0],fileSize / 1e6 / t[0][1],fileSize / 1e6 / t[1][0],fileSize / 1e6 / t[1][1]);
+
+	for (mode = BENCH_COLD; mode <= BENCH_WARM; mode++)
+		for (method = 0; method < 2; method++)
+			t[mode][method] = timeRead (method,mode,READ_PIXELS,1);
+	printf ("  %-26s %10.0f %10.0f %10.0f %10.0f\n","GetPixels swapped, MB/s",
+		fileSize / 1e6 / t[0][0],fileSize / 1e6 / t[0][1],fileSize / 1e6 / t[1][0],fileSize / 1e6 / t[1][1]);
+
+	for (mode = BENCH_COLD; mode <= BENCH_WARM; mode++)
+		for (method = 0; method < 2; method++)
+			t[mode][method] = timeRead (method,mode,READ_STACK,0);
+	printf ("  %-26s %10.0f %10.0f %10.0f %10.0f\n","GetStack, MB/s",
+		stackSize / 1e6 / t[0][0],stackSize / 1e6 / t[0][1],stackSize / 1e6 / t[1][0],stackSize / 1e6 / t[1][1]);
+
+	for (mode = BENCH_COLD; mode <= BENCH_WARM; mode++)
+		for (method = 0; method < 2; method++)
+			t[mode][method] = timeRead (method,mode,READ_PLANES,0) / BENCH_PLANES;
+	printf ("  %-26s %10.2f %10.2f %10.2f %10.2f\n","GetPlane, ms",
+		t[0][0] * 1e3,t[0][1] * 1e3,t[1][0] * 1e3,t[1][1] * 1e3);
+
+	unlink (BENCH_PATH);
+	rmdir ("Pixels");
+	return (0);
+}
@@ -0,0 +1,251 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+/*
+  Checks the statskern writer against Pixels.c.  Each test Pixels is made
+  with NewPixels, filled, and given its stats by DoPlaneStats for every
+  plane and DoStackStats for every stack.  The same planes then go
+  through the kernels the way convert.c's workers take them, and every
+  planeInfo and stackInfo field has to come out the same, to the bit.
+  Until it does, convert.c leaves the stats to Pixels.c; build it with
+  OMEIS_STATS_KERNEL once this passes.
+
+    pixstatscheck       check every pixel type over a few shapes
+
+  It links Pixels.c and what it needs, so the top directory has to be
+  configured first.  The test Pixels go in Pixels/ under the current
+  directory, and are expunged again.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "Pixels.h"
+#include "statskern.h"
+
+typedef struct {
+	const char *name;
+	char bp, isSigned, isFloat;
+} pixType;
+
+static pixType pixTypes[] = {
+	{"uint8",1,0,0}, {"int8",1,1,0}, {"uint16",2,0,0}, {"int16",2,1,0},
+	{"uint32",4,0,0}, {"int32",4,1,0}, {"float",4,1,1}
+};
+#define NUM_TYPES (sizeof (pixTypes) / sizeof (pixType))
+
+/* dx, dy, dz, dc, dt */
+static const ome_dim shapes[][5] = {
+	{1,1,1,1,1}, {7,3,2,1,1}, {31,17,3,2,2}, {256,256,4,1,2}, {1000,3,5,1,1}
+};
+#define NUM_SHAPES (sizeof (shapes) / sizeof (shapes[0]))
+
+/* Random pixels, with zeros and ones among them for the log sums */
+static void
+fillPlane (unsigned char *buf, size_t nPix, const pixType *type)
+{
+	size_t i, nBytes = nPix * type->bp;
+
+	for (i = 0; i < nBytes; i++)
+		buf[i] = rand();
+	if (type->isFloat)
+		for (i = 0; i < nPix; i++)
+			((float *) buf)[i] = (float) (rand() % 200000 - 100000) / 7.0f;
+	for (i = 0; i < nPix; i += 5)
+		memset (buf + i * type->bp,0,type->bp);
+	if (!type->isFloat)
+		for (i = 1; i < nPix; i += 7)
+			buf[i * type->bp + (bigEndian () ? type->bp - 1 : 0)] = 1;
+}
+
+/*
+  The kernels' stats for one stack, as convert.c's workers and
+  recordStack work them out: sums for every plane, the stack's range
+  from those, then every plane's histogram and logs.
+*/
+static int
+kernelStack (PixelsRep *thePixels, ome_coord theC, ome_coord theT,
+	planeInfo *planes, stackInfo *stack)
+{
+	pixHeader *head = thePixels->head;
+	size_t planePix = (size_t)head->dx * head->dy;
+	pixelSums sums[head->dz];
+	pixelHist hist, stackHist, range;
+	pixelLogSums logs;
+	stackSums total;
+	const unsigned char *pix;
+	ome_coord theZ;
+
+	memset (&range,0,sizeof (range));
+	for (theZ = 0; theZ < head->dz; theZ++) {
+		pix = (const unsigned char *) thePixels->pixels + GetOffset (thePixels,0,0,theZ,theC,theT);
+		if (sumPlanePixels (pix,head->dx,head->dy,head->bp,head->isSigned,head->isFloat,sums + theZ) < 0)
+			return (-1);
+		if (!theZ || sums[theZ].min < range.min) range.min = sums[theZ].min;
+		if (!theZ || sums[theZ].max > range.max) range.max = sums[theZ].max;
+	}
+
+	memset (&total,0,sizeof (total));
+	memset (&stackHist,0,sizeof (stackHist));
+	stackHist.min = range.min;
+	stackHist.max = range.max;
+	for (theZ = 0; theZ < head->dz; theZ++) {
+		pix = (const unsigned char *) thePixels->pixels + GetOffset (thePixels,0,0,theZ,theC,theT);
+		hist.min = sums[theZ].min;
+		hist.max = sums[theZ].max;
+		if (histPlanePixels (pix,planePix,head->bp,head->isSigned,head->isFloat,&hist,&stackHist,&logs) < 0)
+			return (-1);
+		setPlaneInfo (planes + theZ,sums + theZ,&hist,&logs,planePix,theZ);
+		addStackPlane (&total,sums + theZ,&logs,planePix,theZ);
+	}
+	setStackInfo (stack,&total,&stackHist);
+
+	return (0);
+}
+
+#define SAME(f) \
+	if (got->f != want->f) { \
+		printf ("  %s %s: %.9g, Pixels.c has %.9g\n",where,#f,(double)got->f,(double)want->f); \
+		nBad++; \
+	}
+
+static int
+samePlane (const planeInfo *got, const planeInfo *want, const char *where)
+{
+	int nBad = 0;
+
+	SAME(min) SAME(max) SAME(mean) SAME(sigma) SAME(geomean) SAME(geosigma)
+	SAME(centroid_x) SAME(centroid_y)
+	SAME(sum_i) SAME(sum_i2) SAME(sum_log_i) SAME(sum_xi) SAME(sum_yi) SAME(sum_zi)
+	SAME(stats_OK)
+	if (memcmp (got->hist,want->hist,sizeof (got->hist))) {
+		printf ("  %s hist differs\n",where);
+		nBad++;
+	}
+	return (nBad);
+}
+
+static int
+sameStack (const stackInfo *got, const stackInfo *want, const char *where)
+{
+	int nBad = 0;
+
+	SAME(min) SAME(max) SAME(mean) SAME(sigma) SAME(geomean) SAME(geosigma)
+	SAME(centroid_x) SAME(centroid_y) SAME(centroid_z)
+	SAME(sum_i) SAME(sum_i2) SAME(sum_log_i) SAME(sum_xi) SAME(sum_yi) SAME(sum_zi)
+	SAME(stats_OK)
+	if (memcmp (got->hist,want->hist,sizeof (got->hist))) {
+		printf ("  %s hist differs\n",where);
+		nBad++;
+	}
+	return (nBad);
+}
+
+/* Returns the number of fields that differ, or -1 if the Pixels couldn't be made */
+static int
+checkShape (const pixType *type, const ome_dim *shape)
+{
+	PixelsRep *thePixels;
+	pixHeader *head;
+	planeInfo *planes;
+	stackInfo stack;
+	size_t planePix = (size_t)shape[0] * shape[1];
+	ome_coord theZ, theC, theT;
+	char where[64];
+	int nBad = 0;
+
+	if (! (thePixels = NewPixels (shape[0],shape[1],shape[2],shape[3],shape[4],
+		type->bp,type->isSigned,type->isFloat)) )
+		return (-1);
+	head = thePixels->head;
+	if (!thePixels->pixels || !thePixels->planeInfos || !thePixels->stackInfos ||
+		! (planes = (planeInfo *) calloc (head->dz,sizeof (planeInfo))) ) {
+		ExpungePixels (thePixels);
+		return (-1);
+	}
+
+	for (theT = 0; theT < head->dt; theT++)
+		for (theC = 0; theC < head->dc; theC++)
+			for (theZ = 0; theZ < head->dz; theZ++)
+				fillPlane ((unsigned char *) thePixels->pixels + GetOffset (thePixels,0,0,theZ,theC,theT),
+					planePix,type);
+
+	for (theT = 0; theT < head->dt; theT++) {
+		for (theC = 0; theC < head->dc; theC++) {
+			for (theZ = 0; theZ < head->dz; theZ++)
+				DoPlaneStats (thePixels,theZ,theC,theT);
+			DoStackStats (thePixels,theC,theT);
+
+			if (kernelStack (thePixels,theC,theT,planes,&stack) < 0) {
+				printf ("  c%d t%d: the kernels failed\n",theC,theT);
+				nBad++;
+				continue;
+			}
+			for (theZ = 0; theZ < head->dz; theZ++) {
+				sprintf (where,"z%d c%d t%d",theZ,theC,theT);
+				nBad += samePlane (planes + theZ,
+					thePixels->planeInfos + ((size_t)theT*head->dc + theC)*head->dz + theZ,where);
+			}
+			sprintf (where,"stack c%d t%d",theC,theT);
+			nBad += sameStack (&stack,thePixels->stackInfos + (size_t)theT*head->dc + theC,where);
+		}
+	}
+
+	free (planes);
+	ExpungePixels (thePixels);
+	return (nBad);
+}
+
+int
+main (void)
+{
+	size_t t, s;
+	int nBad, nFailed = 0;
+
+	srand (1);
+	mkdir ("Pixels",0755);
+	for (t = 0; t < NUM_TYPES; t++) {
+		for (s = 0; s < NUM_SHAPES; s++) {
+			nBad = checkShape (pixTypes + t,shapes[s]);
+			if (nBad) {
+				printf ("%s %dx%dx%d c%d t%d: %s\n",pixTypes[t].name,
+					shapes[s][0],shapes[s][1],shapes[s][2],shapes[s][3],shapes[s][4],
+					nBad < 0 ? "NewPixels failed" : "differs from Pixels.c");
+				nFailed++;
+			}
+		}
+	}
+
+	printf ("statskern (%s) against Pixels.c: %s\n",statsKernelName(),
+		nFailed ? "FAILED" : "every plane and stack matches");
+	return (nFailed ? 1 : 0);
+}
@@ -0,0 +1,50 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+/*
+  Stand-ins for the parts of Pixels.c that the modules under test call.
+  The benchmarks keep their Pixels as Pixels/<ID>, with no hashed
+  directories.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "Pixels.h"
+
+char *getRepPath (OID theID, char *path, char makePath) {
+	sprintf (path + strlen (path),"%llu",(unsigned long long) theID);
+	return (path);
+}
+
+char bigEndian (void) {
+	union { u_int16_t i; unsigned char c[2]; } probe = { 1 };
+
+	return (probe.c[0] == 0);
+}
@@ -0,0 +1,182 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+/*
+  GetROI and SetROI over a matrix of ROI shapes: widths from one pixel
+  to the whole row, heights from one row to the whole plane, and depths
+  of one plane or the whole stack, in a 1024x1024x64x2x1 16-bit Pixels
+  file.  Each shape is done a row at a time with pread and pwrite, as
+  DoROI does, and with plannedROI(), whose output is checked against
+  the rows'.  Reads are timed with a cold and a warm page cache, writes
+  warm.  Times are ms, the best of three.
+
+    roibench
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "Pixels.h"
+#include "roiio.h"
+#include "benchutil.h"
+
+#define BENCH_ID    1
+#define BENCH_PATH  "Pixels/1"
+#define BENCH_REPS  3
+
+static int widths[] = {1, 16, 256, 1024};
+static int heights[] = {1, 64, 1024};
+static int depths[] = {1, 64};
+#define NUM_WIDTHS  (sizeof (widths) / sizeof (int))
+#define NUM_HEIGHTS (sizeof (heights) / sizeof (int))
+#define NUM_DEPTHS  (sizeof (depths) / sizeof (int))
+
+#define BENCH_COLD  0
+#define BENCH_WARM  1
+#define BENCH_WRITE 2
+
+static pixHeader head;
+static PixelsRep thePixels;
+
+static size_t
+pixOffset (int x, int y, int z, int c, int t)
+{
+	return ((((((size_t)t * head.dc + c) * head.dz + z) * head.dy + y) * head.dx + x) * head.bp);
+}
+
+/* One pread or pwrite per row, through a row buffer, in XYZCT order */
+static long long
+rowROI (int fd, int x0, int y0, int z0, int x1, int y1, int z1, char rorw, unsigned char *row, FILE *stream)
+{
+	size_t len = (size_t)(x1 - x0 + 1) * head.bp;
+	long long nPix = 0;
+	int y, z;
+
+	for (z = z0; z <= z1; z++)
+		for (y = y0; y <= y1; y++) {
+			if (rorw == 'w') {
+				if (fread (row,1,len,stream) != len || pwrite (fd,row,len,pixOffset (x0,y,z,0,0)) != (ssize_t)len) return (-1);
+			} else {
+				if (pread (fd,row,len,pixOffset (x0,y,z,0,0)) != (ssize_t)len) return (-1);
+				fwrite (row,1,len,stream);
+			}
+			nPix += x1 - x0 + 1;
+		}
+	return (nPix);
+}
+
+/*
+  Best time in ms for one shape, method (0 rows, 1 planned) and mode.
+  The ROI goes to or comes from buf, whose first size bytes are its pixels.
+*/
+static double
+timeShape (int method, int mode, int fd, int x0, int y0, int x1, int y1, int z1,
+	unsigned char *buf, size_t size, unsigned char *row)
+{
+	char rorw = mode == BENCH_WRITE ? 'w' : 'r';
+	double t, best = 1e9;
+	long long nPix;
+	FILE *stream;
+	int rep;
+
+	for (rep = 0; rep < BENCH_REPS; rep++) {
+		if (mode == BENCH_COLD) dropBenchFile (BENCH_PATH);
+		else if (mode == BENCH_WARM) warmBenchFile (BENCH_PATH);
+		if (! (stream = fmemopen (buf,size,rorw == 'w' ? "r" : "w")) ) return (-1);
+		thePixels.IO_stream = stream;
+		t = benchNow ();
+		if (method == 0) nPix = rowROI (fd,x0,y0,0,x1,y1,z1,rorw,row,stream);
+		else nPix = plannedROI (&thePixels,x0,y0,0,0,0,x1,y1,z1,0,0,rorw);
+		fflush (stream);
+		t = benchNow () - t;
+		fclose (stream);
+		if (nPix * head.bp != (long long)size) return (-1);
+		if (t < best) best = t;
+	}
+	return (best * 1e3);
+}
+
+int
+main (int argc, char **argv)
+{
+	size_t maxSize = (size_t)1024 * 1024 * 64 * 2, size, w, h, d;
+	unsigned char *want, *got, *row;
+	int x0, y0, x1, y1, z1, mode, fd, bad = 0;
+	double ms[3][2];
+
+	head.dx = 1024; head.dy = 1024; head.dz = 64; head.dc = 2; head.dt = 1; head.bp = 2;
+	thePixels.ID = BENCH_ID;
+	thePixels.head = &head;
+	mkdir ("Pixels",0755);
+	if (makeBenchFile (BENCH_PATH,pixOffset (0,0,0,0,head.dt)) < 0 || (fd = open (BENCH_PATH,O_RDWR)) < 0) {
+		fprintf (stderr,"Could not make %s\n",BENCH_PATH);
+		return (1);
+	}
+	if (! (want = (unsigned char *) malloc (maxSize)) || ! (got = (unsigned char *) malloc (maxSize)) ||
+		! (row = (unsigned char *) malloc (head.dx * head.bp)) ) return (1);
+
+	printf ("%dx%dx%dx%dx%d, %d-byte pixels; ms, best of %d\n",head.dx,head.dy,head.dz,head.dc,head.dt,head.bp,BENCH_REPS);
+	printf ("  %-16s %19s %19s %19s\n","","cold GetROI","warm GetROI","warm SetROI");
+	printf ("  %-16s %9s %9s %9s %9s %9s %9s\n","w x h x d","rows","planned","rows","planned","rows","planned");
+	for (d = 0; d < NUM_DEPTHS; d++)
+		for (h = 0; h < NUM_HEIGHTS; h++)
+			for (w = 0; w < NUM_WIDTHS; w++) {
+				/* Off-centre, so that narrow ROIs don't start on a page */
+				x0 = (head.dx - widths[w]) / 3; x1 = x0 + widths[w] - 1;
+				y0 = (head.dy - heights[h]) / 3; y1 = y0 + heights[h] - 1;
+				z1 = depths[d] - 1;
+				size = (size_t)widths[w] * heights[h] * depths[d] * head.bp;
+
+				/* plannedROI must give what the rows do */
+				thePixels.IO_stream = fmemopen (got,size,"w");
+				plannedROI (&thePixels,x0,y0,0,0,0,x1,y1,z1,0,0,'r');
+				fclose (thePixels.IO_stream);
+				thePixels.IO_stream = fmemopen (want,size,"w");
+				rowROI (fd,x0,y0,0,x1,y1,z1,'r',row,thePixels.IO_stream);
+				fclose (thePixels.IO_stream);
+				if (memcmp (want,got,size)) bad++;
+
+				for (mode = BENCH_COLD; mode <= BENCH_WRITE; mode++) {
+					ms[mode][0] = timeShape (0,mode,fd,x0,y0,x1,y1,z1,want,size,row);
+					ms[mode][1] = timeShape (1,mode,fd,x0,y0,x1,y1,z1,want,size,row);
+				}
+				printf ("  %4d x%5d x%3d %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f\n",widths[w],heights[h],depths[d],
+					ms[0][0],ms[0][1],ms[1][0],ms[1][1],ms[2][0],ms[2][1]);
+			}
+	if (bad) printf ("plannedROI differs from the rows in %d shapes\n",bad);
+
+	close (fd);
+	unlink (BENCH_PATH);
+	rmdir ("Pixels");
+	return (bad ? 1 : 0);
+}
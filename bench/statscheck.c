@@ -0,0 +1,267 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+/*
+  Checks the statskern kernels against straightforward loops, and times
+  them.  Sums and histograms must match exactly.  Log sums, which the
+  kernels add up by value rather than by pixel, must match a long double
+  sum to a relative 1e-12.
+
+    statscheck          check every pixel type over a range of sizes
+    statscheck bench    ms per 1024x1024 plane for each pass
+
+  Run it again with OMEIS_STATS_SCALAR set to check the scalar kernels.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "statskern.h"
+
+typedef struct {
+	const char *name;
+	char bp, isSigned, isFloat;
+} pixType;
+
+static pixType pixTypes[] = {
+	{"uint8",1,0,0}, {"int8",1,1,0}, {"uint16",2,0,0}, {"int16",2,1,0},
+	{"uint32",4,0,0}, {"int32",4,1,0}, {"float",4,1,1}
+};
+#define NUM_TYPES (sizeof (pixTypes) / sizeof (pixType))
+
+static double
+pixelValue (const void *pixels, size_t i, const pixType *type)
+{
+	if (type->isFloat) return (((const float *) pixels)[i]);
+	switch (type->bp) {
+		case 1: return (type->isSigned ? (double) ((const int8_t *) pixels)[i] : (double) ((const u_int8_t *) pixels)[i]);
+		case 2: return (type->isSigned ? (double) ((const int16_t *) pixels)[i] : (double) ((const u_int16_t *) pixels)[i]);
+		default: return (type->isSigned ? (double) ((const int32_t *) pixels)[i] : (double) ((const u_int32_t *) pixels)[i]);
+	}
+}
+
+/*
+  Random pixels, with runs at the extremes of the type so that the sign
+  bias and the lane sums are pushed to their limits.
+*/
+static void
+fillPixels (unsigned char *buf, size_t nPix, const pixType *type, int pattern)
+{
+	size_t i, nBytes = nPix * type->bp;
+
+	for (i = 0; i < nBytes; i++)
+		buf[i] = pattern == 1 ? 0xFF : (pattern == 2 ? (i % type->bp == type->bp-1 ? 0x80 : 0) : rand());
+	if (type->isFloat)
+		for (i = 0; i < nPix; i++)
+			((float *) buf)[i] = (float) (rand() % 200000 - 100000) / 7.0f;
+}
+
+/* The plain loop: exact integer sums, or doubles in pixel order */
+static void
+naiveSums (const void *pixels, ome_dim sizeX, ome_dim sizeY, const pixType *type, pixelSums *sums)
+{
+	__int128 s = 0, s2 = 0, sx = 0, sy = 0, iv;
+	double fs = 0, fs2 = 0, fsx = 0, fsy = 0, rs, v;
+	ome_dim x, y;
+	size_t i = 0;
+
+	sums->min = sums->max = pixelValue (pixels,0,type);
+	for (y = 0; y < sizeY; y++) {
+		rs = 0;
+		for (x = 0; x < sizeX; x++, i++) {
+			v = pixelValue (pixels,i,type);
+			if (v < sums->min) sums->min = v;
+			if (v > sums->max) sums->max = v;
+			if (type->isFloat) {
+				rs += v;
+				fs2 += v * v;
+				fsx += v * x;
+			} else {
+				iv = (__int128) v;
+				s += iv;
+				s2 += iv * iv;
+				sx += iv * x;
+				sy += iv * y;
+			}
+		}
+		fs += rs;
+		fsy += rs * y;
+	}
+
+	if (type->isFloat) {
+		sums->sum_i = fs; sums->sum_i2 = fs2;
+		sums->sum_xi = fsx; sums->sum_yi = fsy;
+	} else {
+		sums->sum_i = (double) s; sums->sum_i2 = (double) s2;
+		sums->sum_xi = (double) sx; sums->sum_yi = (double) sy;
+	}
+}
+
+static void
+naiveHist (const void *pixels, size_t nPix, const pixType *type, pixelHist *hist, pixelLogSums *logs)
+{
+	long double sum_log_i = 0, sum_log_i2 = 0;
+	double v, lg;
+	size_t i;
+	int bin;
+
+	memset (hist->hist,0,sizeof (hist->hist));
+	for (i = 0; i < nPix; i++) {
+		v = pixelValue (pixels,i,type);
+		bin = hist->max > hist->min ? (int) ((v - hist->min) * NUM_BINS / (hist->max - hist->min)) : 0;
+		if (bin >= NUM_BINS) bin = NUM_BINS - 1;
+		hist->hist[bin]++;
+		lg = v > 1.0 ? log (v) : 0.0;
+		sum_log_i += lg;
+		sum_log_i2 += (long double)lg * lg;
+	}
+	logs->sum_log_i = sum_log_i;
+	logs->sum_log_i2 = sum_log_i2;
+}
+
+static int
+closeEnough (double a, double b)
+{
+	return (a == b || fabs (a - b) <= 1e-12 * (fabs (a) > fabs (b) ? fabs (a) : fabs (b)));
+}
+
+static int
+checkPlane (unsigned char *buf, ome_dim sizeX, ome_dim sizeY, const pixType *type)
+{
+	pixelSums sums, want;
+	pixelHist hist, wantHist;
+	pixelLogSums logs, wantLogs;
+	size_t nPix = (size_t)sizeX * sizeY;
+
+	if (sumPlanePixels (buf,sizeX,sizeY,type->bp,type->isSigned,type->isFloat,&sums) < 0) return (-1);
+	naiveSums (buf,sizeX,sizeY,type,&want);
+	if (memcmp (&sums,&want,sizeof (pixelSums))) return (-1);
+
+	hist.min = wantHist.min = sums.min;
+	hist.max = wantHist.max = sums.max;
+	if (histPlanePixels (buf,nPix,type->bp,type->isSigned,type->isFloat,&hist,NULL,&logs) < 0) return (-1);
+	naiveHist (buf,nPix,type,&wantHist,&wantLogs);
+	if (memcmp (hist.hist,wantHist.hist,sizeof (hist.hist)) ||
+		!closeEnough (logs.sum_log_i,wantLogs.sum_log_i) ||
+		!closeEnough (logs.sum_log_i2,wantLogs.sum_log_i2))
+		return (-1);
+
+	return (0);
+}
+
+static int
+checkAll (void)
+{
+	static const ome_dim sizes[][2] = {
+		{1,1}, {7,3}, {31,17}, {64,64}, {1000,3}, {STATS_CHUNK+37,2}, {3*STATS_CHUNK,1}, {512,512}
+	};
+	unsigned char *buf;
+	size_t t, s, nSizes = sizeof (sizes) / sizeof (sizes[0]);
+	int pattern, nBad = 0;
+
+	if (! (buf = (unsigned char *) malloc ((size_t)3*STATS_CHUNK * 512 * 4)) ) return (1);
+	for (t = 0; t < NUM_TYPES; t++) {
+		for (s = 0; s < nSizes; s++) {
+			for (pattern = 0; pattern < 3; pattern++) {
+				fillPixels (buf,(size_t)sizes[s][0]*sizes[s][1],pixTypes+t,pattern);
+				if (checkPlane (buf,sizes[s][0],sizes[s][1],pixTypes+t) < 0) {
+					fprintf (stderr,"%s %dx%d pattern %d: mismatch\n",
+						pixTypes[t].name,sizes[s][0],sizes[s][1],pattern);
+					nBad++;
+				}
+			}
+		}
+	}
+	free (buf);
+
+	printf ("statskern (%s): %s\n",statsKernelName(),nBad ? "FAILED" : "all pixel types match");
+	return (nBad ? 1 : 0);
+}
+
+static double
+now (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC,&ts);
+	return (ts.tv_sec + ts.tv_nsec * 1e-9);
+}
+
+static int
+benchAll (void)
+{
+	const ome_dim size = 1024;
+	const int nIter = 50;
+	size_t nPix = (size_t)size * size, t;
+	unsigned char *buf;
+	pixelSums sums;
+	pixelHist hist;
+	pixelLogSums logs;
+	double t0, tNaive, tSums, tHist;
+	int i;
+
+	if (! (buf = (unsigned char *) malloc (nPix * 4)) ) return (1);
+	printf ("statskern (%s), %dx%d planes, ms per plane\n",statsKernelName(),size,size);
+	printf ("           naive  sums   hist\n");
+	for (t = 0; t < NUM_TYPES; t++) {
+		fillPixels (buf,nPix,pixTypes+t,0);
+
+		t0 = now();
+		for (i = 0; i < nIter; i++) naiveSums (buf,size,size,pixTypes+t,&sums);
+		tNaive = (now() - t0) / nIter;
+
+		t0 = now();
+		for (i = 0; i < nIter; i++)
+			sumPlanePixels (buf,size,size,pixTypes[t].bp,pixTypes[t].isSigned,pixTypes[t].isFloat,&sums);
+		tSums = (now() - t0) / nIter;
+
+		hist.min = sums.min;
+		hist.max = sums.max;
+		t0 = now();
+		for (i = 0; i < nIter; i++)
+			histPlanePixels (buf,nPix,pixTypes[t].bp,pixTypes[t].isSigned,pixTypes[t].isFloat,&hist,NULL,&logs);
+		tHist = (now() - t0) / nIter;
+
+		printf ("  %-7s %6.2f %6.2f %6.2f\n",pixTypes[t].name,tNaive*1e3,tSums*1e3,tHist*1e3);
+	}
+	free (buf);
+	return (0);
+}
+
+int
+main (int argc, char **argv)
+{
+	srand (1);
+	if (argc > 1 && !strcmp (argv[1],"bench")) return (benchAll ());
+	return (checkAll ());
+}
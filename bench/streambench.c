@@ -0,0 +1,132 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+/*
+  ReadFile and ZipFiles throughput, sending a file that is in the page
+  cache to a client on a pipe and on a socket, three ways:
+    - fwrite of the mapped file through stdio, as ReadFile did;
+    - fread and fwrite through a 4 KB buffer, as ZipFiles did;
+    - streamFD(), which has the kernel copy (sendfile or splice).
+  CPU is this process's user and system time.
+
+    streambench [MB]    size of the file sent (default 256)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "stream.h"
+#include "benchutil.h"
+
+#define BENCH_FILE  "streambench.dat"
+#define BENCH_REPS  3
+
+static const char *sinkNames[] = {"pipe", "socket"};
+static const char *methodNames[] = {"fwrite from map", "4 KB buffer", "streamFD"};
+
+static double
+cpuTime (void)
+{
+	struct rusage ru;
+
+	getrusage (RUSAGE_SELF,&ru);
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1e-6);
+}
+
+static size_t
+sendFile (int method, int fd, size_t size, FILE *out)
+{
+	char byteBuf[4096];
+	unsigned char *map;
+	FILE *in;
+	size_t sent = 0, n;
+
+	switch (method) {
+		case 0:
+			map = (unsigned char *) mmap (NULL,size,PROT_READ,MAP_SHARED,fd,0);
+			if (map == (unsigned char *) MAP_FAILED) return (0);
+			sent = fwrite (map,1,size,out);
+			munmap (map,size);
+			break;
+		case 1:
+			if (lseek (fd,0,SEEK_SET) != 0 || ! (in = fdopen (dup (fd),"r")) ) return (0);
+			while ( (n = fread (byteBuf,1,sizeof (byteBuf),in)) > 0)
+				sent += fwrite (byteBuf,1,n,out);
+			fclose (in);
+			break;
+		default:
+			sent = streamFD (out,fd,0,size);
+	}
+	fflush (out);
+	return (sent);
+}
+
+int
+main (int argc, char **argv)
+{
+	size_t size = (size_t) (argc > 1 ? atoi (argv[1]) : 256) * 1024 * 1024;
+	double t, cpu, best, bestCPU;
+	benchSink sink;
+	int kind, method, rep, fd;
+
+	if (makeBenchFile (BENCH_FILE,size) < 0 || (fd = open (BENCH_FILE,O_RDONLY)) < 0) {
+		fprintf (stderr,"Could not make %s\n",BENCH_FILE);
+		return (1);
+	}
+	warmBenchFile (BENCH_FILE);
+
+	printf ("%lu MB from the page cache, best of %d\n",(unsigned long) (size >> 20),BENCH_REPS);
+	for (kind = SINK_PIPE; kind <= SINK_SOCKET; kind++) {
+		for (method = 0; method < 3; method++) {
+			best = bestCPU = 1e9;
+			for (rep = 0; rep < BENCH_REPS; rep++) {
+				if (openBenchSink (&sink,kind) < 0) return (1);
+				t = benchNow ();
+				cpu = cpuTime ();
+				if (sendFile (method,fd,size,sink.out) != size) fprintf (stderr,"%s: short\n",methodNames[method]);
+				closeBenchSink (&sink);
+				t = benchNow () - t;
+				cpu = cpuTime () - cpu;
+				if (t < best) best = t;
+				if (cpu < bestCPU) bestCPU = cpu;
+			}
+			printf ("  %-6s  %-15s  %6.0f MB/s  %6.3f s CPU\n",
+				sinkNames[kind],methodNames[method],size / 1048576.0 / best,bestCPU);
+		}
+	}
+
+	close (fd);
+	unlink (BENCH_FILE);
+	return (0);
+}
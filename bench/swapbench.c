@@ -0,0 +1,163 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+/*
+  Byte-swapping throughput for 2- and 4-byte pixels.  First swapPixels()
+  is checked against a pixel-by-pixel loop, over lengths and alignments
+  that exercise the kernels' tails.  Then, in memory, a plain copy (no
+  swap), the pixel-by-pixel loop and swapPixels() are timed.  Last, the
+  pixels are streamed to a client on a pipe: unswapped, swapped by the
+  loop a buffer at a time, and through openSwapWriter().
+
+    swapbench [MB]    size of the pixel buffer (default 256)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "pixswap.h"
+#include "benchutil.h"
+
+#define BENCH_REPS   3
+#define BENCH_WRITE  (64*1024)
+
+/* pixswap.c asks this of Pixels.c */
+char bigEndian (void) {
+	union { u_int16_t i; unsigned char c[2]; } probe = { 1 };
+
+	return (probe.c[0] == 0);
+}
+
+static void
+swapLoop (unsigned char *p, size_t nPix, size_t bp)
+{
+	unsigned char tmp;
+	size_t i, j;
+
+	for (i = 0; i < nPix; i++, p += bp)
+		for (j = 0; j < bp/2; j++) {
+			tmp = p[j];
+			p[j] = p[bp-1-j];
+			p[bp-1-j] = tmp;
+		}
+}
+
+static int
+checkSwap (void)
+{
+	unsigned char a[4096 + 64], b[4096 + 64];
+	size_t bp, n, off, i;
+	int bad = 0;
+
+	for (bp = 2; bp <= 4; bp += 2)
+		for (off = 0; off < 32; off++)
+			for (n = 0; n < 1000; n += n < 100 ? 1 : 37) {
+				for (i = 0; i < sizeof (a); i++) a[i] = b[i] = rand ();
+				swapLoop (a + off,n,bp);
+				swapPixels (b + off,n,bp);
+				if (memcmp (a,b,sizeof (a))) bad++;
+			}
+	return (bad);
+}
+
+static double
+timeMemory (int method, unsigned char *buf, unsigned char *copy, size_t size, size_t bp)
+{
+	double t, best = 1e9;
+	int rep;
+
+	for (rep = 0; rep < BENCH_REPS; rep++) {
+		t = benchNow ();
+		if (method == 0) memcpy (copy,buf,size);
+		else if (method == 1) swapLoop (buf,size / bp,bp);
+		else swapPixels (buf,size / bp,bp);
+		t = benchNow () - t;
+		if (t < best) best = t;
+	}
+	return (size / 1048576.0 / best);
+}
+
+static double
+timeStream (int method, unsigned char *buf, unsigned char *copy, size_t size, size_t bp)
+{
+	double t, best = 1e9;
+	benchSink sink;
+	FILE *out;
+	size_t done;
+	int rep;
+
+	for (rep = 0; rep < BENCH_REPS; rep++) {
+		if (openBenchSink (&sink,SINK_PIPE) < 0) return (0);
+		out = method == 2 ? openSwapWriter (sink.out,bp) : sink.out;
+		t = benchNow ();
+		for (done = 0; done < size; done += BENCH_WRITE) {
+			if (method == 1) {
+				memcpy (copy,buf + done,BENCH_WRITE);
+				swapLoop (copy,BENCH_WRITE / bp,bp);
+				fwrite (copy,1,BENCH_WRITE,out);
+			} else fwrite (buf + done,1,BENCH_WRITE,out);
+		}
+		if (out != sink.out) fclose (out);
+		fflush (sink.out);
+		closeBenchSink (&sink);
+		t = benchNow () - t;
+		if (t < best) best = t;
+	}
+	return (size / 1048576.0 / best);
+}
+
+int
+main (int argc, char **argv)
+{
+	size_t size = (size_t) (argc > 1 ? atoi (argv[1]) : 256) * 1024 * 1024, bp, i;
+	unsigned char *buf, *copy;
+	int bad;
+
+	if ( (bad = checkSwap ()) ) {
+		printf ("swapPixels differs from the loop in %d cases\n",bad);
+		return (1);
+	}
+	if (! (buf = (unsigned char *) malloc (size)) || ! (copy = (unsigned char *) malloc (size)) ) return (1);
+	for (i = 0; i < size; i++) buf[i] = copy[i] = i * 2654435761U >> 24;
+
+	printf ("%lu MB, %s kernels, MB/s, best of %d\n",(unsigned long) (size >> 20),swapKernelName (),BENCH_REPS);
+	printf ("                   no swap  per pixel  swapPixels\n");
+	for (bp = 2; bp <= 4; bp += 2) {
+		printf ("  %lu-byte memory   %7.0f    %7.0f     %7.0f\n",(unsigned long) bp,
+			timeMemory (0,buf,copy,size,bp),timeMemory (1,buf,copy,size,bp),timeMemory (2,buf,copy,size,bp));
+		printf ("  %lu-byte to pipe  %7.0f    %7.0f     %7.0f\n",(unsigned long) bp,
+			timeStream (0,buf,copy,size,bp),timeStream (1,buf,copy,size,bp),timeStream (2,buf,copy,size,bp));
+	}
+
+	free (buf);
+	free (copy);
+	return (0);
+}
@@ -0,0 +1,220 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif  /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Pixels.h"
+#include "OMEIS_Error.h"
+#include "cgi.h"
+#include "planes.h"
+#include "byteorder.h"
+#include "binstats.h"
+
+static const char *fieldNames[BSF_NUM_FIELDS] = {
+	"min", "max", "mean", "sigma", "geomean", "geosigma",
+	"centroid_x", "centroid_y", "centroid_z",
+	"sum_i", "sum_i2", "sum_log_i", "sum_xi", "sum_yi", "sum_zi"
+};
+
+static double
+planeField (planeInfo *info, int field)
+{
+	switch (field) {
+		case BSF_MIN:        return (info->min);
+		case BSF_MAX:        return (info->max);
+		case BSF_MEAN:       return (info->mean);
+		case BSF_SIGMA:      return (info->sigma);
+		case BSF_GEOMEAN:    return (info->geomean);
+		case BSF_GEOSIGMA:   return (info->geosigma);
+		case BSF_CENTROID_X: return (info->centroid_x);
+		case BSF_CENTROID_Y: return (info->centroid_y);
+		case BSF_SUM_I:      return (info->sum_i);
+		case BSF_SUM_I2:     return (info->sum_i2);
+		case BSF_SUM_LOG_I:  return (info->sum_log_i);
+		case BSF_SUM_XI:     return (info->sum_xi);
+		case BSF_SUM_YI:     return (info->sum_yi);
+		case BSF_SUM_ZI:     return (info->sum_zi);
+	}
+	return (0.0);
+}
+
+static double
+stackField (stackInfo *info, int field)
+{
+	switch (field) {
+		case BSF_MIN:        return (info->min);
+		case BSF_MAX:        return (info->max);
+		case BSF_MEAN:       return (info->mean);
+		case BSF_SIGMA:      return (info->sigma);
+		case BSF_GEOMEAN:    return (info->geomean);
+		case BSF_GEOSIGMA:   return (info->geosigma);
+		case BSF_CENTROID_X: return (info->centroid_x);
+		case BSF_CENTROID_Y: return (info->centroid_y);
+		case BSF_CENTROID_Z: return (info->centroid_z);
+		case BSF_SUM_I:      return (info->sum_i);
+		case BSF_SUM_I2:     return (info->sum_i2);
+		case BSF_SUM_LOG_I:  return (info->sum_log_i);
+		case BSF_SUM_XI:     return (info->sum_xi);
+		case BSF_SUM_YI:     return (info->sum_yi);
+		case BSF_SUM_ZI:     return (info->sum_zi);
+	}
+	return (0.0);
+}
+
+static unsigned char *
+putDouble (unsigned char *p, double v)
+{
+	u_int64_t bits;
+
+	memcpy (&bits, &v, sizeof (bits));
+	return (put64 (p, bits));
+}
+
+/*
+  Fields=min,max,... picks the statistics to send, in that order.
+  Returns the number of fields, or -1 if one isn't known.
+*/
+static int
+parseFields (char *spec, int isStack, int *fields)
+{
+	char *name, *save;
+	int nFields = 0, i;
+
+	if (!spec) {
+		for (i = 0; i < BSF_NUM_FIELDS; i++)
+			if (isStack || i != BSF_CENTROID_Z) fields[nFields++] = i;
+		return (nFields);
+	}
+
+	for (name = strtok_r (spec,",",&save); name; name = strtok_r (NULL,",",&save)) {
+		for (i = 0; i < BSF_NUM_FIELDS; i++)
+			if (!strcmp (name,fieldNames[i])) break;
+		if (i == BSF_NUM_FIELDS || (i == BSF_CENTROID_Z && !isStack) || nFields == BSF_NUM_FIELDS)
+			return (-1);
+		fields[nFields++] = i;
+	}
+	return (nFields);
+}
+
+/*
+  theZ, theC and theT select the records to send, each a number, a range
+  n-m or * (the default).
+*/
+static int
+getCoordRange (char **param, char *name, int max, int *from, int *to)
+{
+	char *spec;
+
+	if ( !(spec = get_param (param,name)) ) {
+		*from = 0;
+		*to = max - 1;
+		return (0);
+	}
+	return (parseCoordRange (spec, max, from, to));
+}
+
+int
+writeBinaryStats (PixelsRep *thePixels, char **param, int kind, char *method)
+{
+	pixHeader *head = thePixels->head;
+	int isStack = (kind == BS_STACK_STATS || kind == BS_STACK_HIST);
+	int isHist = (kind == BS_PLANE_HIST || kind == BS_STACK_HIST);
+	int fields[BSF_NUM_FIELDS];
+	int nFields = 0, nValues, i;
+	int z, c, t, z0, z1, c0, c1, t0, t1;
+	size_t nRecords, recordSize, bufSize;
+	unsigned char *buf, *p;
+	planeInfo *planeInfoP;
+	stackInfo *stackInfoP;
+
+	if (!isHist && (nFields = parseFields (get_lc_param (param,"Fields"), isStack, fields)) < 0) {
+		OMEIS_ReportError (method, "PixelsID", thePixels->ID, "Fields must be a list of statistics the %s method reports", method);
+		return (-1);
+	}
+	nValues = isHist ? NUM_BINS : nFields;
+
+	z0 = z1 = 0;
+	if ( (!isStack && getCoordRange (param, "theZ", head->dz, &z0, &z1)) ||
+		getCoordRange (param, "theC", head->dc, &c0, &c1) ||
+		getCoordRange (param, "theT", head->dt, &t0, &t1) ) {
+		OMEIS_ReportError (method, "PixelsID", thePixels->ID,
+			"theZ, theC and theT must each be a number, a range n-m or *, in range (%d,%d,%d).",
+			head->dz-1,head->dc-1,head->dt-1);
+		return (-1);
+	}
+
+	nRecords = (size_t)(z1 - z0 + 1) * (c1 - c0 + 1) * (t1 - t0 + 1);
+	recordSize = (isStack ? 8 : 12) + (size_t)nValues * 8;
+	bufSize = 20 + (isHist ? 0 : nFields * 4) + nRecords * recordSize;
+	if (! (buf = (unsigned char *) malloc (bufSize)) ) {
+		OMEIS_ReportError (method, "PixelsID", thePixels->ID, "Could not allocate %lu bytes", (unsigned long) bufSize);
+		return (-1);
+	}
+
+	memcpy (buf, BINSTATS_MAGIC, 4);
+	p = put32 (buf + 4, BINSTATS_VERSION);
+	p = put32 (p, kind);
+	p = put32 (p, nRecords);
+	p = put32 (p, nValues);
+	if (!isHist)
+		for (i = 0; i < nFields; i++)
+			p = put32 (p, fields[i]);
+
+	for (t = t0; t <= t1; t++)
+		for (c = c0; c <= c1; c++) {
+			if (isStack) {
+				stackInfoP = thePixels->stackInfos + (size_t)t*head->dc + c;
+				p = put32 (p, c);
+				p = put32 (p, t);
+				for (i = 0; i < nValues; i++)
+					p = isHist ? put64 (p, stackInfoP->hist[i]) : putDouble (p, stackField (stackInfoP, fields[i]));
+				continue;
+			}
+			for (z = z0; z <= z1; z++) {
+				planeInfoP = thePixels->planeInfos + ((size_t)t*head->dc + c)*head->dz + z;
+				p = put32 (p, c);
+				p = put32 (p, t);
+				p = put32 (p, z);
+				for (i = 0; i < nValues; i++)
+					p = isHist ? put64 (p, planeInfoP->hist[i]) : putDouble (p, planeField (planeInfoP, fields[i]));
+			}
+		}
+
+	HTTP_ResultType ("application/octet-stream");
+	fwrite (buf, 1, p - buf, stdout);
+	free (buf);
+
+	return (0);
+}
@@ -0,0 +1,79 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifndef binstats_h
+#define binstats_h
+
+#include "Pixels.h"
+
+/*
+  Binary plane/stack statistics (Format=binary).  Everything is
+  little-endian and written with a single fwrite:
+
+    char      magic[4]      "OMES"
+    u_int32_t version       BINSTATS_VERSION
+    u_int32_t kind          one of the BS_ kinds below
+    u_int32_t nRecords
+    u_int32_t nValues       values per record
+    u_int32_t fieldIDs[nValues]   (BS_PLANE_STATS and BS_STACK_STATS only)
+
+  then nRecords records of
+    u_int32_t theC, theT [, theZ for plane kinds]
+    nValues values: float64 statistics, or u_int64 histogram bins
+*/
+
+#define BINSTATS_MAGIC    "OMES"
+#define BINSTATS_VERSION  1
+
+#define BS_PLANE_STATS    1
+#define BS_PLANE_HIST     2
+#define BS_STACK_STATS    3
+#define BS_STACK_HIST     4
+
+	/* Field IDs, in the order of the text output */
+#define BSF_MIN           0
+#define BSF_MAX           1
+#define BSF_MEAN          2
+#define BSF_SIGMA         3
+#define BSF_GEOMEAN       4
+#define BSF_GEOSIGMA      5
+#define BSF_CENTROID_X    6
+#define BSF_CENTROID_Y    7
+#define BSF_CENTROID_Z    8   /* stacks only */
+#define BSF_SUM_I         9
+#define BSF_SUM_I2        10
+#define BSF_SUM_LOG_I     11
+#define BSF_SUM_XI        12
+#define BSF_SUM_YI        13
+#define BSF_SUM_ZI        14
+#define BSF_NUM_FIELDS    15
+
+int writeBinaryStats (PixelsRep *thePixels, char **param, int kind, char *method);
+
+#endif
@@ -0,0 +1,64 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifndef byteorder_h
+#define byteorder_h
+
+#include <sys/types.h>
+
+/*
+  Writers for the little-endian records omeis sends (ZipFiles archives,
+  and the Format=binary answers of GetPlanes, the stats methods and
+  FileInfo/FileSHA1).  Each stores v at p whatever the host's byte order
+  and returns the byte after it.
+*/
+
+static inline unsigned char *
+put16 (unsigned char *p, u_int16_t v)
+{
+	p[0] = v & 0xFF;
+	p[1] = (v >> 8) & 0xFF;
+	return (p + 2);
+}
+
+static inline unsigned char *
+put32 (unsigned char *p, u_int32_t v)
+{
+	p = put16 (p, v & 0xFFFF);
+	return (put16 (p, v >> 16));
+}
+
+static inline unsigned char *
+put64 (unsigned char *p, u_int64_t v)
+{
+	p = put32 (p, v & 0xFFFFFFFF);
+	return (put32 (p, v >> 32));
+}
+
+#endif
@@ -0,0 +1,261 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif  /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+
+#include "Pixels.h"
+#include "chunked.h"
+
+static
+char *chunkPath (OID ID, const char *suffix, char *path) {
+	strcpy (path,"Pixels/");
+	if (! getRepPath (ID,path,0)) return (NULL);
+	if (suffix) strcat (path,suffix);
+	return (path);
+}
+
+/*
+  Chunks=XxYxZ.  Returns 0 if the brick size is usable for bp-byte pixels.
+*/
+int parseChunkSpec (const char *spec, int bp, int *cx, int *cy, int *cz) {
+	if (sscanf (spec,"%dx%dx%d",cx,cy,cz) != 3) return (-1);
+	if (*cx < 1 || *cy < 1 || *cz < 1) return (-1);
+	if ((double)*cx * *cy * *cz * bp > CHUNK_MAX_BRICK) return (-1);
+	return (0);
+}
+
+int setChunkSpec (OID ID, int cx, int cy, int cz) {
+char path[MAXPATHLEN];
+FILE *spec;
+
+	if (! chunkPath (ID,CHUNK_SPEC_SUFFIX,path)) return (-1);
+	if (! (spec = fopen (path,"w")) ) return (-1);
+	fprintf (spec,"%dx%dx%d\n",cx,cy,cz);
+	return (fclose (spec));
+}
+
+/*
+  Writes the .chunked copy if NewPixels asked for one.  Returns 1 if it
+  was built, 0 if none was asked for, -1 if it couldn't be built (reads
+  then simply use the plain file).
+*/
+int buildChunkedCopy (PixelsRep *thePixels) {
+pixHeader *head = thePixels->head;
+char spec_path[MAXPATHLEN], raw_path[MAXPATHLEN], path[MAXPATHLEN], tmp_path[MAXPATHLEN+16];
+char spec[64];
+FILE *specFile, *out;
+chunkHeader ch;
+int cx, cy, cz, bx, by, bz, y, z, c, t, nx, ny;
+size_t bp = head->bp, rowBytes, planeBytes, brickBytes, rawSize;
+unsigned char *raw, *brick;
+struct stat fStat;
+int fd, result = 1;
+
+	if (! chunkPath (thePixels->ID,CHUNK_SPEC_SUFFIX,spec_path) ||
+		! chunkPath (thePixels->ID,NULL,raw_path) ||
+		! chunkPath (thePixels->ID,CHUNK_SUFFIX,path) ) return (-1);
+	if (! (specFile = fopen (spec_path,"r")) ) return (0);
+	if (! fgets (spec,sizeof (spec),specFile) || parseChunkSpec (spec,bp,&cx,&cy,&cz) < 0) {
+		fclose (specFile);
+		return (-1);
+	}
+	fclose (specFile);
+
+	rowBytes = (size_t)head->dx * bp;
+	planeBytes = rowBytes * head->dy;
+	brickBytes = (size_t)cx * cy * cz * bp;
+	rawSize = planeBytes * head->dz * head->dc * head->dt;
+
+	if ( (fd = open (raw_path,O_RDONLY)) < 0) return (-1);
+	if (fstat (fd,&fStat) != 0 || (size_t)fStat.st_size < rawSize) {
+		close (fd);
+		return (-1);
+	}
+	raw = (unsigned char *) mmap (NULL,rawSize,PROT_READ,MAP_SHARED,fd,0);
+	close (fd);
+	if (raw == (unsigned char *) MAP_FAILED) return (-1);
+	madvise (raw,rawSize,MADV_SEQUENTIAL);
+
+	snprintf (tmp_path,sizeof (tmp_path),"%s.%d",path,(int)getpid());
+	if (! (brick = (unsigned char *) malloc (brickBytes)) || ! (out = fopen (tmp_path,"w")) ) {
+		free (brick);
+		munmap (raw,rawSize);
+		return (-1);
+	}
+
+	memset (&ch,0,sizeof (ch));
+	memcpy (ch.magic,CHUNK_MAGIC,4);
+	ch.version = CHUNK_VERSION;
+	ch.bp = bp;
+	ch.dx = head->dx; ch.dy = head->dy; ch.dz = head->dz; ch.dc = head->dc; ch.dt = head->dt;
+	ch.cx = cx; ch.cy = cy; ch.cz = cz;
+	if (fwrite (&ch,sizeof (ch),1,out) != 1) result = -1;
+
+	for (t = 0; t < head->dt && result > 0; t++)
+		for (c = 0; c < head->dc && result > 0; c++)
+			for (bz = 0; bz < head->dz && result > 0; bz += cz)
+				for (by = 0; by < head->dy && result > 0; by += cy)
+					for (bx = 0; bx < head->dx && result > 0; bx += cx) {
+						nx = head->dx - bx < cx ? head->dx - bx : cx;
+						ny = head->dy - by < cy ? head->dy - by : cy;
+						memset (brick,0,brickBytes);
+						for (z = 0; z < cz && bz + z < head->dz; z++)
+							for (y = 0; y < ny; y++)
+								memcpy (brick + ((size_t)z*cy + y)*cx*bp,
+									raw + (((size_t)t*head->dc + c)*head->dz + bz + z)*planeBytes + (size_t)(by + y)*rowBytes + (size_t)bx*bp,
+									nx*bp);
+						if (fwrite (brick,1,brickBytes,out) != brickBytes) result = -1;
+					}
+
+	free (brick);
+	munmap (raw,rawSize);
+	if (fclose (out) != 0) result = -1;
+	if (result < 0 || rename (tmp_path,path) != 0) {
+		unlink (tmp_path);
+		return (-1);
+	}
+	return (1);
+}
+
+/*
+  Writes the ROI to out in XYZCT order, as DoROI does, reading it from the
+  bricks.  Returns the number of pixels written.  Returns -1 without
+  writing anything if there is no chunked copy, or the plain file would be
+  quicker, or the ROI is too wide to buffer; the caller should then use
+  DoROI.
+*/
+long long chunkedROI (PixelsRep *thePixels,
+	int x0, int y0, int z0, int c0, int t0,
+	int x1, int y1, int z1, int c1, int t1, FILE *out) {
+pixHeader *head = thePixels->head;
+char path[MAXPATHLEN];
+chunkHeader ch;
+size_t bp = head->bp, brickBytes, runBytes, slabBytes;
+size_t nbx, nby, nbz, nbxr, nbyr;
+int cx, cy, cz, bx0, bx1, by0, by1, bz0, bz1, bx, by, bz, x, xe, y, z, c, t;
+unsigned char *slab, *src;
+long long nPix = 0;
+double planes, slabs, plainCost, chunkCost;
+off_t brickOff;
+int fd;
+
+	if (x1 < x0 || y1 < y0 || z1 < z0 || c1 < c0 || t1 < t0) return (-1);
+	if (! chunkPath (thePixels->ID,CHUNK_SUFFIX,path) ) return (-1);
+	if ( (fd = open (path,O_RDONLY)) < 0) return (-1);
+	if (pread (fd,&ch,sizeof (ch),0) != sizeof (ch) || memcmp (ch.magic,CHUNK_MAGIC,4) ||
+		ch.version != CHUNK_VERSION || ch.bp != bp ||
+		ch.dx != (u_int32_t)head->dx || ch.dy != (u_int32_t)head->dy || ch.dz != (u_int32_t)head->dz ||
+		ch.dc != (u_int32_t)head->dc || ch.dt != (u_int32_t)head->dt) {
+		close (fd);
+		return (-1);
+	}
+
+	cx = ch.cx;
+	cy = ch.cy;
+	cz = ch.cz;
+	nbx = (head->dx + cx - 1) / cx;
+	nby = (head->dy + cy - 1) / cy;
+	nbz = (head->dz + cz - 1) / cz;
+	bx0 = x0 / cx; bx1 = x1 / cx;
+	by0 = y0 / cy; by1 = y1 / cy;
+	bz0 = z0 / cz; bz1 = z1 / cz;
+	nbxr = bx1 - bx0 + 1;
+	nbyr = by1 - by0 + 1;
+	brickBytes = (size_t)cx * cy * cz * bp;
+	runBytes = nbxr * brickBytes;
+	slabBytes = nbyr * runBytes;
+
+	/*
+	  Only use the bricks if that's cheaper, counting each read as
+	  CHUNK_SEEK_BYTES plus what it spans.  From the plain file that's one
+	  read per plane, spanning the ROI's rows; from the bricks one read per
+	  brick row of each z-slab.
+	*/
+	planes = (double)(z1 - z0 + 1) * (c1 - c0 + 1) * (t1 - t0 + 1);
+	slabs = (double)(bz1 - bz0 + 1) * (c1 - c0 + 1) * (t1 - t0 + 1);
+	plainCost = planes * (CHUNK_SEEK_BYTES + ((double)(y1 - y0) * head->dx + (x1 - x0 + 1)) * bp);
+	chunkCost = slabs * (nbyr * CHUNK_SEEK_BYTES + slabBytes);
+	if (chunkCost > plainCost) {
+		close (fd);
+		return (-1);
+	}
+
+	if (slabBytes > CHUNK_MAX_SLAB || ! (slab = (unsigned char *) malloc (slabBytes)) ) {
+		close (fd);
+		return (-1);
+	}
+
+	for (t = t0; t <= t1; t++)
+		for (c = c0; c <= c1; c++)
+			for (bz = bz0; bz <= bz1; bz++) {
+				/* The bricks x-adjacent in a brick row are adjacent in the file too */
+				for (by = by0; by <= by1; by++) {
+					brickOff = sizeof (ch) + (off_t)((((t*head->dc + c)*nbz + bz)*nby + by)*nbx + bx0) * brickBytes;
+					if (pread (fd,slab + (by - by0)*runBytes,runBytes,brickOff) != (ssize_t)runBytes) {
+						free (slab);
+						close (fd);
+						return (nPix);
+					}
+				}
+
+				for (z = bz*cz > z0 ? bz*cz : z0; z <= z1 && z < (bz+1)*cz; z++)
+					for (y = y0; y <= y1; y++) {
+						by = y / cy;
+						for (bx = bx0; bx <= bx1; bx++) {
+							x = bx*cx > x0 ? bx*cx : x0;
+							xe = (bx+1)*cx - 1 < x1 ? (bx+1)*cx - 1 : x1;
+							src = slab + (by - by0)*runBytes + (bx - bx0)*brickBytes +
+								(((size_t)(z - bz*cz)*cy + (y - by*cy))*cx + (x - bx*cx))*bp;
+							nPix += fwrite (src,bp,xe - x + 1,out);
+						}
+					}
+			}
+
+	free (slab);
+	close (fd);
+	return (nPix);
+}
+
+void removeChunkedCopy (OID ID) {
+char path[MAXPATHLEN];
+
+	if (chunkPath (ID,CHUNK_SUFFIX,path)) unlink (path);
+	if (chunkPath (ID,CHUNK_SPEC_SUFFIX,path)) unlink (path);
+}
@@ -0,0 +1,78 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifndef chunked_h
+#define chunked_h
+
+#include <stdio.h>
+#include "Pixels.h"
+
+/*
+  Optional chunked copy of a Pixels file.  NewPixels with Chunks=XxYxZ
+  records a brick size in <path>.chunkspec.  Once FinishPixels has made the
+  Pixels read-only, a copy laid out as XxYxZ bricks is written to
+  <path>.chunked.  GetROI reads small boxes from the bricks, so a box
+  through Z or T needs a few large reads instead of one read per row.
+  Everything else, and every write, still goes to the plain XYZCT file,
+  so the copy never needs to be kept in step with it.
+
+  The .chunked file starts with a chunkHeader (native byte order, like the
+  Pixels file).  Bricks follow in t, c, z-brick, y-brick, x-brick order.
+  Each brick is stored whole, x fastest, and edge bricks are zero-padded.
+*/
+
+#define CHUNK_MAGIC        "OMEC"
+#define CHUNK_VERSION      1
+#define CHUNK_SPEC_SUFFIX  ".chunkspec"
+#define CHUNK_SUFFIX       ".chunked"
+
+/* Largest brick, and the most brick data one GetROI will buffer */
+#define CHUNK_MAX_BRICK    (16*1024*1024)
+#define CHUNK_MAX_SLAB     (64*1024*1024)
+
+/* What a seek is worth in bytes read, when choosing between the layouts */
+#define CHUNK_SEEK_BYTES   (128*1024)
+
+typedef struct {
+	char magic[4];
+	u_int32_t version;
+	u_int32_t bp;
+	u_int32_t dx, dy, dz, dc, dt;
+	u_int32_t cx, cy, cz;
+} chunkHeader;
+
+int parseChunkSpec (const char *spec, int bp, int *cx, int *cy, int *cz);
+int setChunkSpec (OID ID, int cx, int cy, int cz);
+int buildChunkedCopy (PixelsRep *thePixels);
+long long chunkedROI (PixelsRep *thePixels,
+	int x0, int y0, int z0, int c0, int t0,
+	int x1, int y1, int z1, int c1, int t1, FILE *out);
+void removeChunkedCopy (OID ID);
+
+#endif
@@ -0,0 +1,433 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif  /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "Pixels.h"
+#include "File.h"
+#include "OMEIS_Error.h"
+#include "pixswap.h"
+#include "statskern.h"
+#include "convert.h"
+
+/* The whole range with one ConvertFile, and Pixels.c's stats for it */
+static size_t
+convertWhole (PixelsRep *thePixels, FileRep *theFile, size_t file_offset,
+	size_t offset, size_t nPix, ome_coord theC, ome_coord theT)
+{
+	size_t nIO;
+
+	if ( (nIO = ConvertFile (thePixels, theFile, file_offset, offset, nPix, 1)) == nPix) {
+		if (theC < 0) FinishStats (thePixels, 0);
+		else DoStackStats (thePixels, theC, theT);
+	}
+	return (nIO);
+}
+
+#ifndef OMEIS_STATS_KERNEL
+
+/*
+  Convert (theC < 0) or ConvertStack (theC, theT), with Pixels.c writing
+  the stats.  Define OMEIS_STATS_KERNEL for the statskern writer below,
+  here and in convertPlaneStats, once bench/pixstatscheck has found it
+  gives the same plane and stack infos as DoPlaneStats and DoStackStats.
+  Returns the number of pixels converted, like ConvertFile.
+*/
+size_t
+convertPlanes (PixelsRep *thePixels, FileRep *theFile, size_t file_offset,
+	size_t offset, size_t nPix, ome_coord theC, ome_coord theT,
+	char iam_BigEndian, const char *threadParam)
+{
+	return (convertWhole (thePixels, theFile, file_offset, offset, nPix, theC, theT));
+}
+
+/* ConvertPlane and ConvertTIFF's stats for the plane they converted */
+int
+convertPlaneStats (PixelsRep *thePixels, ome_coord theZ, ome_coord theC, ome_coord theT)
+{
+	return (DoPlaneStats (thePixels, theZ, theC, theT));
+}
+
+#else  /* OMEIS_STATS_KERNEL */
+
+/*
+  One plane's statistics, as the stats workers leave them for the caller:
+  its sums from the first pass, then its histogram, logs and share of
+  its stack's histogram from the second.
+*/
+typedef struct {
+	pixelSums sums;
+	pixelHist hist, stackHist;
+	pixelLogSums logs;
+	int failed;
+} planeResult;
+
+/*
+  Work shared between the caller and its stats workers, a batch of whole
+  stacks at a time.  The workers only read the batch's planes out of the
+  file's map and write their own planeResults.  Everything that goes
+  through the PixelsRep or FileRep (ConvertFile, the plane and stack
+  infos) stays on the caller.
+*/
+typedef struct {
+	const unsigned char *src;     /* the batch's first plane in the file's map */
+	char doSwap, bp, isSigned, isFloat;
+	ome_dim dx, dy;
+	size_t planePix, planeBytes;
+	planeResult *planes;
+	int pass;                     /* 1: sums, 2: histograms and logs */
+	size_t nPlanes, next, nDone;  /* planes in this batch, handed out, finished */
+	int stop;
+	pthread_mutex_t lock;
+	pthread_cond_t work, done;
+} statsJob;
+
+static void
+statsPlane (statsJob *job, size_t plane, unsigned char *buf)
+{
+	planeResult *res = job->planes + plane;
+	const unsigned char *pix = job->src + plane * job->planeBytes;
+
+	/* The same swap ConvertFile makes on its way into the Pixels */
+	if (job->doSwap) {
+		memcpy (buf,pix,job->planeBytes);
+		swapPixels (buf,job->planePix,job->bp);
+		pix = buf;
+	}
+
+	if (job->pass == 1) {
+		res->failed = sumPlanePixels (pix,job->dx,job->dy,job->bp,job->isSigned,job->isFloat,&res->sums) < 0;
+		return;
+	}
+
+	res->hist.min = res->sums.min;
+	res->hist.max = res->sums.max;
+	res->failed = histPlanePixels (pix,job->planePix,job->bp,job->isSigned,job->isFloat,
+		&res->hist,&res->stackHist,&res->logs) < 0;
+}
+
+/*
+  Works through the current batch's planes.  Workers wait for the next
+  batch when they run out; the caller just helps with what is left.
+*/
+static void
+runStats (statsJob *job, unsigned char *buf, int wait)
+{
+	size_t plane;
+
+	pthread_mutex_lock (&job->lock);
+	for (;;) {
+		while (wait && !job->stop && job->next >= job->nPlanes)
+			pthread_cond_wait (&job->work,&job->lock);
+		if (job->stop || job->next >= job->nPlanes) break;
+		plane = job->next++;
+		pthread_mutex_unlock (&job->lock);
+
+		statsPlane (job,plane,buf);
+
+		pthread_mutex_lock (&job->lock);
+		if (++job->nDone == job->nPlanes) pthread_cond_signal (&job->done);
+	}
+	pthread_mutex_unlock (&job->lock);
+}
+
+static void *
+statsThread (void *arg)
+{
+	statsJob *job = (statsJob *) arg;
+	unsigned char *buf = NULL;
+
+	/* Without a buffer this worker just sits out; the caller does its share */
+	if (job->doSwap && ! (buf = (unsigned char *) malloc (job->planeBytes)) )
+		return (NULL);
+	runStats (job,buf,1);
+	free (buf);
+
+	return (NULL);
+}
+
+/* Hands the batch's planes out for a pass */
+static void
+startPass (statsJob *job, int pass)
+{
+	pthread_mutex_lock (&job->lock);
+	job->pass = pass;
+	job->next = job->nDone = 0;
+	pthread_cond_broadcast (&job->work);
+	pthread_mutex_unlock (&job->lock);
+}
+
+/* Helps with what is left of a pass, then waits for the workers to finish it */
+static void
+finishPass (statsJob *job, unsigned char *buf)
+{
+	runStats (job,buf,0);
+	pthread_mutex_lock (&job->lock);
+	while (job->nDone < job->nPlanes)
+		pthread_cond_wait (&job->done,&job->lock);
+	pthread_mutex_unlock (&job->lock);
+}
+
+/*
+  Records one stack's stats: each plane's, and the stack's merged from
+  them.  If any plane's couldn't be done here, Pixels.c does the stack.
+*/
+static void
+recordStack (PixelsRep *thePixels, planeResult *planes, size_t planePix, ome_coord theC, ome_coord theT)
+{
+	pixHeader *head = thePixels->head;
+	size_t stack = (size_t)theT*head->dc + theC;
+	stackSums sums;
+	pixelHist hist;
+	ome_coord theZ;
+	int i;
+
+	for (theZ = 0; theZ < head->dz; theZ++) {
+		if (planes[theZ].failed) {
+			DoStackStats (thePixels, theC, theT);
+			return;
+		}
+	}
+
+	memset (&sums,0,sizeof (sums));
+	memset (&hist,0,sizeof (hist));
+	hist.min = planes[0].stackHist.min;
+	hist.max = planes[0].stackHist.max;
+	for (theZ = 0; theZ < head->dz; theZ++) {
+		setPlaneInfo (thePixels->planeInfos + stack*head->dz + theZ,
+			&planes[theZ].sums, &planes[theZ].hist, &planes[theZ].logs, planePix, theZ);
+		addStackPlane (&sums, &planes[theZ].sums, &planes[theZ].logs, planePix, theZ);
+		for (i = 0; i < NUM_BINS; i++)
+			hist.hist[i] += planes[theZ].stackHist.hist[i];
+	}
+	setStackInfo (thePixels->stackInfos + stack, &sums, &hist);
+}
+
+/*
+  Converts nStacks whole stacks, from firstStack on, with a single
+  ConvertFile.  Meanwhile the workers make the first pass over the
+  planes in the file's map.  Once each stack's range is known, they make
+  the second, binning every plane into its own and its stack's
+  histogram, and the stats are recorded.
+*/
+static size_t
+convertBatch (statsJob *job, PixelsRep *thePixels, FileRep *theFile, size_t file_offset,
+	size_t firstStack, size_t nStacks, ome_coord theC, ome_coord theT, unsigned char *buf)
+{
+	pixHeader *head = thePixels->head;
+	size_t nIO, stack, plane;
+	planeResult *planes;
+	pixelHist range;
+
+	job->src = (const unsigned char *) theFile->file_buf + file_offset;
+	job->nPlanes = nStacks * head->dz;
+	startPass (job,1);
+
+	if (theC < 0) {
+		theC = firstStack % head->dc;
+		theT = firstStack / head->dc;
+	}
+	nIO = ConvertFile (thePixels, theFile, file_offset, GetOffset (thePixels, 0, 0, 0, theC, theT),
+		job->nPlanes * job->planePix, 1);
+
+	finishPass (job,buf);
+	if (nIO != job->nPlanes * job->planePix || !thePixels->planeInfos || !thePixels->stackInfos)
+		return (nIO);
+
+	for (stack = 0; stack < nStacks; stack++) {
+		planes = job->planes + stack * head->dz;
+		memset (&range,0,sizeof (range));
+		for (plane = 0; plane < (size_t)head->dz; plane++) {
+			if (!plane || planes[plane].sums.min < range.min) range.min = planes[plane].sums.min;
+			if (!plane || planes[plane].sums.max > range.max) range.max = planes[plane].sums.max;
+		}
+		for (plane = 0; plane < (size_t)head->dz; plane++)
+			planes[plane].stackHist = range;
+	}
+	startPass (job,2);
+	finishPass (job,buf);
+
+	/* Stacks are consecutive in both the file and the infos */
+	stack = (size_t)theT*head->dc + theC;
+	for (plane = 0; plane < nStacks; plane++, stack++)
+		recordStack (thePixels, job->planes + plane * head->dz, job->planePix,
+			stack % head->dc, stack / head->dc);
+
+	return (nIO);
+}
+
+/*
+  How many threads to work out stats on, counting the caller: Threads if
+  given, otherwise up to CONVERT_DEFAULT_THREADS of the CPUs that the
+  load average says are idle, so that concurrent requests don't pile
+  more threads on the host than it has CPUs.
+*/
+static int
+statsThreads (const char *threadParam)
+{
+	long nCPU;
+	double load;
+	int nThreads = CONVERT_DEFAULT_THREADS;
+
+	if (threadParam) {
+		sscanf (threadParam,"%d",&nThreads);
+		if (nThreads > CONVERT_MAX_THREADS) nThreads = CONVERT_MAX_THREADS;
+	} else {
+		nCPU = sysconf (_SC_NPROCESSORS_ONLN);
+		if (getloadavg (&load,1) == 1) nCPU -= (long) load;
+		if (nCPU < nThreads) nThreads = (int) nCPU;
+	}
+	if (nThreads < 1) nThreads = 1;
+
+	return (nThreads);
+}
+
+/*
+  Convert (theC < 0) or ConvertStack (theC, theT) in batches of whole
+  stacks, of at least CONVERT_BATCH_PLANES planes where there are that
+  many.  Each batch is converted by ConvertFile on this thread, as a
+  whole-range conversion would be, so the Pixels are the same whatever
+  the thread count.  Meanwhile a pool of workers works out the plane and
+  stack stats from the file's map, so nothing is read back from the
+  Pixels.  Anything else is converted and has its stats done the old
+  way, by FinishStats or DoStackStats.  Returns the number of pixels
+  converted, like ConvertFile.
+*/
+size_t
+convertPlanes (PixelsRep *thePixels, FileRep *theFile, size_t file_offset,
+	size_t offset, size_t nPix, ome_coord theC, ome_coord theT,
+	char iam_BigEndian, const char *threadParam)
+{
+	pixHeader *head = thePixels->head;
+	statsJob job;
+	pthread_t *threads = NULL;
+	unsigned char *buf = NULL;
+	size_t nStacks, batchStacks, stack, stackBytes, nIO = 0, batchIO;
+	int nThreads, i;
+
+	memset (&job,0,sizeof (job));
+	job.bp = head->bp;
+	job.isSigned = head->isSigned;
+	job.isFloat = head->isFloat;
+	job.doSwap = swapNeeded (iam_BigEndian,head->bp);
+	job.dx = head->dx;
+	job.dy = head->dy;
+	job.planePix = (size_t)head->dx * head->dy;
+	job.planeBytes = job.planePix * head->bp;
+	stackBytes = job.planeBytes * head->dz;
+	nStacks = theC < 0 ? (size_t)head->dc * head->dt : 1;
+	batchStacks = (CONVERT_BATCH_PLANES + head->dz - 1) / head->dz;
+	if (batchStacks > nStacks) batchStacks = nStacks;
+
+	/* Anything but whole stacks straight from the file's map is one ConvertFile */
+	if (nStacks * job.planePix * head->dz != nPix || !theFile->file_buf ||
+		file_offset + nStacks * stackBytes > theFile->size_rep ||
+		! (job.planes = (planeResult *) calloc (batchStacks * head->dz,sizeof (planeResult))) ||
+		(job.doSwap && ! (buf = (unsigned char *) malloc (job.planeBytes))) ) {
+		free (job.planes);
+		return (convertWhole (thePixels, theFile, file_offset, offset, nPix, theC, theT));
+	}
+
+	pthread_mutex_init (&job.lock,NULL);
+	pthread_cond_init (&job.work,NULL);
+	pthread_cond_init (&job.done,NULL);
+
+	nThreads = statsThreads (threadParam) - 1;
+	if ((size_t)nThreads >= batchStacks * head->dz) nThreads = batchStacks * head->dz - 1;
+	if (nThreads > 0 && (threads = (pthread_t *) calloc (nThreads, sizeof (pthread_t))) ) {
+		for (i = 0; i < nThreads; i++)
+			if (pthread_create (&threads[i], NULL, statsThread, &job) != 0) break;
+		nThreads = i;
+	} else nThreads = 0;
+
+	for (stack = 0; stack < nStacks; stack += batchStacks) {
+		if (batchStacks > nStacks - stack) batchStacks = nStacks - stack;
+		batchIO = convertBatch (&job, thePixels, theFile, file_offset + stack * stackBytes,
+			stack, batchStacks, theC, theT, buf);
+		nIO += batchIO;
+		if (batchIO != batchStacks * head->dz * job.planePix) break;
+	}
+
+	pthread_mutex_lock (&job.lock);
+	job.stop = 1;
+	pthread_cond_broadcast (&job.work);
+	pthread_mutex_unlock (&job.lock);
+	for (i = 0; i < nThreads; i++)
+		pthread_join (threads[i], NULL);
+
+	pthread_cond_destroy (&job.done);
+	pthread_cond_destroy (&job.work);
+	pthread_mutex_destroy (&job.lock);
+	free (threads);
+	free (job.planes);
+	free (buf);
+
+	return (nIO);
+}
+
+/*
+  ConvertPlane and ConvertTIFF's stats for the plane they converted,
+  from the statskern writer like Convert and ConvertStack's, read back
+  from the Pixels' map.  Without one, Pixels.c does them.
+*/
+int
+convertPlaneStats (PixelsRep *thePixels, ome_coord theZ, ome_coord theC, ome_coord theT)
+{
+	pixHeader *head = thePixels->head;
+	size_t planePix = (size_t)head->dx * head->dy;
+	const unsigned char *pix;
+	pixelSums sums;
+	pixelHist hist;
+	pixelLogSums logs;
+
+	if (!thePixels->pixels || !thePixels->planeInfos)
+		return (DoPlaneStats (thePixels, theZ, theC, theT));
+
+	pix = (const unsigned char *) thePixels->pixels + GetOffset (thePixels, 0, 0, theZ, theC, theT);
+	if (sumPlanePixels (pix,head->dx,head->dy,head->bp,head->isSigned,head->isFloat,&sums) < 0)
+		return (DoPlaneStats (thePixels, theZ, theC, theT));
+	hist.min = sums.min;
+	hist.max = sums.max;
+	if (histPlanePixels (pix,planePix,head->bp,head->isSigned,head->isFloat,&hist,NULL,&logs) < 0)
+		return (DoPlaneStats (thePixels, theZ, theC, theT));
+
+	setPlaneInfo (thePixels->planeInfos + ((size_t)theT*head->dc + theC)*head->dz + theZ,
+		&sums, &hist, &logs, planePix, theZ);
+	return (1);
+}
+
+#endif /* OMEIS_STATS_KERNEL */
@@ -0,0 +1,60 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifndef convert_h
+#define convert_h
+
+#include "Pixels.h"
+#include "File.h"
+
+/*
+  Threads for the stats of Convert and ConvertStack, when built with
+  OMEIS_STATS_KERNEL: the default, which is further limited to the CPUs
+  not already busy, and the most a Threads parameter may ask for.
+  Otherwise Pixels.c does the stats after a single ConvertFile.
+*/
+#define CONVERT_DEFAULT_THREADS 4
+#define CONVERT_MAX_THREADS 16
+
+/*
+  Planes converted per ConvertFile call, rounded up to whole stacks.
+  Each batch is converted on the calling thread; only the stats go to
+  the workers, and their first pass runs under the copy.  So however
+  many threads there are, Convert takes at least as long as the serial
+  copy, and once the second stats pass is spread thin that copy is the
+  ceiling (bench/convertbench shows where).
+*/
+#define CONVERT_BATCH_PLANES 64
+
+size_t convertPlanes (PixelsRep *thePixels, FileRep *theFile, size_t file_offset,
+	size_t offset, size_t nPix, ome_coord theC, ome_coord theT,
+	char iam_BigEndian, const char *threadParam);
+int convertPlaneStats (PixelsRep *thePixels, ome_coord theZ, ome_coord theC, ome_coord theT);
+
+#endif
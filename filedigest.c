@@ -0,0 +1,143 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif  /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+
+#include "File.h"
+#include "sha1DB.h"
+#include "filedigest.h"
+
+/*
+  Copies the upload into myFile's map, FILE_DIGEST_CHUNK at a time, and
+  works out its SHA1 into file_info.sha1 (zero past the SHA1) from each
+  chunk as it lands.  An upload that arrived in the request body is
+  copied from where it lies; a local file is read straight into the map.
+  Returns 0, or -1.
+*/
+static
+int copyUpload (FileRep *myFile, const char *file, size_t size, unsigned char isLocalFile) {
+EVP_MD_CTX *ctx;
+unsigned char *dst = (unsigned char *) myFile->file_buf;
+size_t done;
+ssize_t n = 0;
+int fd = -1, rc = -1;
+
+	if (! (ctx = EVP_MD_CTX_new ()) ) return (-1);
+	memset (myFile->file_info.sha1,0,OME_DIGEST_LENGTH);
+	if (!EVP_DigestInit_ex (ctx,EVP_sha1 (),NULL)) goto done;
+	if (isLocalFile) {
+		if ( (fd = open (file,O_RDONLY)) < 0) goto done;
+#ifdef POSIX_FADV_SEQUENTIAL
+		posix_fadvise (fd,0,0,POSIX_FADV_SEQUENTIAL);
+#endif
+	}
+
+	for (done = 0; done < size; done += n) {
+		n = size - done < FILE_DIGEST_CHUNK ? size - done : FILE_DIGEST_CHUNK;
+		if (!isLocalFile) memcpy (dst + done,file + done,n);
+		else if ( (n = read (fd,dst + done,n)) <= 0) goto done;
+		if (!EVP_DigestUpdate (ctx,dst + done,n)) goto done;
+	}
+
+	if (EVP_DigestFinal_ex (ctx,myFile->file_info.sha1,NULL)) rc = 0;
+done:
+	if (fd >= 0) close (fd);
+	EVP_MD_CTX_free (ctx);
+	return (rc);
+}
+
+/*
+  UploadFile, with the SHA1 worked out in the copy.  The first file with
+  a given content is recorded in sha1DB; a later copy keeps its own data,
+  since GetLocalPath, ZipFiles and ImportOMEfile read a file's data where
+  it lies.  Returns the new FileID, or 0.
+*/
+OID digestUploadFile (char *file, size_t size, unsigned char isLocalFile) {
+FileRep *myFile;
+struct stat fStat;
+OID ID;
+
+	if (!file) return (0);
+	/* A local file is taken whole if size is 0 */
+	if (isLocalFile && !size) {
+		if (stat (file,&fStat) != 0) return (0);
+		size = fStat.st_size;
+	}
+	if (! (myFile = NewFile (file,size)) ) return (0);
+	if (copyUpload (myFile,file,size,isLocalFile) < 0) {
+		ExpungeFile (myFile);
+		freeFileRep (myFile);
+		return (0);
+	}
+
+	if ( (ID = FinishFile (myFile)) && !findFileDigest (myFile->file_info.sha1))
+		recordFileDigest (myFile->file_info.sha1,ID);
+	freeFileRep (myFile);
+	return (ID);
+}
+
+/*
+  The FileID holding content with this digest, or 0.  An entry whose file
+  has since been deleted, or no longer has that digest, doesn't count.
+*/
+OID findFileDigest (unsigned char *md) {
+FileRep *theFile;
+DB *shaDB;
+OID ID;
+
+	if (! (shaDB = sha1DB_open (FILE_DIGEST_DB)) ) return (0);
+	ID = sha1DB_get (shaDB,md);
+	sha1DB_close (shaDB);
+	if (!ID || ! (theFile = newFileRep (ID)) ) return (0);
+	if (GetFileInfo (theFile) < 0 || memcmp (theFile->file_info.sha1,md,SHA_DIGEST_LENGTH)) ID = 0;
+	freeFileRep (theFile);
+	return (ID);
+}
+
+/* Points the digest at ID.  Returns 0, or -1 */
+int recordFileDigest (unsigned char *md, OID ID) {
+DB *shaDB;
+int rc;
+
+	if (! (shaDB = sha1DB_open (FILE_DIGEST_DB)) ) return (-1);
+	rc = sha1DB_put (shaDB,md,ID) ? -1 : 0;
+	sha1DB_close (shaDB);
+	return (rc);
+}
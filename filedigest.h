@@ -0,0 +1,53 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifndef filedigest_h
+#define filedigest_h
+
+#include "File.h"
+
+/*
+  Upload-time hashing.  An upload is copied into its new file a chunk at
+  a time, and each chunk goes into the SHA1 as it is copied, so the
+  source is read once.  The digest worked out here is the one FinishFile
+  records for FileInfo and FileSHA1.  Files/sha1DB.idx maps each digest
+  to the first file stored with it, as long as that file is still there
+  with the same digest.  A repeat is stored as a file of its own: making
+  it an alias of the first needs File.c to add it to that file's alias
+  list.
+*/
+
+#define FILE_DIGEST_DB     "Files/sha1DB.idx"
+#define FILE_DIGEST_CHUNK  (4*1024*1024)
+
+OID digestUploadFile (char *file, size_t size, unsigned char isLocalFile);
+OID findFileDigest (unsigned char *md);
+int recordFileDigest (unsigned char *md, OID ID);
+
+#endif
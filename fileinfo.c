@@ -0,0 +1,257 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif  /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "Pixels.h"
+#include "File.h"
+#include "omeis.h"
+#include "OMEIS_Error.h"
+#include "cgi.h"
+#include "byteorder.h"
+#include "fileinfo.h"
+#include "headindex.h"
+
+#define ID_SEPARATORS ", \t\r\n"
+
+static void
+write32 (u_int32_t v)
+{
+	unsigned char b[4];
+
+	put32 (b, v);
+	fwrite (b, 1, sizeof (b), stdout);
+}
+
+static void
+write64 (u_int64_t v)
+{
+	unsigned char b[8];
+
+	put64 (b, v);
+	fwrite (b, 1, sizeof (b), stdout);
+}
+
+/* A list of FileIDs, or a request for binary records, takes the batched path */
+int
+isFileList (char **param)
+{
+	char *theParam;
+
+	if ( (theParam = get_lc_param (param,"Format")) && !strcmp (theParam,"binary") )
+		return (1);
+	return ( (theParam = get_param (param,"FileID")) && strpbrk (theParam, ID_SEPARATORS) );
+}
+
+/*
+  Parses the FileID list into a new array.  Returns the number of IDs, or
+  -1 if one isn't a positive number or there are too many.
+*/
+static int
+parseFileIDs (const char *spec, OID **IDs)
+{
+	char *copy, *piece, *save, *end;
+	unsigned long long scan_ID;
+	int nIDs = 0;
+
+	*IDs = NULL;
+	if ( !(copy = strdup (spec)) ||
+		!(*IDs = (OID *) malloc (FILEINFO_MAX_IDS * sizeof (OID))) ) {
+		free (copy);
+		return (-1);
+	}
+	for (piece = strtok_r (copy, ID_SEPARATORS, &save); piece; piece = strtok_r (NULL, ID_SEPARATORS, &save)) {
+		scan_ID = strtoull (piece, &end, 10);
+		if (*end || scan_ID == 0 || nIDs == FILEINFO_MAX_IDS) {
+			nIDs = -1;
+			break;
+		}
+		(*IDs)[nIDs++] = (OID) scan_ID;
+	}
+	free (copy);
+	if (nIDs <= 0) {
+		free (*IDs);
+		*IDs = NULL;
+		return (-1);
+	}
+	return (nIDs);
+}
+
+/*
+  Looks up one file's info and length in the header index.  For FI_INFO,
+  a file with aliases is opened as well, for the list of them; *aliases
+  is then the FileRep holding it, to be freed by the caller.  Returns 0,
+  or -1 with *error set.
+*/
+static int
+lookupFile (OID ID, int kind, FileInfo *info, u_int64_t *size, FileRep **aliases, const char **error)
+{
+	FileRep *theFile;
+
+	*aliases = NULL;
+	if (indexedFile (ID, info, size) < 0) {
+		*error = "Could not get file info";
+		return (-1);
+	}
+	if (kind != FI_INFO || !info->nAliases) return (0);
+
+	if ( !(theFile = newFileRep (ID)) ) {
+		*error = "newFileRep failed";
+		return (-1);
+	}
+	if (GetFileInfo (theFile) < 0 || GetFileAliases (theFile) < 0) {
+		*error = "Could not get aliases";
+		freeFileRep (theFile);
+		return (-1);
+	}
+	/* The list and its count come from the same read */
+	*info = theFile->file_info;
+	*size = theFile->size_rep;
+	*aliases = theFile;
+	return (0);
+}
+
+static void
+textRecord (OID ID, int kind, FileInfo *info, u_int64_t size, FileRep *aliases, const char *path, const char *error)
+{
+	unsigned long i;
+
+	if (kind != FI_INFO) {
+		fprintf (stdout, "%llu\t", (unsigned long long) ID);
+		if (error) fprintf (stdout, "Error=%s\n", error);
+		else if (kind == FI_PATH) fprintf (stdout, "%s\n", path);
+		else {
+			print_md (info->sha1);
+			fputc ('\n', stdout);
+		}
+		return;
+	}
+
+	/* The single-file FileInfo fields, after the FileID they belong to */
+	fprintf (stdout, "FileID=%llu\n", (unsigned long long) ID);
+	if (error) {
+		fprintf (stdout, "Error=%s\n\n", error);
+		return;
+	}
+	fprintf (stdout, "Name=%s\nLength=%lu\nSHA1=", info->name, (unsigned long) size);
+	print_md (info->sha1);
+	fputc ('\n', stdout);
+	if (info->isAlias)
+		fprintf (stdout, "IsAlias=%llu\n", (unsigned long long) info->isAlias);
+	if (info->nAliases) {
+		fprintf (stdout, "HasAliases=");
+		for (i = 0; i < info->nAliases; i++)
+			fprintf (stdout, "%llu%s", (unsigned long long) aliases->aliases[i].ID,
+				i < info->nAliases - 1 ? "\t" : "\n");
+	}
+	fputc ('\n', stdout);
+}
+
+static void
+binaryRecord (OID ID, int kind, FileInfo *info, u_int64_t size, FileRep *aliases, const char *path, const char *error)
+{
+	size_t len;
+	unsigned long i;
+
+	write64 (ID);
+	write32 (error ? 1 : 0);
+	if (error) return;
+
+	if (kind == FI_PATH) {
+		len = strlen (path);
+		write32 (len);
+		fwrite (path, 1, len, stdout);
+		return;
+	}
+	if (kind == FI_INFO) write64 (size);
+	fwrite (info->sha1, 1, OME_DIGEST_LENGTH, stdout);
+	if (kind == FI_SHA1) return;
+
+	write64 (info->isAlias);
+	write32 (info->nAliases);
+	for (i = 0; i < info->nAliases; i++)
+		write64 (aliases->aliases[i].ID);
+	len = strlen (info->name);
+	write32 (len);
+	fwrite (info->name, 1, len, stdout);
+}
+
+int
+writeFileInfos (char **param, int kind, char *method)
+{
+	char *theParam, file_path[MAXPATHLEN];
+	unsigned char head[20], *p;
+	const char *error;
+	FileRep *aliases;
+	FileInfo info;
+	u_int64_t size;
+	OID *IDs;
+	int nIDs, isBinary, i;
+
+	isBinary = (theParam = get_lc_param (param,"Format")) && !strcmp (theParam,"binary");
+	if ( !(theParam = get_param (param,"FileID")) || (nIDs = parseFileIDs (theParam, &IDs)) < 0) {
+		OMEIS_ReportError (method, NULL, (OID)0,
+			"FileID must be a list of up to %d positive IDs, separated by commas or whitespace.", FILEINFO_MAX_IDS);
+		return (-1);
+	}
+
+	if (isBinary) {
+		HTTP_ResultType ("application/octet-stream");
+		memcpy (head, FILEINFO_MAGIC, 4);
+		p = put32 (head + 4, FILEINFO_VERSION);
+		p = put32 (p, kind);
+		p = put32 (p, OME_DIGEST_LENGTH);
+		put32 (p, nIDs);
+		fwrite (head, 1, sizeof (head), stdout);
+	} else HTTP_ResultType ("text/plain");
+
+	for (i = 0; i < nIDs; i++) {
+		error = NULL;
+		aliases = NULL;
+		if (kind == FI_PATH) {
+			/* Where the file lives; as for one file, it needn't be there yet */
+			strcpy (file_path, "Files/");
+			if (! getRepPath (IDs[i], file_path, 0)) error = "getRepPath failed";
+		} else lookupFile (IDs[i], kind, &info, &size, &aliases, &error);
+
+		if (isBinary) binaryRecord (IDs[i], kind, &info, size, aliases, file_path, error);
+		else textRecord (IDs[i], kind, &info, size, aliases, file_path, error);
+		if (aliases) freeFileRep (aliases);
+	}
+
+	free (IDs);
+	return (0);
+}
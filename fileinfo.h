@@ -0,0 +1,73 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifndef fileinfo_h
+#define fileinfo_h
+
+/*
+  FileInfo, FileSHA1 and GetLocalPath for many files at once.  FileID
+  takes a list of IDs separated by commas or whitespace (so it can be a
+  POSTed field with one ID per line), and there is one record per ID, in
+  the order given.  A file that can't be read gets an error record
+  rather than failing the rest.
+
+  Text (the default):
+    FileInfo       FileID=n, then the single-file fields, then a blank
+                   line; Error=message instead of the fields on failure
+    FileSHA1       n<tab>sha1, or n<tab>Error=message
+    GetLocalPath   n<tab>path, or n<tab>Error=message
+
+  Format=binary, everything little-endian:
+    char      magic[4]      "OMEF"
+    u_int32_t version       FILEINFO_VERSION
+    u_int32_t kind          FI_INFO, FI_SHA1 or FI_PATH
+    u_int32_t digestLength  bytes in each sha1 below
+    u_int32_t nRecords
+  then nRecords records of
+    u_int64_t fileID
+    u_int32_t status        0, or 1 and nothing more for this record
+    FI_INFO:  u_int64_t length, sha1, u_int64_t isAlias,
+              u_int32_t nAliases, u_int64_t aliases[nAliases],
+              u_int32_t nameLength, name (not terminated)
+    FI_SHA1:  sha1
+    FI_PATH:  u_int32_t pathLength, path (not terminated)
+*/
+
+#define FILEINFO_MAGIC    "OMEF"
+#define FILEINFO_VERSION  1
+#define FILEINFO_MAX_IDS  65536
+
+#define FI_INFO  1
+#define FI_SHA1  2
+#define FI_PATH  3
+
+int isFileList (char **param);
+int writeFileInfos (char **param, int kind, char *method);
+
+#endif
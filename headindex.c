@@ -0,0 +1,468 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif  /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/param.h>
+
+#include "Pixels.h"
+#include "File.h"
+#include "headindex.h"
+
+/* Times a reader goes round a record that keeps changing before giving up on it */
+#define HEADINDEX_TRIES       64
+
+/*
+  The object's info file as it was when its record was read from it.
+  purge and updateOMEIS delete and rewrite objects without going through
+  the dispatcher, so a record is only believed while this still holds.
+*/
+typedef struct {
+	u_int64_t dev, ino, size;
+	int64_t mtime, mtime_ns, ctime, ctime_ns;
+} infoStamp;
+
+/* Every record starts with seq and present, in that order */
+typedef struct {
+	u_int32_t seq;
+	u_int32_t present;
+	infoStamp stamp;
+	pixHeader head;
+} pixelsRecord;
+
+typedef struct {
+	u_int32_t seq;
+	u_int32_t present;
+	infoStamp stamp;
+	u_int64_t size;
+	FileInfo info;
+} fileRecord;
+
+typedef struct {
+	const char *path;
+	size_t recordSize;
+	pid_t pid;
+	int fd;
+	int writable;
+	int broken;
+	unsigned char *map;
+	size_t mapSize;
+} headIndex;
+
+static headIndex pixelsIndex = {HEADINDEX_PIXELS, sizeof (pixelsRecord), 0, -1, 0, 1, NULL, 0};
+static headIndex filesIndex  = {HEADINDEX_FILES,  sizeof (fileRecord),   0, -1, 0, 1, NULL, 0};
+
+static
+void closeIndex (headIndex *idx) {
+	if (idx->map) munmap (idx->map,idx->mapSize);
+	if (idx->fd >= 0) close (idx->fd);
+	idx->map = NULL;
+	idx->mapSize = 0;
+	idx->fd = -1;
+}
+
+/* Maps the whole file again if it has grown since it was last mapped */
+static
+int mapIndex (headIndex *idx) {
+struct stat fStat;
+void *map;
+
+	if (fstat (idx->fd,&fStat) < 0) return (-1);
+	if ((size_t) fStat.st_size <= idx->mapSize) return (0);
+	map = mmap (NULL,fStat.st_size,PROT_READ | (idx->writable ? PROT_WRITE : 0),MAP_SHARED,idx->fd,0);
+	if (map == MAP_FAILED) return (-1);
+	if (idx->map) munmap (idx->map,idx->mapSize);
+	idx->map = (unsigned char *) map;
+	idx->mapSize = fStat.st_size;
+	return (0);
+}
+
+/*
+  Puts a new, empty index in place of one written with a different
+  layout.  It is only a cache, so nothing is lost; processes that still
+  have the old one mapped keep it until they exit.  Returns 0, or -1.
+*/
+static
+int replaceIndex (headIndex *idx) {
+headIndexHeader ih;
+char path[MAXPATHLEN];
+int fd;
+
+	snprintf (path,sizeof (path),"%s.%d",idx->path,(int) getpid ());
+	if ( (fd = open (path,O_RDWR | O_CREAT | O_TRUNC,0644)) < 0) return (-1);
+	memset (&ih,0,sizeof (ih));
+	memcpy (ih.magic,HEADINDEX_MAGIC,4);
+	ih.version = HEADINDEX_VERSION;
+	ih.recordSize = idx->recordSize;
+	if (pwrite (fd,&ih,sizeof (ih),0) != sizeof (ih) || rename (path,idx->path) < 0) {
+		close (fd);
+		unlink (path);
+		return (-1);
+	}
+	close (fd);
+
+	close (idx->fd);
+	if ( (idx->fd = open (idx->path,O_RDWR)) < 0) return (-1);
+	return (0);
+}
+
+/*
+  Opens and maps the index the first time this process uses it.  A
+  server worker doesn't keep what it inherited over the fork, so that
+  the flock it takes is its own.  An index written with a different
+  layout is replaced if it can be.  One that can't be opened, or
+  replaced, is left alone: every lookup misses, and omeis reads the
+  headers the long way as it always has.
+*/
+static
+int openIndex (headIndex *idx) {
+headIndexHeader ih;
+struct stat fStat;
+
+	if (idx->pid == getpid ()) return (idx->broken ? -1 : 0);
+	closeIndex (idx);
+	idx->pid = getpid ();
+	idx->broken = 1;
+
+	idx->writable = 1;
+	if ( (idx->fd = open (idx->path,O_RDWR | O_CREAT,0644)) < 0) {
+		idx->writable = 0;
+		if ( (idx->fd = open (idx->path,O_RDONLY)) < 0) return (-1);
+	}
+
+	if (fstat (idx->fd,&fStat) < 0) return (-1);
+	if ((size_t) fStat.st_size < sizeof (ih)) {
+		if (!idx->writable || flock (idx->fd,LOCK_EX) < 0) return (-1);
+		if (fstat (idx->fd,&fStat) == 0 && (size_t) fStat.st_size < sizeof (ih)) {
+			memset (&ih,0,sizeof (ih));
+			memcpy (ih.magic,HEADINDEX_MAGIC,4);
+			ih.version = HEADINDEX_VERSION;
+			ih.recordSize = idx->recordSize;
+			if (pwrite (idx->fd,&ih,sizeof (ih),0) != sizeof (ih)) {
+				flock (idx->fd,LOCK_UN);
+				return (-1);
+			}
+		}
+		flock (idx->fd,LOCK_UN);
+	}
+
+	if (pread (idx->fd,&ih,sizeof (ih),0) != sizeof (ih) || memcmp (ih.magic,HEADINDEX_MAGIC,4)) return (-1);
+	if ( (ih.version != HEADINDEX_VERSION || ih.recordSize != idx->recordSize) &&
+		(!idx->writable || replaceIndex (idx) < 0) ) return (-1);
+	if (mapIndex (idx) < 0) return (-1);
+
+	idx->broken = 0;
+	return (0);
+}
+
+/* The record for ID, or NULL if the file doesn't reach that far yet */
+static
+unsigned char *recordAt (headIndex *idx, OID ID) {
+u_int64_t end = sizeof (headIndexHeader) + ((u_int64_t) ID + 1) * idx->recordSize;
+
+	if (end > idx->mapSize && (mapIndex (idx) < 0 || end > idx->mapSize)) return (NULL);
+	return (idx->map + end - idx->recordSize);
+}
+
+/*
+  Copies ID's record into rec.  Returns 0 if it holds a header, or -1.
+  *seq gets the sequence number the record had, for fillRecord(); it is
+  left odd when the record couldn't be read cleanly, so nothing fills it.
+*/
+static
+int readRecord (headIndex *idx, OID ID, void *rec, u_int32_t *seq) {
+unsigned char *p;
+u_int32_t before, after;
+int tries;
+
+	*seq = 1;
+	if (!ID || openIndex (idx) < 0) return (-1);
+	if (! (p = recordAt (idx,ID)) ) {
+		/* Past the end: it will be all zeros when the file grows */
+		*seq = 0;
+		return (-1);
+	}
+
+	for (tries = 0; tries < HEADINDEX_TRIES; tries++) {
+		before = __atomic_load_n ((u_int32_t *) p,__ATOMIC_ACQUIRE);
+		if (before & 1) {
+			sched_yield ();
+			continue;
+		}
+		memcpy (rec,p,idx->recordSize);
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+		after = __atomic_load_n ((u_int32_t *) p,__ATOMIC_RELAXED);
+		if (before == after) {
+			*seq = before;
+			return (((u_int32_t *) rec)[1] ? 0 : -1);
+		}
+	}
+	return (-1);
+}
+
+/*
+  Writes ID's record (or clears it, if rec is NULL) under the flock,
+  growing the file if need be.  With fill set, the record is only written
+  if its sequence number is still expected: nothing has written it since
+  it was found empty or out of date.  A
+  number left odd by a writer that died part way is made even again by
+  the next plain write or clear.
+*/
+static
+int writeRecord (headIndex *idx, OID ID, const void *rec, int fill, u_int32_t expected) {
+unsigned char *p;
+u_int32_t seq;
+off_t size;
+int result = -1;
+
+	if (!ID || openIndex (idx) < 0 || !idx->writable) return (-1);
+	if (flock (idx->fd,LOCK_EX) < 0) return (-1);
+
+	if (! (p = recordAt (idx,ID)) ) {
+		size = sizeof (headIndexHeader) + (off_t) (ID / HEADINDEX_GROW + 1) * HEADINDEX_GROW * idx->recordSize;
+		if (ftruncate (idx->fd,size) < 0 || ! (p = recordAt (idx,ID)) ) goto done;
+	}
+
+	seq = __atomic_load_n ((u_int32_t *) p,__ATOMIC_RELAXED);
+	if (fill && seq != expected) goto done;
+
+	seq |= 1;
+	__atomic_store_n ((u_int32_t *) p,seq,__ATOMIC_RELAXED);
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+	if (rec) memcpy (p + sizeof (u_int32_t),(const unsigned char *) rec + sizeof (u_int32_t),idx->recordSize - sizeof (u_int32_t));
+	else memset (p + sizeof (u_int32_t),0,idx->recordSize - sizeof (u_int32_t));
+	__atomic_store_n ((u_int32_t *) p,seq + 1,__ATOMIC_RELEASE);
+	result = 0;
+
+done:
+	flock (idx->fd,LOCK_UN);
+	return (result);
+}
+
+/* The stamp of the file at path.  Returns 0, or -1 if it isn't there */
+static
+int stampPath (const char *path, infoStamp *stamp) {
+struct stat fStat;
+
+	if (stat (path,&fStat) < 0) return (-1);
+	memset (stamp,0,sizeof (*stamp));
+	stamp->dev = fStat.st_dev;
+	stamp->ino = fStat.st_ino;
+	stamp->size = fStat.st_size;
+	stamp->mtime = fStat.st_mtim.tv_sec;
+	stamp->mtime_ns = fStat.st_mtim.tv_nsec;
+	stamp->ctime = fStat.st_ctim.tv_sec;
+	stamp->ctime_ns = fStat.st_ctim.tv_nsec;
+	return (0);
+}
+
+
+
+
+/* ----------------- */
+/* Pixels            */
+/* ----------------- */
+
+/* The stamp of ID's info file, at the path_info Pixels.c gives it */
+static
+int stampPixels (OID ID, infoStamp *stamp) {
+char path[MAXPATHLEN];
+
+	strcpy (path,"Pixels/");
+	if (! getRepPath (ID,path,0)) return (-1);
+	strcat (path,".info");
+	return (stampPath (path,stamp));
+}
+
+/*
+  ID's header, from the index if it's there and its info file hasn't
+  changed since, otherwise from the Pixels themselves, after which the
+  index has it too.  Returns 0, or -1 if there are no such Pixels.
+*/
+int indexedPixels (OID ID, pixHeader *head) {
+pixelsRecord rec;
+PixelsRep *thePixels;
+infoStamp stamp;
+u_int32_t seq;
+int stamped;
+
+	stamped = stampPixels (ID,&stamp) == 0;
+	if (readRecord (&pixelsIndex,ID,&rec,&seq) == 0 && stamped && !memcmp (&rec.stamp,&stamp,sizeof (stamp))) {
+		*head = rec.head;
+		return (0);
+	}
+
+	if (! (thePixels = GetPixelsRep (ID,'i',1)) ) return (-1);
+	*head = *thePixels->head;
+	freePixelsRep (thePixels);
+
+	/* Stamped before the read, so a change made meanwhile makes the record miss */
+	if (stamped) {
+		memset (&rec,0,sizeof (rec));
+		rec.present = 1;
+		rec.stamp = stamp;
+		rec.head = *head;
+		writeRecord (&pixelsIndex,ID,&rec,1,seq);
+	}
+	return (0);
+}
+
+/*
+  CheckCoords() against the index, which reads the header in only if it
+  doesn't have it yet.  Returns 1 if the coordinates are in range, 0 if
+  they're not, or -1 if there are no such Pixels.  The header is left in
+  head, for the error message.
+*/
+int indexedCoords (OID ID, pixHeader *head, ome_coord theX, ome_coord theY, ome_coord theZ, ome_coord theC, ome_coord theT) {
+	if (indexedPixels (ID,head) < 0) return (-1);
+	return (theX >= 0 && theX < head->dx && theY >= 0 && theY < head->dy && theZ >= 0 && theZ < head->dz &&
+		theC >= 0 && theC < head->dc && theT >= 0 && theT < head->dt);
+}
+
+/* Records a header NewPixels or FinishPixels has just written */
+void indexPixels (OID ID, pixHeader *head) {
+pixelsRecord rec;
+
+	memset (&rec,0,sizeof (rec));
+	if (stampPixels (ID,&rec.stamp) < 0) {
+		forgetPixels (ID);
+		return;
+	}
+	rec.present = 1;
+	rec.head = *head;
+	writeRecord (&pixelsIndex,ID,&rec,0,0);
+}
+
+void forgetPixels (OID ID) {
+	writeRecord (&pixelsIndex,ID,NULL,0,0);
+}
+
+
+
+
+/* ----------------- */
+/* Files             */
+/* ----------------- */
+
+/* The stamp of ID's info file.  Returns 0, or -1 */
+static
+int stampFile (OID ID, infoStamp *stamp) {
+FileRep *theFile;
+int result;
+
+	if (! (theFile = newFileRep (ID)) ) return (-1);
+	result = stampPath (theFile->path_info,stamp);
+	freeFileRep (theFile);
+	return (result);
+}
+
+/*
+  Reads ID's FileInfo the long way, stamped with its info file as it was
+  before the read.  Returns 0, or -1.
+*/
+static
+int readFileInfo (OID ID, fileRecord *rec) {
+FileRep *theFile;
+
+	if (! (theFile = newFileRep (ID)) ) return (-1);
+	memset (rec,0,sizeof (*rec));
+	if (stampPath (theFile->path_info,&rec->stamp) < 0 || GetFileInfo (theFile) < 0) {
+		freeFileRep (theFile);
+		return (-1);
+	}
+	rec->present = 1;
+	rec->size = theFile->size_rep;
+	rec->info = theFile->file_info;
+	freeFileRep (theFile);
+	return (0);
+}
+
+/*
+  ID's FileInfo and length, from the index if they're there and its info
+  file hasn't changed since, otherwise from the file's own info, after
+  which the index has them too.  Returns 0, or -1 if there is no such
+  file.  The aliases themselves aren't kept; callers that need them,
+  when nAliases isn't 0, still read them.
+*/
+int indexedFile (OID ID, FileInfo *info, u_int64_t *size) {
+fileRecord rec;
+infoStamp stamp;
+u_int32_t seq;
+
+	if (readRecord (&filesIndex,ID,&rec,&seq) < 0 || stampFile (ID,&stamp) < 0 ||
+		memcmp (&rec.stamp,&stamp,sizeof (stamp))) {
+		if (readFileInfo (ID,&rec) < 0) return (-1);
+		writeRecord (&filesIndex,ID,&rec,1,seq);
+	}
+	*info = rec.info;
+	*size = rec.size;
+	return (0);
+}
+
+/*
+  Records a file UploadFile has just stored.  If it is an alias, the
+  original has one more alias than its record says, so that is cleared.
+*/
+void indexFile (OID ID) {
+fileRecord rec;
+
+	if (readFileInfo (ID,&rec) < 0) return;
+	writeRecord (&filesIndex,ID,&rec,0,0);
+	if (rec.info.isAlias) writeRecord (&filesIndex,rec.info.isAlias,NULL,0,0);
+}
+
+/*
+  Clears ID's record, and those of the files whose aliases it changes:
+  its original, if it is an alias, and its own aliases.  Called before
+  ExpungeFile, while those can still be read, and again after it.
+*/
+void forgetFile (OID ID) {
+FileRep *theFile;
+unsigned long i;
+
+	writeRecord (&filesIndex,ID,NULL,0,0);
+	if (! (theFile = newFileRep (ID)) ) return;
+	if (GetFileInfo (theFile) == 0 && GetFileAliases (theFile) == 0) {
+		if (theFile->file_info.isAlias) writeRecord (&filesIndex,theFile->file_info.isAlias,NULL,0,0);
+		for (i = 0; i < theFile->file_info.nAliases; i++)
+			writeRecord (&filesIndex,theFile->aliases[i].ID,NULL,0,0);
+	}
+	freeFileRep (theFile);
+}
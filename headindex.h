@@ -0,0 +1,86 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifndef headindex_h
+#define headindex_h
+
+#include "Pixels.h"
+#include "File.h"
+
+/*
+  Repository header index.  Pixels/header.idx and Files/header.idx hold
+  a copy of each object's header, one fixed-size record per ID at
+  ID * record size: the pixHeader for Pixels, the FileInfo and length
+  for Files.  Both are mapped shared, so PixelsInfo, PixelsSHA1,
+  FileInfo, FileSHA1 and out-of-range coordinates can be answered with
+  a stat of the object's info file rather than opening and reading it;
+  in server mode the mapping lasts as long as the worker.
+
+  The records are kept by the dispatcher: NewPixels, FinishPixels and
+  UploadFile write them, DeletePixels and DeleteFile clear them.  purge
+  and updateOMEIS change objects without it, so each record also holds
+  the device, inode, size, mtime and ctime of the object's info file as
+  it was when the record was read, and a lookup only uses the record if
+  a stat of that file still gives the same.  A record that isn't there
+  (an older repository, or one cleared since) or no longer matches is
+  filled in again the first time it is read the long way.
+
+  Each record starts with a sequence number that is odd while the record
+  is being written.  Writers hold an flock on the index and bump it on
+  either side of the write; readers copy the record and retry if the
+  number changed under them, so they never see half a header and never
+  take a lock.  A record is only filled in from disk if its number is
+  still the one seen before the disk was read, so a fill can't bring
+  back a header that was changed or cleared in between.
+*/
+
+#define HEADINDEX_MAGIC       "OMEH"
+#define HEADINDEX_VERSION     2
+#define HEADINDEX_PIXELS      "Pixels/header.idx"
+#define HEADINDEX_FILES       "Files/header.idx"
+
+/* The file grows by this many records at a time */
+#define HEADINDEX_GROW        4096
+
+typedef struct {
+	char magic[4];
+	u_int32_t version;
+	u_int32_t recordSize;
+	u_int32_t reserved;
+} headIndexHeader;
+
+int indexedPixels (OID ID, pixHeader *head);
+int indexedFile (OID ID, FileInfo *info, u_int64_t *size);
+int indexedCoords (OID ID, pixHeader *head, ome_coord theX, ome_coord theY, ome_coord theZ, ome_coord theC, ome_coord theT);
+void indexPixels (OID ID, pixHeader *head);
+void indexFile (OID ID);
+void forgetPixels (OID ID);
+void forgetFile (OID ID);
+
+#endif
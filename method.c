@@ -39,72 +39,237 @@
 #endif  /* HAVE_CONFIG_H */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <assert.h>
 
+#include "OMEIS_Error.h"
+#include "cgi.h"
 #include "method.h"
 
-unsigned int
-get_method_by_name(char * m_name)
+/*
+  The method table, kept sorted by name (strcmp order) so that a lookup is
+  a binary search: at most six comparisons instead of walking every name.
+  Each entry declares the parameters the method requires and, for the
+  Get/Set methods, the extent of the pixels they move.
+*/
+static const method_entry methods[] = {
+	{"Composite",     M_COMPOSITE,      MP_PIXELSID,                MIO_NONE},
+	{"Convert",       M_CONVERT,        MP_PIXELSID | MP_FILEID,    MIO_NONE},
+	{"ConvertPlane",  M_CONVERTPLANE,   MP_PIXELSID | MP_FILEID,    MIO_NONE},
+	{"ConvertRows",   M_CONVERTROWS,    MP_PIXELSID | MP_FILEID,    MIO_NONE},
+	{"ConvertStack",  M_CONVERTSTACK,   MP_PIXELSID | MP_FILEID,    MIO_NONE},
+	{"ConvertTIFF",   M_CONVERTTIFF,    MP_PIXELSID | MP_FILEID,    MIO_NONE},
+	{"DeleteFile",    M_DELETEFILE,     MP_FILEID,                  MIO_NONE},
+	{"DeletePixels",  M_DELETEPIXELS,   MP_PIXELSID,                MIO_NONE},
+	{"ExportOMEfile", M_EXPORTOMEFILE,  0,                          MIO_NONE},
+	{"FileInfo",      M_FILEINFO,       MP_FILEID,                  MIO_NONE},
+	{"FileSHA1",      M_FILESHA1,       MP_FILEID,                  MIO_NONE},
+	{"FinishPixels",  M_FINISHPIXELS,   MP_PIXELSID,                MIO_NONE},
+	{"GetLocalPath",  M_GETLOCALPATH,   0,                          MIO_NONE},
+	{"GetPixels",     M_GETPIXELS,      MP_PIXELSID,                MIO_PIXELS},
+	{"GetPlane",      M_GETPLANE,       MP_PIXELSID,                MIO_PLANE},
+	{"GetPlaneHist",  M_GETPLANESHIST,  MP_PIXELSID,                MIO_NONE},
+	{"GetPlaneStats", M_GETPLANESSTATS, MP_PIXELSID,                MIO_NONE},
+	{"GetPlanes",     M_GETPLANES,      MP_PIXELSID,                MIO_NONE},
+	{"GetProjection", M_GETPROJECTION,  MP_PIXELSID,                MIO_NONE},
+	{"GetROI",        M_GETROI,         MP_PIXELSID,                MIO_NONE},
+	{"GetRows",       M_GETROWS,        MP_PIXELSID,                MIO_ROWS},
+	{"GetStack",      M_GETSTACK,       MP_PIXELSID,                MIO_STACK},
+	{"GetStackHist",  M_GETSTACKHIST,   MP_PIXELSID,                MIO_NONE},
+	{"GetStackStats", M_GETSTACKSTATS,  MP_PIXELSID,                MIO_NONE},
+	{"GetThumb",      M_GETTHUMB,       MP_PIXELSID,                MIO_NONE},
+	{"ImportOMEfile", M_IMPORTOMEFILE,  MP_FILEID,                  MIO_NONE},
+	{"IsOMExml",      M_ISOMEXML,       MP_FILEID,                  MIO_NONE},
+	{"NewPixels",     M_NEWPIXELS,      0,                          MIO_NONE},
+	{"Pixels",        M_PIXELS,         MP_PIXELSID,                MIO_NONE},
+	{"PixelsInfo",    M_PIXELSINFO,     MP_PIXELSID,                MIO_NONE},
+	{"PixelsSHA1",    M_PIXELSSHA1,     MP_PIXELSID,                MIO_NONE},
+	{"Plane",         M_PLANE,          MP_PIXELSID,                MIO_NONE},
+	{"ReadFile",      M_READFILE,       MP_FILEID,                  MIO_NONE},
+	{"SetPixels",     M_SETPIXELS,      MP_PIXELSID | MP_PIXELS_IN, MIO_PIXELS},
+	{"SetPlane",      M_SETPLANE,       MP_PIXELSID | MP_PIXELS_IN, MIO_PLANE},
+	{"SetROI",        M_SETROI,         MP_PIXELSID | MP_PIXELS_IN, MIO_NONE},
+	{"SetRows",       M_SETROWS,        MP_PIXELSID | MP_PIXELS_IN, MIO_ROWS},
+	{"SetStack",      M_SETSTACK,       MP_PIXELSID | MP_PIXELS_IN, MIO_STACK},
+	{"Stack",         M_STACK,          MP_PIXELSID,                MIO_NONE},
+	{"UploadFile",    M_UPLOADFILE,     0,                          MIO_NONE},
+	{"ZipFiles",      M_ZIPFILES,       0,                          MIO_NONE},
+};
+
+#define NUM_METHODS (sizeof (methods) / sizeof (method_entry))
+
+static int
+compare_method(const void *key, const void *entry)
+{
+	return strcmp((const char *) key, ((const method_entry *) entry)->name);
+}
+
+const method_entry *
+get_method_entry(const char * m_name)
 {
 	/* Sanity check (FATAL) */
 	assert(m_name != NULL);
 
-	/* Pixels comparisions */
-	if (strcmp(m_name, "Pixels") == 0) return M_PIXELS;
-	if (strcmp(m_name, "NewPixels") == 0) return M_NEWPIXELS;
-	if (strcmp(m_name, "PixelsInfo") == 0) return M_PIXELSINFO;
-	if (strcmp(m_name, "PixelsSHA1") == 0) return M_PIXELSSHA1;
-	if (strcmp(m_name, "SetPixels") == 0) return M_SETPIXELS;
-	if (strcmp(m_name, "GetPixels") == 0) return M_GETPIXELS;
-	if (strcmp(m_name, "FinishPixels") == 0) return M_FINISHPIXELS;
-	if (strcmp(m_name, "Convert") == 0) return M_CONVERT;
-	if (strcmp(m_name, "DeletePixels") == 0) return M_DELETEPIXELS;
-	
-
-	/* Row comparisions */
-	if (strcmp(m_name, "SetRows") == 0) return M_SETROWS;
-	if (strcmp(m_name, "GetRows") == 0) return M_GETROWS;
-	if (strcmp(m_name, "ConvertRows") == 0) return M_CONVERTROWS;
-
-	/* Plane comparisions */
-	if (strcmp(m_name, "Plane") == 0) return M_PLANE;
-	if (strcmp(m_name, "SetPlane") == 0) return M_SETPLANE;
-	if (strcmp(m_name, "GetPlane") == 0) return M_GETPLANE;
-	if (strcmp(m_name, "GetPlaneStats") == 0) return M_GETPLANESSTATS;
-	if (strcmp(m_name, "GetPlaneHist") == 0) return M_GETPLANESHIST;
-	if (strcmp(m_name, "ConvertPlane") == 0) return M_CONVERTPLANE;
-	if (strcmp(m_name, "ConvertTIFF") == 0) return M_CONVERTTIFF;
-	
-	/* Stack comparisions */
-	if (strcmp(m_name, "Stack") == 0) return M_STACK;
-	if (strcmp(m_name, "SetStack") == 0) return M_SETSTACK;
-	if (strcmp(m_name, "GetStack") == 0) return M_GETSTACK;
-	if (strcmp(m_name, "GetStackStats") == 0) return M_GETSTACKSTATS;
-	if (strcmp(m_name, "GetStackHist") == 0) return M_GETSTACKHIST;
-	if (strcmp(m_name, "ConvertStack") == 0) return M_CONVERTSTACK;
-
-	/* ROI comparisions */
-	if (strcmp(m_name, "SetROI") == 0) return M_SETROI;
-	if (strcmp(m_name, "GetROI") == 0) return M_GETROI;
-
-	/* File comparisions */
-	if (strcmp(m_name, "FileSHA1") == 0) return M_FILESHA1;
-	if (strcmp(m_name, "FileInfo") == 0) return M_FILEINFO;
-	if (strcmp(m_name, "ReadFile") == 0) return M_READFILE;
-	if (strcmp(m_name, "UploadFile") == 0) return M_UPLOADFILE;
-	if (strcmp(m_name, "DeleteFile") == 0) return M_DELETEFILE;
-	if (strcmp(m_name, "ZipFiles") == 0) return M_ZIPFILES;
-
-	/* Utility/other comparisons */
-	if (strcmp(m_name, "GetLocalPath") == 0) return M_GETLOCALPATH;
-	if (strcmp(m_name, "ImportOMEfile") == 0) return M_IMPORTOMEFILE;
-	if (strcmp(m_name, "ExportOMEfile") == 0) return M_EXPORTOMEFILE;
-	if (strcmp(m_name, "Composite") == 0) return M_COMPOSITE;
-	if (strcmp(m_name, "GetThumb") == 0) return M_GETTHUMB;
-	if (strcmp(m_name, "IsOMExml") == 0) return M_ISOMEXML;
+	return (const method_entry *)
+		bsearch(m_name, methods, NUM_METHODS, sizeof (method_entry), compare_method);
+}
+
+unsigned int
+get_method_by_name(char * m_name)
+{
+	const method_entry *entry = get_method_entry(m_name);
 
 	/* fprintf(stderr, "Unknown method '%s'.\n", m_name); */
-	return 0;  /* Unknown method */
+	return entry ? entry->m_val : 0;  /* 0: Unknown method */
+}
+
+/*
+  The parameters get_method_params() picks out, sorted by name (strcmp
+  order) for a binary search.  lower marks the ones whose values are
+  lower-cased, as get_lc_param() does.
+*/
+typedef struct {
+	const char *name;
+	int which;
+	char lower;
+} param_name;
+
+static const param_name param_names[] = {
+	{"Axis",          MPV_AXIS,          1},
+	{"BigEndian",     MPV_BIGENDIAN,     1},
+	{"Chunks",        MPV_CHUNKS,        0},
+	{"Compression",   MPV_COMPRESSION,   0},
+	{"Dims",          MPV_DIMS,          0},
+	{"File",          MPV_FILE,          0},
+	{"FileID",        MPV_FILEID,        0},
+	{"Force",         MPV_FORCE,         0},
+	{"Format",        MPV_FORMAT,        1},
+	{"IsFloat",       MPV_ISFLOAT,       1},
+	{"IsLocalFile",   MPV_ISLOCALFILE,   1},
+	{"IsSigned",      MPV_ISSIGNED,      1},
+	{"Length",        MPV_LENGTH,        0},
+	{"Level",         MPV_LEVEL,         0},
+	{"Method",        MPV_METHOD,        0},
+	{"Offset",        MPV_OFFSET,        0},
+	{"Operator",      MPV_OPERATOR,      1},
+	{"Pixels",        MPV_PIXELS,        0},
+	{"PixelsID",      MPV_PIXELSID,      0},
+	{"Planes",        MPV_PLANES,        0},
+	{"Pyramid",       MPV_PYRAMID,       1},
+	{"ROI",           MPV_ROI,           0},
+	{"Range",         MPV_RANGE,         0},
+	{"Size",          MPV_SIZE,          0},
+	{"TIFFDirIndex",  MPV_TIFFDIRINDEX,  0},
+	{"Threads",       MPV_THREADS,       0},
+	{"UploadSize",    MPV_UPLOADSIZE,    0},
+	{"nRows",         MPV_NROWS,         0},
+	{"theC",          MPV_THEC,          0},
+	{"theT",          MPV_THET,          0},
+	{"theY",          MPV_THEY,          0},
+	{"theZ",          MPV_THEZ,          0},
+};
+
+#define NUM_PARAM_NAMES (sizeof (param_names) / sizeof (param_name))
+
+static int
+compare_param(const void *key, const void *entry)
+{
+	return strcmp((const char *) key, ((const param_name *) entry)->name);
 }
 
+/*
+  Parses the request's parameters in a single pass over its name/value
+  pairs: the method, which is looked up, the ones shared by most methods,
+  which are converted and checked against what the method requires, and
+  the rest, which are kept as they are in params->values.  As with
+  get_param(), the first of a repeated parameter counts.  Errors are
+  reported here; returns -1 if the request can't go ahead.
+*/
+int
+get_method_params(char **param, method_params *params)
+{
+	const method_entry *entry;
+	const param_name *name;
+	char *theParam, *p;
+	unsigned long long scan_ID;
+	int i;
+
+	memset (params, 0, sizeof (method_params));
+	params->theZ = params->theC = params->theT = params->theY = -1;
+	params->iam_BigEndian = 1;
+
+	for (i = 0; param[i] && param[i+1]; i += 2) {
+		name = (const param_name *)
+			bsearch(param[i], param_names, NUM_PARAM_NAMES, sizeof (param_name), compare_param);
+		if (!name || params->values[name->which]) continue;
+		params->values[name->which] = param[i+1];
+		if (name->lower)
+			for (p = param[i+1]; *p; p++) *p = tolower ((unsigned char) *p);
+	}
+
+	if (! (params->method = params->values[MPV_METHOD]) ) {
+		OMEIS_ReportError ("OMEIS", NULL, (OID)0, "Method parameter missing");
+		return (-1);
+	}
+
+	/* Trap for inputed method name strings that don't correspond to implemented methods */
+	if (! (params->entry = entry = get_method_entry (params->method)) ) {
+		OMEIS_ReportError (params->method, NULL, (OID)0, "Method doesn't exist");
+		return (-1);
+	}
+
+	if ( (theParam = params->values[MPV_PIXELSID]) ) {
+		sscanf (theParam,"%llu",&scan_ID);
+		params->pixelsID = (OID) scan_ID;
+		if (params->pixelsID <= 0) {
+			OMEIS_ReportError ((char *) entry->name, NULL, params->pixelsID, "PixelsID must be positive.");
+			return (-1);
+		}
+	} else if (entry->required & MP_PIXELSID) {
+		OMEIS_ReportError ((char *) entry->name, NULL, (OID)0, "PixelsID Parameter missing");
+		return (-1);
+	}
+
+	if ( (theParam = params->values[MPV_FILEID]) ) {
+		sscanf (theParam,"%llu",&scan_ID);
+		params->fileID = (OID) scan_ID;
+	} else if (entry->required & MP_FILEID) {
+		OMEIS_ReportError ((char *) entry->name, NULL, params->pixelsID, "FileID must be specified!");
+		return (-1);
+	}
+
+	if ( (entry->required & MP_PIXELS_IN) && !params->values[MPV_PIXELS] )
+		OMEIS_ReportError ((char *) entry->name, "PixelsID", params->pixelsID, "No pixels specified");
+
+	if ( (theParam = params->values[MPV_ISLOCALFILE]) ) {
+		if ( !strcmp (theParam,"true") || !strcmp (theParam,"1") ) params->isLocalFile = 1;
+	}
+
+	if ( (theParam = params->values[MPV_THEZ]) )
+		sscanf (theParam,"%d",&params->theZ);
+
+	if ( (theParam = params->values[MPV_THEC]) )
+		sscanf (theParam,"%d",&params->theC);
+
+	if ( (theParam = params->values[MPV_THET]) )
+		sscanf (theParam,"%d",&params->theT);
+
+	if ( (theParam = params->values[MPV_THEY]) )
+		sscanf (theParam,"%d",&params->theY);
+
+	if ( (theParam = params->values[MPV_LEVEL]) ) {
+		sscanf (theParam,"%d",&params->level);
+		if (params->level < 0) {
+			OMEIS_ReportError ((char *) entry->name, "PixelsID", params->pixelsID, "Level must not be negative.");
+			return (-1);
+		}
+	}
+
+	if ( (theParam = params->values[MPV_BIGENDIAN]) ) {
+		if (!strcmp (theParam,"0") || !strcmp (theParam,"false") ) params->iam_BigEndian=0;
+	}
+
+	return (0);
+}
@@ -34,11 +34,72 @@
  *------------------------------------------------------------------------------
  */
 
+#ifndef method_h
+#define method_h
+
+#include "Pixels.h"
+
+/* PARAMETER SCHEMA */
+
+	/* Parameters a method can't do without */
+#define MP_PIXELSID     0x01  /* PixelsID */
+#define MP_FILEID       0x02  /* FileID (a single one) */
+#define MP_PIXELS_IN    0x04  /* Pixels: the pixels a Set method writes */
+
+	/* Extent of the pixel I/O done by the Get/Set methods */
+#define MIO_NONE        0
+#define MIO_PIXELS      1
+#define MIO_STACK       2
+#define MIO_PLANE       3
+#define MIO_ROWS        4
+
+typedef struct {
+	const char *name;
+	unsigned int m_val;
+	unsigned int required;   /* MP_ flags */
+	unsigned int io;         /* MIO_ extent */
+} method_entry;
+
+/*
+  Every parameter dispatch() and the methods it hands method_params to
+  look at.  They are all picked out of the request in one pass; the
+  value of one that wasn't given is NULL.
+*/
+enum {
+	MPV_AXIS, MPV_BIGENDIAN, MPV_CHUNKS, MPV_COMPRESSION, MPV_DIMS,
+	MPV_FILE, MPV_FILEID, MPV_FORCE, MPV_FORMAT, MPV_ISFLOAT,
+	MPV_ISLOCALFILE, MPV_ISSIGNED, MPV_LENGTH, MPV_LEVEL, MPV_METHOD,
+	MPV_OFFSET, MPV_OPERATOR, MPV_PIXELS, MPV_PIXELSID, MPV_PLANES,
+	MPV_PYRAMID, MPV_ROI, MPV_RANGE, MPV_SIZE, MPV_TIFFDIRINDEX,
+	MPV_THREADS, MPV_UPLOADSIZE, MPV_NROWS, MPV_THEC, MPV_THET,
+	MPV_THEY, MPV_THEZ,
+	MPV_NUM
+};
+
+/* Request parameters, parsed once per request */
+typedef struct {
+	const method_entry *entry;
+	char *method;
+	OID pixelsID;
+	OID fileID;
+	ome_coord theZ, theC, theT, theY;
+	int level;               /* resolution level, 0 = full */
+	char iam_BigEndian;
+	unsigned char isLocalFile;
+	char *values[MPV_NUM];   /* as given, or lower-cased where get_lc_param() would */
+} method_params;
+
 /* METHOD RETRIEVAL FUNCTIONS */
 
+const method_entry *
+get_method_entry(const char * m_name);
+
 unsigned int
 get_method_by_name(char * m_name);
 
+int
+get_method_params(char **param, method_params *params);
+
 /* SUPPORTED CGI METHODS */
 
 	/* PIXELS METHODS */
@@ -65,6 +126,8 @@ get_method_by_name(char * m_name);
 #define M_CONVERTPLANE  24
 #define M_CONVERTTIFF   25
 #define M_GETPLANESHIST 26  
+#define M_GETPLANES     27
+#define M_GETPROJECTION 28
 
 	/* STACK METHODS */
 #define M_STACK         30
@@ -94,3 +157,4 @@ get_method_by_name(char * m_name);
 #define M_GETTHUMB      64
 #define M_ISOMEXML      65
 
+#endif
@@ -57,15 +57,111 @@
 #include "cgi.h"
 #include "method.h"
 #include "composite.h"
-#include "xmlBinaryResolution.h"
-#include "xmlBinaryInsertion.h"
+#include "omexml.h"
+#include "filedigest.h"
+#include "fileinfo.h"
+#include "headindex.h"
 #include "xmlIsOME.h"
 #include "archive.h"
+#include "server.h"
+#include "stream.h"
+#include "range.h"
+#include "planes.h"
+#include "projection.h"
+#include "render.h"
+#include "binstats.h"
+#include "thumbcache.h"
+#include "convert.h"
+#include "pixswap.h"
+#include "chunked.h"
+#include "pyramid.h"
+#include "roiio.h"
+#include "pixread.h"
 
 #ifndef OMEIS_ROOT
 #define OMEIS_ROOT "."
 #endif
 
+/* Byte ranges of a repository file (ReadFile) */
+typedef struct {
+	int fd;
+	size_t offset;
+	u_int8_t *buf;
+} fileRange;
+
+static
+int sendFileRange (void *ctx, u_int64_t offset, u_int64_t length) {
+fileRange *theRange = (fileRange *) ctx;
+
+	if (theRange->fd >= 0)
+		return (streamFD (stdout,theRange->fd,theRange->offset+offset,length) == (ssize_t)length ? 0 : -1);
+	return (fwrite (theRange->buf + theRange->offset + offset,1,length,stdout) == length ? 0 : -1);
+}
+
+/*
+  Byte ranges of a pixel stream (GetPixels, GetStack, GetPlane, GetRows).
+  Returns -1 if the range couldn't all be sent.
+*/
+typedef struct {
+	PixelsRep *thePixels;
+	size_t offset;
+	int swap;
+} pixelsRange;
+
+static
+int sendPixelsRange (void *ctx, u_int64_t offset, u_int64_t length) {
+pixelsRange *theRange = (pixelsRange *) ctx;
+PixelsRep *thePixels = theRange->thePixels;
+size_t bp = thePixels->head->bp, firstPix, lastPix, nPix;
+FILE *filter, *swapper = NULL;
+long long nRead;
+int rc;
+
+	/* Read whole pixels, and let the filter trim the partial ones at either end */
+	firstPix = offset / bp;
+	lastPix = (offset + length - 1) / bp;
+	if (! (filter = openRangeFilter (stdout,offset % bp,length)) ) return (-1);
+	if (theRange->swap && ! (swapper = openSwapWriter (filter,bp)) ) {
+		fclose (filter);
+		return (-1);
+	}
+
+	thePixels->IO_stream = swapper ? swapper : filter;
+	nPix = lastPix - firstPix + 1;
+	if ( (nRead = readPixels (thePixels, theRange->offset + firstPix*bp, nPix, thePixels->IO_stream)) < 0)
+		nRead = DoPixelIO (thePixels, theRange->offset + firstPix*bp, nPix, 'r');
+	rc = nRead == (long long) nPix ? 0 : -1;
+	if (swapper && fclose (swapper) != 0) rc = -1;
+	if (fclose (filter) != 0) rc = -1;
+	thePixels->IO_stream = stdout;
+
+	return (rc);
+}
+
+
+/*
+  Points thePixels->IO_stream at the client: stdout for reads, in for
+  writes, with a swap filter in between if the client's byte order isn't
+  ours.  closePixelsStream() takes the filter away again after the I/O.
+*/
+static
+int openPixelsStream (PixelsRep *thePixels, char rorw, FILE *in, int swap) {
+FILE *stream = rorw == 'w' ? in : stdout;
+
+	if (swap && stream) {
+		if (rorw == 'w') stream = openSwapReader (stream,thePixels->head->bp);
+		else stream = openSwapWriter (stream,thePixels->head->bp);
+		if (!stream) return (-1);
+	}
+	thePixels->IO_stream = stream;
+	return (0);
+}
+
+static
+void closePixelsStream (PixelsRep *thePixels, char rorw, FILE *in, int swap) {
+	if (swap && thePixels->IO_stream) fclose (thePixels->IO_stream);
+	thePixels->IO_stream = rorw == 'w' ? in : stdout;
+}
 
 static
 int
@@ -73,16 +169,25 @@ dispatch (char **param)
 {
 	PixelsRep *thePixels;
 	FileRep *theFile;
-	pixHeader *head;
+	pixHeader *head, indexHead;
 	size_t nPix=0, nIO=0;
 	char *theParam,rorw='r',iam_BigEndian=1;
 	OID ID=0,resultID;
 	size_t offset=0, file_offset=0;
-	unsigned long long scan_off, scan_length, scan_ID;
+	unsigned long long scan_off, scan_length;
 	unsigned char isLocalFile=0;
 	char *dims;
 	int isSigned,isFloat;
 	int numInts,numX,numY,numZ,numC,numT,numB;
+	int chunkX,chunkY,chunkZ;
+	int rendered;
+	int inRange = 1;
+	long nRows = 1;
+	int binCompression, nThreads;
+	FileInfo indexInfo;
+	u_int64_t indexSize;
+	long long nRead;
+	int level, levelX, levelY;
 	int force,result;
 	int fd;
 	unsigned long z,dz,c,dc,t,dt;
@@ -92,9 +197,12 @@ dispatch (char **param)
 	unsigned long length;
 	OID fileID;
 	struct stat fStat;
-	FILE *file;
+	FILE *file, *inStream = NULL;
+	int swap = 0;
 	char file_path[MAXPATHLEN],file_path2[MAXPATHLEN];
 	unsigned long tiffDir=0;
+	byteRange ranges[MAX_BYTE_RANGES];
+	int nRanges;
 	int i;
 
 	/* Co-ordinates */
@@ -115,67 +223,27 @@ dispatch (char **param)
 
 	/* XXX: char * method should be able to disappear at some point */
 	char *method;
+	const method_entry *m_entry;
+	method_params m_params;
 	unsigned int m_val;
 
 
-	if (! (method = get_param (param,"Method")) ) {
-		OMEIS_ReportError ("OMEIS", NULL, ID, "Method parameter missing");
+	/* The method, and every parameter it may look at, in one pass */
+	if (get_method_params (param, &m_params) < 0)
 		return (-1);
-	}
-
-	m_val = get_method_by_name(method);
-	/* Trap for inputed method name strings that don't correspond to implemented methods */
-	if (m_val == 0){
-			OMEIS_ReportError (method, NULL, ID, "Method doesn't exist");
-			return (-1);
-	}
-
-	/* END (method operations) */
-
-	/* ID requirements */
-	if ( (theParam = get_param (param,"PixelsID")) ) {
-		sscanf (theParam,"%llu",&scan_ID);
-		ID = (OID) scan_ID;
-		if (ID <= 0) {
-			OMEIS_ReportError (method, NULL, ID, "PixelsID must be positive.");
-			return (-1);
-		}
-	} else if (m_val != M_NEWPIXELS   &&
-			 m_val != M_FILEINFO      &&
-			 m_val != M_FILESHA1      &&
-			 m_val != M_READFILE      &&
-			 m_val != M_UPLOADFILE    &&
-			 m_val != M_IMPORTOMEFILE &&
-			 m_val != M_EXPORTOMEFILE &&
-			 m_val != M_ISOMEXML      &&
-			 m_val != M_DELETEFILE    &&
-			 m_val != M_GETLOCALPATH  &&
-		         m_val != M_ZIPFILES) {
-			OMEIS_ReportError (method, NULL, ID, "PixelsID Parameter missing");
-			return (-1);
-	}
-
-	if ((theParam = get_lc_param(param,"IsLocalFile"))) {
-		if ( !strcmp (theParam,"true") || !strcmp (theParam,"1") ) isLocalFile = 1;
-	} else
-		isLocalFile = 0;
-
-
-	if ( (theParam = get_param (param,"theZ")) )
-		sscanf (theParam,"%d",&theZ);
-
-	if ( (theParam = get_param (param,"theC")) )
-		sscanf (theParam,"%d",&theC);
-
-	if ( (theParam = get_param (param,"theT")) )
-		sscanf (theParam,"%d",&theT);
-
-	if ( (theParam = get_param (param,"theY")) )
-		sscanf (theParam,"%d",&theY);
-
-	if ( (theParam = get_lc_param (param,"BigEndian")) ) {
-		if (!strcmp (theParam,"0") || !strcmp (theParam,"false") ) iam_BigEndian=0;
-	}
+	method = m_params.method;
+	m_entry = m_params.entry;
+	m_val = m_entry->m_val;
+
+	ID = m_params.pixelsID;
+	fileID = m_params.fileID;
+	theZ = m_params.theZ;
+	theC = m_params.theC;
+	theT = m_params.theT;
+	theY = m_params.theY;
+	level = m_params.level;
+	iam_BigEndian = m_params.iam_BigEndian;
+	isLocalFile = m_params.isLocalFile;
 
 	/* ---------------------- */
 	/* SIMPLE METHOD DISPATCH */
@@ -184,7 +252,7 @@ dispatch (char **param)
 			isSigned = 0;
 			isFloat = 0;
 
-			if (! (dims = get_param (param,"Dims")) ) {
+			if (! (dims = m_params.values[MPV_DIMS]) ) {
 				OMEIS_ReportError (method, NULL, ID, "Dims Parameter missing");
 				return (-1);
 			}
@@ -195,14 +263,14 @@ dispatch (char **param)
 				return (-1);
 			}
 
-			if ( (theParam = get_lc_param (param,"IsFloat")) ) {
+			if ( (theParam = m_params.values[MPV_ISFLOAT]) ) {
 				if (!strcmp (theParam,"1") || !strcmp (theParam,"true") ) {
 					isFloat  = 1;
 					isSigned = 1;
 				}
 			}
 
-			if ( (theParam = get_lc_param (param,"IsSigned")) ) {
+			if ( (theParam = m_params.values[MPV_ISSIGNED]) ) {
 				if (!strcmp (theParam,"1") || !strcmp (theParam,"true") ) isSigned=1;
 
 				/* [Bug 536] isFloat=1 and isSigned=0 is not allowed */
@@ -222,10 +290,24 @@ dispatch (char **param)
 				return (-1);
 			}
 
+			chunkX = 0;
+			if ( (theParam = m_params.values[MPV_CHUNKS]) && parseChunkSpec (theParam,numB,&chunkX,&chunkY,&chunkZ) < 0) {
+				OMEIS_ReportError (method, NULL, ID,
+					"Chunks improperly formed.  Expecting XxYxZ, all positive integers, for bricks of at most %d bytes.",CHUNK_MAX_BRICK);
+				return (-1);
+			}
+
 			if (! (thePixels = NewPixels (numX,numY,numZ,numC,numT,numB,isSigned,isFloat)) ) {
 				OMEIS_ReportError (method, NULL, ID, "NewPixels failed.");
 				return (-1);
 			}
+			indexPixels (thePixels->ID,thePixels->head);
+
+			if (chunkX && setChunkSpec (thePixels->ID,chunkX,chunkY,chunkZ) < 0) {
+				OMEIS_ReportError (method, "PixelsID", thePixels->ID, "Could not record chunk layout.");
+				freePixelsRep (thePixels);
+				return (-1);
+			}
 
 			HTTP_ResultType ("text/plain");
 			fprintf (stdout,"%llu\n",(unsigned long long)thePixels->ID);
@@ -235,12 +317,13 @@ dispatch (char **param)
 		case M_PIXELSINFO:
         	if (!ID) return (-1);
 
-			if (! (thePixels = GetPixelsRep (ID,'i',1)) ) {
+			/* The header index answers these without opening the Pixels */
+			if (indexedPixels (ID,&indexHead) < 0) {
 				OMEIS_ReportError (method, "PixelsID", ID, "GetPixelsRep failed.");
 				return (-1);
 			}
 
-			head = thePixels->head;
+			head = &indexHead;
 
 			HTTP_ResultType ("text/plain");
 			fprintf(stdout,"Dims=%d,%d,%d,%d,%d,%hhu\n",
@@ -252,32 +335,29 @@ dispatch (char **param)
 			print_md(head->sha1);
 			fprintf(stdout,"\n");
 
-			freePixelsRep (thePixels);
-
 			break;
 		case M_PIXELSSHA1:
         	if (!ID) return (-1);
 
-			if (! (thePixels = GetPixelsRep (ID,'i',1)) ) {
+			/* The header index answers these without opening the Pixels */
+			if (indexedPixels (ID,&indexHead) < 0) {
 				OMEIS_ReportError (method, "PixelsID", ID, "GetPixelsRep failed.");
 				return (-1);
 			}
 
-			head = thePixels->head;
+			head = &indexHead;
 
 			HTTP_ResultType ("text/plain");
 			print_md(head->sha1);
 			fprintf(stdout,"\n");
 
-			freePixelsRep (thePixels);
-
 			break;
 		case M_FINISHPIXELS:
 			force = 0;
 			result = 0;
 
 			if (!ID) return (-1);
-			if ( (theParam = get_param (param,"Force")) )
+			if ( (theParam = m_params.values[MPV_FORCE]) )
 				sscanf (theParam,"%d",&force);
 
 			if (! (thePixels = GetPixelsRep (ID,'w',iam_BigEndian)) ) {
@@ -292,6 +372,16 @@ dispatch (char **param)
 				freePixelsRep (thePixels);
 				return (-1);
 			} else {
+				/* A match for existing Pixels gets their ID, and these are gone */
+				if (resultID != ID)
+					forgetPixels (ID);
+				else {
+					indexPixels (ID,thePixels->head);
+					/* The Pixels are read-only now, so a chunked copy can't go stale */
+					buildChunkedCopy (thePixels);
+					if ( (theParam = m_params.values[MPV_PYRAMID]) && (!strcmp (theParam,"1") || !strcmp (theParam,"true")) )
+						buildPyramid (thePixels);
+				}
 				HTTP_ResultType ("text/plain");
 				fprintf (stdout,"%llu\n",(unsigned long long)resultID);
 			}
@@ -306,10 +396,15 @@ dispatch (char **param)
 				return (-1);
 			}
 
+			purgeThumbCache (ID);
+			removeChunkedCopy (ID);
+			removePyramid (ID);
 			if (!ExpungePixels (thePixels)) {
 				OMEIS_ReportError (method, "PixelsID", ID, "ExpungePixels failed.");
+				freePixelsRep (thePixels);
 				return (-1);
 			}
+			forgetPixels (ID);
 
 			HTTP_ResultType ("text/plain");
 			fprintf (stdout,"%llu\n",(unsigned long long)thePixels->ID);
@@ -335,6 +430,13 @@ dispatch (char **param)
 			dz = head->dz;
 			dc = head->dc;
 			dt = head->dt;
+			if ( (theParam = m_params.values[MPV_FORMAT]) && !strcmp (theParam,"binary") ) {
+				result = writeBinaryStats (thePixels, param, BS_PLANE_STATS, method);
+				freePixelsRep (thePixels);
+				if (result < 0) return (-1);
+				break;
+			}
+
 			HTTP_ResultType ("text/plain");
 
 			for (t = 0; t < dt; t++)
@@ -372,6 +474,13 @@ dispatch (char **param)
 			dz = head->dz;
 			dc = head->dc;
 			dt = head->dt;
+			if ( (theParam = m_params.values[MPV_FORMAT]) && !strcmp (theParam,"binary") ) {
+				result = writeBinaryStats (thePixels, param, BS_PLANE_HIST, method);
+				freePixelsRep (thePixels);
+				if (result < 0) return (-1);
+				break;
+			}
+
 			HTTP_ResultType ("text/plain");
 			for (t = 0; t < dt; t++)
 				for (c = 0; c < dc; c++)
@@ -404,6 +513,13 @@ dispatch (char **param)
 			dz = head->dz;
 			dc = head->dc;
 			dt = head->dt;
+			if ( (theParam = m_params.values[MPV_FORMAT]) && !strcmp (theParam,"binary") ) {
+				result = writeBinaryStats (thePixels, param, BS_STACK_STATS, method);
+				freePixelsRep (thePixels);
+				if (result < 0) return (-1);
+				break;
+			}
+
 			HTTP_ResultType ("text/plain");
 
 			for (t = 0; t < dt; t++)
@@ -439,6 +555,13 @@ dispatch (char **param)
 			dz = head->dz;
 			dc = head->dc;
 			dt = head->dt;
+			if ( (theParam = m_params.values[MPV_FORMAT]) && !strcmp (theParam,"binary") ) {
+				result = writeBinaryStats (thePixels, param, BS_STACK_HIST, method);
+				freePixelsRep (thePixels);
+				if (result < 0) return (-1);
+				break;
+			}
+
 			HTTP_ResultType ("text/plain");
 
 			for (t = 0; t < dt; t++)
@@ -455,30 +578,29 @@ dispatch (char **param)
 			break;
 		case M_UPLOADFILE:
 			uploadSize = 0;
-			if ( (theParam = get_param (param,"UploadSize")) ) {
+			if ( (theParam = m_params.values[MPV_UPLOADSIZE]) ) {
 				sscanf (theParam,"%llu",&scan_length);
 				uploadSize = (unsigned long)scan_length;
 			} else {
 				OMEIS_ReportError (method, NULL, ID,"UploadSize must be specified!");
 				return (-1);
 			}
-			if ( (ID = UploadFile (get_param (param,"File"),uploadSize,isLocalFile) ) == 0) {
+			/* The same bytes again become an alias of the file that has them */
+			if ( (ID = digestUploadFile (m_params.values[MPV_FILE],uploadSize,isLocalFile) ) == 0) {
 				OMEIS_ReportError (method, NULL, ID, "UploadFile failed.");
 				return (-1);
 			} else {
+				indexFile (ID);
 				HTTP_ResultType ("text/plain");
 				fprintf (stdout,"%llu\n",(unsigned long long)ID);
 			}
 
 			break;
 		case M_GETLOCALPATH:
-			fileID = 0;
-
-			if ( (theParam = get_param (param,"FileID")) ) {
-				sscanf (theParam,"%llu",&scan_ID);
-				fileID = (OID)scan_ID;
+			if (!ID && fileID && isFileList (param)) {
+				if (writeFileInfos (param, FI_PATH, method) < 0) return (-1);
+				break;
 			}
-
 			if (ID) {
 				if (! (thePixels = GetPixelsRep (ID,'i',bigEndian())) ) {
 					OMEIS_ReportError (method, "PixelsID", ID, "GetPixelsRep failed.");
@@ -499,23 +621,19 @@ dispatch (char **param)
 
 			break;
 		case M_DELETEFILE:
-			if ( (theParam = get_param (param,"FileID")) ) {
-				sscanf (theParam,"%llu",&scan_ID);
-				fileID = (OID)scan_ID;
-			} else {
-				OMEIS_ReportError (method, NULL, fileID,"FileID must be specified!");
-				return (-1);
-			}
-
 			if ( !(theFile = GetFileRep (fileID,0,0)) ) {
 				OMEIS_ReportError (method, "FileID", fileID, "GetFileRep failed.");
 				return (-1);
 			}
 
+			/* Before, while its aliases can still be read, and after, in case it was read back meanwhile */
+			forgetFile (fileID);
 			if ( !ExpungeFile (theFile)) {
 				OMEIS_ReportError (method, "FileID", fileID, "ExpungeFile failed.");
+				freeFileRep (theFile);
 				return (-1);
 			}
+			forgetFile (fileID);
 
 			HTTP_ResultType ("text/plain");
 			fprintf (stdout,"%llu\n",(unsigned long long)theFile->ID);
@@ -523,14 +641,20 @@ dispatch (char **param)
 
 			break;
 		case M_FILEINFO:
-			if ( (theParam = get_param (param,"FileID")) ) {
-				sscanf (theParam,"%llu",&scan_ID);
-				fileID = (OID)scan_ID;
-			} else {
-				OMEIS_ReportError (method, NULL, ID,"FileID must be specified!");
-				return (-1);
+			if (isFileList (param)) {
+				if (writeFileInfos (param, FI_INFO, method) < 0) return (-1);
+				break;
+			}
+			/* From the header index, unless there are aliases to list */
+			if (indexedFile (fileID,&indexInfo,&indexSize) == 0 && !indexInfo.nAliases) {
+				HTTP_ResultType ("text/plain");
+				fprintf (stdout,"Name=%s\nLength=%lu\nSHA1=",indexInfo.name,(unsigned long)indexSize);
+				print_md(indexInfo.sha1);
+				printf("\n");
+				if (indexInfo.isAlias)
+					fprintf (stdout,"IsAlias=%llu\n",(unsigned long long)indexInfo.isAlias);
+				break;
 			}
-
 			if ( !(theFile = newFileRep (fileID)) ) {
 				OMEIS_ReportError (method, "FileID", fileID, "Could not make new repository file");
 				return (-1);
@@ -573,46 +697,27 @@ dispatch (char **param)
 
 			break;
 		case M_FILESHA1:
-			if ( (theParam = get_param (param,"FileID")) ) {
-				sscanf (theParam,"%llu",&scan_ID);
-				fileID = (OID)scan_ID;
-			} else {
-				OMEIS_ReportError (method, NULL, fileID,"FileID must be specified!");
-				return (-1);
+			if (isFileList (param)) {
+				if (writeFileInfos (param, FI_SHA1, method) < 0) return (-1);
+				break;
 			}
-
-			if ( !(theFile = newFileRep (fileID)) ) {
-				OMEIS_ReportError (method, "FileID", fileID,"newFileRep failed");
-				return (-1);
-			}
-
-			if (GetFileInfo (theFile) < 0) {
-				freeFileRep (theFile);
+			/* The digest recorded at upload, from the header index */
+			if (indexedFile (fileID,&indexInfo,&indexSize) < 0) {
 				OMEIS_ReportError (method, "FileID", fileID,"Could not get info for repository file");
 				return (-1);
 			}
 
-
 			HTTP_ResultType ("text/plain");
 
 			/* Print our lovely and useful SHA1. */
-			print_md(theFile->file_info.sha1);  /* Convenience provided by digest.c */
+			print_md(indexInfo.sha1);  /* Convenience provided by digest.c */
 			printf("\n");
-			freeFileRep (theFile);
 
 			break;
 		case M_READFILE:
 			offset = 0;
 			length = 0;
 
-			if ( (theParam = get_param (param,"FileID")) ) {
-				sscanf (theParam,"%llu",&scan_ID);
-				fileID = (OID)scan_ID;
-			} else {
-				OMEIS_ReportError (method, NULL, ID,"FileID must be specified!");
-				return (-1);
-			}
-
 			if ( !(theFile = GetFileRep (fileID,offset,length)) ) {
 				OMEIS_ReportError (method, "FileID", fileID, "GetFileRep failed.");
 				return (-1);
@@ -625,12 +730,12 @@ dispatch (char **param)
 			}
 			theFile->size_rep = fStat.st_size;
 
-			if ( (theParam = get_param (param,"Offset")) ) {
+			if ( (theParam = m_params.values[MPV_OFFSET]) ) {
 				sscanf (theParam,"%llu",&scan_off);
 				offset = (size_t)scan_off;
 			}
 
-			if ( (theParam = get_param (param,"Length")) ) {
+			if ( (theParam = m_params.values[MPV_LENGTH]) ) {
 				sscanf (theParam,"%llu",&scan_length);
 				length = (size_t)scan_length;
 			} else {
@@ -640,6 +745,7 @@ dispatch (char **param)
 			/* check if the offset is past EOF */
 			if (offset >= theFile->size_rep) {
 				OMEIS_ReportError (method, "FileID", fileID, "Offset is greater than file's length.");
+				freeFileRep (theFile);
 				return (-1);
 			}
 
@@ -657,25 +763,47 @@ dispatch (char **param)
 				fprintf (stdout,"Content-Disposition: attachment; filename=\"%s\"\r\n",theFile->file_info.name);
 			}
 
-			HTTP_ResultType ("application/octet-stream");
-			fwrite ((u_int8_t *) theFile->file_buf + offset,length,1,stdout);
+			/* An HTTP Range applies to the Offset/Length slice being read */
+			if ( (nRanges = getRequestRanges (length, ranges, MAX_BYTE_RANGES)) < 0) {
+				rangeNotSatisfiable (length);
+				freeFileRep (theFile);
+				break;
+			}
+
+			{
+				fileRange theRange;
+
+				theRange.fd = open (theFile->path_rep, O_RDONLY);
+				theRange.offset = offset;
+				theRange.buf = (u_int8_t *) theFile->file_buf;
+
+				if (nRanges > 0)
+					sendByteRanges (ranges, nRanges, length, "application/octet-stream",
+						sendFileRange, &theRange);
+				else {
+					acceptRanges ();
+					HTTP_ResultType ("application/octet-stream");
+					sendFileRange (&theRange, 0, length);
+				}
+				if (theRange.fd >= 0) close (theRange.fd);
+			}
 			freeFileRep (theFile);
 
 			break;
+		case M_GETPLANES:
+			if (getPlanes (param, &m_params) < 0)
+				return (-1);
+			break;
+		case M_GETPROJECTION:
+			if (getProjection (param, &m_params) < 0)
+				return (-1);
+			break;
 		case M_ZIPFILES:
 		  if (zipFiles(param))
 		    return (-1);
 		  break;
 		
 		case M_IMPORTOMEFILE:
-			if ( (theParam = get_param (param,"FileID")) ) {
-				sscanf (theParam,"%llu",&scan_ID);
-				fileID = (OID)scan_ID;
-			} else {
-				OMEIS_ReportError (method, NULL, ID,"FileID must be specified!");
-				return (-1);
-			}
-
 			strcpy (file_path,"Files/");
 			if (! getRepPath (fileID,file_path,0)) {
 				OMEIS_ReportError (method, "FileID", fileID, "getRepPath failed.");
@@ -683,7 +811,7 @@ dispatch (char **param)
 			}
 
 			/*
-			  libxml2 can directly read gzip files, but not bzip2.
+			  The reader takes gzip files as well as plain ones.
 			  Inflate if bzip2, otherwise parse .gz directly.
 			*/
 			if ( stat (file_path,&fStat) != 0 ) {
@@ -700,59 +828,38 @@ dispatch (char **param)
 				}
 			}
 			HTTP_ResultType ("text/xml");
-			parse_xml_file( file_path );
+			if (importOMEXML (file_path,method) < 0)
+				return (-1);
 
 			break;
 		case M_EXPORTOMEFILE:
 			uploadSize = 0;
-			if ( (theParam = get_param (param,"UploadSize")) ) {
+			if ( (theParam = m_params.values[MPV_UPLOADSIZE]) ) {
 				sscanf (theParam,"%llu",&scan_length);
 				uploadSize = (unsigned long)scan_length;
 			} else {
 				OMEIS_ReportError (method, NULL, ID,"UploadSize must be specified!");
 				return (-1);
 			}
-			if ( (ID = UploadFile (get_param (param,"File"),uploadSize,isLocalFile) ) == 0) {
-				OMEIS_ReportError (method, NULL, (OID)0, "UploadFile failed.");
+			binCompression = OMEXML_BIN_NONE;
+			if ( (theParam = m_params.values[MPV_COMPRESSION]) &&
+				(binCompression = parseBinCompression (theParam)) < 0) {
+				OMEIS_ReportError (method, NULL, (OID)0, "Compression must be 'none', 'zlib' or 'bzip2', not '%s'", theParam);
 				return (-1);
 			}
+			nThreads = 0;
+			if ( (theParam = m_params.values[MPV_THREADS]) )
+				sscanf (theParam,"%d",&nThreads);
 
+			/* Parsed straight from the request, without a copy in Files/ */
 			HTTP_ResultType ("text/plain");
-			strcpy (file_path,"Files/");
-			if (! getRepPath (ID,file_path,0)) {
-				OMEIS_ReportError (method, "FileID", ID, "getRepPath failed.");
+			if (exportOMEXML (m_params.values[MPV_FILE],uploadSize,isLocalFile,iam_BigEndian,
+				binCompression,nThreads,method) < 0)
 				return (-1);
-			}
-
-			xmlInsertBinaryData( file_path, iam_BigEndian );
-			/* This is supposed to parse from STDIN. It works when input
-			is piped in and omeis is ran as a command line program. It
-			reports 'Empty Document' when input is posted on a form and
-			omeis is ran as a cgi.
-			xmlInsertBinaryData( "-", iam_BigEndian );*/
-
-			if ( !(theFile = GetFileRep (ID,0,0)) ) {
-				OMEIS_ReportError (method, "FileID", ID, "GetFileRep failed.");
-				return (-1);
-			}
-			if ( !ExpungeFile (theFile)) {
-				OMEIS_ReportError (method, "FileID", fileID, "ExpungeFile failed.");
-				return (-1);
-			}
-
-			freeFileRep (theFile);
 
 			break;
 
 		case M_ISOMEXML:
-			if ( (theParam = get_param (param,"FileID")) ) {
-				sscanf (theParam,"%llu",&scan_ID);
-				fileID = (OID)scan_ID;
-			} else {
-				OMEIS_ReportError (method, NULL, ID,"FileID must be specified!");
-				return (-1);
-			}
-
 			strcpy (file_path,"Files/");
 			if (! getRepPath (fileID,file_path,0)) {
 				OMEIS_ReportError (method, "FileID", fileID, "getRepPath failed.");
@@ -782,21 +889,13 @@ dispatch (char **param)
 		case M_CONVERTPLANE:
 		case M_CONVERTTIFF:
 		case M_CONVERTROWS:
-			if ( (theParam = get_param (param,"FileID")) ) {
-				sscanf (theParam,"%llu",&scan_ID);
-				fileID = (OID)scan_ID;
-			} else {
-				OMEIS_ReportError (method, "PixelsID", ID,"FileID must be specified!");
-				return (-1);
-			}
-
-			if ( (theParam = get_param (param,"Offset")) ) {
+			if ( (theParam = m_params.values[MPV_OFFSET]) ) {
 				sscanf (theParam,"%llu",&scan_off);
 				file_offset = (size_t)scan_off;
 			}
 
 			tiffDir=0;
-			if ( (theParam = get_param (param,"TIFFDirIndex")) ) {
+			if ( (theParam = m_params.values[MPV_TIFFDIRINDEX]) ) {
 				sscanf (theParam,"%lu",&tiffDir);
 			}
 
@@ -840,7 +939,7 @@ dispatch (char **param)
 			} else if (m_val == M_CONVERTROWS) {
 				long nRows=1;
 
-				if ( (theParam = get_param (param,"nRows")) )
+				if ( (theParam = m_params.values[MPV_NROWS]) )
 					sscanf (theParam,"%ld",&nRows);
 				if (theY < 0 ||theZ < 0 || theC < 0 || theT < 0) {
 					OMEIS_ReportError (method, "PixelsID", ID,"Parameters theY, theZ, theC and theT must be specified to do operations on rows." );
@@ -866,11 +965,16 @@ dispatch (char **param)
 
 			if ( !(theFile = GetFileRep (fileID,0,0)) ) {
 				OMEIS_ReportError (method, "FileID", fileID, "GetFileRep failed.");
+				freePixelsRep (thePixels);
 				return (-1);
 			}
 
 			if (m_val == M_CONVERTTIFF)
 				nIO = ConvertTIFF (thePixels, theFile, theZ, theC, theT, tiffDir, 1);
+			else if (m_val == M_CONVERT)
+				nIO = convertPlanes (thePixels, theFile, file_offset, offset, nPix, -1, -1, iam_BigEndian, m_params.values[MPV_THREADS]);
+			else if (m_val == M_CONVERTSTACK)
+				nIO = convertPlanes (thePixels, theFile, file_offset, offset, nPix, theC, theT, iam_BigEndian, m_params.values[MPV_THREADS]);
 			else
 				nIO = ConvertFile (thePixels, theFile, file_offset, offset, nPix, 1);
 			if (nIO != nPix) {
@@ -882,17 +986,13 @@ dispatch (char **param)
 				return (-1);
 			} else {
 
-				/* compute the Pixel's statistics as appropriate */
+				/* compute the Pixel's statistics as appropriate.
+				   convertPlanes has done them for Convert and ConvertStack,
+				   and convertPlaneStats does them the same way for a plane */
 				switch (m_val) {
-					case M_CONVERT:
-						FinishStats (thePixels, 0);
-						break;
-					case M_CONVERTSTACK:
-						DoStackStats (thePixels, theC, theT);
-						break;
 					case M_CONVERTPLANE:
 					case M_CONVERTTIFF:
-						DoPlaneStats (thePixels, theZ, theC, theT);
+						convertPlaneStats (thePixels, theZ, theC, theT);
 						break;
 				}
 				freePixelsRep (thePixels);
@@ -913,6 +1013,13 @@ dispatch (char **param)
 				return (-1);
 			}
 
+			/* The render engine takes what it can; the rest goes to DoComposite */
+			if ( (rendered = renderComposite (thePixels, theZ, theT, level, param, method)) != RENDER_FALLBACK) {
+				freePixelsRep (thePixels);
+				if (rendered < 0) return (-1);
+				break;
+			}
+
 			if (DoComposite (thePixels, theZ, theT, param) < 0) {
 				OMEIS_ReportError (method, "PixelsID", ID, "Could not generate composite.");
 				freePixelsRep (thePixels);
@@ -922,7 +1029,7 @@ dispatch (char **param)
 			break;
 
 		case M_GETTHUMB:
-			if ( (theParam = get_param (param,"Size")) ) {
+			if ( (theParam = m_params.values[MPV_SIZE]) ) {
 				sscanf (theParam,"%d,%d",&sizeX,&sizeY);
 				if (sizeX <= 0 || sizeY <= 0) {
 					OMEIS_ReportError (method, "PixelsID", ID,"Thumbnail size cannot be zero or negative.");
@@ -930,6 +1037,13 @@ dispatch (char **param)
 				}
 			}
 
+			/* Scaled thumbnails are cached per size */
+			if (sizeX > 0 && sizeY > 0) {
+				if (getCachedThumb (ID,sizeX,sizeY) < 0)
+					return (-1);
+				break;
+			}
+
 			strcpy (file_path,"Pixels/");
 			if (! getRepPath (ID,file_path,0)) {
 				OMEIS_ReportError (method, "PixelsID", ID, "Could not get repository path");
@@ -947,99 +1061,147 @@ dispatch (char **param)
 				return (-1);
 			}
 
-			if ( DoThumb(ID,file,sizeX,sizeY) < 0 ) {
-				OMEIS_ReportError (method, "PixelsID", ID,"Could not get thumbnail at %s",file_path);
-				fclose(file);
-				return (-1);
-			}
+			/* Thumbnails are stored as JPEGs; unscaled ones go out as-is */
+			HTTP_ResultType ("image/jpeg");
+			streamFD (stdout,fileno (file),0,fStat.st_size);
 			fclose(file);
 
-
 			break;
 	} /* END case (method) */
 
 	/* ----------------------- */
 	/* COMPLEX METHOD DISPATCH */
-	if (m_val == M_SETPIXELS || m_val == M_GETPIXELS ||
-		m_val == M_SETROWS   || m_val == M_GETROWS  ||
-		m_val == M_SETPLANE  || m_val == M_GETPLANE  ||
-		m_val == M_SETSTACK  || m_val == M_GETSTACK) {
+	if (m_entry->io != MIO_NONE) {
 		char *filename = NULL;
 		if (!ID) return (-1);
 
 
-		if (strstr (method,"Set")) {
+		if (m_entry->required & MP_PIXELS_IN) {
 			rorw = 'w';
-			if (!(filename = get_param(param,"Pixels"))) {
-				OMEIS_ReportError(method, "PixelsID", ID,"No pixels specified");
-			}
+			filename = m_params.values[MPV_PIXELS];
 		} else rorw = 'r';
 
-		if (! (thePixels = GetPixelsRep (ID,rorw,iam_BigEndian)) ) {
-			OMEIS_ReportError (method, "PixelsID", ID, "GetPixelsRep failed.");
-			return (-1);
-		}
-
-		head = thePixels->head;
-		if (strstr (method,"Pixels")) {
-			nPix = head->dx*head->dy*head->dz*head->dc*head->dt;
-			offset = 0;
-		} else if (strstr (method,"Stack")) {
+		/* Stacks, planes and rows are checked against the header index, so a bad request never opens the Pixels */
+		if (m_entry->io == MIO_STACK) {
 			if (theC < 0 || theT < 0) {
 				OMEIS_ReportError (method, "PixelsID", ID,"Parameters theC and theT must be specified to do operations on stacks." );
-				freePixelsRep (thePixels);
 				return (-1);
 			}
-			nPix = head->dx*head->dy*head->dz;
-			if (!CheckCoords (thePixels, 0, 0, 0, theC, theT)){
-				OMEIS_ReportError (method, "PixelsID", ID,"Parameters theC, theT (%d,%d) must be in range (%d,%d).",theC,theT,head->dc-1,head->dt-1);
-				freePixelsRep (thePixels);
+			if ( (inRange = indexedCoords (ID, &indexHead, 0, 0, 0, theC, theT)) == 0) {
+				OMEIS_ReportError (method, "PixelsID", ID,"Parameters theC, theT (%d,%d) must be in range (%d,%d).",theC,theT,indexHead.dc-1,indexHead.dt-1);
 				return (-1);
 			}
-			offset = GetOffset (thePixels, 0, 0, 0, theC, theT);
-		} else if (strstr (method,"Plane")) {
+		} else if (m_entry->io == MIO_PLANE) {
 			if (theZ < 0 || theC < 0 || theT < 0) {
 				OMEIS_ReportError (method, "PixelsID", ID,"Parameters theZ, theC and theT must be specified to do operations on planes." );
-				freePixelsRep (thePixels);
 				return (-1);
 			}
-			nPix = head->dx*head->dy;
-			if (!CheckCoords (thePixels, 0, 0, theZ, theC, theT)){
-				OMEIS_ReportError (method, "PixelsID", ID,"Parameters theZ, theC, theT (%d,%d,%d) must be in range (%d,%d,%d).",theZ,theC,theT,head->dz-1,head->dc-1,head->dt-1);
-				freePixelsRep (thePixels);
+			if ( (inRange = indexedCoords (ID, &indexHead, 0, 0, theZ, theC, theT)) == 0) {
+				OMEIS_ReportError (method, "PixelsID", ID,"Parameters theZ, theC, theT (%d,%d,%d) must be in range (%d,%d,%d).",theZ,theC,theT,indexHead.dz-1,indexHead.dc-1,indexHead.dt-1);
 				return (-1);
 			}
-			offset = GetOffset (thePixels, 0, 0, theZ, theC, theT);
-		} else if (strstr (method,"Rows")) {
-			long nRows=1;
-			if ( (theParam = get_param (param,"nRows")) )
+		} else if (m_entry->io == MIO_ROWS) {
+			if ( (theParam = m_params.values[MPV_NROWS]) )
 				sscanf (theParam,"%ld",&nRows);
 			if (theY < 0 || theZ < 0 || theC < 0 || theT < 0) {
 				OMEIS_ReportError (method, "PixelsID", ID,"Parameters theY, theZ, theC and theT must be specified to do operations on rows." );
-				freePixelsRep (thePixels);
 				return (-1);
 			}
-			if (!CheckCoords (thePixels, 0, theY, theZ, theC, theT)){
+			if ( (inRange = indexedCoords (ID, &indexHead, 0, theY, theZ, theC, theT)) == 0) {
 				OMEIS_ReportError (method, "PixelsID", ID,"Parameters theY, theZ, theC, theT (%d,%d,%d,%d) must be in range (%d,%d,%d,%d).",
-					theY,theZ,theC,theT,head->dy-1,head->dz-1,head->dc-1,head->dt-1);
-				freePixelsRep (thePixels);
+					theY,theZ,theC,theT,indexHead.dy-1,indexHead.dz-1,indexHead.dc-1,indexHead.dt-1);
 				return (-1);
 			}
-			if (!CheckCoords (thePixels, 0, theY+nRows-1, theZ, theC, theT)){
+			if (inRange > 0 && !indexedCoords (ID, &indexHead, 0, theY+nRows-1, theZ, theC, theT)) {
 				OMEIS_ReportError (method, "PixelsID", ID,"Number of rows (%d) and theY (%d) exceed maximum Y (%d).",
-					nRows,theY,head->dy-1);
-				freePixelsRep (thePixels);
+					nRows,theY,indexHead.dy-1);
 				return (-1);
 			}
+		}
+		if (inRange < 0) {
+			OMEIS_ReportError (method, "PixelsID", ID, "GetPixelsRep failed.");
+			return (-1);
+		}
 
+		/* Pixels are opened in our own byte order and swapped in batches on the way through */
+		if (! (thePixels = GetPixelsRep (ID,rorw,bigEndian())) ) {
+			OMEIS_ReportError (method, "PixelsID", ID, "GetPixelsRep failed.");
+			return (-1);
+		}
+
+		head = thePixels->head;
+		swap = swapNeeded (iam_BigEndian,head->bp);
+		if (m_entry->io == MIO_PIXELS) {
+			nPix = head->dx*head->dy*head->dz*head->dc*head->dt;
+			offset = 0;
+		} else if (m_entry->io == MIO_STACK) {
+			nPix = head->dx*head->dy*head->dz;
+			offset = GetOffset (thePixels, 0, 0, 0, theC, theT);
+		} else if (m_entry->io == MIO_PLANE) {
+			nPix = head->dx*head->dy;
+			offset = GetOffset (thePixels, 0, 0, theZ, theC, theT);
+		} else if (m_entry->io == MIO_ROWS) {
 			nPix = head->dx*nRows;
 			offset = GetOffset (thePixels, 0, theY, theZ, theC, theT);
 		}
 
+		/* Planes and stacks can be read from a level of the pyramid */
+		if (level > 0) {
+			if (rorw != 'r' || (m_entry->io != MIO_PLANE && m_entry->io != MIO_STACK)) {
+				OMEIS_ReportError (method, "PixelsID", ID, "Level can only be used to read planes and stacks.");
+				freePixelsRep (thePixels);
+				return (-1);
+			}
+			if (pyramidLevelSize (thePixels, level, &levelX, &levelY) < 0) {
+				OMEIS_ReportError (method, "PixelsID", ID, "Resolution level %d does not exist.", level);
+				freePixelsRep (thePixels);
+				return (-1);
+			}
+			if (openPixelsStream (thePixels, 'r', NULL, swap) < 0) {
+				OMEIS_ReportError (method, "PixelsID", ID, "Could not set up byte swapping.");
+				freePixelsRep (thePixels);
+				return (-1);
+			}
+			HTTP_ResultType ("application/octet-stream");
+			if (m_entry->io == MIO_PLANE)
+				pyramidROI (thePixels, level, 0, 0, theZ, theC, theT, levelX-1, levelY-1, theZ, theC, theT, thePixels->IO_stream, method);
+			else
+				pyramidROI (thePixels, level, 0, 0, 0, theC, theT, levelX-1, levelY-1, head->dz-1, theC, theT, thePixels->IO_stream, method);
+			closePixelsStream (thePixels, 'r', NULL, swap);
+			freePixelsRep (thePixels);
+			return (1);
+		}
+
+		if (rorw == 'r') {
+			pixelsRange theRange;
+
+			nRanges = getRequestRanges ((u_int64_t)nPix*head->bp, ranges, MAX_BYTE_RANGES);
+			if (nRanges < 0) {
+				rangeNotSatisfiable ((u_int64_t)nPix*head->bp);
+				freePixelsRep (thePixels);
+				return (1);
+			} else if (nRanges > 0) {
+				theRange.thePixels = thePixels;
+				theRange.offset = offset;
+				theRange.swap = swap;
+				/* The headers are out, so all that is left to tell is the exit status */
+				result = sendByteRanges (ranges, nRanges, (u_int64_t)nPix*head->bp, "application/octet-stream",
+					sendPixelsRange, &theRange);
+				freePixelsRep (thePixels);
+				return (result < 0 ? -1 : 1);
+			}
+		}
+
 		if (rorw == 'w')
-			thePixels->IO_stream = openInputFile(filename,isLocalFile);
-		else {
-			thePixels->IO_stream = stdout;
+			inStream = openInputFile(filename,isLocalFile);
+		if (openPixelsStream (thePixels, rorw, inStream, swap) < 0) {
+			OMEIS_ReportError (method, "PixelsID", ID, "Could not set up byte swapping.");
+			if (rorw == 'w') closeInputFile(inStream,isLocalFile);
+			freePixelsRep (thePixels);
+			return (-1);
+		}
+		if (rorw == 'r') {
+			acceptRanges ();
 			HTTP_ResultType ("application/octet-stream");
 		}
 
@@ -1048,9 +1210,13 @@ dispatch (char **param)
 		  we can't report an error in a sensible way, so don't bother checking.
 		  Its up to the client to figure out if the right number of pixels were read/written.
 		*/
-		nIO = DoPixelIO (thePixels, offset, nPix, rorw);
+		if (rorw != 'r' || (nRead = readPixels (thePixels, offset, nPix, thePixels->IO_stream)) < 0)
+			nIO = DoPixelIO (thePixels, offset, nPix, rorw);
+		else
+			nIO = nRead;
+		closePixelsStream (thePixels, rorw, inStream, swap);
 		if (rorw == 'w') {
-			closeInputFile(thePixels->IO_stream,isLocalFile);
+			closeInputFile(inStream,isLocalFile);
 			HTTP_ResultType ("text/plain");
 			fprintf (stdout,"%ld\n", (long) nIO);
 		}
@@ -1061,17 +1227,16 @@ dispatch (char **param)
 	else if (m_val == M_SETROI || m_val == M_GETROI) {
 		char *ROI;
 		int x0,y0,z0,c0,t0,x1,y1,z1,c1,t1;
+		long long nROI;
 		char *filename=NULL;
 
 		if (!ID) return (-1);
 		if (m_val == M_SETROI) {
 			rorw = 'w';
-			if (!(filename = get_param(param,"Pixels"))) {
-				OMEIS_ReportError(method, "PixelsID", ID,"No pixels specified");
-			}
+			filename = m_params.values[MPV_PIXELS];
 		} else rorw = 'r';
 
-		if ( !(ROI = get_param (param,"ROI")) ) {
+		if ( !(ROI = m_params.values[MPV_ROI]) ) {
 			OMEIS_ReportError (method, "PixelsID", ID,"ROI Parameter required for the %s method",method);
 			return (-1);
 		}
@@ -1082,36 +1247,73 @@ dispatch (char **param)
 			return (-1);
 		}
 
-		if (! (thePixels = GetPixelsRep (ID,rorw,iam_BigEndian)) ) {
+		/* Checked against the header index, so a bad ROI never opens the Pixels */
+		if ( (inRange = indexedCoords (ID, &indexHead, x0, y0, z0, c0, t0)) < 0) {
 			OMEIS_ReportError (method, "PixelsID", ID, "GetPixelsRep failed.");
 			return (-1);
 		}
-
-		head = thePixels->head;
-		if (!CheckCoords (thePixels, x0, y0, z0, c0, t0)){
+		if (!inRange) {
 			OMEIS_ReportError (method, "PixelsID", ID, "Parameters x0, y0, z0, c0, t0"
 								" (%d,%d,%d,%d,%d) must be in range (%d,%d,%d,%d,%d).",
-								x0,y0,z0,c0,t0,head->dx-1,head->dy-1,head->dz-1,head->dc-1,head->dt-1);
-			freePixelsRep (thePixels);
+								x0,y0,z0,c0,t0,indexHead.dx-1,indexHead.dy-1,indexHead.dz-1,indexHead.dc-1,indexHead.dt-1);
 			return (-1);
 		}
-		if (!CheckCoords (thePixels, x1, y1, z1, c1, t1)){
+		if (!indexedCoords (ID, &indexHead, x1, y1, z1, c1, t1)) {
 			OMEIS_ReportError (method, "PixelsID", ID, "Parameters x1, y1, z1, c1, t1"
 								" (%d,%d,%d,%d,%d) must be in range (%d,%d,%d,%d,%d).",
-								x1,y1,z1,c1,t1,head->dx-1,head->dy-1,head->dz-1,head->dc-1,head->dt-1);
-			freePixelsRep (thePixels);
+								x1,y1,z1,c1,t1,indexHead.dx-1,indexHead.dy-1,indexHead.dz-1,indexHead.dc-1,indexHead.dt-1);
+			return (-1);
+		}
+
+		if (! (thePixels = GetPixelsRep (ID,rorw,bigEndian())) ) {
+			OMEIS_ReportError (method, "PixelsID", ID, "GetPixelsRep failed.");
 			return (-1);
 		}
 
+		head = thePixels->head;
+		swap = swapNeeded (iam_BigEndian,head->bp);
+
+		/* At a pyramid level, X and Y are in the level's own coordinates */
+		if (level > 0) {
+			if (rorw != 'r') {
+				OMEIS_ReportError (method, "PixelsID", ID, "Level can only be used to read an ROI.");
+				freePixelsRep (thePixels);
+				return (-1);
+			}
+			if (pyramidLevelSize (thePixels, level, &levelX, &levelY) < 0) {
+				OMEIS_ReportError (method, "PixelsID", ID, "Resolution level %d does not exist.", level);
+				freePixelsRep (thePixels);
+				return (-1);
+			}
+			if (x0 > x1 || y0 > y1 || x1 >= levelX || y1 >= levelY) {
+				OMEIS_ReportError (method, "PixelsID", ID, "Parameters x0, y0, x1, y1 (%d,%d,%d,%d) must be in range (%d,%d) at level %d.",
+					x0,y0,x1,y1,levelX-1,levelY-1,level);
+				freePixelsRep (thePixels);
+				return (-1);
+			}
+		}
+
 		if (rorw == 'w')
-			thePixels->IO_stream = openInputFile(filename,isLocalFile);
-		else {
-			thePixels->IO_stream = stdout;
-			HTTP_ResultType ("application/octet-stream");
+			inStream = openInputFile(filename,isLocalFile);
+		if (openPixelsStream (thePixels, rorw, inStream, swap) < 0) {
+			OMEIS_ReportError (method, "PixelsID", ID, "Could not set up byte swapping.");
+			if (rorw == 'w') closeInputFile(inStream,isLocalFile);
+			freePixelsRep (thePixels);
+			return (-1);
 		}
-		nIO = DoROI (thePixels,x0,y0,z0,c0,t0,x1,y1,z1,c1,t1, rorw);
+		if (rorw == 'r')
+			HTTP_ResultType ("application/octet-stream");
+		if (level > 0)
+			nIO = pyramidROI (thePixels,level,x0,y0,z0,c0,t0,x1,y1,z1,c1,t1,thePixels->IO_stream,method);
+		else if (rorw == 'r' && (nROI = chunkedROI (thePixels,x0,y0,z0,c0,t0,x1,y1,z1,c1,t1,thePixels->IO_stream)) >= 0)
+			nIO = nROI;
+		else if ( (nROI = plannedROI (thePixels,x0,y0,z0,c0,t0,x1,y1,z1,c1,t1,rorw)) >= 0)
+			nIO = nROI;
+		else
+			nIO = DoROI (thePixels,x0,y0,z0,c0,t0,x1,y1,z1,c1,t1, rorw);
+		closePixelsStream (thePixels, rorw, inStream, swap);
 		if (rorw == 'w') {
-			closeInputFile(thePixels->IO_stream,isLocalFile);
+			closeInputFile(inStream,isLocalFile);
 			HTTP_ResultType ("text/plain");
 			fprintf (stdout,"%ld\n", (long) nIO);
 		}
@@ -1137,6 +1339,14 @@ char **in_params;
 			OMEIS_ROOT,strerror (errno));
 		exit (-1);
 	}
+
+	/* Persistent server mode: omeis -D <socket path | host:port> [nWorkers] */
+	if (argc > 2 && !strcmp (argv[1],"-D")) {
+		if (serveRequests (argv[2], argc > 3 ? atoi (argv[3]) : 0, dispatch) < 0)
+			exit (-1);
+		return (0);
+	}
+
 	in_params = getCLIvars(argc,argv) ;
 	if( !in_params ) {
 		in_params = getcgivars() ;
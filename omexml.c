@@ -0,0 +1,1092 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif  /* HAVE_CONFIG_H */
+
+/* For open_memstream and fopencookie */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <zlib.h>
+#include <bzlib.h>
+#include <libxml/parser.h>
+
+#include "Pixels.h"
+#include "OMEIS_Error.h"
+#include "pixswap.h"
+#include "headindex.h"
+#include "b64stream.h"
+#include "omexml.h"
+
+typedef struct {
+	int dx, dy, dz, dc, dt, bp, isSigned, isFloat;
+	int bigEndian;
+	int order[3];     /* 0 for Z, 1 for C, 2 for T; fastest first */
+} pixelsDesc;
+
+typedef struct {
+	xmlParserCtxtPtr ctxt;
+	char *method;
+	int import;
+	char bigEndian;         /* export: byte order of the BinData written */
+	int binCompression;     /* export: how the BinData is compressed */
+	int nThreads;           /* export: planes encoded at once */
+	FILE *out;
+	FILE *doc;              /* out, or the held body of a Pixels element */
+	int openTag;            /* the last start tag still needs its '>' */
+	int skip;               /* depth inside an element being left out */
+	int error;
+	char message[256];
+
+	/* The Pixels element being exported or imported */
+	int inPixels;
+	pixelsDesc desc;
+	PixelsRep *thePixels;
+	int fd;
+	size_t planeBytes;
+	u_int64_t pos, total;   /* import: pixel bytes written, and expected */
+	char *heldTag, *heldBody, heldID[32], heldSHA1[64];
+	size_t heldTagSize, heldBodySize;
+	FILE *heldBodyStream;
+
+	/* The BinData being decoded */
+	int inBinData, compression, streamEnd;
+	b64Decoder b64;
+	z_stream zs;
+	bz_stream bz;
+	unsigned char *decoded, *inflated, *stage;
+	size_t decodedSize, nStage;
+} omexmlState;
+
+static
+void fail (omexmlState *st, const char *fmt, ...) {
+va_list ap;
+
+	if (st->error) return;
+	st->error = 1;
+	va_start (ap,fmt);
+	vsnprintf (st->message,sizeof (st->message),fmt,ap);
+	va_end (ap);
+	xmlStopParser (st->ctxt);
+}
+
+/* libxml2's own messages would go to stderr; the last one is reported instead */
+static
+void quietError (void *ctx, xmlErrorPtr error) {
+}
+
+/*
+  Writes len bytes of s, escaped.  Attribute values arrive with '&' still
+  escaped (as &#38; or an entity reference), so it passes through there.
+*/
+static
+void writeEscaped (FILE *f, const xmlChar *s, int len, int attr) {
+const xmlChar *p = s, *end = s + len;
+const char *rep;
+
+	for (; p < end; p++) {
+		switch (*p) {
+			case '<':  rep = "&lt;"; break;
+			case '>':  rep = "&gt;"; break;
+			case '&':  rep = attr ? NULL : "&amp;"; break;
+			case '"':  rep = attr ? "&quot;" : NULL; break;
+			case '\r': rep = "&#13;"; break;
+			case '\n': rep = attr ? "&#10;" : NULL; break;
+			case '\t': rep = attr ? "&#9;" : NULL; break;
+			default:   rep = NULL;
+		}
+		if (!rep) continue;
+		fwrite (s,1,p - s,f);
+		fputs (rep,f);
+		s = p + 1;
+	}
+	fwrite (s,1,p - s,f);
+}
+
+static
+void writeName (FILE *f, const xmlChar *prefix, const xmlChar *localname) {
+	if (prefix) fprintf (f,"%s:",(const char *) prefix);
+	fputs ((const char *) localname,f);
+}
+
+static
+void closeTag (omexmlState *st) {
+	if (st->openTag) fputc ('>',st->doc);
+	st->openTag = 0;
+}
+
+/* The start tag, without its '>', leaving out the attributes named in drop */
+static
+void writeStartTag (FILE *f, const xmlChar *localname, const xmlChar *prefix,
+	int nb_namespaces, const xmlChar **namespaces, int nb_attributes, const xmlChar **attributes,
+	const char **drop) {
+const char **d;
+int i;
+
+	fputc ('<',f);
+	writeName (f,prefix,localname);
+	for (i = 0; i < nb_namespaces; i++) {
+		fputs (namespaces[2*i] ? " xmlns:" : " xmlns",f);
+		if (namespaces[2*i]) fputs ((const char *) namespaces[2*i],f);
+		fputs ("=\"",f);
+		writeEscaped (f,namespaces[2*i+1],strlen ((const char *) namespaces[2*i+1]),1);
+		fputc ('"',f);
+	}
+	for (i = 0; i < nb_attributes; i++) {
+		for (d = drop; d && *d && strcmp (*d,(const char *) attributes[5*i]); d++) ;
+		if (d && *d) continue;
+		fputc (' ',f);
+		writeName (f,attributes[5*i+1],attributes[5*i]);
+		fputs ("=\"",f);
+		writeEscaped (f,attributes[5*i+3],attributes[5*i+4] - attributes[5*i+3],1);
+		fputc ('"',f);
+	}
+}
+
+/* An attribute's value as a string in buf, or NULL if it isn't there */
+static
+const char *getAttr (int nb_attributes, const xmlChar **attributes, const char *name, char *buf, size_t size) {
+size_t len;
+int i;
+
+	for (i = 0; i < nb_attributes; i++) {
+		if (strcmp ((const char *) attributes[5*i],name)) continue;
+		len = attributes[5*i+4] - attributes[5*i+3];
+		if (len >= size) len = size - 1;
+		memcpy (buf,attributes[5*i+3],len);
+		buf[len] = '\0';
+		return (buf);
+	}
+	return (NULL);
+}
+
+static
+int parseOrder (const char *order, pixelsDesc *desc) {
+int i;
+
+	if (strlen (order) != 5 || strncasecmp (order,"XY",2)) return (-1);
+	for (i = 0; i < 3; i++) {
+		switch (order[i+2]) {
+			case 'Z': case 'z': desc->order[i] = 0; break;
+			case 'C': case 'c': desc->order[i] = 1; break;
+			case 'T': case 't': desc->order[i] = 2; break;
+			default: return (-1);
+		}
+	}
+	if (desc->order[0] == desc->order[1] || desc->order[0] == desc->order[2] || desc->order[1] == desc->order[2])
+		return (-1);
+	return (0);
+}
+
+/* Byte offset in the XYZCT Pixels file of plane k in the document's order */
+static
+u_int64_t planeOffset (pixelsDesc *desc, u_int64_t k, size_t planeBytes) {
+int size[3], coord[3], i;
+
+	size[0] = desc->dz;
+	size[1] = desc->dc;
+	size[2] = desc->dt;
+	for (i = 0; i < 3; i++) {
+		coord[desc->order[i]] = k % size[desc->order[i]];
+		k /= size[desc->order[i]];
+	}
+	return ((((u_int64_t)coord[2]*desc->dc + coord[1])*desc->dz + coord[0]) * planeBytes);
+}
+
+static
+const char *pixelType (pixelsDesc *desc) {
+	if (desc->isFloat) return ("float");
+	switch (desc->bp) {
+		case 1:  return (desc->isSigned ? "int8" : "Uint8");
+		case 2:  return (desc->isSigned ? "int16" : "Uint16");
+		default: return (desc->isSigned ? "int32" : "Uint32");
+	}
+}
+
+static
+int parsePixelType (const char *type, pixelsDesc *desc) {
+static const struct { const char *name; int bp, isSigned, isFloat; } types[] = {
+	{"int8",1,1,0}, {"int16",2,1,0}, {"int32",4,1,0},
+	{"uint8",1,0,0}, {"uint16",2,0,0}, {"uint32",4,0,0}, {"float",4,1,1}
+};
+int i;
+
+	for (i = 0; i < (int)(sizeof (types) / sizeof (types[0])); i++)
+		if (!strcasecmp (type,types[i].name)) {
+			desc->bp = types[i].bp;
+			desc->isSigned = types[i].isSigned;
+			desc->isFloat = types[i].isFloat;
+			return (0);
+		}
+	return (-1);
+}
+
+/* Lets go of the Pixels, expunging them if an import didn't finish */
+static
+void releasePixels (omexmlState *st) {
+	if (st->fd >= 0) close (st->fd);
+	st->fd = -1;
+	if (!st->thePixels) return;
+	if (st->import && st->error && ExpungePixels (st->thePixels)) forgetPixels (st->thePixels->ID);
+	freePixelsRep (st->thePixels);
+	st->thePixels = NULL;
+}
+
+/*
+  Export.  A plane is read OMEXML_PLANE_CHUNK bytes at a time, swapped,
+  passed through zlib or bzip2 if asked for, and base64ed into the sink
+  as each piece comes out, so a plane is never held whole.  With more
+  than one thread, each plane is encoded into its own buffer by a pool
+  of threads, and the buffers are sent in plane order.
+*/
+typedef struct {
+	unsigned char *raw, *packed;
+	char *text;
+} planeScratch;
+
+typedef struct {
+	int compression;
+	z_stream zs;
+	bz_stream bz;
+	b64Encoder b64;
+	planeScratch *s;
+	FILE *sink;
+} planeCoder;
+
+static
+void encodeText (planeCoder *pc, const unsigned char *p, size_t n) {
+	fwrite (pc->s->text,1,b64Encode (&pc->b64,p,n,pc->s->text),pc->sink);
+}
+
+/* Feeds n bytes to the compressor, and encodes whatever it gives back */
+static
+int packChunk (planeCoder *pc, unsigned char *p, size_t n, int last) {
+int rc;
+
+	if (pc->compression == OMEXML_BIN_ZLIB) {
+		pc->zs.next_in = p;
+		pc->zs.avail_in = n;
+		do {
+			pc->zs.next_out = pc->s->packed;
+			pc->zs.avail_out = OMEXML_PLANE_CHUNK;
+			if ( (rc = deflate (&pc->zs,last ? Z_FINISH : Z_NO_FLUSH)) == Z_STREAM_ERROR) return (-1);
+			encodeText (pc,pc->s->packed,OMEXML_PLANE_CHUNK - pc->zs.avail_out);
+		} while (pc->zs.avail_out == 0 || (last && rc != Z_STREAM_END));
+	} else if (pc->compression == OMEXML_BIN_BZIP2) {
+		pc->bz.next_in = (char *) p;
+		pc->bz.avail_in = n;
+		do {
+			pc->bz.next_out = (char *) pc->s->packed;
+			pc->bz.avail_out = OMEXML_PLANE_CHUNK;
+			if ( (rc = BZ2_bzCompress (&pc->bz,last ? BZ_FINISH : BZ_RUN)) < 0) return (-1);
+			encodeText (pc,pc->s->packed,OMEXML_PLANE_CHUNK - pc->bz.avail_out);
+		} while (pc->bz.avail_out == 0 || (last && rc != BZ_STREAM_END));
+	} else encodeText (pc,p,n);
+	return (0);
+}
+
+/* Writes plane k as a BinData element to sink.  Safe to run in several threads at once */
+static
+int encodePlane (omexmlState *st, u_int64_t k, FILE *sink, planeScratch *s) {
+static const char *names[] = {"none","zlib","bzip2"};
+u_int64_t off = planeOffset (&st->desc,k,st->planeBytes);
+planeCoder pc;
+size_t done, n;
+int swap = swapNeeded (st->bigEndian,st->desc.bp), rc = 0;
+
+	memset (&pc,0,sizeof (pc));
+	pc.compression = st->binCompression;
+	pc.s = s;
+	pc.sink = sink;
+	if (pc.compression == OMEXML_BIN_ZLIB && deflateInit (&pc.zs,Z_DEFAULT_COMPRESSION) != Z_OK) return (-1);
+	if (pc.compression == OMEXML_BIN_BZIP2 && BZ2_bzCompressInit (&pc.bz,9,0,0) != BZ_OK) return (-1);
+	b64EncodeInit (&pc.b64);
+
+	if (pc.compression == OMEXML_BIN_NONE) fputs ("<Bin:BinData>",sink);
+	else fprintf (sink,"<Bin:BinData Compression=\"%s\">",names[pc.compression]);
+	for (done = 0; done < st->planeBytes && rc == 0; done += n) {
+		n = st->planeBytes - done < OMEXML_PLANE_CHUNK ? st->planeBytes - done : OMEXML_PLANE_CHUNK;
+		if (pread (st->fd,s->raw,n,off + done) != (ssize_t) n) {
+			rc = -1;
+			break;
+		}
+		if (swap) swapPixels (s->raw,n / st->desc.bp,st->desc.bp);
+		rc = packChunk (&pc,s->raw,n,done + n == st->planeBytes);
+	}
+	fwrite (s->text,1,b64EncodeEnd (&pc.b64,s->text),sink);
+	fputs ("</Bin:BinData>",sink);
+
+	if (pc.compression == OMEXML_BIN_ZLIB) deflateEnd (&pc.zs);
+	else if (pc.compression == OMEXML_BIN_BZIP2) BZ2_bzCompressEnd (&pc.bz);
+	return (rc);
+}
+
+static
+int newScratch (planeScratch *s) {
+	s->raw = (unsigned char *) malloc (OMEXML_PLANE_CHUNK);
+	s->packed = (unsigned char *) malloc (OMEXML_PLANE_CHUNK);
+	s->text = (char *) malloc (B64_ENCODED_MAX (OMEXML_PLANE_CHUNK));
+	return (s->raw && s->packed && s->text ? 0 : -1);
+}
+
+static
+void freeScratch (planeScratch *s) {
+	free (s->raw);
+	free (s->packed);
+	free (s->text);
+}
+
+/* Each job slot keeps its buffer from plane to plane */
+typedef struct {
+	u_int64_t k;
+	char *text;
+	size_t size, room;
+	char done;
+	char failed;
+} planeJob;
+
+static
+ssize_t jobWrite (void *cookie, const char *data, size_t size) {
+planeJob *job = (planeJob *) cookie;
+size_t room = job->room ? job->room : OMEXML_PLANE_CHUNK;
+char *text;
+
+	while (room - job->size < size) room *= 2;
+	if (room != job->room) {
+		if (! (text = (char *) realloc (job->text,room)) ) return (-1);
+		job->text = text;
+		job->room = room;
+	}
+	memcpy (job->text + job->size,data,size);
+	job->size += size;
+	return (size);
+}
+
+typedef struct {
+	omexmlState *st;
+	planeJob *jobs;
+	int nJobs;
+	unsigned long head;   /* oldest job not yet sent */
+	unsigned long next;   /* next job for a thread to pick up */
+	unsigned long tail;   /* jobs submitted so far */
+	int nThreads;
+	pthread_t *threads;
+	pthread_mutex_t lock;
+	pthread_cond_t workReady;
+	pthread_cond_t jobDone;
+	char shutdown;
+} planePool;
+
+static
+void *encodeThread (void *arg) {
+static const cookie_io_functions_t jobFuncs = {NULL, jobWrite, NULL, NULL};
+planePool *pool = (planePool *) arg;
+planeScratch s;
+planeJob *job;
+FILE *sink;
+int ok = newScratch (&s) == 0;
+
+	pthread_mutex_lock (&pool->lock);
+	for (;;) {
+		while (!pool->shutdown && pool->next == pool->tail)
+			pthread_cond_wait (&pool->workReady,&pool->lock);
+		if (pool->shutdown) break;
+
+		job = &pool->jobs[pool->next % pool->nJobs];
+		pool->next++;
+		pthread_mutex_unlock (&pool->lock);
+
+		job->failed = 1;
+		job->size = 0;
+		if (ok && (sink = fopencookie (job,"w",jobFuncs)) ) {
+			job->failed = encodePlane (pool->st,job->k,sink,&s) < 0;
+			if (fclose (sink)) job->failed = 1;
+		}
+
+		pthread_mutex_lock (&pool->lock);
+		job->done = 1;
+		pthread_cond_broadcast (&pool->jobDone);
+	}
+	pthread_mutex_unlock (&pool->lock);
+
+	freeScratch (&s);
+	return (NULL);
+}
+
+/* Waits for the oldest plane in flight and sends it */
+static
+int sendOldest (planePool *pool) {
+planeJob *job = &pool->jobs[pool->head % pool->nJobs];
+int rc = 0;
+
+	pthread_mutex_lock (&pool->lock);
+	while (!job->done)
+		pthread_cond_wait (&pool->jobDone,&pool->lock);
+	pthread_mutex_unlock (&pool->lock);
+	pool->head++;
+
+	if (job->failed) rc = -1;
+	else if (fwrite (job->text,1,job->size,pool->st->doc) != job->size) rc = -1;
+	return (rc);
+}
+
+static
+int sendPlanes (omexmlState *st, u_int64_t nPlanes) {
+planePool pool;
+planeScratch s;
+u_int64_t k;
+size_t inFlight = B64_ENCODED_MAX (st->planeBytes) + 64;
+int i, rc = 0;
+
+	memset (&pool,0,sizeof (pool));
+	pool.st = st;
+	pool.nThreads = st->nThreads;
+	pool.nJobs = pool.nThreads * OMEXML_JOBS_PER_THREAD;
+	if ((u_int64_t) pool.nJobs > nPlanes) pool.nJobs = nPlanes;
+	if ((size_t) pool.nJobs > OMEXML_MAX_IN_FLIGHT / inFlight) pool.nJobs = OMEXML_MAX_IN_FLIGHT / inFlight;
+	if (pool.nThreads > pool.nJobs) pool.nThreads = pool.nJobs;
+
+	/* One plane at a time, or planes too big to hold: encode straight to the document */
+	if (pool.nThreads <= 1) {
+		if (newScratch (&s) < 0) rc = -1;
+		for (k = 0; k < nPlanes && rc == 0; k++)
+			rc = encodePlane (st,k,st->doc,&s);
+		freeScratch (&s);
+		return (rc);
+	}
+
+	if ( !(pool.jobs = (planeJob *) calloc (pool.nJobs,sizeof (planeJob))) ||
+		!(pool.threads = (pthread_t *) calloc (pool.nThreads,sizeof (pthread_t))) ) {
+		free (pool.jobs);
+		return (-1);
+	}
+	pthread_mutex_init (&pool.lock,NULL);
+	pthread_cond_init (&pool.workReady,NULL);
+	pthread_cond_init (&pool.jobDone,NULL);
+	for (i = 0; i < pool.nThreads; i++)
+		if (pthread_create (&pool.threads[i],NULL,encodeThread,&pool)) break;
+	pool.nThreads = i;
+	if (i == 0) rc = -1;
+
+	for (k = 0; k < nPlanes && rc == 0; k++) {
+		if (pool.tail - pool.head == (unsigned long) pool.nJobs && sendOldest (&pool) < 0) {
+			rc = -1;
+			break;
+		}
+		pthread_mutex_lock (&pool.lock);
+		pool.jobs[pool.tail % pool.nJobs].k = k;
+		pool.jobs[pool.tail % pool.nJobs].done = 0;
+		pool.tail++;
+		pthread_cond_signal (&pool.workReady);
+		pthread_mutex_unlock (&pool.lock);
+	}
+	while (pool.head < pool.tail)
+		if (sendOldest (&pool) < 0) rc = -1;
+
+	pthread_mutex_lock (&pool.lock);
+	pool.shutdown = 1;
+	pthread_cond_broadcast (&pool.workReady);
+	pthread_mutex_unlock (&pool.lock);
+	for (i = 0; i < pool.nThreads; i++)
+		pthread_join (pool.threads[i],NULL);
+	pthread_mutex_destroy (&pool.lock);
+	pthread_cond_destroy (&pool.workReady);
+	pthread_cond_destroy (&pool.jobDone);
+	for (i = 0; i < pool.nJobs; i++)
+		free (pool.jobs[i].text);
+	free (pool.threads);
+	free (pool.jobs);
+	return (rc);
+}
+
+static
+void exportPixels (omexmlState *st, const xmlChar *localname, const xmlChar *prefix,
+	int nb_namespaces, const xmlChar **namespaces, int nb_attributes, const xmlChar **attributes,
+	const char *serverID) {
+static const char *drop[] = {"ImageServerID","FileSHA1","BigEndian","SizeX","SizeY","SizeZ","SizeC","SizeT","PixelType",NULL};
+pixHeader *head;
+unsigned long long ID;
+char order[16];
+int i, haveBin = 0;
+
+	if (sscanf (serverID,"%llu",&ID) != 1 || ! (st->thePixels = GetPixelsRep ((OID) ID,'r',bigEndian())) ) {
+		fail (st,"Pixels ImageServerID=%s could not be opened.",serverID);
+		return;
+	}
+	head = st->thePixels->head;
+	memset (&st->desc,0,sizeof (st->desc));
+	st->desc.dx = head->dx; st->desc.dy = head->dy; st->desc.dz = head->dz;
+	st->desc.dc = head->dc; st->desc.dt = head->dt;
+	st->desc.bp = head->bp; st->desc.isSigned = head->isSigned; st->desc.isFloat = head->isFloat;
+	if (parseOrder (getAttr (nb_attributes,attributes,"DimensionOrder",order,sizeof (order)) ? order : "XYZCT",&st->desc) < 0) {
+		fail (st,"Pixels ImageServerID=%s has a bad DimensionOrder.",serverID);
+		return;
+	}
+	st->planeBytes = (size_t)head->dx * head->dy * head->bp;
+
+	if ( (st->fd = open (st->thePixels->path_rep,O_RDONLY)) < 0) {
+		fail (st,"Could not read Pixels %s.",serverID);
+		return;
+	}
+
+	closeTag (st);
+	writeStartTag (st->doc,localname,prefix,nb_namespaces,namespaces,nb_attributes,attributes,drop);
+	fprintf (st->doc," SizeX=\"%d\" SizeY=\"%d\" SizeZ=\"%d\" SizeC=\"%d\" SizeT=\"%d\" PixelType=\"%s\" BigEndian=\"%s\"",
+		head->dx,head->dy,head->dz,head->dc,head->dt,pixelType (&st->desc),st->bigEndian ? "true" : "false");
+	for (i = 0; i < nb_namespaces; i++)
+		if (namespaces[2*i] && !strcmp ((const char *) namespaces[2*i],"Bin")) haveBin = 1;
+	if (!haveBin) fputs (" xmlns:Bin=\"" OMEXML_BIN_NS "\"",st->doc);
+	fputc ('>',st->doc);
+
+	if (sendPlanes (st,(u_int64_t)head->dz * head->dc * head->dt) < 0)
+		fail (st,"Could not encode Pixels %s.",serverID);
+	st->inPixels = 1;
+}
+
+/*
+  Import: decoded pixel bytes are gathered in stage and written out in
+  whole pixels, swapped if the document's byte order isn't ours.
+*/
+static
+int flushStage (omexmlState *st) {
+size_t n = st->nStage - st->nStage % st->desc.bp, done, seg, inPlane;
+u_int64_t off;
+ssize_t put;
+
+	if (st->pos + n > st->total) {
+		fail (st,"BinData holds more than SizeX*SizeY*SizeZ*SizeC*SizeT pixels.");
+		return (-1);
+	}
+	if (!st->desc.bigEndian != !bigEndian()) swapPixels (st->stage,n / st->desc.bp,st->desc.bp);
+	for (done = 0; done < n; done += seg) {
+		inPlane = (st->pos + done) % st->planeBytes;
+		seg = st->planeBytes - inPlane < n - done ? st->planeBytes - inPlane : n - done;
+		off = planeOffset (&st->desc,(st->pos + done) / st->planeBytes,st->planeBytes) + inPlane;
+		if ( (put = pwrite (st->fd,st->stage + done,seg,off)) != (ssize_t) seg) {
+			fail (st,"Could not write Pixels %llu.",(unsigned long long) st->thePixels->ID);
+			return (-1);
+		}
+	}
+	st->pos += n;
+	memmove (st->stage,st->stage + n,st->nStage - n);
+	st->nStage -= n;
+	return (0);
+}
+
+static
+void stagePixels (omexmlState *st, const unsigned char *p, size_t n) {
+size_t m;
+
+	while (n && !st->error) {
+		m = OMEXML_STAGE_SIZE - st->nStage < n ? OMEXML_STAGE_SIZE - st->nStage : n;
+		memcpy (st->stage + st->nStage,p,m);
+		st->nStage += m;
+		p += m;
+		n -= m;
+		if (st->nStage == OMEXML_STAGE_SIZE) flushStage (st);
+	}
+}
+
+/* Decoded base64 goes through the BinData's decompressor, if it has one */
+static
+void inflateBinData (omexmlState *st, unsigned char *p, size_t n) {
+int rc;
+
+	if (st->compression == OMEXML_BIN_NONE) {
+		stagePixels (st,p,n);
+		return;
+	}
+	if (st->streamEnd) {
+		if (n) fail (st,"BinData continues past the end of its compressed stream.");
+		return;
+	}
+	if (st->compression == OMEXML_BIN_ZLIB) {
+		st->zs.next_in = p;
+		st->zs.avail_in = n;
+		do {
+			st->zs.next_out = st->inflated;
+			st->zs.avail_out = OMEXML_STAGE_SIZE;
+			rc = inflate (&st->zs,Z_NO_FLUSH);
+			if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) {
+				fail (st,"BinData could not be inflated (zlib: %s).",st->zs.msg ? st->zs.msg : "error");
+				return;
+			}
+			stagePixels (st,st->inflated,OMEXML_STAGE_SIZE - st->zs.avail_out);
+			if (rc == Z_STREAM_END) st->streamEnd = 1;
+		} while (!st->error && !st->streamEnd && st->zs.avail_out == 0);
+	} else {
+		st->bz.next_in = (char *) p;
+		st->bz.avail_in = n;
+		do {
+			st->bz.next_out = (char *) st->inflated;
+			st->bz.avail_out = OMEXML_STAGE_SIZE;
+			rc = BZ2_bzDecompress (&st->bz);
+			if (rc != BZ_OK && rc != BZ_STREAM_END) {
+				fail (st,"BinData could not be decompressed (bzip2 error %d).",rc);
+				return;
+			}
+			stagePixels (st,st->inflated,OMEXML_STAGE_SIZE - st->bz.avail_out);
+			if (rc == BZ_STREAM_END) st->streamEnd = 1;
+		} while (!st->error && !st->streamEnd && st->bz.avail_out == 0);
+	}
+}
+
+static
+void importPixels (omexmlState *st, const xmlChar *localname, const xmlChar *prefix,
+	int nb_namespaces, const xmlChar **namespaces, int nb_attributes, const xmlChar **attributes) {
+static const char *drop[] = {"ImageServerID","FileSHA1",NULL};
+static const char *sizes[] = {"SizeX","SizeY","SizeZ","SizeC","SizeT"};
+char buf[64];
+int *dims[5], i;
+FILE *tag;
+
+	memset (&st->desc,0,sizeof (st->desc));
+	dims[0] = &st->desc.dx; dims[1] = &st->desc.dy; dims[2] = &st->desc.dz;
+	dims[3] = &st->desc.dc; dims[4] = &st->desc.dt;
+	for (i = 0; i < 5; i++)
+		if (!getAttr (nb_attributes,attributes,sizes[i],buf,sizeof (buf)) || sscanf (buf,"%d",dims[i]) != 1 || *dims[i] < 1) {
+			fail (st,"Pixels element needs a positive %s.",sizes[i]);
+			return;
+		}
+	if (!getAttr (nb_attributes,attributes,"PixelType",buf,sizeof (buf)) || parsePixelType (buf,&st->desc) < 0) {
+		fail (st,"Pixels PixelType must be int8, int16, int32, Uint8, Uint16, Uint32 or float.");
+		return;
+	}
+	if (parseOrder (getAttr (nb_attributes,attributes,"DimensionOrder",buf,sizeof (buf)) ? buf : "XYZCT",&st->desc) < 0) {
+		fail (st,"Pixels DimensionOrder %s is not one of XYZCT, XYZTC, XYCZT, XYCTZ, XYTZC, XYTCZ.",buf);
+		return;
+	}
+	st->desc.bigEndian = !getAttr (nb_attributes,attributes,"BigEndian",buf,sizeof (buf)) ||
+		!strcasecmp (buf,"true") || !strcmp (buf,"1");
+	st->planeBytes = (size_t)st->desc.dx * st->desc.dy * st->desc.bp;
+	st->total = (u_int64_t) st->planeBytes * st->desc.dz * st->desc.dc * st->desc.dt;
+	st->pos = 0;
+	st->nStage = 0;
+
+	/* Held until the element ends and the Pixels have an ID */
+	closeTag (st);
+	if (! (tag = open_memstream (&st->heldTag,&st->heldTagSize)) ||
+		! (st->heldBodyStream = open_memstream (&st->heldBody,&st->heldBodySize)) ) {
+		if (tag) fclose (tag);
+		fail (st,"Could not hold the Pixels element.");
+		return;
+	}
+	writeStartTag (tag,localname,prefix,nb_namespaces,namespaces,nb_attributes,attributes,drop);
+	fclose (tag);
+	if (!getAttr (nb_attributes,attributes,"ImageServerID",st->heldID,sizeof (st->heldID))) *st->heldID = '\0';
+	if (!getAttr (nb_attributes,attributes,"FileSHA1",st->heldSHA1,sizeof (st->heldSHA1))) *st->heldSHA1 = '\0';
+	st->doc = st->heldBodyStream;
+	st->inPixels = 1;
+}
+
+static
+void startBinData (omexmlState *st, int nb_attributes, const xmlChar **attributes) {
+char buf[32];
+
+	st->compression = OMEXML_BIN_NONE;
+	if (getAttr (nb_attributes,attributes,"Compression",buf,sizeof (buf)) &&
+		(st->compression = parseBinCompression (buf)) < 0) {
+		fail (st,"BinData Compression must be none, zlib or bzip2, not %s.",buf);
+		return;
+	}
+
+	/* The Pixels are made when the first BinData arrives */
+	if (!st->thePixels) {
+		if (! (st->thePixels = NewPixels (st->desc.dx,st->desc.dy,st->desc.dz,st->desc.dc,st->desc.dt,
+			st->desc.bp,st->desc.isSigned,st->desc.isFloat)) ) {
+			fail (st,"NewPixels failed.");
+			return;
+		}
+		if ( (st->fd = open (st->thePixels->path_rep,O_RDWR)) < 0) {
+			fail (st,"Could not open Pixels %llu.",(unsigned long long) st->thePixels->ID);
+			return;
+		}
+	}
+
+	st->streamEnd = 0;
+	if (st->compression == OMEXML_BIN_ZLIB) {
+		memset (&st->zs,0,sizeof (st->zs));
+		/* zlib or gzip headers */
+		if (inflateInit2 (&st->zs,15 + 32) != Z_OK) {
+			fail (st,"Could not start zlib.");
+			return;
+		}
+	} else if (st->compression == OMEXML_BIN_BZIP2) {
+		memset (&st->bz,0,sizeof (st->bz));
+		if (BZ2_bzDecompressInit (&st->bz,0,0) != BZ_OK) {
+			fail (st,"Could not start bzip2.");
+			return;
+		}
+	}
+	b64DecodeInit (&st->b64);
+	st->inBinData = 1;
+}
+
+static
+void endBinData (omexmlState *st) {
+	if (b64DecodeEnd (&st->b64) < 0)
+		fail (st,"BinData ends in the middle of a base64 group.");
+	else if (st->compression != OMEXML_BIN_NONE && !st->streamEnd)
+		fail (st,"BinData ends in the middle of its compressed stream.");
+	if (st->compression == OMEXML_BIN_ZLIB) inflateEnd (&st->zs);
+	else if (st->compression == OMEXML_BIN_BZIP2) BZ2_bzDecompressEnd (&st->bz);
+	st->inBinData = 0;
+}
+
+static
+void endImportPixels (omexmlState *st, const xmlChar *localname, const xmlChar *prefix) {
+OID resultID = 0;
+int i;
+
+	fclose (st->heldBodyStream);
+	st->heldBodyStream = NULL;
+	st->doc = st->out;
+	if (st->thePixels) {
+		if (flushStage (st) < 0) return;
+		if (st->nStage || st->pos != st->total) {
+			fail (st,"BinData holds %llu bytes of pixels; SizeX*SizeY*SizeZ*SizeC*SizeT needs %llu.",
+				(unsigned long long) (st->pos + st->nStage),(unsigned long long) st->total);
+			return;
+		}
+		close (st->fd);
+		st->fd = -1;
+		if ( (resultID = FinishPixels (st->thePixels,0)) == 0) {
+			fail (st,"FinishPixels failed.");
+			return;
+		}
+		if (resultID == st->thePixels->ID) indexPixels (resultID,st->thePixels->head);
+		else forgetPixels (st->thePixels->ID);
+	}
+
+	fwrite (st->heldTag,1,st->heldTagSize,st->out);
+	if (resultID) {
+		fprintf (st->out," ImageServerID=\"%llu\" FileSHA1=\"",(unsigned long long) resultID);
+		for (i = 0; i < OME_DIGEST_LENGTH; i++) fprintf (st->out,"%02x",st->thePixels->head->sha1[i]);
+		fputc ('"',st->out);
+		freePixelsRep (st->thePixels);
+		st->thePixels = NULL;
+	} else {
+		/* No BinData: whatever the element already referred to stands */
+		if (*st->heldID) {
+			fputs (" ImageServerID=\"",st->out);
+			writeEscaped (st->out,(const xmlChar *) st->heldID,strlen (st->heldID),1);
+			fputc ('"',st->out);
+		}
+		if (*st->heldSHA1) {
+			fputs (" FileSHA1=\"",st->out);
+			writeEscaped (st->out,(const xmlChar *) st->heldSHA1,strlen (st->heldSHA1),1);
+			fputc ('"',st->out);
+		}
+	}
+	fputc ('>',st->out);
+	fwrite (st->heldBody,1,st->heldBodySize,st->out);
+	fputs ("</",st->out);
+	writeName (st->out,prefix,localname);
+	fputc ('>',st->out);
+	free (st->heldTag);
+	free (st->heldBody);
+	st->heldTag = st->heldBody = NULL;
+	st->inPixels = 0;
+}
+
+/*
+  SAX callbacks
+*/
+static
+void startElement (void *ctx, const xmlChar *localname, const xmlChar *prefix, const xmlChar *URI,
+	int nb_namespaces, const xmlChar **namespaces, int nb_attributes, int nb_defaulted, const xmlChar **attributes) {
+omexmlState *st = (omexmlState *) ctx;
+const char *name = (const char *) localname;
+char serverID[32];
+
+	if (st->error) return;
+	if (st->skip) {
+		st->skip++;
+		return;
+	}
+
+	if (st->inBinData) {
+		fail (st,"BinData can't have child elements.");
+		return;
+	}
+	if (st->inPixels && (!strcmp (name,"BinData") || !strcmp (name,"External"))) {
+		if (st->import && !strcmp (name,"BinData")) startBinData (st,nb_attributes,attributes);
+		else st->skip = 1;
+		return;
+	}
+	if (!st->inPixels && !strcmp (name,"Pixels")) {
+		if (st->import) {
+			importPixels (st,localname,prefix,nb_namespaces,namespaces,nb_attributes,attributes);
+			return;
+		}
+		if (getAttr (nb_attributes,attributes,"ImageServerID",serverID,sizeof (serverID))) {
+			exportPixels (st,localname,prefix,nb_namespaces,namespaces,nb_attributes,attributes,serverID);
+			return;
+		}
+	}
+
+	closeTag (st);
+	writeStartTag (st->doc,localname,prefix,nb_namespaces,namespaces,nb_attributes,attributes,NULL);
+	st->openTag = 1;
+}
+
+static
+void endElement (void *ctx, const xmlChar *localname, const xmlChar *prefix, const xmlChar *URI) {
+omexmlState *st = (omexmlState *) ctx;
+
+	if (st->error) return;
+	if (st->skip) {
+		st->skip--;
+		return;
+	}
+	if (st->inBinData) {
+		endBinData (st);
+		return;
+	}
+	if (st->inPixels && !strcmp ((const char *) localname,"Pixels")) {
+		if (st->import) {
+			endImportPixels (st,localname,prefix);
+			return;
+		}
+		releasePixels (st);
+		st->inPixels = 0;
+	}
+
+	if (st->openTag) {
+		fputs ("/>",st->doc);
+		st->openTag = 0;
+		return;
+	}
+	fputs ("</",st->doc);
+	writeName (st->doc,prefix,localname);
+	fputc ('>',st->doc);
+}
+
+static
+void characters (void *ctx, const xmlChar *ch, int len) {
+omexmlState *st = (omexmlState *) ctx;
+ssize_t n;
+
+	if (st->error || st->skip) return;
+	if (st->inBinData) {
+		if ((size_t) B64_DECODED_MAX (len) > st->decodedSize) {
+			free (st->decoded);
+			st->decodedSize = B64_DECODED_MAX (len);
+			if (! (st->decoded = (unsigned char *) malloc (st->decodedSize)) ) {
+				st->decodedSize = 0;
+				fail (st,"Could not allocate BinData buffer.");
+				return;
+			}
+		}
+		if ( (n = b64Decode (&st->b64,(const char *) ch,len,st->decoded)) < 0) {
+			fail (st,"BinData is not base64.");
+			return;
+		}
+		inflateBinData (st,st->decoded,n);
+		return;
+	}
+	closeTag (st);
+	writeEscaped (st->doc,ch,len,0);
+}
+
+static
+void comment (void *ctx, const xmlChar *value) {
+omexmlState *st = (omexmlState *) ctx;
+
+	if (st->error || st->skip || st->inBinData) return;
+	closeTag (st);
+	fprintf (st->doc,"<!--%s-->",(const char *) value);
+}
+
+static
+void processingInstruction (void *ctx, const xmlChar *target, const xmlChar *data) {
+omexmlState *st = (omexmlState *) ctx;
+
+	if (st->error || st->skip || st->inBinData) return;
+	closeTag (st);
+	fprintf (st->doc,"<?%s%s%s?>",(const char *) target,data ? " " : "",data ? (const char *) data : "");
+}
+
+/*
+  Runs the document through the parser, from memory or from a file (gzip
+  or plain).  Returns 0, or -1 (reported).
+*/
+static
+int parseDocument (omexmlState *st, const char *mem, size_t size, gzFile gz) {
+xmlSAXHandler handler;
+xmlErrorPtr xmlError;
+char *buf = NULL;
+size_t done = 0;
+int n, rc = 0;
+
+	memset (&handler,0,sizeof (handler));
+	handler.initialized = XML_SAX2_MAGIC;
+	handler.startElementNs = startElement;
+	handler.endElementNs = endElement;
+	handler.characters = characters;
+	handler.ignorableWhitespace = characters;
+	handler.cdataBlock = characters;
+	handler.comment = comment;
+	handler.processingInstruction = processingInstruction;
+	handler.serror = quietError;
+
+	st->doc = st->out;
+	st->fd = -1;
+	if (gz && ! (buf = (char *) malloc (OMEXML_CHUNK)) ) {
+		OMEIS_ReportError (st->method, NULL, (OID)0, "Could not allocate document buffer.");
+		return (-1);
+	}
+	if (! (st->stage = (unsigned char *) malloc (OMEXML_STAGE_SIZE)) ||
+		! (st->inflated = (unsigned char *) malloc (OMEXML_STAGE_SIZE)) ||
+		! (st->ctxt = xmlCreatePushParserCtxt (&handler,st,NULL,0,NULL)) ) {
+		OMEIS_ReportError (st->method, NULL, (OID)0, "Could not start the XML parser.");
+		free (buf);
+		free (st->stage);
+		free (st->inflated);
+		return (-1);
+	}
+	/* No network, no entity expansion, no limit on the size of a text node */
+	xmlCtxtUseOptions (st->ctxt,XML_PARSE_NONET | XML_PARSE_HUGE);
+
+	fputs ("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n",st->out);
+	while (!st->error && rc == 0) {
+		if (gz) {
+			if ( (n = gzread (gz,buf,OMEXML_CHUNK)) < 0) {
+				fail (st,"Could not read the document.");
+				break;
+			}
+			if (n == 0) break;
+			rc = xmlParseChunk (st->ctxt,buf,n,0);
+		} else {
+			if (done == size) break;
+			n = size - done < OMEXML_CHUNK ? size - done : OMEXML_CHUNK;
+			rc = xmlParseChunk (st->ctxt,mem + done,n,0);
+			done += n;
+		}
+	}
+	if (!st->error && rc == 0) rc = xmlParseChunk (st->ctxt,NULL,0,1);
+	if (!st->error && (rc != 0 || !st->ctxt->wellFormed)) {
+		xmlError = xmlCtxtGetLastError (st->ctxt);
+		fail (st,"The document is not well-formed XML: %s",xmlError && xmlError->message ? xmlError->message : "parse error");
+		st->message[strcspn (st->message,"\n")] = '\0';
+	}
+	fflush (st->out);
+
+	/* Whatever was left half-done */
+	if (st->inBinData && st->compression == OMEXML_BIN_ZLIB) inflateEnd (&st->zs);
+	if (st->inBinData && st->compression == OMEXML_BIN_BZIP2) BZ2_bzDecompressEnd (&st->bz);
+	if (st->heldBodyStream) fclose (st->heldBodyStream);
+	free (st->heldTag);
+	free (st->heldBody);
+	releasePixels (st);
+	xmlFreeParserCtxt (st->ctxt);
+	free (st->decoded);
+	free (st->stage);
+	free (st->inflated);
+	free (buf);
+
+	if (st->error) {
+		OMEIS_ReportError (st->method, NULL, (OID)0, "%s", st->message);
+		return (-1);
+	}
+	return (0);
+}
+
+/* OMEXML_BIN_NONE, _ZLIB or _BZIP2 for a BinData Compression value, or -1 */
+int parseBinCompression (const char *name) {
+	if (!strcasecmp (name,"none")) return (OMEXML_BIN_NONE);
+	if (!strcasecmp (name,"zlib")) return (OMEXML_BIN_ZLIB);
+	if (!strcasecmp (name,"bzip2")) return (OMEXML_BIN_BZIP2);
+	return (-1);
+}
+
+/*
+  The document is the request body (size bytes at doc), or with
+  isLocalFile, the file named by doc.  The result goes to stdout.
+  nThreads below 1 means one per CPU, up to OMEXML_MAX_THREADS.
+*/
+int exportOMEXML (const char *doc, size_t size, int isLocalFile, char bigEndian,
+	int compression, int nThreads, char *method) {
+omexmlState st;
+gzFile gz = NULL;
+long nCPU;
+int rc;
+
+	memset (&st,0,sizeof (st));
+	st.method = method;
+	st.bigEndian = bigEndian;
+	st.binCompression = compression;
+	if (nThreads < 1) {
+		nCPU = sysconf (_SC_NPROCESSORS_ONLN);
+		nThreads = nCPU < 1 ? 1 : nCPU > OMEXML_MAX_THREADS ? OMEXML_MAX_THREADS : (int) nCPU;
+	}
+	st.nThreads = nThreads > OMEXML_MAX_THREADS ? OMEXML_MAX_THREADS : nThreads;
+	st.out = stdout;
+	if (!doc) {
+		OMEIS_ReportError (method, NULL, (OID)0, "File parameter missing.");
+		return (-1);
+	}
+	if (isLocalFile && ! (gz = gzopen (doc,"rb")) ) {
+		OMEIS_ReportError (method, NULL, (OID)0, "Could not open %s.",doc);
+		return (-1);
+	}
+	rc = parseDocument (&st,doc,size,gz);
+	if (gz) gzclose (gz);
+	return (rc);
+}
+
+/* path is a repository file, plain or gzipped.  The result goes to stdout. */
+int importOMEXML (const char *path, char *method) {
+omexmlState st;
+gzFile gz;
+int rc;
+
+	memset (&st,0,sizeof (st));
+	st.method = method;
+	st.import = 1;
+	st.out = stdout;
+	if (! (gz = gzopen (path,"rb")) ) {
+		OMEIS_ReportError (method, NULL, (OID)0, "Could not open %s.",path);
+		return (-1);
+	}
+	rc = parseDocument (&st,NULL,0,gz);
+	gzclose (gz);
+	return (rc);
+}
@@ -0,0 +1,72 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifndef omexml_h
+#define omexml_h
+
+/*
+  Streaming OME-XML.  Both directions run the document through a SAX
+  parser a chunk at a time and write it back out as the events arrive,
+  so neither the document nor its pixels are ever held whole, and the
+  document isn't stored in the repository on the way through.
+
+  Export: each <Pixels ImageServerID="n"> gets the planes of Pixels n,
+  in its DimensionOrder, as <Bin:BinData> base64 read straight from the
+  repository, optionally zlib or bzip2 compressed.  Planes are encoded
+  by a pool of threads and sent in order.  SizeX-SizeT, PixelType and BigEndian are set from the
+  Pixels and the BigEndian parameter; ImageServerID and FileSHA1 are
+  dropped, and so is any BinData or External already there.
+
+  Import: the BinData in each <Pixels> is decoded (base64, then zlib or
+  bzip2 if it says so) straight into new repository Pixels, which are
+  finished when the element ends.  The BinData is left out of the
+  document sent back, and the Pixels element gets ImageServerID and
+  FileSHA1 attributes instead.  Only the Pixels start tag and its
+  non-BinData children are held until then.
+*/
+
+#define OMEXML_CHUNK       (64*1024)       /* document bytes per parser call */
+#define OMEXML_PLANE_CHUNK (3*64*1024)     /* pixel bytes per BinData write: a multiple of 3 and of any pixel */
+#define OMEXML_STAGE_SIZE  (1024*1024)     /* decoded pixel bytes gathered before a write */
+#define OMEXML_BIN_NS      "http://www.openmicroscopy.org/XMLschemas/BinaryFile/RC1/BinaryFile.xsd"
+
+#define OMEXML_BIN_NONE  0
+#define OMEXML_BIN_ZLIB  1
+#define OMEXML_BIN_BZIP2 2
+
+#define OMEXML_MAX_THREADS     16
+#define OMEXML_JOBS_PER_THREAD 2                   /* planes in flight per thread */
+#define OMEXML_MAX_IN_FLIGHT   (256*1024*1024)     /* encoded planes held waiting their turn */
+
+int parseBinCompression (const char *name);
+int exportOMEXML (const char *doc, size_t size, int isLocalFile, char bigEndian,
+	int compression, int nThreads, char *method);
+int importOMEXML (const char *path, char *method);
+
+#endif
@@ -0,0 +1,320 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif  /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+
+#include "Pixels.h"
+#include "stream.h"
+#include "pixread.h"
+
+/* Bytes at the start of a stream looked for in the page cache */
+#define PIXREAD_PROBE (64*1024)
+
+/*
+  A swapped stream's two buffers.  The reader thread fills them in turn;
+  the sender empties them in the same order.
+*/
+typedef struct {
+	int fd;
+	u_int64_t offset, end;
+	unsigned char *buf[2];
+	size_t len[2];
+	int full[2];
+	int eof, stop;
+	pthread_mutex_t lock;
+	pthread_cond_t filled, emptied;
+} pixReader;
+
+static
+int preadAll (int fd, unsigned char *p, size_t n, u_int64_t off) {
+ssize_t got;
+
+	while (n > 0) {
+		if ( (got = pread (fd,p,n,off)) <= 0) {
+			if (got < 0 && errno == EINTR) continue;
+			return (-1);
+		}
+		p += got;
+		n -= got;
+		off += got;
+	}
+	return (0);
+}
+
+/*
+  True if the len bytes at off (len at most PIXREAD_PROBE) are in the
+  page cache.  mincore() looks without reading anything; a read that
+  mustn't block would still start one, which is a round trip to a slow
+  disk.
+*/
+static
+int inCache (int fd, u_int64_t off, size_t len) {
+size_t page = sysconf (_SC_PAGESIZE), mapLength, nPages, i;
+u_int64_t mapStart = off - off % page;
+unsigned char vec[PIXREAD_PROBE / 4096 + 2];
+void *map;
+int cached;
+
+	mapLength = off + len - mapStart;
+	nPages = (mapLength + page - 1) / page;
+	if (!len || nPages > sizeof (vec)) return (0);
+	map = mmap (NULL,mapLength,PROT_READ,MAP_SHARED,fd,mapStart);
+	if (map == MAP_FAILED) return (0);
+	cached = mincore (map,mapLength,vec) == 0;
+	for (i = 0; cached && i < nPages; i++)
+		if (! (vec[i] & 1)) cached = 0;
+	munmap (map,mapLength);
+	return (cached);
+}
+
+/* Reads and sends length bytes a buffer at a time.  Returns the bytes sent */
+static
+u_int64_t copyRange (int fd, u_int64_t off, u_int64_t length, unsigned char *buf, size_t bufSize, FILE *out) {
+u_int64_t sent = 0;
+size_t n;
+
+	while (sent < length) {
+		n = length - sent < bufSize ? length - sent : bufSize;
+		if (preadAll (fd,buf,n,off + sent) < 0 || fwrite (buf,1,n,out) != n) break;
+		sent += n;
+	}
+	return (sent);
+}
+
+static
+void *readerThread (void *arg) {
+pixReader *r = (pixReader *) arg;
+u_int64_t off = r->offset;
+size_t n;
+int slot = 0, stop;
+
+	while (off < r->end) {
+		pthread_mutex_lock (&r->lock);
+		while (r->full[slot] && !r->stop)
+			pthread_cond_wait (&r->emptied,&r->lock);
+		stop = r->stop;
+		pthread_mutex_unlock (&r->lock);
+		if (stop) break;
+
+		n = r->end - off < PIXREAD_CHUNK ? r->end - off : PIXREAD_CHUNK;
+		if (preadAll (r->fd,r->buf[slot],n,off) < 0) break;
+		off += n;
+
+		pthread_mutex_lock (&r->lock);
+		r->len[slot] = n;
+		r->full[slot] = 1;
+		pthread_cond_signal (&r->filled);
+		pthread_mutex_unlock (&r->lock);
+		slot ^= 1;
+	}
+
+	pthread_mutex_lock (&r->lock);
+	r->eof = 1;
+	pthread_cond_signal (&r->filled);
+	pthread_mutex_unlock (&r->lock);
+	return (NULL);
+}
+
+/*
+  Sends what the reader thread reads, dropping each chunk from the page
+  cache once it has gone if drop is set.  Returns the bytes sent.
+*/
+static
+u_int64_t sendChunks (pixReader *r, FILE *out, int drop) {
+u_int64_t sent = 0;
+int slot = 0, failed;
+
+	for (;;) {
+		pthread_mutex_lock (&r->lock);
+		while (!r->full[slot] && !r->eof)
+			pthread_cond_wait (&r->filled,&r->lock);
+		if (!r->full[slot]) {
+			pthread_mutex_unlock (&r->lock);
+			break;
+		}
+		pthread_mutex_unlock (&r->lock);
+
+		failed = fwrite (r->buf[slot],1,r->len[slot],out) != r->len[slot];
+		if (!failed) {
+			if (drop) posix_fadvise (r->fd,r->offset + sent,r->len[slot],POSIX_FADV_DONTNEED);
+			sent += r->len[slot];
+		}
+
+		pthread_mutex_lock (&r->lock);
+		r->full[slot] = 0;
+		r->stop = failed;
+		pthread_cond_signal (&r->emptied);
+		pthread_mutex_unlock (&r->lock);
+		if (failed) break;
+		slot ^= 1;
+	}
+
+	return (sent);
+}
+
+/*
+  A stream through a swap filter: the file is read by a second thread
+  while this one swaps and sends.  With one CPU there is nothing for the
+  thread to overlap (the kernel reads ahead of a sequential pread on its
+  own), so, as without the thread or the second buffer, the file is read
+  and sent in turn.  Returns the bytes sent, or -1 with nothing sent if
+  there is no buffer.
+*/
+static
+long long readAhead (int fd, u_int64_t offset, u_int64_t length, FILE *out, int drop) {
+pixReader r;
+pthread_t thread;
+u_int64_t sent;
+
+	memset (&r,0,sizeof (r));
+	r.fd = fd;
+	r.offset = offset;
+	r.end = offset + length;
+	if (! (r.buf[0] = (unsigned char *) malloc (PIXREAD_CHUNK)) ) return (-1);
+	if (sysconf (_SC_NPROCESSORS_ONLN) > 1)
+		r.buf[1] = (unsigned char *) malloc (PIXREAD_CHUNK);
+
+	pthread_mutex_init (&r.lock,NULL);
+	pthread_cond_init (&r.filled,NULL);
+	pthread_cond_init (&r.emptied,NULL);
+	if (r.buf[1] && pthread_create (&thread,NULL,readerThread,&r) == 0) {
+		sent = sendChunks (&r,out,drop);
+		pthread_join (thread,NULL);
+	} else {
+		sent = copyRange (fd,offset,length,r.buf[0],PIXREAD_CHUNK,out);
+		if (drop) posix_fadvise (fd,offset,sent,POSIX_FADV_DONTNEED);
+	}
+	pthread_cond_destroy (&r.emptied);
+	pthread_cond_destroy (&r.filled);
+	pthread_mutex_destroy (&r.lock);
+
+	free (r.buf[1]);
+	free (r.buf[0]);
+	return (sent);
+}
+
+/* A cached stream through a swap filter, written from a map of the file */
+static
+long long sendMapped (int fd, u_int64_t offset, u_int64_t length, FILE *out) {
+u_int64_t mapStart = offset - offset % sysconf (_SC_PAGESIZE), sent;
+unsigned char *map;
+
+	map = (unsigned char *) mmap (NULL,offset + length - mapStart,PROT_READ,MAP_SHARED,fd,mapStart);
+	if (map == (unsigned char *) MAP_FAILED) return (-1);
+	sent = fwrite (map + (offset - mapStart),1,length,out);
+	munmap (map,offset + length - mapStart);
+	return (sent);
+}
+
+/*
+  Sends cached data as it is: straight to the client with streamFD(), or
+  written from a map of the file if it has to be swapped.  Returns the
+  bytes sent, or -1 if nothing could be.
+*/
+static
+long long sendCached (int fd, u_int64_t offset, u_int64_t length, FILE *out) {
+ssize_t n;
+
+	if (fileno (out) < 0) return (sendMapped (fd,offset,length,out));
+	return ( (n = streamFD (out,fd,offset,length)) > 0 ? n : -1);
+}
+
+/*
+  A stream: sequential, and dropped behind if it is big and was cold.
+  Cold, it is read in large preads, which the disk sees as large reads.
+*/
+static
+long long streamPixels (int fd, u_int64_t offset, u_int64_t length, FILE *out) {
+long long sent = -1;
+int cached;
+
+	posix_fadvise (fd,offset,length,POSIX_FADV_SEQUENTIAL);
+	cached = inCache (fd,offset,length < PIXREAD_PROBE ? length : PIXREAD_PROBE);
+
+	if (cached) sent = sendCached (fd,offset,length,out);
+	if (sent < 0)
+		/* Data that was already cached is someone else's too, so it stays */
+		sent = readAhead (fd,offset,length,out,!cached && length >= PIXREAD_DROP_MIN);
+	return (sent);
+}
+
+/*
+  Reads nPix pixels from byte offset of the plain Pixels file to out.
+  Returns the number of pixels sent, or -1 without touching out if the
+  file can't be opened, is too short, or there is no memory to read it
+  with; the caller should then use DoPixelIO.
+*/
+long long readPixels (PixelsRep *thePixels, size_t offset, size_t nPix, FILE *out) {
+u_int64_t length = (u_int64_t) nPix * thePixels->head->bp;
+long long sent = 0;
+char path[MAXPATHLEN];
+unsigned char *buf;
+struct stat fStat;
+int fd;
+
+	strcpy (path,"Pixels/");
+	if (! getRepPath (thePixels->ID,path,0)) return (-1);
+	if ( (fd = open (path,O_RDONLY)) < 0) return (-1);
+	if (fstat (fd,&fStat) != 0 || (u_int64_t) fStat.st_size < offset + length) {
+		close (fd);
+		return (-1);
+	}
+
+	if (length >= PIXREAD_STREAM_MIN)
+		sent = streamPixels (fd,offset,length,out);
+	else if (length) {
+		sent = -1;
+		if (inCache (fd,offset,length < PIXREAD_PROBE ? length : PIXREAD_PROBE))
+			sent = sendCached (fd,offset,length,out);
+		if (sent < 0 && (buf = (unsigned char *) malloc (length)) ) {
+			/* A plane or a few rows, not cached: one read, and nothing after it */
+			posix_fadvise (fd,0,0,POSIX_FADV_RANDOM);
+			sent = copyRange (fd,offset,length,buf,length,out);
+			free (buf);
+		}
+	}
+
+	close (fd);
+	/* Nothing sent, so nothing lost: DoPixelIO can still try */
+	if (length && sent <= 0) return (-1);
+	return (sent / thePixels->head->bp);
+}
@@ -0,0 +1,63 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifndef pixread_h
+#define pixread_h
+
+#include <stdio.h>
+#include "Pixels.h"
+
+/*
+  Reads of the plain Pixels file (GetPixels, GetStack, GetPlane, GetRows
+  and byte ranges of them), sorted by size, each with the hints and the
+  read pattern that suit it:
+    - a stream, at least PIXREAD_STREAM_MIN contiguous bytes, is marked
+      sequential.  If it isn't cached, it is read PIXREAD_CHUNK at a time
+      with pread(), which the disk sees as large reads, and with more
+      than one CPU a reader thread fills one of two buffers while the
+      other is swapped and sent.  Streams of PIXREAD_DROP_MIN or more are
+      then dropped from the page cache as they are sent, so one big export
+      doesn't push out everything else.  One that is already cached goes
+      straight to the client with streamFD(), or is written from a map of
+      the file if it has to be swapped;
+    - anything shorter (a plane, some rows) is marked random and read
+      with one pread(), so a cold plane is a few large disk reads rather
+      than one per readahead window, and nothing past it is read.
+  Asking for the data with POSIX_FADV_WILLNEED instead is no good on a
+  slow device: the kernel splits it into readahead-sized requests.
+  Strided reads (ROIs) are planned and prefetched in roiio.c.
+*/
+
+#define PIXREAD_STREAM_MIN  (8*1024*1024)
+#define PIXREAD_DROP_MIN    (64*1024*1024)
+#define PIXREAD_CHUNK       (4*1024*1024)
+
+long long readPixels (PixelsRep *thePixels, size_t offset, size_t nPix, FILE *out);
+
+#endif
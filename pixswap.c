@@ -0,0 +1,275 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif  /* HAVE_CONFIG_H */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  /* fopencookie() */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SWAP_X86 1
+#include <immintrin.h>
+#endif
+
+#include "Pixels.h"
+#include "pixswap.h"
+
+typedef void (*swap_kernel)(unsigned char *buf, size_t nPix);
+
+static
+void swap16_scalar (unsigned char *buf, size_t nPix) {
+u_int16_t v;
+size_t i;
+
+	for (i = 0; i < nPix; i++, buf += 2) {
+		memcpy (&v,buf,2);
+		v = __builtin_bswap16 (v);
+		memcpy (buf,&v,2);
+	}
+}
+
+static
+void swap32_scalar (unsigned char *buf, size_t nPix) {
+u_int32_t v;
+size_t i;
+
+	for (i = 0; i < nPix; i++, buf += 4) {
+		memcpy (&v,buf,4);
+		v = __builtin_bswap32 (v);
+		memcpy (buf,&v,4);
+	}
+}
+
+#ifdef SWAP_X86
+
+__attribute__((target("ssse3")))
+static
+void swap16_ssse3 (unsigned char *buf, size_t nPix) {
+__m128i mask = _mm_setr_epi8 (1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14);
+size_t i;
+
+	for (i = 0; i + 8 <= nPix; i += 8, buf += 16)
+		_mm_storeu_si128 ((__m128i *)buf, _mm_shuffle_epi8 (_mm_loadu_si128 ((__m128i *)buf),mask));
+	swap16_scalar (buf,nPix - i);
+}
+
+__attribute__((target("ssse3")))
+static
+void swap32_ssse3 (unsigned char *buf, size_t nPix) {
+__m128i mask = _mm_setr_epi8 (3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12);
+size_t i;
+
+	for (i = 0; i + 4 <= nPix; i += 4, buf += 16)
+		_mm_storeu_si128 ((__m128i *)buf, _mm_shuffle_epi8 (_mm_loadu_si128 ((__m128i *)buf),mask));
+	swap32_scalar (buf,nPix - i);
+}
+
+__attribute__((target("avx2")))
+static
+void swap16_avx2 (unsigned char *buf, size_t nPix) {
+__m256i mask = _mm256_setr_epi8 (1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14,
+	1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14);
+size_t i;
+
+	for (i = 0; i + 32 <= nPix; i += 32, buf += 64) {
+		_mm256_storeu_si256 ((__m256i *)buf, _mm256_shuffle_epi8 (_mm256_loadu_si256 ((__m256i *)buf),mask));
+		_mm256_storeu_si256 ((__m256i *)(buf+32), _mm256_shuffle_epi8 (_mm256_loadu_si256 ((__m256i *)(buf+32)),mask));
+	}
+	swap16_ssse3 (buf,nPix - i);
+}
+
+__attribute__((target("avx2")))
+static
+void swap32_avx2 (unsigned char *buf, size_t nPix) {
+__m256i mask = _mm256_setr_epi8 (3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12,
+	3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12);
+size_t i;
+
+	for (i = 0; i + 16 <= nPix; i += 16, buf += 64) {
+		_mm256_storeu_si256 ((__m256i *)buf, _mm256_shuffle_epi8 (_mm256_loadu_si256 ((__m256i *)buf),mask));
+		_mm256_storeu_si256 ((__m256i *)(buf+32), _mm256_shuffle_epi8 (_mm256_loadu_si256 ((__m256i *)(buf+32)),mask));
+	}
+	swap32_ssse3 (buf,nPix - i);
+}
+
+#endif /* SWAP_X86 */
+
+static swap_kernel swap16 = NULL, swap32 = NULL;
+static const char *kernelName = "scalar";
+
+/* Racing callers all pick the same kernels, so no locking is needed */
+static
+void selectKernels (void) {
+swap_kernel k16 = swap16_scalar, k32 = swap32_scalar;
+
+#ifdef SWAP_X86
+	__builtin_cpu_init ();
+	if (__builtin_cpu_supports ("avx2")) {
+		k16 = swap16_avx2;
+		k32 = swap32_avx2;
+		kernelName = "avx2";
+	} else if (__builtin_cpu_supports ("ssse3")) {
+		k16 = swap16_ssse3;
+		k32 = swap32_ssse3;
+		kernelName = "ssse3";
+	}
+#endif
+	swap32 = k32;
+	swap16 = k16;
+}
+
+const char *swapKernelName (void) {
+	if (!swap16) selectKernels ();
+	return (kernelName);
+}
+
+void swapPixels (void *buf, size_t nPix, size_t bp) {
+unsigned char *p = (unsigned char *) buf, tmp;
+size_t i, j;
+
+	if (!swap16) selectKernels ();
+
+	if (bp == 2) swap16 (p,nPix);
+	else if (bp == 4) swap32 (p,nPix);
+	else if (bp > 1) {
+		for (i = 0; i < nPix; i++, p += bp)
+			for (j = 0; j < bp/2; j++) {
+				tmp = p[j];
+				p[j] = p[bp-1-j];
+				p[bp-1-j] = tmp;
+			}
+	}
+}
+
+int swapNeeded (char iam_BigEndian, size_t bp) {
+	return (bp > 1 && !iam_BigEndian != !bigEndian());
+}
+
+/*
+  Swap filters.  The writer copies what it is given into its own buffer
+  (the caller's is const), swaps whole pixels and passes them on, holding
+  back a partial pixel until the rest of it arrives.  The reader swaps in
+  place in the buffer stdio hands it, which is made SWAP_BUF_SIZE so the
+  kernels get large batches.  Closing a filter doesn't close the stream
+  it wraps.
+*/
+typedef struct {
+	FILE *stream;
+	size_t bp;
+	size_t held;
+	unsigned char *buf;
+} swapFilter;
+
+static
+ssize_t swapFilterWrite (void *cookie, const char *data, size_t size) {
+swapFilter *filter = (swapFilter *) cookie;
+size_t left = size, n, nPix;
+
+	while (left) {
+		n = SWAP_BUF_SIZE - filter->held;
+		if (n > left) n = left;
+		memcpy (filter->buf + filter->held,data,n);
+		data += n;
+		left -= n;
+		n += filter->held;
+
+		nPix = n / filter->bp;
+		swapPixels (filter->buf,nPix,filter->bp);
+		if (fwrite (filter->buf,filter->bp,nPix,filter->stream) != nPix) return (-1);
+		filter->held = n - nPix*filter->bp;
+		memmove (filter->buf,filter->buf + nPix*filter->bp,filter->held);
+	}
+	return (size);
+}
+
+static
+ssize_t swapFilterRead (void *cookie, char *data, size_t size) {
+swapFilter *filter = (swapFilter *) cookie;
+size_t n;
+
+	if (size >= filter->bp) size -= size % filter->bp;
+	n = fread (data,1,size,filter->stream);
+	swapPixels (data,n / filter->bp,filter->bp);
+	return (n);
+}
+
+static
+int swapFilterClose (void *cookie) {
+swapFilter *filter = (swapFilter *) cookie;
+int result = 0;
+
+	/* A trailing partial pixel can't be swapped; send it as it is */
+	if (filter->held && fwrite (filter->buf,1,filter->held,filter->stream) != filter->held)
+		result = -1;
+	free (filter->buf);
+	free (filter);
+	return (result);
+}
+
+static
+FILE *openSwapFilter (FILE *stream, size_t bp, const char *mode) {
+swapFilter *filter;
+cookie_io_functions_t funcs;
+FILE *swapStream;
+
+	if (! (filter = (swapFilter *) calloc (1,sizeof (swapFilter))) ) return (NULL);
+	filter->stream = stream;
+	filter->bp = bp;
+	if (*mode == 'w' && ! (filter->buf = (unsigned char *) malloc (SWAP_BUF_SIZE)) ) {
+		free (filter);
+		return (NULL);
+	}
+
+	memset (&funcs,0,sizeof (funcs));
+	if (*mode == 'w') funcs.write = swapFilterWrite;
+	else funcs.read = swapFilterRead;
+	funcs.close = swapFilterClose;
+	if (! (swapStream = fopencookie (filter,mode,funcs)) ) {
+		free (filter->buf);
+		free (filter);
+		return (NULL);
+	}
+	setvbuf (swapStream,NULL,_IOFBF,SWAP_BUF_SIZE);
+	return (swapStream);
+}
+
+FILE *openSwapWriter (FILE *out, size_t bp) {
+	return (openSwapFilter (out,bp,"w"));
+}
+
+FILE *openSwapReader (FILE *in, size_t bp) {
+	return (openSwapFilter (in,bp,"r"));
+}
@@ -0,0 +1,52 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifndef pixswap_h
+#define pixswap_h
+
+#include <stdio.h>
+#include <sys/types.h>
+
+/*
+  Byte-swapping for clients whose endianness differs from the server's.
+  Rather than have DoPixelIO() swap pixel by pixel, the PixelsRep is
+  opened in native order and the stream it reads or writes is wrapped in
+  a filter that swaps SWAP_BUF_SIZE batches with the widest kernel the
+  CPU has.
+*/
+
+#define SWAP_BUF_SIZE (1024*1024)
+
+void swapPixels (void *buf, size_t nPix, size_t bp);
+const char *swapKernelName (void);
+int swapNeeded (char iam_BigEndian, size_t bp);
+FILE *openSwapWriter (FILE *out, size_t bp);
+FILE *openSwapReader (FILE *in, size_t bp);
+
+#endif
@@ -0,0 +1,203 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif  /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Pixels.h"
+#include "OMEIS_Error.h"
+#include "cgi.h"
+#include "byteorder.h"
+#include "planes.h"
+#include "pixswap.h"
+
+/*
+  Parses one coordinate of a plane spec: "n", "n-m" or "*" (all of them).
+  Returns 0, or -1 if it's malformed or outside 0..max-1.
+*/
+int
+parseCoordRange (char *spec, int max, int *from, int *to)
+{
+	char *end;
+
+	while (*spec == ' ') spec++;
+	if (!strcmp (spec,"*")) {
+		*from = 0;
+		*to = max - 1;
+		return (0);
+	}
+
+	*from = *to = (int) strtol (spec, &end, 10);
+	if (end == spec) return (-1);
+	if (*end == '-') {
+		spec = end + 1;
+		*to = (int) strtol (spec, &end, 10);
+		if (end == spec) return (-1);
+	}
+	while (*end == ' ') end++;
+	if (*end) return (-1);
+
+	return (*from < 0 || *to < *from || *to >= max ? -1 : 0);
+}
+
+/*
+  Planes=z,c,t;z,c,t;...  where each of z, c and t is a number, a range
+  n-m or *.  For example Planes=*,0,0-9 is the first ten stacks of channel 0.
+*/
+int
+getPlanes (char **param, method_params *m_params)
+{
+	PixelsRep *thePixels;
+	pixHeader *head;
+	char *method = "GetPlanes";
+	char *spec, *tuple, *coord[3], *save1, *save2;
+	char *wanted;
+	unsigned char *frame, *p;
+	size_t nTotal, nWanted, plane, run, nPix;
+	int z, c, t, z0, z1, c0, c1, t0, t1;
+	OID ID = m_params->pixelsID;
+
+	if ( !(spec = m_params->values[MPV_PLANES]) ) {
+		OMEIS_ReportError (method, "PixelsID", ID, "Planes parameter missing");
+		return (-1);
+	}
+
+	/* Opened in our own byte order; a swap filter on stdout does the rest */
+	if (! (thePixels = GetPixelsRep (ID,'r',bigEndian())) ) {
+		OMEIS_ReportError (method, "PixelsID", ID, "GetPixelsRep failed.");
+		return (-1);
+	}
+	head = thePixels->head;
+
+	nTotal = (size_t)head->dz * head->dc * head->dt;
+	if (! (wanted = (char *) calloc (nTotal,1)) ) {
+		OMEIS_ReportError (method, "PixelsID", ID, "Could not allocate plane list");
+		freePixelsRep (thePixels);
+		return (-1);
+	}
+
+	/* Mark the requested planes by their index in the file */
+	for (tuple = strtok_r (spec,";",&save1); tuple; tuple = strtok_r (NULL,";",&save1)) {
+		coord[0] = strtok_r (tuple,",",&save2);
+		coord[1] = strtok_r (NULL,",",&save2);
+		coord[2] = strtok_r (NULL,",",&save2);
+		if (!coord[2] || strtok_r (NULL,",",&save2) ||
+			parseCoordRange (coord[0],head->dz,&z0,&z1) ||
+			parseCoordRange (coord[1],head->dc,&c0,&c1) ||
+			parseCoordRange (coord[2],head->dt,&t0,&t1)) {
+			OMEIS_ReportError (method, "PixelsID", ID,
+				"Planes improperly formed.  Expecting z,c,t;... with each a number, a range n-m or *, in range (%d,%d,%d).",
+				head->dz-1,head->dc-1,head->dt-1);
+			free (wanted);
+			freePixelsRep (thePixels);
+			return (-1);
+		}
+
+		for (t = t0; t <= t1; t++)
+			for (c = c0; c <= c1; c++)
+				for (z = z0; z <= z1; z++)
+					wanted[((size_t)t*head->dc + c)*head->dz + z] = 1;
+	}
+
+	for (nWanted = 0, plane = 0; plane < nTotal; plane++)
+		if (wanted[plane]) nWanted++;
+	if (!nWanted) {
+		OMEIS_ReportError (method, "PixelsID", ID, "No planes requested");
+		free (wanted);
+		freePixelsRep (thePixels);
+		return (-1);
+	}
+
+	if (! (frame = (unsigned char *) malloc (32 + nWanted*12)) ) {
+		OMEIS_ReportError (method, "PixelsID", ID, "Could not allocate plane list");
+		free (wanted);
+		freePixelsRep (thePixels);
+		return (-1);
+	}
+
+	nPix = (size_t)head->dx * head->dy;
+	memcpy (frame,PLANES_MAGIC,4);
+	p = put32 (frame + 4, PLANES_VERSION);
+	p = put32 (p, nWanted);
+	p = put32 (p, head->dx);
+	p = put32 (p, head->dy);
+	p = put32 (p, head->bp);
+	p = put64 (p, (u_int64_t)nPix*head->bp);
+	for (plane = 0; plane < nTotal; plane++) {
+		if (!wanted[plane]) continue;
+		p = put32 (p, plane % head->dz);
+		p = put32 (p, (plane / head->dz) % head->dc);
+		p = put32 (p, plane / ((size_t)head->dz * head->dc));
+	}
+
+	thePixels->IO_stream = stdout;
+	if ( swapNeeded (m_params->iam_BigEndian,head->bp) &&
+		! (thePixels->IO_stream = openSwapWriter (stdout,head->bp)) ) {
+		OMEIS_ReportError (method, "PixelsID", ID, "Could not set up byte swapping");
+		free (frame);
+		free (wanted);
+		freePixelsRep (thePixels);
+		return (-1);
+	}
+
+	HTTP_ResultType ("application/octet-stream");
+	fwrite (frame,1,p - frame,stdout);
+	free (frame);
+
+	/*
+	  Planes that are next to each other in the file are read with a single
+	  DoPixelIO call, so a run of them is one sequential read.
+	*/
+	for (plane = 0; plane < nTotal; plane += run) {
+		if (!wanted[plane]) {
+			run = 1;
+			continue;
+		}
+		for (run = 1; plane + run < nTotal && wanted[plane + run]; run++);
+
+		z = plane % head->dz;
+		c = (plane / head->dz) % head->dc;
+		t = plane / ((size_t)head->dz * head->dc);
+		DoPixelIO (thePixels, GetOffset (thePixels, 0, 0, z, c, t), nPix*run, 'r');
+	}
+
+	if (thePixels->IO_stream != stdout) {
+		fclose (thePixels->IO_stream);
+		thePixels->IO_stream = stdout;
+	}
+	free (wanted);
+	freePixelsRep (thePixels);
+
+	return (0);
+}
@@ -0,0 +1,57 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifndef planes_h
+#define planes_h
+
+#include "method.h"
+
+/*
+  GetPlanes response framing.  All fields are little-endian:
+
+    char      magic[4]      "OMEP"
+    u_int32_t version       PLANES_VERSION
+    u_int32_t nPlanes
+    u_int32_t sizeX, sizeY
+    u_int32_t bytesPerPixel
+    u_int64_t bytesPerPlane
+    u_int32_t theZ, theC, theT    (nPlanes times)
+
+  followed by the pixels of each plane, in the same order as the list.
+  Planes are listed once each, in the order they are stored (Z fastest,
+  then C, then T), whatever order they were requested in.
+*/
+
+#define PLANES_MAGIC    "OMEP"
+#define PLANES_VERSION  1
+
+int parseCoordRange (char *spec, int max, int *from, int *to);
+int getPlanes (char **param, method_params *m_params);
+
+#endif
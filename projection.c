@@ -0,0 +1,447 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif  /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PROJ_X86 1
+#include <immintrin.h>
+#endif
+
+#include "Pixels.h"
+#include "OMEIS_Error.h"
+#include "cgi.h"
+#include "method.h"
+#include "planes.h"
+#include "pixswap.h"
+#include "projection.h"
+
+#define PROJ_MAX   0
+#define PROJ_MIN   1
+#define PROJ_MEAN  2
+#define PROJ_SUM   3
+
+/* Pixel types, as indexes into the kernel tables */
+#define PT_U8   0
+#define PT_S8   1
+#define PT_U16  2
+#define PT_S16  3
+#define PT_U32  4
+#define PT_S32  5
+#define PT_F32  6
+#define PT_NUM  7
+
+/* Bytes per vector in the portable kernels; on x86 each is a pair of SSE2 registers */
+#define PROJ_VEC 32
+
+/* Sums of 1 and 2 byte pixels fit in 32 bits for up to this many planes */
+#define PROJ_MAX_NARROW 65536
+
+/*
+  The kernels fold one plane into the accumulator plane.  The portable ones
+  are written with GCC vector extensions; the sums are built again for AVX2,
+  and max and min get AVX2 versions with the native vpmax/vpmin (the
+  compare-and-select the vector extensions give takes four instructions).
+*/
+typedef void (*fold_kernel) (void *acc, const void *plane, size_t n);
+
+#define PROJ_SELECT(T, IT, name, isa, ATTR, fn, cmp) \
+ATTR static void fn##_##name##_##isa (void *accp, const void *inp, size_t n) { \
+	typedef T vec __attribute__ ((vector_size (PROJ_VEC))); \
+	typedef IT ivec __attribute__ ((vector_size (PROJ_VEC))); \
+	T *acc = (T *) accp; \
+	const T *in = (const T *) inp; \
+	size_t i = 0; \
+	vec a, b; \
+	ivec m; \
+	for (; i + PROJ_VEC / sizeof (T) <= n; i += PROJ_VEC / sizeof (T)) { \
+		memcpy (&a,acc + i,PROJ_VEC); \
+		memcpy (&b,in + i,PROJ_VEC); \
+		m = b cmp a; \
+		a = (vec) (((ivec) b & m) | ((ivec) a & ~m)); \
+		memcpy (acc + i,&a,PROJ_VEC); \
+	} \
+	for (; i < n; i++) \
+		if (in[i] cmp acc[i]) acc[i] = in[i]; \
+}
+
+#define PROJ_ADD(T, A, name, isa, ATTR) \
+ATTR static void sum_##name##_##isa (void *accp, const void *inp, size_t n) { \
+	typedef A avec __attribute__ ((vector_size (PROJ_VEC))); \
+	typedef T tvec __attribute__ ((vector_size (PROJ_VEC / sizeof (A) * sizeof (T)))); \
+	A *acc = (A *) accp; \
+	const T *in = (const T *) inp; \
+	size_t i = 0; \
+	avec a; \
+	tvec t; \
+	for (; i + PROJ_VEC / sizeof (A) <= n; i += PROJ_VEC / sizeof (A)) { \
+		memcpy (&a,acc + i,sizeof (a)); \
+		memcpy (&t,in + i,sizeof (t)); \
+		a += __builtin_convertvector (t,avec); \
+		memcpy (acc + i,&a,sizeof (a)); \
+	} \
+	for (; i < n; i++) \
+		acc[i] += in[i]; \
+}
+
+#define PROJ_TYPE(T, IT, name, isa, ATTR) \
+	PROJ_SELECT (T, IT, name, isa, ATTR, max, >) \
+	PROJ_SELECT (T, IT, name, isa, ATTR, min, <)
+
+#define PROJ_SUMS(isa, ATTR) \
+	PROJ_ADD (u_int8_t,  u_int32_t, u8,   isa, ATTR) \
+	PROJ_ADD (int8_t,    int32_t,   s8,   isa, ATTR) \
+	PROJ_ADD (u_int16_t, u_int32_t, u16,  isa, ATTR) \
+	PROJ_ADD (int16_t,   int32_t,   s16,  isa, ATTR) \
+	PROJ_ADD (u_int8_t,  u_int64_t, u8w,  isa, ATTR) \
+	PROJ_ADD (int8_t,    int64_t,   s8w,  isa, ATTR) \
+	PROJ_ADD (u_int16_t, u_int64_t, u16w, isa, ATTR) \
+	PROJ_ADD (int16_t,   int64_t,   s16w, isa, ATTR) \
+	PROJ_ADD (u_int32_t, u_int64_t, u32w, isa, ATTR) \
+	PROJ_ADD (int32_t,   int64_t,   s32w, isa, ATTR) \
+	PROJ_ADD (float,     double,    f32w, isa, ATTR)
+
+#define PROJ_TABLES(isa) \
+	static const fold_kernel max_##isa[PT_NUM] = { \
+		max_u8_##isa, max_s8_##isa, max_u16_##isa, max_s16_##isa, max_u32_##isa, max_s32_##isa, max_f32_##isa }; \
+	static const fold_kernel min_##isa[PT_NUM] = { \
+		min_u8_##isa, min_s8_##isa, min_u16_##isa, min_s16_##isa, min_u32_##isa, min_s32_##isa, min_f32_##isa }; \
+	static const fold_kernel sum_##isa[PT_NUM] = { \
+		sum_u8_##isa, sum_s8_##isa, sum_u16_##isa, sum_s16_##isa, NULL, NULL, NULL }; \
+	static const fold_kernel sumw_##isa[PT_NUM] = { \
+		sum_u8w_##isa, sum_s8w_##isa, sum_u16w_##isa, sum_s16w_##isa, sum_u32w_##isa, sum_s32w_##isa, sum_f32w_##isa };
+
+PROJ_TYPE (u_int8_t,  int8_t,  u8,  base, )
+PROJ_TYPE (int8_t,    int8_t,  s8,  base, )
+PROJ_TYPE (u_int16_t, int16_t, u16, base, )
+PROJ_TYPE (int16_t,   int16_t, s16, base, )
+PROJ_TYPE (u_int32_t, int32_t, u32, base, )
+PROJ_TYPE (int32_t,   int32_t, s32, base, )
+PROJ_TYPE (float,     int32_t, f32, base, )
+PROJ_SUMS (base, )
+PROJ_TABLES (base)
+
+#ifdef PROJ_X86
+/* PT is what the load and store take a pointer to */
+#define PROJ_AVX2_SELECT(T, name, fn, cmp, op, PT, LOAD, STORE) \
+__attribute__ ((target ("avx2"))) static void fn##_##name##_avx2 (void *accp, const void *inp, size_t n) { \
+	T *acc = (T *) accp; \
+	const T *in = (const T *) inp; \
+	size_t i = 0; \
+	for (; i + 32 / sizeof (T) <= n; i += 32 / sizeof (T)) \
+		STORE ((PT *)(acc + i),op (LOAD ((const PT *)(in + i)),LOAD ((const PT *)(acc + i)))); \
+	for (; i < n; i++) \
+		if (in[i] cmp acc[i]) acc[i] = in[i]; \
+}
+
+#define PROJ_AVX2_INT(T, name, epi) \
+	PROJ_AVX2_SELECT (T, name, max, >, _mm256_max_##epi, __m256i, _mm256_loadu_si256, _mm256_storeu_si256) \
+	PROJ_AVX2_SELECT (T, name, min, <, _mm256_min_##epi, __m256i, _mm256_loadu_si256, _mm256_storeu_si256)
+
+PROJ_AVX2_INT (u_int8_t,  u8,  epu8)
+PROJ_AVX2_INT (int8_t,    s8,  epi8)
+PROJ_AVX2_INT (u_int16_t, u16, epu16)
+PROJ_AVX2_INT (int16_t,   s16, epi16)
+PROJ_AVX2_INT (u_int32_t, u32, epu32)
+PROJ_AVX2_INT (int32_t,   s32, epi32)
+PROJ_AVX2_SELECT (float, f32, max, >, _mm256_max_ps, float, _mm256_loadu_ps, _mm256_storeu_ps)
+PROJ_AVX2_SELECT (float, f32, min, <, _mm256_min_ps, float, _mm256_loadu_ps, _mm256_storeu_ps)
+PROJ_SUMS (avx2, __attribute__ ((target ("avx2"))))
+PROJ_TABLES (avx2)
+#endif
+
+static const fold_kernel *kernelMax, *kernelMin, *kernelSum, *kernelSumWide;
+static const char *kernelName;
+
+static void
+selectKernels (void)
+{
+	kernelMax = max_base;
+	kernelMin = min_base;
+	kernelSum = sum_base;
+	kernelSumWide = sumw_base;
+	kernelName = "base";
+
+#ifdef PROJ_X86
+	kernelName = "sse2";
+	__builtin_cpu_init ();
+	if (__builtin_cpu_supports ("avx2")) {
+		kernelMax = max_avx2;
+		kernelMin = min_avx2;
+		kernelSum = sum_avx2;
+		kernelSumWide = sumw_avx2;
+		kernelName = "avx2";
+	}
+#endif
+}
+
+const char *
+projKernelName (void)
+{
+	if (!kernelName) selectKernels ();
+	return (kernelName);
+}
+
+static int
+pixelType (pixHeader *head)
+{
+	if (head->isFloat) return (PT_F32);
+	if (head->bp == 1) return (head->isSigned ? PT_S8 : PT_U8);
+	if (head->bp == 2) return (head->isSigned ? PT_S16 : PT_U16);
+	return (head->isSigned ? PT_S32 : PT_U32);
+}
+
+/* Integer mean rounded half up, i.e. floor ((2*sum + count) / (2*count)) */
+static int64_t
+roundMean (int64_t sum, int64_t count)
+{
+	int64_t num = 2*sum + count, den = 2*count, q = num / den;
+
+	return (num % den && num < 0 ? q - 1 : q);
+}
+
+#define MEAN_LOOP(A, T) { \
+	A *a = (A *) acc; \
+	T *o = (T *) acc; \
+	for (i = 0; i < n; i++) o[i] = (T) roundMean ((int64_t) a[i],count); \
+}
+
+#define SUM_LOOP(A, T, clamp) { \
+	A *a = (A *) acc; \
+	T *o = (T *) acc; \
+	for (i = 0; i < n; i++) o[i] = (T) (clamp); \
+}
+
+/*
+  Turns the sums in acc into the result, in place: the result never has
+  wider pixels than the accumulator, so each one lands at or before the
+  sum it came from.
+*/
+static void
+finishPlane (void *acc, size_t n, int type, int wide, int op, int64_t count)
+{
+	size_t i;
+
+	if (type == PT_F32) {
+		double *a = (double *) acc;
+		float *o = (float *) acc;
+		for (i = 0; i < n; i++) o[i] = (float) (op == PROJ_MEAN ? a[i] / count : a[i]);
+		return;
+	}
+
+	if (op == PROJ_MEAN) {
+		if (wide) switch (type) {
+			case PT_U8:  MEAN_LOOP (u_int64_t, u_int8_t);  break;
+			case PT_S8:  MEAN_LOOP (int64_t,   int8_t);    break;
+			case PT_U16: MEAN_LOOP (u_int64_t, u_int16_t); break;
+			case PT_S16: MEAN_LOOP (int64_t,   int16_t);   break;
+			case PT_U32: MEAN_LOOP (u_int64_t, u_int32_t); break;
+			case PT_S32: MEAN_LOOP (int64_t,   int32_t);   break;
+		} else switch (type) {
+			case PT_U8:  MEAN_LOOP (u_int32_t, u_int8_t);  break;
+			case PT_S8:  MEAN_LOOP (int32_t,   int8_t);    break;
+			case PT_U16: MEAN_LOOP (u_int32_t, u_int16_t); break;
+			case PT_S16: MEAN_LOOP (int32_t,   int16_t);   break;
+		}
+		return;
+	}
+
+	/* Sums go out as 4-byte pixels; 32-bit sums are that already */
+	if (wide) {
+		if (type == PT_U8 || type == PT_U16 || type == PT_U32)
+			SUM_LOOP (u_int64_t, u_int32_t, a[i] > UINT32_MAX ? UINT32_MAX : a[i])
+		else
+			SUM_LOOP (int64_t, int32_t, a[i] > INT32_MAX ? INT32_MAX : a[i] < INT32_MIN ? INT32_MIN : a[i])
+	}
+}
+
+/* Where the planes come from: a map of the plain file */
+typedef struct {
+	PixelsRep *thePixels;
+	unsigned char *map;
+	size_t mapSize;
+} planeSource;
+
+static const void *
+loadPlane (planeSource *src, int z, int c, int t)
+{
+	return (src->map + GetOffset (src->thePixels, 0, 0, z, c, t));
+}
+
+static int
+openPlaneSource (planeSource *src, PixelsRep *thePixels)
+{
+	pixHeader *head = thePixels->head;
+	char path[MAXPATHLEN];
+	struct stat fStat;
+	int fd;
+
+	src->thePixels = thePixels;
+	src->map = NULL;
+	src->mapSize = (size_t)head->dx * head->dy * head->bp * head->dz * head->dc * head->dt;
+	strcpy (path,"Pixels/");
+	if (! getRepPath (thePixels->ID,path,0)) return (-1);
+	if ( (fd = open (path,O_RDONLY)) < 0) return (-1);
+	if (fstat (fd,&fStat) != 0 || (size_t)fStat.st_size < src->mapSize) {
+		close (fd);
+		return (-1);
+	}
+	src->map = (unsigned char *) mmap (NULL,src->mapSize,PROT_READ,MAP_SHARED,fd,0);
+	close (fd);
+	if (src->map == (unsigned char *) MAP_FAILED) {
+		src->map = NULL;
+		return (-1);
+	}
+	return (0);
+}
+
+static void
+closePlaneSource (planeSource *src)
+{
+	if (src->map) munmap (src->map,src->mapSize);
+}
+
+int
+getProjection (char **param, method_params *m_params)
+{
+	PixelsRep *thePixels;
+	pixHeader *head;
+	planeSource src;
+	char *method = "GetProjection";
+	char *theParam, range[64];
+	unsigned char *acc;
+	const void *plane;
+	const fold_kernel *kernels;
+	fold_kernel fold;
+	size_t nPix, accBytes, outBp;
+	int axisZ = 1, op = PROJ_MAX, type, wide, from, to, i, count;
+	int theZ = m_params->theZ, theC = m_params->theC, theT = m_params->theT;
+	FILE *out = stdout;
+	OID ID = m_params->pixelsID;
+
+	if ( (theParam = m_params->values[MPV_AXIS]) ) {
+		if (!strcmp (theParam,"z")) axisZ = 1;
+		else if (!strcmp (theParam,"t")) axisZ = 0;
+		else {
+			OMEIS_ReportError (method, "PixelsID", ID, "Axis must be Z or T, not %s", theParam);
+			return (-1);
+		}
+	}
+
+	if ( (theParam = m_params->values[MPV_OPERATOR]) ) {
+		if (!strcmp (theParam,"max")) op = PROJ_MAX;
+		else if (!strcmp (theParam,"min")) op = PROJ_MIN;
+		else if (!strcmp (theParam,"mean")) op = PROJ_MEAN;
+		else if (!strcmp (theParam,"sum")) op = PROJ_SUM;
+		else {
+			OMEIS_ReportError (method, "PixelsID", ID, "Operator must be max, min, mean or sum, not %s", theParam);
+			return (-1);
+		}
+	}
+
+	/* Opened in our own byte order; a swap filter on stdout does the rest */
+	if (! (thePixels = GetPixelsRep (ID,'r',bigEndian())) ) {
+		OMEIS_ReportError (method, "PixelsID", ID, "GetPixelsRep failed.");
+		return (-1);
+	}
+	head = thePixels->head;
+
+	strncpy (range,(theParam = m_params->values[MPV_RANGE]) ? theParam : "*",sizeof (range) - 1);
+	range[sizeof (range) - 1] = '\0';
+	if (theC < 0 || theC >= head->dc ||
+		(axisZ && (theT < 0 || theT >= head->dt)) || (!axisZ && (theZ < 0 || theZ >= head->dz))) {
+		OMEIS_ReportError (method, "PixelsID", ID,
+			"Parameters theC and %s must be specified and in range (%d,%d).",
+			axisZ ? "theT" : "theZ",head->dc-1,axisZ ? head->dt-1 : head->dz-1);
+		freePixelsRep (thePixels);
+		return (-1);
+	}
+	if (parseCoordRange (range,axisZ ? head->dz : head->dt,&from,&to) < 0) {
+		OMEIS_ReportError (method, "PixelsID", ID,
+			"Range improperly formed.  Expecting a number, a range n-m or *, in range (0,%d).",
+			(axisZ ? head->dz : head->dt) - 1);
+		freePixelsRep (thePixels);
+		return (-1);
+	}
+
+	if (!kernelName) selectKernels ();
+	type = pixelType (head);
+	count = to - from + 1;
+	wide = type == PT_U32 || type == PT_S32 || type == PT_F32 || count > PROJ_MAX_NARROW;
+	nPix = (size_t)head->dx * head->dy;
+	if (op == PROJ_MAX || op == PROJ_MIN) {
+		kernels = op == PROJ_MAX ? kernelMax : kernelMin;
+		accBytes = outBp = head->bp;
+	} else {
+		kernels = wide ? kernelSumWide : kernelSum;
+		accBytes = wide ? 8 : 4;
+		outBp = op == PROJ_SUM ? 4 : head->bp;
+	}
+	fold = kernels[type];
+
+	if (! (acc = (unsigned char *) calloc (nPix,accBytes)) ||
+		openPlaneSource (&src,thePixels) < 0) {
+		OMEIS_ReportError (method, "PixelsID", ID, "Could not read pixels.");
+		free (acc);
+		freePixelsRep (thePixels);
+		return (-1);
+	}
+
+	/* One plane at a time; max and min start from the first plane itself */
+	for (i = from; i <= to; i++) {
+		plane = loadPlane (&src,axisZ ? i : theZ,theC,axisZ ? theT : i);
+		if (i == from && accBytes == head->bp) memcpy (acc,plane,nPix * accBytes);
+		else fold (acc,plane,nPix);
+	}
+	closePlaneSource (&src);
+	if (op == PROJ_MEAN || op == PROJ_SUM)
+		finishPlane (acc,nPix,type,wide,op,count);
+
+	HTTP_ResultType ("application/octet-stream");
+	if (swapNeeded (m_params->iam_BigEndian,outBp) && ! (out = openSwapWriter (stdout,outBp)) )
+		out = stdout;
+	fwrite (acc,outBp,nPix,out);
+	if (out != stdout) fclose (out);
+
+	free (acc);
+	freePixelsRep (thePixels);
+	return (0);
+}
@@ -0,0 +1,55 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifndef projection_h
+#define projection_h
+
+#include "method.h"
+
+/*
+  GetProjection: one plane reduced over Z or T in the server.
+
+    PixelsID, theC      which Pixels and channel
+    theT or theZ        the fixed coordinate: theT for Axis=Z, theZ for Axis=T
+    Axis=Z|T            what to reduce over (default Z)
+    Operator=max|min|mean|sum   (default max)
+    Range=n-m           part of the axis: a number, a range n-m or * (default *)
+    BigEndian           byte order of the result, as for GetPlane
+
+  The result is one plane of sizeX by sizeY pixels.  max, min and mean come
+  back in the Pixels' own type (integer means round half up).  sum comes
+  back as 4-byte pixels: uint32 or int32 for integer Pixels (saturating),
+  float for float Pixels.  Planes are read one at a time into one
+  accumulator plane.
+*/
+
+const char *projKernelName (void);
+int getProjection (char **param, method_params *m_params);
+
+#endif
@@ -0,0 +1,443 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif  /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "Pixels.h"
+#include "OMEIS_Error.h"
+#include "pyramid.h"
+
+static
+char *levelPath (OID ID, int level, char *path) {
+	strcpy (path,"Pixels/");
+	if (! getRepPath (ID,path,0)) return (NULL);
+	sprintf (path + strlen (path),"%s%d",PYRAMID_SUFFIX,level);
+	return (path);
+}
+
+/*
+  Row kernels: dst[x] is the mean of a[2x], a[2x+1], b[2x], b[2x+1] for
+  the n output pixels.  The SSE2 versions do the bulk and leave the tail
+  to the scalar loop, which computes exactly the same thing.
+*/
+#define HALVE_ROW(type,acc) \
+static \
+void halve_##type (const void *va, const void *vb, void *vd, int n) { \
+const type *a = (const type *) va, *b = (const type *) vb; \
+type *d = (type *) vd; \
+int x = halve_##type##_simd (a,b,d,n); \
+	for (; x < n; x++) \
+		d[x] = (type) (((acc)a[2*x] + a[2*x+1] + b[2*x] + b[2*x+1] + 2) >> 2); \
+}
+
+#ifdef __SSE2__
+
+static
+int halve_u_int8_t_simd (const u_int8_t *a, const u_int8_t *b, u_int8_t *d, int n) {
+__m128i lo = _mm_set1_epi16 (0x00FF), two = _mm_set1_epi16 (2), va, vb, s0, s1;
+int x;
+
+	for (x = 0; x + 16 <= n; x += 16) {
+		va = _mm_loadu_si128 ((const __m128i *)(a + 2*x));
+		vb = _mm_loadu_si128 ((const __m128i *)(b + 2*x));
+		s0 = _mm_add_epi16 (_mm_add_epi16 (_mm_and_si128 (va,lo),_mm_srli_epi16 (va,8)),
+			_mm_add_epi16 (_mm_and_si128 (vb,lo),_mm_srli_epi16 (vb,8)));
+		va = _mm_loadu_si128 ((const __m128i *)(a + 2*x + 16));
+		vb = _mm_loadu_si128 ((const __m128i *)(b + 2*x + 16));
+		s1 = _mm_add_epi16 (_mm_add_epi16 (_mm_and_si128 (va,lo),_mm_srli_epi16 (va,8)),
+			_mm_add_epi16 (_mm_and_si128 (vb,lo),_mm_srli_epi16 (vb,8)));
+		s0 = _mm_srli_epi16 (_mm_add_epi16 (s0,two),2);
+		s1 = _mm_srli_epi16 (_mm_add_epi16 (s1,two),2);
+		_mm_storeu_si128 ((__m128i *)(d + x),_mm_packus_epi16 (s0,s1));
+	}
+	return (x);
+}
+
+static
+int halve_int8_t_simd (const int8_t *a, const int8_t *b, int8_t *d, int n) {
+__m128i two = _mm_set1_epi16 (2), va, vb, s0, s1;
+int x;
+
+#define SUM8(v) _mm_add_epi16 (_mm_srai_epi16 (_mm_slli_epi16 (v,8),8),_mm_srai_epi16 (v,8))
+	for (x = 0; x + 16 <= n; x += 16) {
+		va = _mm_loadu_si128 ((const __m128i *)(a + 2*x));
+		vb = _mm_loadu_si128 ((const __m128i *)(b + 2*x));
+		s0 = _mm_add_epi16 (SUM8 (va),SUM8 (vb));
+		va = _mm_loadu_si128 ((const __m128i *)(a + 2*x + 16));
+		vb = _mm_loadu_si128 ((const __m128i *)(b + 2*x + 16));
+		s1 = _mm_add_epi16 (SUM8 (va),SUM8 (vb));
+		s0 = _mm_srai_epi16 (_mm_add_epi16 (s0,two),2);
+		s1 = _mm_srai_epi16 (_mm_add_epi16 (s1,two),2);
+		_mm_storeu_si128 ((__m128i *)(d + x),_mm_packs_epi16 (s0,s1));
+	}
+#undef SUM8
+	return (x);
+}
+
+static
+int halve_u_int16_t_simd (const u_int16_t *a, const u_int16_t *b, u_int16_t *d, int n) {
+__m128i lo = _mm_set1_epi32 (0xFFFF), two = _mm_set1_epi32 (2), bias = _mm_set1_epi32 (0x8000);
+__m128i flip = _mm_set1_epi16 ((short)0x8000), va, vb, s0, s1;
+int x;
+
+#define SUM16(v) _mm_add_epi32 (_mm_and_si128 (v,lo),_mm_srli_epi32 (v,16))
+	for (x = 0; x + 8 <= n; x += 8) {
+		va = _mm_loadu_si128 ((const __m128i *)(a + 2*x));
+		vb = _mm_loadu_si128 ((const __m128i *)(b + 2*x));
+		s0 = _mm_add_epi32 (SUM16 (va),SUM16 (vb));
+		va = _mm_loadu_si128 ((const __m128i *)(a + 2*x + 8));
+		vb = _mm_loadu_si128 ((const __m128i *)(b + 2*x + 8));
+		s1 = _mm_add_epi32 (SUM16 (va),SUM16 (vb));
+		/* No unsigned 32->16 pack in SSE2: shift into signed range and back */
+		s0 = _mm_sub_epi32 (_mm_srli_epi32 (_mm_add_epi32 (s0,two),2),bias);
+		s1 = _mm_sub_epi32 (_mm_srli_epi32 (_mm_add_epi32 (s1,two),2),bias);
+		_mm_storeu_si128 ((__m128i *)(d + x),_mm_xor_si128 (_mm_packs_epi32 (s0,s1),flip));
+	}
+#undef SUM16
+	return (x);
+}
+
+static
+int halve_int16_t_simd (const int16_t *a, const int16_t *b, int16_t *d, int n) {
+__m128i two = _mm_set1_epi32 (2), va, vb, s0, s1;
+int x;
+
+#define SUM16(v) _mm_add_epi32 (_mm_srai_epi32 (_mm_slli_epi32 (v,16),16),_mm_srai_epi32 (v,16))
+	for (x = 0; x + 8 <= n; x += 8) {
+		va = _mm_loadu_si128 ((const __m128i *)(a + 2*x));
+		vb = _mm_loadu_si128 ((const __m128i *)(b + 2*x));
+		s0 = _mm_add_epi32 (SUM16 (va),SUM16 (vb));
+		va = _mm_loadu_si128 ((const __m128i *)(a + 2*x + 8));
+		vb = _mm_loadu_si128 ((const __m128i *)(b + 2*x + 8));
+		s1 = _mm_add_epi32 (SUM16 (va),SUM16 (vb));
+		s0 = _mm_srai_epi32 (_mm_add_epi32 (s0,two),2);
+		s1 = _mm_srai_epi32 (_mm_add_epi32 (s1,two),2);
+		_mm_storeu_si128 ((__m128i *)(d + x),_mm_packs_epi32 (s0,s1));
+	}
+#undef SUM16
+	return (x);
+}
+
+static
+int halve_float_simd (const float *a, const float *b, float *d, int n) {
+__m128 quarter = _mm_set1_ps (0.25f), r0, r1;
+int x;
+
+	for (x = 0; x + 4 <= n; x += 4) {
+		r0 = _mm_add_ps (_mm_loadu_ps (a + 2*x),_mm_loadu_ps (b + 2*x));
+		r1 = _mm_add_ps (_mm_loadu_ps (a + 2*x + 4),_mm_loadu_ps (b + 2*x + 4));
+		_mm_storeu_ps (d + x,_mm_mul_ps (_mm_add_ps (_mm_shuffle_ps (r0,r1,0x88),_mm_shuffle_ps (r0,r1,0xDD)),quarter));
+	}
+	return (x);
+}
+
+#else /* __SSE2__ */
+
+#define NO_SIMD(type) static int halve_##type##_simd (const type *a, const type *b, type *d, int n) { return (0); }
+NO_SIMD(u_int8_t)
+NO_SIMD(int8_t)
+NO_SIMD(u_int16_t)
+NO_SIMD(int16_t)
+NO_SIMD(float)
+
+#endif /* __SSE2__ */
+
+static int halve_u_int32_t_simd (const u_int32_t *a, const u_int32_t *b, u_int32_t *d, int n) { return (0); }
+static int halve_int32_t_simd (const int32_t *a, const int32_t *b, int32_t *d, int n) { return (0); }
+
+HALVE_ROW(u_int8_t,int)
+HALVE_ROW(int8_t,int)
+HALVE_ROW(u_int16_t,int)
+HALVE_ROW(int16_t,int)
+HALVE_ROW(u_int32_t,int64_t)
+HALVE_ROW(int32_t,int64_t)
+
+static
+void halve_float (const void *va, const void *vb, void *vd, int n) {
+const float *a = (const float *) va, *b = (const float *) vb;
+float *d = (float *) vd;
+int x = halve_float_simd (a,b,d,n);
+
+	for (; x < n; x++)
+		d[x] = ((a[2*x] + b[2*x]) + (a[2*x+1] + b[2*x+1])) * 0.25f;
+}
+
+typedef void (*halve_kernel)(const void *a, const void *b, void *d, int n);
+
+static
+halve_kernel pickKernel (pixHeader *head) {
+	if (head->isFloat) return (head->bp == 4 ? halve_float : NULL);
+	switch (head->bp) {
+		case 1: return (head->isSigned ? halve_int8_t : halve_u_int8_t);
+		case 2: return (head->isSigned ? halve_int16_t : halve_u_int16_t);
+		case 4: return (head->isSigned ? halve_int32_t : halve_u_int32_t);
+	}
+	return (NULL);
+}
+
+/*
+  Halves one sw x sh plane into dst.  An odd last column or row is
+  averaged with itself, via padded copies of the two source rows.
+*/
+static
+void halvePlane (halve_kernel halve, const unsigned char *src, int sw, int sh,
+	unsigned char *dst, size_t bp, unsigned char *rowA, unsigned char *rowB) {
+int dw = (sw + 1) / 2, dh = (sh + 1) / 2, y, y2;
+size_t srcRow = (size_t)sw * bp;
+
+	for (y = 0; y < dh; y++) {
+		y2 = 2*y + 1 < sh ? 2*y + 1 : 2*y;
+		memcpy (rowA,src + 2*y*srcRow,srcRow);
+		memcpy (rowB,src + y2*srcRow,srcRow);
+		if (sw & 1) {
+			memcpy (rowA + srcRow,rowA + srcRow - bp,bp);
+			memcpy (rowB + srcRow,rowB + srcRow - bp,bp);
+		}
+		halve (rowA,rowB,dst + (size_t)y*dw*bp,dw);
+	}
+}
+
+/*
+  Maps a whole level read-only; level 0 is the Pixels file itself, which
+  has no pyramidHeader.  For other levels the header is checked and copied
+  to ph, and the pixels start sizeof (pyramidHeader) into the map.
+  Returns the map (munmap it with *mapSize), or NULL.
+*/
+unsigned char *mapPyramidLevel (PixelsRep *thePixels, int level, pyramidHeader *ph, size_t *mapSize) {
+char path[MAXPATHLEN];
+unsigned char *map;
+struct stat fStat;
+int fd;
+
+	strcpy (path,"Pixels/");
+	if (! getRepPath (thePixels->ID,path,0)) return (NULL);
+	if (level > 0) sprintf (path + strlen (path),"%s%d",PYRAMID_SUFFIX,level);
+	if ( (fd = open (path,O_RDONLY)) < 0) return (NULL);
+	if (fstat (fd,&fStat) != 0 || fStat.st_size == 0) {
+		close (fd);
+		return (NULL);
+	}
+	map = (unsigned char *) mmap (NULL,fStat.st_size,PROT_READ,MAP_SHARED,fd,0);
+	close (fd);
+	if (map == (unsigned char *) MAP_FAILED) return (NULL);
+	*mapSize = fStat.st_size;
+	if (level > 0) {
+		memcpy (ph,map,sizeof (pyramidHeader));
+		if ((size_t)fStat.st_size < sizeof (pyramidHeader) || memcmp (ph->magic,PYRAMID_MAGIC,4) ||
+			ph->version != PYRAMID_VERSION || ph->bp != thePixels->head->bp) {
+			munmap (map,fStat.st_size);
+			return (NULL);
+		}
+	}
+	return (map);
+}
+
+/*
+  Builds the pyramid for finished Pixels, each level from the one below.
+  Returns the number of levels written, or -1.
+*/
+int buildPyramid (PixelsRep *thePixels) {
+pixHeader *head = thePixels->head;
+halve_kernel halve;
+pyramidHeader ph, src;
+char path[MAXPATHLEN], tmp_path[MAXPATHLEN+16];
+unsigned char *map, *srcPix, *dst, *rowA, *rowB;
+size_t mapSize, bp = head->bp, srcPlane, dstPlane, plane, nPlanes;
+int level, sw, sh;
+FILE *out;
+
+	if (! (halve = pickKernel (head)) ) return (-1);
+	nPlanes = (size_t)head->dz * head->dc * head->dt;
+
+	memset (&src,0,sizeof (src));
+	src.dx = head->dx;
+	src.dy = head->dy;
+	for (level = 1; level <= PYRAMID_MAX_LEVELS; level++) {
+		sw = src.dx;
+		sh = src.dy;
+		if ((sw <= PYRAMID_MIN_SIZE && sh <= PYRAMID_MIN_SIZE) || (sw == 1 && sh == 1)) break;
+
+		if (! (map = mapPyramidLevel (thePixels,level - 1,&src,&mapSize)) ) return (-1);
+		srcPix = level == 1 ? map : map + sizeof (pyramidHeader);
+		srcPlane = (size_t)sw * sh * bp;
+		if ((size_t)(srcPix - map) + srcPlane * nPlanes > mapSize) {
+			munmap (map,mapSize);
+			return (-1);
+		}
+
+		memset (&ph,0,sizeof (ph));
+		memcpy (ph.magic,PYRAMID_MAGIC,4);
+		ph.version = PYRAMID_VERSION;
+		ph.level = level;
+		ph.bp = bp;
+		ph.isSigned = head->isSigned;
+		ph.isFloat = head->isFloat;
+		ph.dx = (sw + 1) / 2;
+		ph.dy = (sh + 1) / 2;
+		ph.dz = head->dz;
+		ph.dc = head->dc;
+		ph.dt = head->dt;
+		dstPlane = (size_t)ph.dx * ph.dy * bp;
+
+		levelPath (thePixels->ID,level,path);
+		snprintf (tmp_path,sizeof (tmp_path),"%s.%d",path,(int)getpid());
+		dst = (unsigned char *) malloc (dstPlane);
+		rowA = (unsigned char *) malloc (((size_t)sw + 1) * bp);
+		rowB = (unsigned char *) malloc (((size_t)sw + 1) * bp);
+		out = (dst && rowA && rowB) ? fopen (tmp_path,"w") : NULL;
+		if (!out || fwrite (&ph,sizeof (ph),1,out) != 1) {
+			if (out) fclose (out);
+			unlink (tmp_path);
+			free (dst); free (rowA); free (rowB);
+			munmap (map,mapSize);
+			return (-1);
+		}
+
+		for (plane = 0; plane < nPlanes; plane++) {
+			halvePlane (halve,srcPix + plane*srcPlane,sw,sh,dst,bp,rowA,rowB);
+			if (fwrite (dst,1,dstPlane,out) != dstPlane) break;
+		}
+
+		free (dst); free (rowA); free (rowB);
+		munmap (map,mapSize);
+		if (fclose (out) != 0 || plane < nPlanes || rename (tmp_path,path) != 0) {
+			unlink (tmp_path);
+			return (-1);
+		}
+		src = ph;
+	}
+
+	return (level - 1);
+}
+
+/*
+  Size of a level, from its header.  Returns 0, or -1 if there is no such
+  level.
+*/
+int pyramidLevelSize (PixelsRep *thePixels, int level, int *dx, int *dy) {
+char path[MAXPATHLEN];
+pyramidHeader ph;
+int fd;
+ssize_t n;
+
+	if (level < 1 || ! levelPath (thePixels->ID,level,path)) return (-1);
+	if ( (fd = open (path,O_RDONLY)) < 0) return (-1);
+	n = pread (fd,&ph,sizeof (ph),0);
+	close (fd);
+	if (n != sizeof (ph) || memcmp (ph.magic,PYRAMID_MAGIC,4) || ph.version != PYRAMID_VERSION) return (-1);
+	*dx = ph.dx;
+	*dy = ph.dy;
+	return (0);
+}
+
+/*
+  Writes an ROI of a level to out in XYZCT order.  X and Y are in the
+  level's own coordinates.  Returns the number of pixels written, or -1
+  (reported) before anything is written if the level or ROI is bad.
+*/
+long long pyramidROI (PixelsRep *thePixels, int level,
+	int x0, int y0, int z0, int c0, int t0,
+	int x1, int y1, int z1, int c1, int t1, FILE *out, char *method) {
+pixHeader *head = thePixels->head;
+char path[MAXPATHLEN];
+pyramidHeader ph;
+unsigned char *buf;
+size_t bp = head->bp, rowBytes, planeBytes, spanBytes;
+long long nPix = 0;
+off_t planeOff;
+int fd, y, z, c, t;
+
+	if (level < 1 || ! levelPath (thePixels->ID,level,path) || (fd = open (path,O_RDONLY)) < 0) {
+		OMEIS_ReportError (method, "PixelsID", thePixels->ID, "Resolution level %d does not exist.",level);
+		return (-1);
+	}
+	if (pread (fd,&ph,sizeof (ph),0) != sizeof (ph) || memcmp (ph.magic,PYRAMID_MAGIC,4) ||
+		ph.version != PYRAMID_VERSION || ph.bp != bp) {
+		OMEIS_ReportError (method, "PixelsID", thePixels->ID, "Resolution level %d is damaged.",level);
+		close (fd);
+		return (-1);
+	}
+	if (x0 < 0 || y0 < 0 || z0 < 0 || c0 < 0 || t0 < 0 ||
+		x1 < x0 || y1 < y0 || z1 < z0 || c1 < c0 || t1 < t0 ||
+		x1 >= (int)ph.dx || y1 >= (int)ph.dy || z1 >= (int)ph.dz || c1 >= (int)ph.dc || t1 >= (int)ph.dt) {
+		OMEIS_ReportError (method, "PixelsID", thePixels->ID,
+			"Coordinates must be in range (%d,%d,%d,%d,%d) at resolution level %d.",
+			ph.dx-1,ph.dy-1,ph.dz-1,ph.dc-1,ph.dt-1,level);
+		close (fd);
+		return (-1);
+	}
+
+	rowBytes = (size_t)ph.dx * bp;
+	planeBytes = rowBytes * ph.dy;
+	spanBytes = (size_t)(y1 - y0) * rowBytes + (size_t)(x1 - x0 + 1) * bp;
+	if (! (buf = (unsigned char *) malloc (spanBytes)) ) {
+		OMEIS_ReportError (method, "PixelsID", thePixels->ID, "Could not allocate %lu bytes",(unsigned long) spanBytes);
+		close (fd);
+		return (-1);
+	}
+
+	/* One read per plane covering the ROI's rows, then the rows are cut out of it */
+	for (t = t0; t <= t1; t++)
+		for (c = c0; c <= c1; c++)
+			for (z = z0; z <= z1; z++) {
+				planeOff = sizeof (ph) + (off_t)(((size_t)t*ph.dc + c)*ph.dz + z) * planeBytes;
+				if (pread (fd,buf,spanBytes,planeOff + (off_t)y0*rowBytes + (off_t)x0*bp) != (ssize_t)spanBytes)
+					goto done;
+				for (y = 0; y <= y1 - y0; y++)
+					nPix += fwrite (buf + (size_t)y*rowBytes,bp,x1 - x0 + 1,out);
+			}
+
+done:
+	free (buf);
+	close (fd);
+	return (nPix);
+}
+
+void removePyramid (OID ID) {
+char path[MAXPATHLEN];
+int level;
+
+	for (level = 1; level <= PYRAMID_MAX_LEVELS; level++)
+		if (! levelPath (ID,level,path) || unlink (path) != 0) break;
+}
@@ -0,0 +1,69 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifndef pyramid_h
+#define pyramid_h
+
+#include <stdio.h>
+#include "Pixels.h"
+
+/*
+  Resolution pyramid.  FinishPixels with Pyramid=1 writes level 1, 2, ...
+  next to the Pixels file as <path>.level<N>.  Each level halves X and Y
+  (rounding up) by averaging 2x2 blocks, until both are at most
+  PYRAMID_MIN_SIZE.  Z, C and T are kept.  Integer means round half up,
+  so every kernel gives the same result.
+
+  Each level file is a pyramidHeader (native byte order) followed by the
+  level's pixels in XYZCT order, like the Pixels file.
+*/
+
+#define PYRAMID_MAGIC      "OMEL"
+#define PYRAMID_VERSION    1
+#define PYRAMID_SUFFIX     ".level"
+#define PYRAMID_MIN_SIZE   256
+#define PYRAMID_MAX_LEVELS 16
+
+typedef struct {
+	char magic[4];
+	u_int32_t version;
+	u_int32_t level;
+	u_int32_t bp, isSigned, isFloat;
+	u_int32_t dx, dy, dz, dc, dt;
+} pyramidHeader;
+
+int buildPyramid (PixelsRep *thePixels);
+long long pyramidROI (PixelsRep *thePixels, int level,
+	int x0, int y0, int z0, int c0, int t0,
+	int x1, int y1, int z1, int c1, int t1, FILE *out, char *method);
+int pyramidLevelSize (PixelsRep *thePixels, int level, int *dx, int *dy);
+unsigned char *mapPyramidLevel (PixelsRep *thePixels, int level, pyramidHeader *ph, size_t *mapSize);
+void removePyramid (OID ID);
+
+#endif
@@ -0,0 +1,225 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif  /* HAVE_CONFIG_H */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  /* fopencookie() */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#include "Pixels.h"
+#include "range.h"
+
+/* Returns NULL if the number doesn't fit in 64 bits */
+static
+const char *parseNumber (const char *p, u_int64_t *value, char *found) {
+	*value = 0;
+	*found = 0;
+	while (isdigit ((unsigned char)*p)) {
+		if (*value > (UINT64_MAX - (*p - '0')) / 10) return (NULL);
+		*value = *value * 10 + (*p - '0');
+		*found = 1;
+		p++;
+	}
+	return (p);
+}
+
+/*
+  Parses a Range header value ("bytes=0-499,1000-,-500") against an entity
+  of total bytes.  Returns the number of satisfiable ranges stored in
+  ranges, 0 if the header is malformed or asks for the whole entity (so it
+  should be ignored), or -1 if no range is satisfiable (416), as when a
+  position is too big for 64 bits.
+*/
+int parseByteRanges (const char *spec, u_int64_t total, byteRange *ranges, int maxRanges) {
+const char *p = spec;
+u_int64_t first, last;
+char hasFirst, hasLast;
+int nRanges=0, nSpecs=0;
+
+	while (isspace ((unsigned char)*p)) p++;
+	if (strncmp (p,"bytes=",6)) return (0);
+	p += 6;
+
+	for (;;) {
+		while (isspace ((unsigned char)*p)) p++;
+		/* No entity is that big, so no part of it is satisfiable */
+		if (! (p = parseNumber (p,&first,&hasFirst)) ) return (-1);
+		if (*p++ != '-') return (0);
+		if (! (p = parseNumber (p,&last,&hasLast)) ) return (-1);
+		while (isspace ((unsigned char)*p)) p++;
+		if (*p && *p != ',') return (0);
+		if (!hasFirst && !hasLast) return (0);
+		if (hasFirst && hasLast && last < first) return (0);
+		if (++nSpecs > maxRanges) return (0);
+
+		if (!hasFirst) {
+			/* suffix range: the last 'last' bytes */
+			if (last > 0 && total > 0) {
+				ranges[nRanges].first = last >= total ? 0 : total - last;
+				ranges[nRanges].last = total - 1;
+				nRanges++;
+			}
+		} else if (first < total) {
+			ranges[nRanges].first = first;
+			ranges[nRanges].last = (!hasLast || last >= total) ? total - 1 : last;
+			nRanges++;
+		}
+
+		if (!*p) break;
+		p++;
+	}
+
+	if (nRanges == 0) return (-1);
+	if (nRanges == 1 && ranges[0].first == 0 && ranges[0].last == total - 1) return (0);
+	return (nRanges);
+}
+
+/*
+  Ranges only apply to CGI requests; the command line always gets everything.
+*/
+int getRequestRanges (u_int64_t total, byteRange *ranges, int maxRanges) {
+char *spec;
+
+	if (!getenv ("REQUEST_METHOD") || !(spec = getenv ("HTTP_RANGE")) )
+		return (0);
+	return (parseByteRanges (spec,total,ranges,maxRanges));
+}
+
+void acceptRanges (void) {
+	if (getenv ("REQUEST_METHOD"))
+		fprintf (stdout,"Accept-Ranges: bytes\r\n");
+}
+
+void rangeNotSatisfiable (u_int64_t total) {
+	fprintf (stdout,"Status: 416 Requested Range Not Satisfiable\r\n");
+	fprintf (stdout,"Content-Range: bytes */%llu\r\n",(unsigned long long)total);
+	HTTP_ResultType ("text/plain");
+}
+
+/*
+  Sends a 206 response: a single range as the body, or several as a
+  multipart/byteranges body.
+*/
+int sendByteRanges (byteRange *ranges, int nRanges, u_int64_t total, char *type,
+	rangeSender sender, void *ctx) {
+char multipart[128];
+int i;
+
+	fprintf (stdout,"Status: 206 Partial Content\r\n");
+	acceptRanges ();
+
+	if (nRanges == 1) {
+		fprintf (stdout,"Content-Range: bytes %llu-%llu/%llu\r\n",
+			(unsigned long long)ranges[0].first, (unsigned long long)ranges[0].last,
+			(unsigned long long)total);
+		fprintf (stdout,"Content-Length: %llu\r\n",
+			(unsigned long long)(ranges[0].last - ranges[0].first + 1));
+		HTTP_ResultType (type);
+		return (sender (ctx,ranges[0].first,ranges[0].last - ranges[0].first + 1));
+	}
+
+	sprintf (multipart,"multipart/byteranges; boundary=%s",RANGE_BOUNDARY);
+	HTTP_ResultType (multipart);
+	for (i = 0; i < nRanges; i++) {
+		fprintf (stdout,"\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %llu-%llu/%llu\r\n\r\n",
+			RANGE_BOUNDARY, type,
+			(unsigned long long)ranges[i].first, (unsigned long long)ranges[i].last,
+			(unsigned long long)total);
+		if (sender (ctx,ranges[i].first,ranges[i].last - ranges[i].first + 1) < 0)
+			return (-1);
+	}
+	fprintf (stdout,"\r\n--%s--\r\n",RANGE_BOUNDARY);
+
+	return (0);
+}
+
+/*
+  A write-only stream that drops the first skip bytes written to it, passes
+  the next length bytes on to out, and drops the rest.  This lets whole
+  pixels be read with DoPixelIO() while only the requested bytes are sent.
+*/
+typedef struct {
+	FILE *out;
+	u_int64_t skip;
+	u_int64_t remaining;
+} rangeFilter;
+
+static
+ssize_t rangeFilterWrite (void *cookie, const char *buf, size_t size) {
+rangeFilter *filter = (rangeFilter *) cookie;
+size_t n = size;
+
+	if (filter->skip) {
+		size_t nSkip = filter->skip < n ? filter->skip : n;
+		filter->skip -= nSkip;
+		buf += nSkip;
+		n -= nSkip;
+	}
+	if (n > filter->remaining) n = filter->remaining;
+	if (n) {
+		if (fwrite (buf,1,n,filter->out) != n) return (-1);
+		filter->remaining -= n;
+	}
+	return (size);
+}
+
+static
+int rangeFilterClose (void *cookie) {
+	free (cookie);
+	return (0);
+}
+
+FILE *openRangeFilter (FILE *out, u_int64_t skip, u_int64_t length) {
+rangeFilter *filter;
+cookie_io_functions_t funcs;
+FILE *stream;
+
+	if (! (filter = (rangeFilter *) malloc (sizeof (rangeFilter))) ) return (NULL);
+	filter->out = out;
+	filter->skip = skip;
+	filter->remaining = length;
+
+	memset (&funcs,0,sizeof (funcs));
+	funcs.write = rangeFilterWrite;
+	funcs.close = rangeFilterClose;
+	if (! (stream = fopencookie (filter,"w",funcs)) ) {
+		free (filter);
+		return (NULL);
+	}
+	return (stream);
+}
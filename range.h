@@ -0,0 +1,61 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifndef range_h
+#define range_h
+
+#include <stdio.h>
+#include <sys/types.h>
+
+/*
+  HTTP byte ranges (RFC 2616 section 14.35).  Repository files and finished
+  Pixels never change once written, so ranges are always honoured and
+  If-Range needs no validation.
+*/
+
+#define MAX_BYTE_RANGES   64
+#define RANGE_BOUNDARY    "OMEIS_byteranges_boundary"
+
+typedef struct {
+	u_int64_t first;
+	u_int64_t last;   /* inclusive */
+} byteRange;
+
+/* Sends length bytes of the entity starting at offset to stdout */
+typedef int (*rangeSender)(void *ctx, u_int64_t offset, u_int64_t length);
+
+int parseByteRanges (const char *spec, u_int64_t total, byteRange *ranges, int maxRanges);
+int getRequestRanges (u_int64_t total, byteRange *ranges, int maxRanges);
+void acceptRanges (void);
+void rangeNotSatisfiable (u_int64_t total);
+int sendByteRanges (byteRange *ranges, int nRanges, u_int64_t total, char *type,
+	rangeSender sender, void *ctx);
+FILE *openRangeFilter (FILE *out, u_int64_t skip, u_int64_t length);
+
+#endif
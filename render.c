@@ -0,0 +1,510 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif  /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <setjmp.h>
+#include <sys/mman.h>
+#include <jpeglib.h>
+#include <png.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RENDER_X86 1
+#include <tmmintrin.h>
+#endif
+
+#include "Pixels.h"
+#include "OMEIS_Error.h"
+#include "cgi.h"
+#include "pyramid.h"
+#include "render.h"
+
+#define FORMAT_JPEG 0
+#define FORMAT_PNG  1
+
+/* A lookup table from pixel value to 0-255, and what it was made for */
+typedef struct {
+	int bp, isSigned, isFloat;
+	float black, white, gamma;
+	unsigned long lastUsed;
+	u_int8_t *lut;
+} renderLUT;
+
+static renderLUT lutCache[RENDER_LUT_CACHE];
+static unsigned long lutClock;
+
+typedef struct {
+	int c;
+	float black, white, gamma;
+	const unsigned char *plane;  /* first pixel of the channel's source plane */
+	renderLUT *lut;
+	double scale;                /* 4-byte pixels: table steps per unit of value */
+} renderChannel;
+
+typedef struct {
+	pixHeader *head;
+	int nColors;                 /* 3 for RGB, 1 for grey */
+	renderChannel *color[3];     /* NULL where a colour is off */
+	int srcW, srcH, outW, outH;
+	int *xmap;                   /* source column of each output column, or NULL */
+	u_int8_t *planar[3], *zeros, *rgb;
+} renderJob;
+
+typedef void (*interleave_kernel) (const u_int8_t *r, const u_int8_t *g, const u_int8_t *b, u_int8_t *rgb, int n);
+
+static interleave_kernel interleave;
+static const char *kernelName;
+
+static
+u_int8_t levelOf (double v, double black, double white, double gamma) {
+double t;
+
+	if (white <= black) return (v > black ? 255 : 0);
+	t = (v - black) / (white - black);
+	if (!(t > 0)) return (0);
+	if (t >= 1) return (255);
+	if (gamma != 1.0) t = pow (t, 1.0 / gamma);
+	return ((u_int8_t) (t * 255.0 + 0.5));
+}
+
+/*
+  Finds or makes the table for a channel's settings.  Tables for 4-byte and
+  float pixels only depend on gamma: the pixels are scaled into them.
+  The tables a request is using are the most recently used, so a cache of
+  three or more never evicts one of them.
+*/
+static
+renderLUT *getLUT (pixHeader *head, float black, float white, float gamma) {
+renderLUT *entry, *victim = lutCache;
+int wide = head->bp > 2 || head->isFloat, i;
+size_t size;
+
+	if (wide) {
+		black = 0;
+		white = 1;
+	}
+	for (entry = lutCache; entry < lutCache + RENDER_LUT_CACHE; entry++) {
+		if (entry->lut && entry->bp == head->bp && entry->isSigned == head->isSigned &&
+			entry->isFloat == head->isFloat && entry->black == black && entry->white == white &&
+			entry->gamma == gamma) {
+			entry->lastUsed = ++lutClock;
+			return (entry);
+		}
+		if (!entry->lut || (victim->lut && entry->lastUsed < victim->lastUsed)) victim = entry;
+	}
+
+	size = wide ? RENDER_LUT_STEPS : (size_t)1 << (8 * head->bp);
+	free (victim->lut);
+	if (! (victim->lut = (u_int8_t *) malloc (size)) ) return (NULL);
+	victim->bp = head->bp;
+	victim->isSigned = head->isSigned;
+	victim->isFloat = head->isFloat;
+	victim->black = black;
+	victim->white = white;
+	victim->gamma = gamma;
+	victim->lastUsed = ++lutClock;
+
+	/* 1 and 2-byte tables are indexed by the pixel's bits */
+	for (i = 0; i < (int)size; i++) {
+		if (wide)
+			victim->lut[i] = levelOf ((double) i / (RENDER_LUT_STEPS - 1),0,1,gamma);
+		else if (head->bp == 1)
+			victim->lut[i] = levelOf (head->isSigned ? (int8_t) i : i,black,white,gamma);
+		else
+			victim->lut[i] = levelOf (head->isSigned ? (int16_t) i : i,black,white,gamma);
+	}
+	return (victim);
+}
+
+#define LOOKUP_INDEXED(T) { \
+	const T *s = (const T *) src; \
+	if (xmap) for (x = 0; x < n; x++) dst[x] = lut[s[xmap[x]]]; \
+	else for (x = 0; x < n; x++) dst[x] = lut[s[x]]; \
+}
+
+/* NaNs go to 0 along with everything at or below black */
+#define LOOKUP_SCALED(T) { \
+	const T *s = (const T *) src; \
+	double f, black = ch->black, scale = ch->scale; \
+	for (x = 0; x < n; x++) { \
+		f = ((double) s[xmap ? xmap[x] : x] - black) * scale; \
+		dst[x] = lut[!(f > 0) ? 0 : f >= RENDER_LUT_STEPS - 1 ? RENDER_LUT_STEPS - 1 : (int) (f + 0.5)]; \
+	} \
+}
+
+static
+void lookupRow (renderChannel *ch, pixHeader *head, const unsigned char *src, const int *xmap, int n, u_int8_t *dst) {
+const u_int8_t *lut = ch->lut->lut;
+int x;
+
+	if (head->isFloat) LOOKUP_SCALED (float)
+	else if (head->bp == 1) LOOKUP_INDEXED (u_int8_t)
+	else if (head->bp == 2) LOOKUP_INDEXED (u_int16_t)
+	else if (head->isSigned) LOOKUP_SCALED (int32_t)
+	else LOOKUP_SCALED (u_int32_t)
+}
+
+/*
+  Blend kernels: three planar rows into one RGB row.
+*/
+static
+void interleave_scalar (const u_int8_t *r, const u_int8_t *g, const u_int8_t *b, u_int8_t *rgb, int n) {
+int x;
+
+	for (x = 0; x < n; x++) {
+		rgb[3*x]   = r[x];
+		rgb[3*x+1] = g[x];
+		rgb[3*x+2] = b[x];
+	}
+}
+
+#ifdef RENDER_X86
+/* Sixteen pixels at a time: each 16 bytes out are three byte shuffles or'ed together */
+__attribute__((target("ssse3"))) static
+void interleave_ssse3 (const u_int8_t *r, const u_int8_t *g, const u_int8_t *b, u_int8_t *rgb, int n) {
+const __m128i r0 = _mm_setr_epi8 (0,-1,-1,1,-1,-1,2,-1,-1,3,-1,-1,4,-1,-1,5);
+const __m128i g0 = _mm_setr_epi8 (-1,0,-1,-1,1,-1,-1,2,-1,-1,3,-1,-1,4,-1,-1);
+const __m128i b0 = _mm_setr_epi8 (-1,-1,0,-1,-1,1,-1,-1,2,-1,-1,3,-1,-1,4,-1);
+const __m128i r1 = _mm_setr_epi8 (-1,-1,6,-1,-1,7,-1,-1,8,-1,-1,9,-1,-1,10,-1);
+const __m128i g1 = _mm_setr_epi8 (5,-1,-1,6,-1,-1,7,-1,-1,8,-1,-1,9,-1,-1,10);
+const __m128i b1 = _mm_setr_epi8 (-1,5,-1,-1,6,-1,-1,7,-1,-1,8,-1,-1,9,-1,-1);
+const __m128i r2 = _mm_setr_epi8 (-1,11,-1,-1,12,-1,-1,13,-1,-1,14,-1,-1,15,-1,-1);
+const __m128i g2 = _mm_setr_epi8 (-1,-1,11,-1,-1,12,-1,-1,13,-1,-1,14,-1,-1,15,-1);
+const __m128i b2 = _mm_setr_epi8 (10,-1,-1,11,-1,-1,12,-1,-1,13,-1,-1,14,-1,-1,15);
+__m128i R, G, B;
+int x;
+
+	for (x = 0; x + 16 <= n; x += 16) {
+		R = _mm_loadu_si128 ((const __m128i *)(r + x));
+		G = _mm_loadu_si128 ((const __m128i *)(g + x));
+		B = _mm_loadu_si128 ((const __m128i *)(b + x));
+		_mm_storeu_si128 ((__m128i *)(rgb + 3*x),
+			_mm_or_si128 (_mm_or_si128 (_mm_shuffle_epi8 (R,r0),_mm_shuffle_epi8 (G,g0)),_mm_shuffle_epi8 (B,b0)));
+		_mm_storeu_si128 ((__m128i *)(rgb + 3*x + 16),
+			_mm_or_si128 (_mm_or_si128 (_mm_shuffle_epi8 (R,r1),_mm_shuffle_epi8 (G,g1)),_mm_shuffle_epi8 (B,b1)));
+		_mm_storeu_si128 ((__m128i *)(rgb + 3*x + 32),
+			_mm_or_si128 (_mm_or_si128 (_mm_shuffle_epi8 (R,r2),_mm_shuffle_epi8 (G,g2)),_mm_shuffle_epi8 (B,b2)));
+	}
+	interleave_scalar (r + x,g + x,b + x,rgb + 3*x,n - x);
+}
+#endif
+
+static
+void selectKernels (void) {
+	interleave = interleave_scalar;
+	kernelName = "scalar";
+#ifdef RENDER_X86
+	__builtin_cpu_init ();
+	if (__builtin_cpu_supports ("ssse3")) {
+		interleave = interleave_ssse3;
+		kernelName = "ssse3";
+	}
+#endif
+}
+
+const char *renderKernelName (void) {
+	if (!kernelName) selectKernels ();
+	return (kernelName);
+}
+
+/*
+  Row y of the image, nearest neighbour from the source plane.
+*/
+static
+const u_int8_t *renderRow (renderJob *job, int y) {
+size_t srcRow = (size_t)job->srcW * job->head->bp;
+int sy = (int) (((long long)(2*y + 1) * job->srcH) / (2 * job->outH)), k;
+
+	for (k = 0; k < job->nColors; k++)
+		if (job->color[k])
+			lookupRow (job->color[k],job->head,job->color[k]->plane + sy*srcRow,job->xmap,job->outW,job->planar[k]);
+	if (job->nColors == 1) return (job->planar[0]);
+	interleave (job->planar[0],job->planar[1],job->planar[2],job->rgb,job->outW);
+	return (job->rgb);
+}
+
+typedef struct {
+	struct jpeg_error_mgr pub;
+	jmp_buf jump;
+} jpegError;
+
+static
+void jpegErrorExit (j_common_ptr cinfo) {
+	longjmp (((jpegError *) cinfo->err)->jump,1);
+}
+
+static
+int encodeJPEG (renderJob *job, int quality, FILE *out) {
+struct jpeg_compress_struct cinfo;
+jpegError jerr;
+JSAMPROW row;
+int y;
+
+	cinfo.err = jpeg_std_error (&jerr.pub);
+	jerr.pub.error_exit = jpegErrorExit;
+	if (setjmp (jerr.jump)) {
+		jpeg_destroy_compress (&cinfo);
+		return (-1);
+	}
+	jpeg_create_compress (&cinfo);
+	jpeg_stdio_dest (&cinfo,out);
+	cinfo.image_width = job->outW;
+	cinfo.image_height = job->outH;
+	cinfo.input_components = job->nColors;
+	cinfo.in_color_space = job->nColors == 3 ? JCS_RGB : JCS_GRAYSCALE;
+	jpeg_set_defaults (&cinfo);
+	jpeg_set_quality (&cinfo,quality,TRUE);
+	jpeg_start_compress (&cinfo,TRUE);
+	for (y = 0; y < job->outH; y++) {
+		row = (JSAMPROW) renderRow (job,y);
+		jpeg_write_scanlines (&cinfo,&row,1);
+	}
+	jpeg_finish_compress (&cinfo);
+	jpeg_destroy_compress (&cinfo);
+	return (0);
+}
+
+/* Fast deflate and the Sub filter: these are for looking at, not archiving */
+static
+int encodePNG (renderJob *job, FILE *out) {
+png_structp png;
+png_infop info;
+int y;
+
+	if (! (png = png_create_write_struct (PNG_LIBPNG_VER_STRING,NULL,NULL,NULL)) ) return (-1);
+	if (! (info = png_create_info_struct (png)) ) {
+		png_destroy_write_struct (&png,NULL);
+		return (-1);
+	}
+	if (setjmp (png_jmpbuf (png))) {
+		png_destroy_write_struct (&png,&info);
+		return (-1);
+	}
+	png_init_io (png,out);
+	png_set_compression_level (png,1);
+	png_set_filter (png,0,PNG_FILTER_SUB);
+	png_set_IHDR (png,info,job->outW,job->outH,8,job->nColors == 3 ? PNG_COLOR_TYPE_RGB : PNG_COLOR_TYPE_GRAY,
+		PNG_INTERLACE_NONE,PNG_COMPRESSION_TYPE_DEFAULT,PNG_FILTER_TYPE_DEFAULT);
+	png_write_info (png,info);
+	for (y = 0; y < job->outH; y++)
+		png_write_row (png,(png_bytep) renderRow (job,y));
+	png_write_end (png,info);
+	png_destroy_write_struct (&png,&info);
+	return (0);
+}
+
+/*
+  Parses c,black,white[,gamma].  Returns 1 if the parameter is there, 0 if
+  not, -1 (reported) if it's bad.
+*/
+static
+int parseChannel (char **param, char *name, pixHeader *head, renderChannel *ch, char *method, OID ID) {
+char *theParam;
+int n;
+
+	if (! (theParam = get_param (param,name)) ) return (0);
+	ch->gamma = 1.0;
+	n = sscanf (theParam,"%d,%f,%f,%f",&ch->c,&ch->black,&ch->white,&ch->gamma);
+	if (n < 3 || ch->c < 0 || ch->c >= head->dc || !(ch->gamma > 0)) {
+		OMEIS_ReportError (method, "PixelsID", ID,
+			"%s improperly formed.  Expecting c,black,white[,gamma] with c in range (0,%d) and gamma > 0.",
+			name,head->dc-1);
+		return (-1);
+	}
+	return (1);
+}
+
+/*
+  Renders and sends the composite.  Returns 0, -1 (reported, nothing sent)
+  or RENDER_FALLBACK if the request uses something only DoComposite does.
+*/
+int renderComposite (PixelsRep *thePixels, int theZ, int theT, int level, char **param, char *method) {
+static char *colorNames[] = {"RedChannel","GreenChannel","BlueChannel","GrayChannel"};
+pixHeader *head = thePixels->head;
+pyramidHeader ph;
+renderChannel channels[4], *ch;
+renderJob job;
+planeInfo *stats;
+char *theParam;
+unsigned char *map = NULL;
+size_t mapSize = 0, planeBytes, planeOff;
+int format = FORMAT_JPEG, quality = RENDER_JPEG_QUALITY, basis = 0, sizeSet = 0;
+int have[4], nOn = 0, lw, lh, k, j, x, rc = -1;
+OID ID = thePixels->ID;
+
+	memset (&job,0,sizeof (job));
+	memset (channels,0,sizeof (channels));
+	job.head = head;
+
+	if (theZ >= head->dz || theT >= head->dt) {
+		OMEIS_ReportError (method, "PixelsID", ID, "Parameters theZ and theT must be in range (%d,%d).",
+			head->dz-1,head->dt-1);
+		return (-1);
+	}
+	for (k = 0; k < 4; k++) {
+		if ( (have[k] = parseChannel (param,colorNames[k],head,channels + k,method,ID)) < 0) return (-1);
+		if (k < 3) nOn += have[k];
+	}
+
+	/* Anything else is DoComposite's, unless the request is for a pyramid level it can't read */
+	if ( (theParam = get_lc_param (param,"Format")) ) {
+		if (!strcmp (theParam,"png")) format = FORMAT_PNG;
+		else if (strcmp (theParam,"jpeg") && strcmp (theParam,"jpg")) goto fallback;
+	}
+	if ( (theParam = get_lc_param (param,"LevelBasis")) ) {
+		if (!strcmp (theParam,"mean")) basis = 1;
+		else if (!strcmp (theParam,"geomean")) basis = 2;
+		else goto fallback;
+		if (!thePixels->planeInfos) goto fallback;
+	}
+	if (!nOn && !have[3]) goto fallback;
+
+	if ( (theParam = get_param (param,"Quality")) ) {
+		if (sscanf (theParam,"%d",&quality) != 1 || quality < 1 || quality > 100) {
+			OMEIS_ReportError (method, "PixelsID", ID, "Quality must be between 1 and 100.");
+			return (-1);
+		}
+	}
+
+	/* The source plane: a pyramid level if asked for one, or if Size allows */
+	job.srcW = head->dx;
+	job.srcH = head->dy;
+	if (level > 0 && pyramidLevelSize (thePixels,level,&job.srcW,&job.srcH) < 0) {
+		OMEIS_ReportError (method, "PixelsID", ID, "Resolution level %d does not exist.", level);
+		return (-1);
+	}
+	job.outW = job.srcW;
+	job.outH = job.srcH;
+	if ( (theParam = get_param (param,"Size")) ) {
+		if (sscanf (theParam,"%d,%d",&job.outW,&job.outH) != 2 || job.outW <= 0 || job.outH <= 0) {
+			OMEIS_ReportError (method, "PixelsID", ID, "Size must be two positive integers: w,h.");
+			return (-1);
+		}
+		sizeSet = 1;
+	}
+	if (sizeSet && level == 0)
+		for (k = 1; pyramidLevelSize (thePixels,k,&lw,&lh) == 0 && lw >= job.outW && lh >= job.outH; k++) {
+			level = k;
+			job.srcW = lw;
+			job.srcH = lh;
+		}
+
+	/* The colours, and each one's table */
+	job.nColors = nOn ? 3 : 1;
+	for (k = nOn ? 0 : 3; k < (nOn ? 3 : 4); k++) {
+		if (!have[k]) continue;
+		ch = channels + k;
+		job.color[nOn ? k : 0] = ch;
+		if (basis) {
+			stats = thePixels->planeInfos + ((size_t)theT*head->dc + ch->c)*head->dz + theZ;
+			if (!stats->stats_OK) {
+				if (level > 0) {
+					OMEIS_ReportError (method, "PixelsID", ID, "LevelBasis needs the plane statistics.");
+					return (-1);
+				}
+				goto fallback;
+			}
+			ch->black = basis == 1 ? stats->mean + ch->black*stats->sigma : stats->geomean + ch->black*stats->geosigma;
+			ch->white = basis == 1 ? stats->mean + ch->white*stats->sigma : stats->geomean + ch->white*stats->geosigma;
+		}
+		if (! (ch->lut = getLUT (head,ch->black,ch->white,ch->gamma)) ) {
+			OMEIS_ReportError (method, "PixelsID", ID, "Could not allocate lookup table.");
+			return (-1);
+		}
+		ch->scale = ch->white > ch->black ? (RENDER_LUT_STEPS - 1) / ((double) ch->white - ch->black) : 1e30;
+	}
+
+	if (!interleave) selectKernels ();
+	job.rgb = (u_int8_t *) malloc ((size_t)job.outW * 3);
+	job.zeros = (u_int8_t *) calloc (job.outW,1);
+	for (k = 0; k < job.nColors; k++)
+		job.planar[k] = job.color[k] ? (u_int8_t *) malloc (job.outW) : job.zeros;
+	if (job.outW != job.srcW && (job.xmap = (int *) malloc (job.outW * sizeof (int))) )
+		for (x = 0; x < job.outW; x++) job.xmap[x] = (int) (((long long)(2*x + 1) * job.srcW) / (2 * job.outW));
+	if (!job.rgb || !job.zeros || (job.outW != job.srcW && !job.xmap) ||
+		(job.color[0] && !job.planar[0]) || (job.nColors == 3 &&
+		((job.color[1] && !job.planar[1]) || (job.color[2] && !job.planar[2])))) {
+		OMEIS_ReportError (method, "PixelsID", ID, "Could not allocate row buffers.");
+		goto done;
+	}
+
+	/* The planes, from a map of the level or of the plain Pixels */
+	planeBytes = (size_t)job.srcW * job.srcH * head->bp;
+	for (k = 0; k < job.nColors; k++) {
+		if (! (ch = job.color[k]) ) continue;
+		for (j = 0; j < k; j++)
+			if (job.color[j] && job.color[j]->c == ch->c) ch->plane = job.color[j]->plane;
+		if (ch->plane) continue;
+
+		planeOff = (((size_t)theT*head->dc + ch->c)*head->dz + theZ) * planeBytes;
+		if (!map) {
+			if (! (map = mapPyramidLevel (thePixels,level,&ph,&mapSize)) ) {
+				OMEIS_ReportError (method, "PixelsID", ID, "Could not read resolution level %d.", level);
+				goto done;
+			}
+		}
+		if (level > 0) planeOff += sizeof (ph);
+		if (planeOff + planeBytes > mapSize) {
+			OMEIS_ReportError (method, "PixelsID", ID, "Resolution level %d is damaged.", level);
+			goto done;
+		}
+		ch->plane = map + planeOff;
+	}
+
+	HTTP_ResultType (format == FORMAT_PNG ? "image/png" : "image/jpeg");
+	if (format == FORMAT_PNG) encodePNG (&job,stdout);
+	else encodeJPEG (&job,quality,stdout);
+	rc = 0;
+
+done:
+	for (k = 0; k < job.nColors; k++) {
+		if (job.color[k]) {
+			if (job.planar[k] != job.zeros) free (job.planar[k]);
+		}
+	}
+	free (job.rgb);
+	free (job.zeros);
+	free (job.xmap);
+	if (map) munmap (map,mapSize);
+	return (rc);
+
+fallback:
+	if (level > 0) {
+		OMEIS_ReportError (method, "PixelsID", ID,
+			"Level needs Format jpeg or png, LevelBasis mean or geomean and at least one channel.");
+		return (-1);
+	}
+	return (RENDER_FALLBACK);
+}
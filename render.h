@@ -0,0 +1,66 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifndef render_h
+#define render_h
+
+#include "Pixels.h"
+
+/*
+  Composite rendering.  Composite draws one Z/T plane of up to three
+  channels as an RGB image (or one channel as grey):
+
+    RedChannel, GreenChannel, BlueChannel, GrayChannel = c,black,white[,gamma]
+    LevelBasis=mean|geomean   black and white are in sigmas from the
+                              plane's mean or geometric mean
+    Level=n                   render from level n of the resolution pyramid
+    Size=w,h                  scale to w by h (nearest neighbour), from the
+                              smallest pyramid level that is at least as big
+    Format=jpeg|png, Quality=1-100 (jpeg only)
+
+  Each channel goes through a lookup table from pixel value to 0-255:
+  (v-black)/(white-black), clamped to 0-1, raised to 1/gamma.  Tables for
+  1 and 2-byte pixels are indexed by the pixel itself; 4-byte and float
+  pixels are scaled into a RENDER_LUT_STEPS table.  The last
+  RENDER_LUT_CACHE tables are kept, so paging through Z with the same
+  settings doesn't rebuild them.  The image is encoded and sent a row at
+  a time.
+*/
+
+#define RENDER_LUT_CACHE    8
+#define RENDER_LUT_STEPS    4096
+#define RENDER_JPEG_QUALITY 85
+
+/* renderComposite's answer when the request needs DoComposite */
+#define RENDER_FALLBACK     1
+
+int renderComposite (PixelsRep *thePixels, int theZ, int theT, int level, char **param, char *method);
+const char *renderKernelName (void);
+
+#endif
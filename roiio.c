@@ -0,0 +1,374 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif  /* HAVE_CONFIG_H */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  /* preadv2() */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/param.h>
+
+#include "Pixels.h"
+#include "roiio.h"
+
+typedef struct {
+	pixHeader *head;
+	int x0, y0, z0, c0, t0;
+	int x1, y1, z1, c1, t1;
+	int y, z, c, t;
+	size_t rowBytes;
+	int done;
+} roiPlan;
+
+static
+u_int64_t rowOffset (roiPlan *plan) {
+pixHeader *head = plan->head;
+
+	return (((((u_int64_t)plan->t*head->dc + plan->c)*head->dz + plan->z)*head->dy + plan->y)*head->dx + plan->x0) * head->bp;
+}
+
+static
+void nextRow (roiPlan *plan) {
+	if (++plan->y <= plan->y1) return;
+	plan->y = plan->y0;
+	if (++plan->z <= plan->z1) return;
+	plan->z = plan->z0;
+	if (++plan->c <= plan->c1) return;
+	plan->c = plan->c0;
+	if (++plan->t <= plan->t1) return;
+	plan->done = 1;
+}
+
+/*
+  The next run of rows that are next to each other in the file.  Returns 0
+  when there are no more.
+*/
+static
+int nextRun (roiPlan *plan, u_int64_t *off, u_int64_t *len) {
+	if (plan->done) return (0);
+	*off = rowOffset (plan);
+	*len = plan->rowBytes;
+	for (nextRow (plan); !plan->done && rowOffset (plan) == *off + *len; nextRow (plan))
+		*len += plan->rowBytes;
+	return (1);
+}
+
+/*
+  Walks the plan once up front: how many runs there are, and how many
+  ROI_WINDOW pieces of file they touch.
+*/
+static
+void surveyROI (roiPlan plan, u_int64_t *nRuns, u_int64_t *nWindows) {
+u_int64_t off, len, w0, w1, lastWindow = ~(u_int64_t)0;
+
+	*nRuns = *nWindows = 0;
+	while (nextRun (&plan,&off,&len)) {
+		(*nRuns)++;
+		w0 = off / ROI_WINDOW;
+		w1 = (off + len - 1) / ROI_WINDOW;
+		*nWindows += w1 - w0 + 1 - (w0 == lastWindow);
+		lastWindow = w1;
+	}
+}
+
+/*
+  Asks for every run up front, so a cold ROI is read with many requests in
+  flight rather than one at a time.  Runs less than ROI_GAP_BYTES apart
+  are asked for together.
+*/
+static
+void prefetchROI (roiPlan plan, int fd) {
+u_int64_t off, len, rangeStart, rangeEnd;
+int pending;
+
+	pending = nextRun (&plan,&off,&len);
+	while (pending) {
+		rangeStart = off;
+		rangeEnd = off + len;
+		while ( (pending = nextRun (&plan,&off,&len)) && off - rangeEnd <= ROI_GAP_BYTES)
+			rangeEnd = off + len;
+		posix_fadvise (fd,rangeStart,rangeEnd - rangeStart,POSIX_FADV_WILLNEED);
+	}
+}
+
+/*
+  True if the bytes at off are already in the page cache (RWF_NOWAIT fails
+  rather than go to the disk).  Without RWF_NOWAIT, assume they aren't.
+*/
+static
+int inCache (int fd, unsigned char *buf, size_t len, u_int64_t off) {
+#ifdef RWF_NOWAIT
+struct iovec iov;
+
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	return (preadv2 (fd,&iov,1,off,RWF_NOWAIT) == (ssize_t)len);
+#else
+	return (0);
+#endif
+}
+
+static
+int preadAll (int fd, unsigned char *p, size_t n, u_int64_t off) {
+ssize_t got;
+
+	while (n > 0) {
+		if ( (got = pread (fd,p,n,off)) <= 0) {
+			if (got < 0 && errno == EINTR) continue;
+			return (-1);
+		}
+		p += got;
+		n -= got;
+		off += got;
+	}
+	return (0);
+}
+
+static
+int pwriteAll (int fd, const unsigned char *p, size_t n, u_int64_t off) {
+ssize_t put;
+
+	while (n > 0) {
+		if ( (put = pwrite (fd,p,n,off)) < 0) {
+			if (errno == EINTR) continue;
+			return (-1);
+		}
+		p += put;
+		n -= put;
+		off += put;
+	}
+	return (0);
+}
+
+/*
+  Sparse ROIs: one pread or pwrite per run, through the buffer.
+*/
+static
+long long directROI (roiPlan *plan, int fd, char rorw,
+	unsigned char *buf, size_t bufSize, u_int64_t total, FILE *stream) {
+u_int64_t off, len, n;
+size_t fill = 0, got, bp = plan->head->bp;
+unsigned char *p;
+long long nPix = 0;
+int pending;
+
+	pending = nextRun (plan,&off,&len);
+	if (rorw == 'w') {
+		while (pending) {
+			got = fread (buf,1,total < bufSize ? total : bufSize,stream);
+			got -= got % bp;
+			if (got == 0) break;
+			total -= got;
+			for (p = buf; p < buf + got && pending; ) {
+				n = len < (u_int64_t)(buf + got - p) ? len : (u_int64_t)(buf + got - p);
+				if (pwriteAll (fd,p,n,off) < 0) return (nPix);
+				nPix += n / bp;
+				p += n;
+				off += n;
+				len -= n;
+				if (len == 0) pending = nextRun (plan,&off,&len);
+			}
+		}
+		return (nPix);
+	}
+
+	while (pending) {
+		n = len < bufSize - fill ? len : bufSize - fill;
+		if (preadAll (fd,buf + fill,n,off) < 0) {
+			if (fwrite (buf,1,fill,stream) == fill) nPix += fill / bp;
+			return (nPix);
+		}
+		fill += n;
+		off += n;
+		len -= n;
+		if (len == 0) pending = nextRun (plan,&off,&len);
+
+		if (fill == bufSize || ! pending) {
+			if (fwrite (buf,1,fill,stream) != fill) break;
+			nPix += fill / bp;
+			fill = 0;
+		}
+	}
+
+	return (nPix);
+}
+
+/*
+  Dense ROIs (many runs to a window): gather or scatter the runs through a
+  map of the stretch of file they cover.
+*/
+static
+long long gatherROI (roiPlan *plan, unsigned char *map, u_int64_t mapStart,
+	unsigned char *buf, size_t bufSize, FILE *out) {
+u_int64_t off, len, n;
+size_t fill = 0, bp = plan->head->bp;
+long long nPix = 0;
+int pending;
+
+	pending = nextRun (plan,&off,&len);
+	while (pending) {
+		/* Runs bigger than the buffer go out straight from the map */
+		if (fill == 0 && len >= bufSize) {
+			n = len - len % bufSize;
+			if (fwrite (map + (off - mapStart),1,n,out) != n) break;
+			nPix += n / bp;
+			off += n;
+			len -= n;
+		} else {
+			n = len < bufSize - fill ? len : bufSize - fill;
+			memcpy (buf + fill,map + (off - mapStart),n);
+			fill += n;
+			off += n;
+			len -= n;
+		}
+		if (len == 0) pending = nextRun (plan,&off,&len);
+
+		if (fill > 0 && (fill == bufSize || ! pending)) {
+			if (fwrite (buf,1,fill,out) != fill) break;
+			nPix += fill / bp;
+			fill = 0;
+		}
+	}
+
+	return (nPix);
+}
+
+static
+long long scatterROI (roiPlan *plan, unsigned char *map, u_int64_t mapStart,
+	unsigned char *buf, size_t bufSize, u_int64_t total, FILE *in) {
+u_int64_t off, len, n;
+size_t got, bp = plan->head->bp;
+unsigned char *p;
+long long nPix = 0;
+int pending;
+
+	pending = nextRun (plan,&off,&len);
+	while (pending) {
+		got = fread (buf,1,total < bufSize ? total : bufSize,in);
+		got -= got % bp;
+		if (got == 0) break;
+		total -= got;
+		for (p = buf; p < buf + got && pending; ) {
+			n = len < (u_int64_t)(buf + got - p) ? len : (u_int64_t)(buf + got - p);
+			memcpy (map + (off - mapStart),p,n);
+			nPix += n / bp;
+			p += n;
+			off += n;
+			len -= n;
+			if (len == 0) pending = nextRun (plan,&off,&len);
+		}
+	}
+
+	return (nPix);
+}
+
+/*
+  Reads or writes the ROI through thePixels->IO_stream, in XYZCT order like
+  DoROI.  Returns the number of pixels read or written, or -1 without
+  touching the stream if the file can't be opened or the ROI is out of
+  range; the caller should then use DoROI.
+*/
+long long plannedROI (PixelsRep *thePixels,
+	int x0, int y0, int z0, int c0, int t0,
+	int x1, int y1, int z1, int c1, int t1, char rorw) {
+pixHeader *head = thePixels->head;
+char path[MAXPATHLEN];
+roiPlan plan;
+u_int64_t first, last, mapStart, total, nRuns, nWindows;
+size_t bufSize;
+unsigned char *map = NULL, *buf;
+struct stat fStat;
+long long nPix;
+int fd;
+
+	if (x0 < 0 || y0 < 0 || z0 < 0 || c0 < 0 || t0 < 0 ||
+		x1 < x0 || y1 < y0 || z1 < z0 || c1 < c0 || t1 < t0 ||
+		x1 >= head->dx || y1 >= head->dy || z1 >= head->dz || c1 >= head->dc || t1 >= head->dt) return (-1);
+
+	plan.head = head;
+	plan.x0 = x0; plan.y0 = y0; plan.z0 = z0; plan.c0 = c0; plan.t0 = t0;
+	plan.x1 = x1; plan.y1 = y1; plan.z1 = z1; plan.c1 = c1; plan.t1 = t1;
+	plan.rowBytes = (size_t)(x1 - x0 + 1) * head->bp;
+	plan.done = 0;
+
+	plan.y = y1; plan.z = z1; plan.c = c1; plan.t = t1;
+	last = rowOffset (&plan) + plan.rowBytes;
+	plan.y = y0; plan.z = z0; plan.c = c0; plan.t = t0;
+	first = rowOffset (&plan);
+	total = (u_int64_t)plan.rowBytes * (y1 - y0 + 1) * (z1 - z0 + 1) * (c1 - c0 + 1) * (t1 - t0 + 1);
+	bufSize = total < ROI_BUF_SIZE ? total : ROI_BUF_SIZE;
+	surveyROI (plan,&nRuns,&nWindows);
+
+	strcpy (path,"Pixels/");
+	if (! getRepPath (thePixels->ID,path,0)) return (-1);
+	if ( (fd = open (path,rorw == 'w' ? O_RDWR : O_RDONLY)) < 0) return (-1);
+	if (fstat (fd,&fStat) != 0 || (u_int64_t)fStat.st_size < last ||
+		! (buf = (unsigned char *) malloc (bufSize)) ) {
+		close (fd);
+		return (-1);
+	}
+
+	/*
+	  A map costs a page fault per window touched, where a run costs a
+	  call; map when the runs are packed at least ROI_MAP_DENSITY to a window.
+	*/
+	mapStart = first - first % sysconf (_SC_PAGESIZE);
+	if (nRuns >= ROI_MAP_DENSITY * nWindows) {
+		map = (unsigned char *) mmap (NULL,last - mapStart,rorw == 'w' ? PROT_READ|PROT_WRITE : PROT_READ,
+			MAP_SHARED,fd,mapStart);
+		if (map == (unsigned char *) MAP_FAILED) map = NULL;
+	}
+
+	/* Prefetching costs more than it saves if the ends of the ROI are already cached */
+	if (nWindows > 1 && ! (inCache (fd,buf,plan.rowBytes < bufSize ? plan.rowBytes : bufSize,first) &&
+		inCache (fd,buf,plan.rowBytes < bufSize ? plan.rowBytes : bufSize,last - plan.rowBytes)) )
+		prefetchROI (plan,fd);
+	if (! map)
+		nPix = directROI (&plan,fd,rorw,buf,bufSize,total,thePixels->IO_stream);
+	else if (rorw == 'w')
+		nPix = scatterROI (&plan,map,mapStart,buf,bufSize,total,thePixels->IO_stream);
+	else
+		nPix = gatherROI (&plan,map,mapStart,buf,bufSize,thePixels->IO_stream);
+
+	if (map) munmap (map,last - mapStart);
+	free (buf);
+	close (fd);
+	return (nPix);
+}
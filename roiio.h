@@ -0,0 +1,61 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifndef roiio_h
+#define roiio_h
+
+#include <stdio.h>
+#include "Pixels.h"
+
+/*
+  Planned ROI I/O on the plain Pixels file.  The rows of an ROI are walked
+  in file order, and rows that follow on from each other are merged into
+  runs, so a whole-width ROI is one run per plane (or one for the lot).
+  The plan is surveyed before any I/O:
+    - runs packed at least ROI_MAP_DENSITY to a ROI_WINDOW of file (narrow
+      ROIs through a stack) are gathered or scattered through a map of the
+      file, with no call per row;
+    - sparser runs get one pread or pwrite each.
+  Either way the pixels pass through a buffer of up to ROI_BUF_SIZE and
+  go to or from the client in large pieces.  Unless the ends of the ROI
+  are already cached, the runs are prefetched first (merged when less
+  than ROI_GAP_BYTES apart), so a cold ROI has many reads in flight
+  instead of one at a time.
+*/
+
+#define ROI_BUF_SIZE     (4*1024*1024)
+#define ROI_GAP_BYTES    (32*1024)
+#define ROI_WINDOW       (64*1024)
+#define ROI_MAP_DENSITY  2
+
+long long plannedROI (PixelsRep *thePixels,
+	int x0, int y0, int z0, int c0, int t0,
+	int x1, int y1, int z1, int c1, int t1, char rorw);
+
+#endif
@@ -0,0 +1,383 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif  /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdio_ext.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include "OMEIS_Error.h"
+#include "cgi.h"
+#include "server.h"
+
+static volatile sig_atomic_t stopServer = 0;
+
+static
+void onStopSignal (int sig) {
+	stopServer = 1;
+}
+
+/* Only here to interrupt waitpid() when a delayed respawn is due */
+static
+void onAlarmSignal (int sig) {
+}
+
+/*
+  listen_addr is either the path of a UNIX domain socket, or host:port
+  (host may be empty, meaning the loopback interface) for a TCP socket.
+*/
+static
+int openListener (const char *listen_addr) {
+int sock;
+char *colon;
+
+	if ( (colon = strrchr (listen_addr,':')) ) {
+		struct addrinfo hints, *res, *rp;
+		char host[256];
+		size_t hostLen = colon - listen_addr;
+		int on = 1;
+
+		if (hostLen >= sizeof (host)) return (-1);
+		strncpy (host,listen_addr,hostLen);
+		host[hostLen] = '\0';
+		if (!*host) strcpy (host,"127.0.0.1");
+
+		memset (&hints,0,sizeof (hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_PASSIVE;
+		if (getaddrinfo (host,colon+1,&hints,&res) != 0) return (-1);
+
+		sock = -1;
+		for (rp = res; rp; rp = rp->ai_next) {
+			if ( (sock = socket (rp->ai_family,rp->ai_socktype,rp->ai_protocol)) < 0) continue;
+			setsockopt (sock,SOL_SOCKET,SO_REUSEADDR,&on,sizeof (on));
+			if (bind (sock,rp->ai_addr,rp->ai_addrlen) == 0) break;
+			close (sock);
+			sock = -1;
+		}
+		freeaddrinfo (res);
+		if (sock < 0) return (-1);
+	} else {
+		struct sockaddr_un addr;
+
+		if (strlen (listen_addr) >= sizeof (addr.sun_path)) return (-1);
+		if ( (sock = socket (AF_UNIX,SOCK_STREAM,0)) < 0) return (-1);
+		memset (&addr,0,sizeof (addr));
+		addr.sun_family = AF_UNIX;
+		strcpy (addr.sun_path,listen_addr);
+		unlink (listen_addr);
+		if (bind (sock,(struct sockaddr *)&addr,sizeof (addr)) < 0) {
+			close (sock);
+			return (-1);
+		}
+		chmod (listen_addr,0660);
+	}
+
+	if (listen (sock,SERVER_LISTEN_BACKLOG) < 0) {
+		close (sock);
+		return (-1);
+	}
+	return (sock);
+}
+
+static
+int readFully (int fd, char *buf, size_t len) {
+ssize_t nRead;
+
+	while (len) {
+		nRead = read (fd,buf,len);
+		if (nRead < 0 && errno == EINTR) continue;
+		if (nRead <= 0) return (-1);
+		buf += nRead;
+		len -= nRead;
+	}
+	return (0);
+}
+
+/*
+  Reads the SCGI netstring header block ("<len>:name\0value\0...,") from the
+  connection without buffering, so that the request body is left unread on
+  the socket for getcgivars() to consume through stdin.
+  Returns the length of the header block, or -1 on error.
+*/
+static
+long readRequestHeaders (int fd, char *headers) {
+long len=0;
+char c;
+
+	for (;;) {
+		if (readFully (fd,&c,1) < 0) return (-1);
+		if (c == ':') break;
+		if (c < '0' || c > '9') return (-1);
+		len = len*10 + (c - '0');
+		if (len >= SERVER_MAX_HEADERS) return (-1);
+	}
+
+	if (readFully (fd,headers,len+1) < 0) return (-1);
+	if (headers[len] != ',') return (-1);
+	headers[len] = '\0';
+	return (len);
+}
+
+/*
+  Makes each SCGI header an environment variable, the way a web server
+  would set up a CGI process.  The names are left pointing into headers
+  so that clearRequestEnv() can remove them once the request is done.
+*/
+static
+int setRequestEnv (char *headers, long len, char **names, int maxNames) {
+char *name, *value, *end = headers + len;
+int nNames=0;
+
+	name = headers;
+	while (name < end && nNames < maxNames) {
+		value = name + strlen (name) + 1;
+		if (value >= end) break;
+		setenv (name,value,1);
+		names[nNames++] = name;
+		name = value + strlen (value) + 1;
+	}
+	return (nNames);
+}
+
+static
+void clearRequestEnv (char **names, int nNames) {
+int i;
+
+	for (i = 0; i < nNames; i++)
+		unsetenv (names[i]);
+}
+
+static
+void freeParams (char **param) {
+char **p;
+
+	if (!param) return;
+	for (p = param; *p; p++)
+		free (*p);
+	free (param);
+}
+
+static
+void serveConnection (int conn, int stdin_fd, int stdout_fd, request_handler handler) {
+char headers[SERVER_MAX_HEADERS+1];
+char *names[SERVER_MAX_HEADERS/4];
+char **param;
+long len;
+int nNames;
+
+	if ( (len = readRequestHeaders (conn,headers)) < 0) return;
+	nNames = setRequestEnv (headers,len,names,sizeof (names) / sizeof (char *));
+
+	/* Hand the connection to stdio: body on stdin, CGI response on stdout */
+	fflush (stdout);
+	dup2 (conn,STDIN_FILENO);
+	dup2 (conn,STDOUT_FILENO);
+	__fpurge (stdin);
+	clearerr (stdin);
+	clearerr (stdout);
+
+	if ( (param = getcgivars()) ) {
+		handler (param);
+		freeParams (param);
+	} else {
+		OMEIS_ReportError ("OMEIS", NULL, (OID)0, "Bad request.  Missing parameters.");
+	}
+
+	fflush (stdout);
+	dup2 (stdin_fd,STDIN_FILENO);
+	dup2 (stdout_fd,STDOUT_FILENO);
+	clearerr (stdout);
+	clearRequestEnv (names,nNames);
+}
+
+static
+void workerLoop (int sock, request_handler handler) {
+int conn, nServed, stdin_fd, stdout_fd;
+
+	signal (SIGTERM, SIG_DFL);
+	signal (SIGINT, SIG_DFL);
+	signal (SIGALRM, SIG_DFL);
+	/* A client hanging up mid-response must not take the worker down */
+	signal (SIGPIPE, SIG_IGN);
+
+	stdin_fd = dup (STDIN_FILENO);
+	stdout_fd = dup (STDOUT_FILENO);
+
+	for (nServed = 0; nServed < SERVER_MAX_REQUESTS; ) {
+		if ( (conn = accept (sock,NULL,NULL)) < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			break;
+		}
+		serveConnection (conn,stdin_fd,stdout_fd,handler);
+		close (conn);
+		nServed++;
+	}
+
+	/* Leaving early means accept() failed, which counts against respawning */
+	exit (nServed < SERVER_MAX_REQUESTS ? 1 : 0);
+}
+
+static
+pid_t startWorker (int sock, request_handler handler) {
+pid_t pid;
+
+	if ( (pid = fork()) == 0)
+		workerLoop (sock,handler);
+	return (pid);
+}
+
+/*
+  Works out when the worker in a slot may be started again after it exited
+  with status.  A worker that served its requests and exited cleanly is
+  replaced at once.  One that crashed or failed within SERVER_MIN_UPTIME of
+  starting waits, doubling each time it happens again, up to
+  SERVER_MAX_BACKOFF, so a worker that can't start doesn't fork in a loop.
+*/
+static
+void scheduleRespawn (int status, time_t started, time_t *restartAt, int *backoff) {
+time_t now = time (NULL);
+
+	if ( (WIFEXITED (status) && WEXITSTATUS (status) == 0) || now - started >= SERVER_MIN_UPTIME) {
+		*backoff = 0;
+		*restartAt = now;
+		return;
+	}
+
+	*backoff = *backoff ? *backoff * 2 : 1;
+	if (*backoff > SERVER_MAX_BACKOFF) *backoff = SERVER_MAX_BACKOFF;
+	*restartAt = now + *backoff;
+	OMEIS_ReportError ("Server", NULL, (OID)0,
+		"Worker exited after %d seconds; restarting in %d",(int)(now - started),*backoff);
+}
+
+/*
+  Listens on listen_addr and keeps nWorkers pre-forked processes accepting
+  connections on it.  Workers are replaced when they exit, either because
+  they have served SERVER_MAX_REQUESTS requests or because they crashed.
+  Returns only after SIGTERM/SIGINT, or if the socket could not be set up.
+*/
+int serveRequests (const char *listen_addr, int nWorkers, request_handler handler) {
+int sock, i, nRunning=0, status, *backoff;
+pid_t *workers, pid;
+time_t *started, *restartAt, now, nextStart;
+struct sigaction act;
+
+	if (nWorkers < 1) nWorkers = SERVER_DEFAULT_WORKERS;
+
+	if ( (sock = openListener (listen_addr)) < 0) {
+		OMEIS_ReportError ("Server", NULL, (OID)0, "Could not listen on %s: %s",
+			listen_addr, strerror (errno));
+		return (-1);
+	}
+
+	workers = (pid_t *) calloc (nWorkers,sizeof (pid_t));
+	started = (time_t *) calloc (nWorkers,sizeof (time_t));
+	restartAt = (time_t *) calloc (nWorkers,sizeof (time_t));
+	backoff = (int *) calloc (nWorkers,sizeof (int));
+	if (!workers || !started || !restartAt || !backoff) {
+		OMEIS_ReportError ("Server", NULL, (OID)0, "Could not allocate worker table");
+		free (workers);
+		free (started);
+		free (restartAt);
+		free (backoff);
+		close (sock);
+		return (-1);
+	}
+
+	/* No SA_RESTART, so waitpid() returns as soon as we're asked to stop */
+	memset (&act,0,sizeof (act));
+	act.sa_handler = onStopSignal;
+	sigaction (SIGTERM,&act,NULL);
+	sigaction (SIGINT,&act,NULL);
+	act.sa_handler = onAlarmSignal;
+	sigaction (SIGALRM,&act,NULL);
+
+	while (!stopServer) {
+		now = time (NULL);
+		nextStart = 0;
+		for (i = 0; i < nWorkers; i++) {
+			if (workers[i] > 0) continue;
+			if (restartAt[i] > now) {
+				if (!nextStart || restartAt[i] < nextStart) nextStart = restartAt[i];
+				continue;
+			}
+			if ( (workers[i] = startWorker (sock,handler)) > 0) {
+				started[i] = now;
+				nRunning++;
+			}
+		}
+
+		/* Wake up for the next delayed respawn even if no worker exits */
+		if (nextStart) alarm (nextStart - now);
+		pid = waitpid (-1,&status,0);
+		alarm (0);
+		if (pid > 0) {
+			for (i = 0; i < nWorkers; i++) {
+				if (workers[i] == pid) {
+					workers[i] = 0;
+					nRunning--;
+					scheduleRespawn (status,started[i],&restartAt[i],&backoff[i]);
+				}
+			}
+		} else if (errno == ECHILD) {
+			/* fork() is failing, or every slot is waiting; don't spin */
+			sleep (1);
+		}
+	}
+
+	for (i = 0; i < nWorkers; i++)
+		if (workers[i] > 0) kill (workers[i],SIGTERM);
+	while (nRunning > 0 && wait (NULL) > 0)
+		nRunning--;
+
+	free (workers);
+	free (started);
+	free (restartAt);
+	free (backoff);
+	close (sock);
+	if (!strchr (listen_addr,':')) unlink (listen_addr);
+
+	return (0);
+}
@@ -0,0 +1,53 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifndef server_h
+#define server_h
+
+/*
+  Persistent server mode.  Instead of being exec'ed once per CGI request,
+  omeis can listen on a local (UNIX domain) or TCP socket and answer SCGI
+  requests from a pool of pre-forked worker processes.  Each request is
+  presented to the dispatcher exactly like a CGI invocation: the SCGI headers
+  become the environment, the request body is on stdin and the CGI-style
+  response goes to stdout.
+*/
+
+#define SERVER_DEFAULT_WORKERS  4
+#define SERVER_MAX_REQUESTS     1000  /* requests served before a worker is recycled */
+#define SERVER_MAX_HEADERS      16384 /* largest SCGI header block accepted */
+#define SERVER_LISTEN_BACKLOG   128
+#define SERVER_MIN_UPTIME       10    /* seconds; a worker dying sooner has failed */
+#define SERVER_MAX_BACKOFF      60    /* longest wait before respawning a failed worker */
+
+typedef int (*request_handler)(char **param);
+
+int serveRequests (const char *listen_addr, int nWorkers, request_handler handler);
+
+#endif
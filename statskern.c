@@ -0,0 +1,615 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif  /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/types.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define STATS_X86 1
+#include <immintrin.h>
+#endif
+
+#include "statskern.h"
+
+typedef __int128 sum_t;
+
+/*
+  Sums over one chunk of a row.  Signed pixels are biased into the
+  unsigned range by flipping the sign bit, so one kernel serves both.
+*/
+typedef struct {
+	u_int64_t sum, sum2, sumx;
+	u_int32_t min, max;
+} chunkSums;
+
+typedef void (*chunk_kernel) (const void *buf, size_t n, u_int32_t x0, u_int32_t flip, chunkSums *acc);
+
+static void
+chunk8_scalar (const void *buf, size_t n, u_int32_t x0, u_int32_t flip, chunkSums *acc)
+{
+	const u_int8_t *p = (const u_int8_t *) buf;
+	u_int64_t sum = 0, sum2 = 0, sumx = 0;
+	u_int32_t v, min = acc->min, max = acc->max;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		v = p[i] ^ flip;
+		if (v < min) min = v;
+		if (v > max) max = v;
+		sum += v;
+		sum2 += (u_int64_t)v * v;
+		sumx += (u_int64_t)v * (x0 + i);
+	}
+	acc->sum += sum;
+	acc->sum2 += sum2;
+	acc->sumx += sumx;
+	acc->min = min;
+	acc->max = max;
+}
+
+static void
+chunk16_scalar (const void *buf, size_t n, u_int32_t x0, u_int32_t flip, chunkSums *acc)
+{
+	const u_int16_t *p = (const u_int16_t *) buf;
+	u_int64_t sum = 0, sum2 = 0, sumx = 0;
+	u_int32_t v, min = acc->min, max = acc->max;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		v = p[i] ^ flip;
+		if (v < min) min = v;
+		if (v > max) max = v;
+		sum += v;
+		sum2 += (u_int64_t)v * v;
+		sumx += (u_int64_t)v * (x0 + i);
+	}
+	acc->sum += sum;
+	acc->sum2 += sum2;
+	acc->sumx += sumx;
+	acc->min = min;
+	acc->max = max;
+}
+
+#ifdef STATS_X86
+
+/*
+  v and x hold four u32 lanes each.  The squares and x-weighted values
+  are formed with the 32x32->64 multiply on the even lanes, then on the
+  odd lanes shifted down.
+*/
+#define SSE2_ACCUM(v,x,s,s2,sx) do { \
+	__m128i _vo = _mm_srli_epi64 (v,32), _xo = _mm_srli_epi64 (x,32); \
+	s = _mm_add_epi32 (s,v); \
+	s2 = _mm_add_epi64 (s2,_mm_add_epi64 (_mm_mul_epu32 (v,v),_mm_mul_epu32 (_vo,_vo))); \
+	sx = _mm_add_epi64 (sx,_mm_add_epi64 (_mm_mul_epu32 (v,x),_mm_mul_epu32 (_vo,_xo))); \
+} while (0)
+
+__attribute__((target("sse2"))) static u_int64_t
+hsum32_sse2 (__m128i v)
+{
+	u_int32_t l[4];
+	_mm_storeu_si128 ((__m128i *)l,v);
+	return ((u_int64_t)l[0] + l[1] + l[2] + l[3]);
+}
+
+__attribute__((target("sse2"))) static u_int64_t
+hsum64_sse2 (__m128i v)
+{
+	u_int64_t l[2];
+	_mm_storeu_si128 ((__m128i *)l,v);
+	return (l[0] + l[1]);
+}
+
+__attribute__((target("sse2"))) static void
+chunk8_sse2 (const void *buf, size_t n, u_int32_t x0, u_int32_t flip, chunkSums *acc)
+{
+	const u_int8_t *p = (const u_int8_t *) buf;
+	__m128i zero = _mm_setzero_si128 (), four = _mm_set1_epi32 (4);
+	__m128i vflip = _mm_set1_epi8 ((char)flip);
+	__m128i vmin = _mm_set1_epi8 ((char)0xFF), vmax = zero;
+	__m128i s = zero, s2 = zero, sx = zero;
+	__m128i x = _mm_setr_epi32 (x0, x0+1, x0+2, x0+3);
+	__m128i v, w, v32;
+	u_int8_t l[16];
+	size_t i, k;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		v = _mm_xor_si128 (_mm_loadu_si128 ((const __m128i *)(p+i)),vflip);
+		vmin = _mm_min_epu8 (vmin,v);
+		vmax = _mm_max_epu8 (vmax,v);
+
+		w = _mm_unpacklo_epi8 (v,zero);
+		v32 = _mm_unpacklo_epi16 (w,zero); SSE2_ACCUM (v32,x,s,s2,sx); x = _mm_add_epi32 (x,four);
+		v32 = _mm_unpackhi_epi16 (w,zero); SSE2_ACCUM (v32,x,s,s2,sx); x = _mm_add_epi32 (x,four);
+		w = _mm_unpackhi_epi8 (v,zero);
+		v32 = _mm_unpacklo_epi16 (w,zero); SSE2_ACCUM (v32,x,s,s2,sx); x = _mm_add_epi32 (x,four);
+		v32 = _mm_unpackhi_epi16 (w,zero); SSE2_ACCUM (v32,x,s,s2,sx); x = _mm_add_epi32 (x,four);
+	}
+
+	if (i) {
+		_mm_storeu_si128 ((__m128i *)l,vmin);
+		for (k = 0; k < 16; k++) if (l[k] < acc->min) acc->min = l[k];
+		_mm_storeu_si128 ((__m128i *)l,vmax);
+		for (k = 0; k < 16; k++) if (l[k] > acc->max) acc->max = l[k];
+		acc->sum += hsum32_sse2 (s);
+		acc->sum2 += hsum64_sse2 (s2);
+		acc->sumx += hsum64_sse2 (sx);
+	}
+
+	chunk8_scalar (p+i, n-i, x0+i, flip, acc);
+}
+
+__attribute__((target("sse2"))) static void
+chunk16_sse2 (const void *buf, size_t n, u_int32_t x0, u_int32_t flip, chunkSums *acc)
+{
+	const u_int16_t *p = (const u_int16_t *) buf;
+	__m128i zero = _mm_setzero_si128 (), four = _mm_set1_epi32 (4);
+	/* min/max are signed in SSE2, so compare with the sign bit flipped back */
+	__m128i vflip = _mm_set1_epi16 ((short)(flip ^ 0x8000)), sign = _mm_set1_epi16 ((short)0x8000);
+	__m128i vmin = _mm_set1_epi16 (0x7FFF), vmax = _mm_set1_epi16 ((short)0x8000);
+	__m128i s = zero, s2 = zero, sx = zero;
+	__m128i x = _mm_setr_epi32 (x0, x0+1, x0+2, x0+3);
+	__m128i v, w, v32;
+	u_int16_t l[8];
+	size_t i, k;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		w = _mm_xor_si128 (_mm_loadu_si128 ((const __m128i *)(p+i)),vflip);
+		vmin = _mm_min_epi16 (vmin,w);
+		vmax = _mm_max_epi16 (vmax,w);
+
+		v = _mm_xor_si128 (w,sign);
+		v32 = _mm_unpacklo_epi16 (v,zero); SSE2_ACCUM (v32,x,s,s2,sx); x = _mm_add_epi32 (x,four);
+		v32 = _mm_unpackhi_epi16 (v,zero); SSE2_ACCUM (v32,x,s,s2,sx); x = _mm_add_epi32 (x,four);
+	}
+
+	if (i) {
+		_mm_storeu_si128 ((__m128i *)l,_mm_xor_si128 (vmin,sign));
+		for (k = 0; k < 8; k++) if (l[k] < acc->min) acc->min = l[k];
+		_mm_storeu_si128 ((__m128i *)l,_mm_xor_si128 (vmax,sign));
+		for (k = 0; k < 8; k++) if (l[k] > acc->max) acc->max = l[k];
+		acc->sum += hsum32_sse2 (s);
+		acc->sum2 += hsum64_sse2 (s2);
+		acc->sumx += hsum64_sse2 (sx);
+	}
+
+	chunk16_scalar (p+i, n-i, x0+i, flip, acc);
+}
+
+#define AVX2_ACCUM(v,x,s,s2,sx) do { \
+	__m256i _vo = _mm256_srli_epi64 (v,32), _xo = _mm256_srli_epi64 (x,32); \
+	s = _mm256_add_epi32 (s,v); \
+	s2 = _mm256_add_epi64 (s2,_mm256_add_epi64 (_mm256_mul_epu32 (v,v),_mm256_mul_epu32 (_vo,_vo))); \
+	sx = _mm256_add_epi64 (sx,_mm256_add_epi64 (_mm256_mul_epu32 (v,x),_mm256_mul_epu32 (_vo,_xo))); \
+} while (0)
+
+__attribute__((target("avx2"))) static void
+reduce_avx2 (__m256i s, __m256i s2, __m256i sx, chunkSums *acc)
+{
+	u_int32_t l32[8];
+	u_int64_t l64[4];
+	int k;
+
+	_mm256_storeu_si256 ((__m256i *)l32,s);
+	for (k = 0; k < 8; k++) acc->sum += l32[k];
+	_mm256_storeu_si256 ((__m256i *)l64,s2);
+	for (k = 0; k < 4; k++) acc->sum2 += l64[k];
+	_mm256_storeu_si256 ((__m256i *)l64,sx);
+	for (k = 0; k < 4; k++) acc->sumx += l64[k];
+}
+
+__attribute__((target("avx2"))) static void
+chunk8_avx2 (const void *buf, size_t n, u_int32_t x0, u_int32_t flip, chunkSums *acc)
+{
+	const u_int8_t *p = (const u_int8_t *) buf;
+	__m256i zero = _mm256_setzero_si256 (), eight = _mm256_set1_epi32 (8);
+	__m256i vflip = _mm256_set1_epi8 ((char)flip);
+	__m256i vmin = _mm256_set1_epi8 ((char)0xFF), vmax = zero;
+	__m256i s = zero, s2 = zero, sx = zero;
+	__m256i x = _mm256_setr_epi32 (x0, x0+1, x0+2, x0+3, x0+4, x0+5, x0+6, x0+7);
+	__m256i v, v32;
+	__m128i lo, hi;
+	u_int8_t l[32];
+	size_t i, k;
+
+	for (i = 0; i + 32 <= n; i += 32) {
+		v = _mm256_xor_si256 (_mm256_loadu_si256 ((const __m256i *)(p+i)),vflip);
+		vmin = _mm256_min_epu8 (vmin,v);
+		vmax = _mm256_max_epu8 (vmax,v);
+
+		lo = _mm256_castsi256_si128 (v);
+		hi = _mm256_extracti128_si256 (v,1);
+		v32 = _mm256_cvtepu8_epi32 (lo);                    AVX2_ACCUM (v32,x,s,s2,sx); x = _mm256_add_epi32 (x,eight);
+		v32 = _mm256_cvtepu8_epi32 (_mm_srli_si128 (lo,8)); AVX2_ACCUM (v32,x,s,s2,sx); x = _mm256_add_epi32 (x,eight);
+		v32 = _mm256_cvtepu8_epi32 (hi);                    AVX2_ACCUM (v32,x,s,s2,sx); x = _mm256_add_epi32 (x,eight);
+		v32 = _mm256_cvtepu8_epi32 (_mm_srli_si128 (hi,8)); AVX2_ACCUM (v32,x,s,s2,sx); x = _mm256_add_epi32 (x,eight);
+	}
+
+	if (i) {
+		_mm256_storeu_si256 ((__m256i *)l,vmin);
+		for (k = 0; k < 32; k++) if (l[k] < acc->min) acc->min = l[k];
+		_mm256_storeu_si256 ((__m256i *)l,vmax);
+		for (k = 0; k < 32; k++) if (l[k] > acc->max) acc->max = l[k];
+		reduce_avx2 (s,s2,sx,acc);
+	}
+
+	/* Leave no dirty upper halves behind to slow down SSE code (libm) after us */
+	_mm256_zeroupper ();
+	chunk8_scalar (p+i, n-i, x0+i, flip, acc);
+}
+
+__attribute__((target("avx2"))) static void
+chunk16_avx2 (const void *buf, size_t n, u_int32_t x0, u_int32_t flip, chunkSums *acc)
+{
+	const u_int16_t *p = (const u_int16_t *) buf;
+	__m256i zero = _mm256_setzero_si256 (), eight = _mm256_set1_epi32 (8);
+	__m256i vflip = _mm256_set1_epi16 ((short)flip);
+	__m256i vmin = _mm256_set1_epi16 ((short)0xFFFF), vmax = zero;
+	__m256i s = zero, s2 = zero, sx = zero;
+	__m256i x = _mm256_setr_epi32 (x0, x0+1, x0+2, x0+3, x0+4, x0+5, x0+6, x0+7);
+	__m256i v, v32;
+	u_int16_t l[16];
+	size_t i, k;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		v = _mm256_xor_si256 (_mm256_loadu_si256 ((const __m256i *)(p+i)),vflip);
+		vmin = _mm256_min_epu16 (vmin,v);
+		vmax = _mm256_max_epu16 (vmax,v);
+
+		v32 = _mm256_cvtepu16_epi32 (_mm256_castsi256_si128 (v));      AVX2_ACCUM (v32,x,s,s2,sx); x = _mm256_add_epi32 (x,eight);
+		v32 = _mm256_cvtepu16_epi32 (_mm256_extracti128_si256 (v,1)); AVX2_ACCUM (v32,x,s,s2,sx); x = _mm256_add_epi32 (x,eight);
+	}
+
+	if (i) {
+		_mm256_storeu_si256 ((__m256i *)l,vmin);
+		for (k = 0; k < 16; k++) if (l[k] < acc->min) acc->min = l[k];
+		_mm256_storeu_si256 ((__m256i *)l,vmax);
+		for (k = 0; k < 16; k++) if (l[k] > acc->max) acc->max = l[k];
+		reduce_avx2 (s,s2,sx,acc);
+	}
+
+	/* Leave no dirty upper halves behind to slow down SSE code (libm) after us */
+	_mm256_zeroupper ();
+	chunk16_scalar (p+i, n-i, x0+i, flip, acc);
+}
+
+#endif /* STATS_X86 */
+
+static chunk_kernel kernel8 = NULL, kernel16 = NULL;
+static const char *kernelName = "scalar";
+
+/*
+  Picks the widest kernels the CPU supports.  Racing callers all pick the
+  same ones, so no locking is needed.  OMEIS_STATS_SCALAR in the
+  environment forces the scalar kernels, for checking results.
+*/
+static void
+selectKernels (void)
+{
+	chunk_kernel k8 = chunk8_scalar, k16 = chunk16_scalar;
+
+#ifdef STATS_X86
+	__builtin_cpu_init ();
+	if (__builtin_cpu_supports ("avx2")) {
+		k8 = chunk8_avx2;
+		k16 = chunk16_avx2;
+		kernelName = "avx2";
+	} else if (__builtin_cpu_supports ("sse2")) {
+		k8 = chunk8_sse2;
+		k16 = chunk16_sse2;
+		kernelName = "sse2";
+	}
+	if (getenv ("OMEIS_STATS_SCALAR")) {
+		k8 = chunk8_scalar;
+		k16 = chunk16_scalar;
+		kernelName = "scalar";
+	}
+#endif
+	kernel16 = k16;
+	kernel8 = k8;
+}
+
+const char *
+statsKernelName (void)
+{
+	if (!kernel8) selectKernels ();
+	return (kernelName);
+}
+
+/*
+  1 and 2 byte pixels go through the row kernels in STATS_CHUNK pieces.
+*/
+static void
+sumSmallInts (const void *pixels, ome_dim sizeX, ome_dim sizeY, char bp, char isSigned, pixelSums *sums)
+{
+	chunk_kernel kernel = (bp == 1) ? kernel8 : kernel16;
+	u_int32_t flip = isSigned ? (bp == 1 ? 0x80 : 0x8000) : 0;
+	sum_t bias = flip, nPix = (sum_t)sizeX * sizeY;
+	sum_t sv = 0, sv2 = 0, sxv = 0, syv = 0, rowSum, sumX;
+	u_int32_t min = 0xFFFFFFFF, max = 0;
+	const char *row;
+	chunkSums cs;
+	ome_dim x, y;
+	size_t n;
+
+	for (y = 0; y < sizeY; y++) {
+		row = (const char *)pixels + (size_t)y * sizeX * bp;
+		rowSum = 0;
+		for (x = 0; x < sizeX; x += n) {
+			n = sizeX - x;
+			if (n > STATS_CHUNK) n = STATS_CHUNK;
+			memset (&cs,0,sizeof (cs));
+			cs.min = min;
+			cs.max = max;
+			kernel (row + (size_t)x * bp, n, x, flip, &cs);
+			min = cs.min;
+			max = cs.max;
+			rowSum += cs.sum;
+			sv2 += cs.sum2;
+			sxv += cs.sumx;
+		}
+		sv += rowSum;
+		syv += (sum_t)y * (rowSum - bias * sizeX);
+	}
+
+	/* Undo the bias: v = i + bias */
+	sumX = (sum_t)sizeX * (sizeX - 1) / 2;
+	sums->min = (double)((sum_t)min - bias);
+	sums->max = (double)((sum_t)max - bias);
+	sums->sum_i = (double)(sv - bias * nPix);
+	sums->sum_i2 = (double)(sv2 - 2 * bias * sv + bias * bias * nPix);
+	sums->sum_xi = (double)(sxv - bias * sumX * sizeY);
+	sums->sum_yi = (double)syv;
+}
+
+#define SUM_SCALAR(type,acc_t) do { \
+	const type *p = (const type *) pixels; \
+	acc_t s = 0, s2 = 0, sx = 0, sy = 0, rs, v; \
+	type min = p[0], max = p[0]; \
+	ome_dim x, y; \
+	for (y = 0; y < sizeY; y++) { \
+		rs = 0; \
+		for (x = 0; x < sizeX; x++, p++) { \
+			if (*p < min) min = *p; \
+			if (*p > max) max = *p; \
+			v = *p; \
+			rs += v; \
+			s2 += v * v; \
+			sx += v * x; \
+		} \
+		s += rs; \
+		sy += rs * y; \
+	} \
+	sums->min = min; sums->max = max; \
+	sums->sum_i = s; sums->sum_i2 = s2; \
+	sums->sum_xi = sx; sums->sum_yi = sy; \
+} while (0)
+
+int
+sumPlanePixels (const void *pixels, ome_dim sizeX, ome_dim sizeY,
+	char bp, char isSigned, char isFloat, pixelSums *sums)
+{
+	if (!kernel8) selectKernels ();
+
+	memset (sums,0,sizeof (pixelSums));
+	if (sizeX <= 0 || sizeY <= 0) return (0);
+
+	if (isFloat) {
+		if (bp != 4) return (-1);
+		SUM_SCALAR (float,double);
+	} else if (bp == 1 || bp == 2) {
+		sumSmallInts (pixels,sizeX,sizeY,bp,isSigned,sums);
+	} else if (bp == 4) {
+		if (isSigned) SUM_SCALAR (int32_t,sum_t);
+		else SUM_SCALAR (u_int32_t,sum_t);
+	} else return (-1);
+
+	return (0);
+}
+
+/*
+  The bin v falls in, in a histogram from min to max.  NaNs go in bin 0.
+*/
+static int
+histBin (double v, const pixelHist *h)
+{
+	int bin;
+
+	if (h->max <= h->min || !(v > h->min)) return (0);
+	bin = (int) ((v - h->min) * NUM_BINS / (h->max - h->min));
+	return (bin < NUM_BINS ? bin : NUM_BINS - 1);
+}
+
+static double
+logPixel (double v)
+{
+	return (v > 1.0 ? log (v) : 0.0);
+}
+
+/*
+  1 and 2 byte pixels are counted by value first, so each distinct value
+  is binned and logged once rather than once per pixel.
+*/
+static int
+histSmallInts (const void *pixels, size_t nPix, char bp, char isSigned,
+	pixelHist *plane, pixelHist *stack, pixelLogSums *logs)
+{
+	size_t nValues = (bp == 1) ? 0x100 : 0x10000;
+	u_int32_t flip = isSigned ? (bp == 1 ? 0x80 : 0x8000) : 0;
+	double bias = flip, v, lg;
+	size_t *counts, i, k, hi;
+
+	if (! (counts = (size_t *) calloc (nValues,sizeof (size_t))) ) return (-1);
+	if (bp == 1) {
+		const u_int8_t *p = (const u_int8_t *) pixels;
+		for (i = 0; i < nPix; i++) counts[p[i] ^ flip]++;
+	} else {
+		const u_int16_t *p = (const u_int16_t *) pixels;
+		for (i = 0; i < nPix; i++) counts[p[i] ^ flip]++;
+	}
+
+	hi = (size_t) (plane->max + bias);
+	for (k = (size_t) (plane->min + bias); k <= hi; k++) {
+		if (!counts[k]) continue;
+		v = (double)k - bias;
+		plane->hist[histBin (v,plane)] += counts[k];
+		if (stack) stack->hist[histBin (v,stack)] += counts[k];
+		lg = logPixel (v);
+		logs->sum_log_i += lg * counts[k];
+		logs->sum_log_i2 += lg * lg * counts[k];
+	}
+
+	free (counts);
+	return (0);
+}
+
+/* Logs are added up in long double; a plane has millions of them */
+#define HIST_SCALAR(type) do { \
+	const type *p = (const type *) pixels; \
+	long double sl = 0, sl2 = 0; \
+	for (i = 0; i < nPix; i++) { \
+		v = p[i]; \
+		plane->hist[histBin (v,plane)]++; \
+		if (stack) stack->hist[histBin (v,stack)]++; \
+		lg = logPixel (v); \
+		sl += lg; \
+		sl2 += lg * lg; \
+	} \
+	logs->sum_log_i = sl; \
+	logs->sum_log_i2 = sl2; \
+} while (0)
+
+/*
+  The second pass over a plane.  plane->min and max must be the plane's,
+  from sumPlanePixels; its histogram and logs are cleared and filled in.
+  If stack isn't NULL, the pixels are also added to the stack's
+  histogram, whose min and max must already span the whole stack.
+*/
+int
+histPlanePixels (const void *pixels, size_t nPix, char bp, char isSigned, char isFloat,
+	pixelHist *plane, pixelHist *stack, pixelLogSums *logs)
+{
+	double v, lg;
+	size_t i;
+
+	memset (plane->hist,0,sizeof (plane->hist));
+	memset (logs,0,sizeof (pixelLogSums));
+
+	if (isFloat) {
+		if (bp != 4) return (-1);
+		HIST_SCALAR (float);
+	} else if (bp == 1 || bp == 2) {
+		return (histSmallInts (pixels,nPix,bp,isSigned,plane,stack,logs));
+	} else if (bp == 4) {
+		if (isSigned) HIST_SCALAR (int32_t);
+		else HIST_SCALAR (u_int32_t);
+	} else return (-1);
+
+	return (0);
+}
+
+static void
+momentStats (double n, double sum_i, double sum_i2, const pixelLogSums *logs,
+	float *mean, float *sigma, float *geomean, float *geosigma)
+{
+	*mean = *sigma = *geomean = 0.0;
+	*geosigma = 1.0;
+	if (n < 1.0) return;
+
+	*mean = sum_i / n;
+	*geomean = exp (logs->sum_log_i / n);
+	if (n < 2.0) return;
+	*sigma = sqrt (fabs (sum_i2 - sum_i * sum_i / n) / (n - 1.0));
+	*geosigma = exp (sqrt (fabs (logs->sum_log_i2 - logs->sum_log_i * logs->sum_log_i / n) / (n - 1.0)));
+}
+
+void
+setPlaneInfo (planeInfo *info, const pixelSums *sums, const pixelHist *hist,
+	const pixelLogSums *logs, size_t nPix, ome_coord theZ)
+{
+	info->min = sums->min;
+	info->max = sums->max;
+	momentStats ((double)nPix,sums->sum_i,sums->sum_i2,logs,
+		&info->mean,&info->sigma,&info->geomean,&info->geosigma);
+	info->centroid_x = sums->sum_i ? sums->sum_xi / sums->sum_i : 0.0;
+	info->centroid_y = sums->sum_i ? sums->sum_yi / sums->sum_i : 0.0;
+	info->sum_i = sums->sum_i;
+	info->sum_i2 = sums->sum_i2;
+	info->sum_log_i = logs->sum_log_i;
+	info->sum_xi = sums->sum_xi;
+	info->sum_yi = sums->sum_yi;
+	info->sum_zi = sums->sum_i * theZ;
+	memcpy (info->hist,hist->hist,sizeof (info->hist));
+	info->stats_OK = 1;
+}
+
+void
+addStackPlane (stackSums *stack, const pixelSums *sums, const pixelLogSums *logs,
+	size_t nPix, ome_coord theZ)
+{
+	if (!stack->nPix || sums->min < stack->sums.min) stack->sums.min = sums->min;
+	if (!stack->nPix || sums->max > stack->sums.max) stack->sums.max = sums->max;
+	stack->sums.sum_i += sums->sum_i;
+	stack->sums.sum_i2 += sums->sum_i2;
+	stack->sums.sum_xi += sums->sum_xi;
+	stack->sums.sum_yi += sums->sum_yi;
+	stack->sum_zi += sums->sum_i * theZ;
+	stack->logs.sum_log_i += logs->sum_log_i;
+	stack->logs.sum_log_i2 += logs->sum_log_i2;
+	stack->nPix += nPix;
+}
+
+void
+setStackInfo (stackInfo *info, const stackSums *stack, const pixelHist *hist)
+{
+	double sum_i = stack->sums.sum_i;
+
+	info->min = stack->sums.min;
+	info->max = stack->sums.max;
+	momentStats ((double)stack->nPix,sum_i,stack->sums.sum_i2,&stack->logs,
+		&info->mean,&info->sigma,&info->geomean,&info->geosigma);
+	info->centroid_x = sum_i ? stack->sums.sum_xi / sum_i : 0.0;
+	info->centroid_y = sum_i ? stack->sums.sum_yi / sum_i : 0.0;
+	info->centroid_z = sum_i ? stack->sum_zi / sum_i : 0.0;
+	info->sum_i = sum_i;
+	info->sum_i2 = stack->sums.sum_i2;
+	info->sum_log_i = stack->logs.sum_log_i;
+	info->sum_xi = stack->sums.sum_xi;
+	info->sum_yi = stack->sums.sum_yi;
+	info->sum_zi = stack->sum_zi;
+	memcpy (info->hist,hist->hist,sizeof (info->hist));
+	info->stats_OK = 1;
+}
@@ -0,0 +1,89 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifndef statskern_h
+#define statskern_h
+
+#include "Pixels.h"
+
+/*
+  Plane and stack statistics for pixels that are already in memory, as
+  Convert and ConvertStack have them.  The first pass (sumPlanePixels)
+  sums integer pixel types exactly in integer arithmetic, so the
+  vectorized and scalar kernels agree to the bit, and only converts to
+  double at the end.  Floats are summed in double in pixel order.  The
+  log sums and the histogram need min/max, so they are a second pass
+  (histPlanePixels).  Stack statistics are merged from their planes.
+*/
+typedef struct {
+	double min, max;
+	double sum_i, sum_i2;
+	double sum_xi, sum_yi;
+} pixelSums;
+
+/* Pixels per call into a row kernel; keeps 32-bit lane sums from overflowing */
+#define STATS_CHUNK 8192
+
+/*
+  Second-pass results.  The histogram has NUM_BINS equal bins from min to
+  max inclusive (all pixels in bin 0 if min == max).  The log sums are of
+  log (i), with pixels below 1 counted as 1, so planes with zeros or
+  negative pixels still have a geometric mean.  A plane's pixels can be
+  binned into its stack's histogram in the same pass once the stack's
+  min and max are known.
+*/
+typedef struct {
+	double min, max;
+	unsigned long hist[NUM_BINS];
+} pixelHist;
+
+typedef struct {
+	double sum_log_i, sum_log_i2;
+} pixelLogSums;
+
+/* A stack's totals, merged from its planes' first and second passes */
+typedef struct {
+	pixelSums sums;
+	pixelLogSums logs;
+	double sum_zi;
+	size_t nPix;
+} stackSums;
+
+int sumPlanePixels (const void *pixels, ome_dim sizeX, ome_dim sizeY,
+	char bp, char isSigned, char isFloat, pixelSums *sums);
+int histPlanePixels (const void *pixels, size_t nPix, char bp, char isSigned, char isFloat,
+	pixelHist *plane, pixelHist *stack, pixelLogSums *logs);
+void setPlaneInfo (planeInfo *info, const pixelSums *sums, const pixelHist *hist,
+	const pixelLogSums *logs, size_t nPix, ome_coord theZ);
+void addStackPlane (stackSums *stack, const pixelSums *sums, const pixelLogSums *logs,
+	size_t nPix, ome_coord theZ);
+void setStackInfo (stackInfo *info, const stackSums *stack, const pixelHist *hist);
+const char *statsKernelName (void);
+
+#endif
@@ -0,0 +1,166 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif  /* HAVE_CONFIG_H */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  /* splice() */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#include "stream.h"
+
+/*
+  Output to a non-blocking socket can return EAGAIN; wait until it drains.
+*/
+static
+int waitWritable (int out_fd) {
+struct pollfd pfd;
+
+	pfd.fd = out_fd;
+	pfd.events = POLLOUT;
+	return (poll (&pfd,1,-1) < 0 && errno != EINTR ? -1 : 0);
+}
+
+#ifdef __linux__
+/*
+  sendfile() handles sockets, and since Linux 2.6.33 any output descriptor.
+  Older kernels only splice file pages straight into a pipe.
+  Both return the number of bytes sent, which may be less than length if
+  the kernel refuses the output descriptor, in which case errno is EINVAL.
+*/
+static
+ssize_t kernelCopy (int out_fd, int fd, off_t offset, size_t length) {
+size_t sent=0, chunk;
+ssize_t n;
+loff_t off = offset;
+struct stat oStat;
+char usePipe = 0;
+
+	while (sent < length) {
+		chunk = length - sent > STREAM_CHUNK_SIZE ? STREAM_CHUNK_SIZE : length - sent;
+		if (usePipe)
+			n = splice (fd,&off,out_fd,NULL,chunk,SPLICE_F_MORE);
+		else {
+			off_t soff = (off_t) off;
+			n = sendfile (out_fd,fd,&soff,chunk);
+			if (n > 0) off = soff;
+		}
+
+		if (n > 0) {
+			sent += n;
+		} else if (n == 0) {
+			break;  /* file is shorter than expected */
+		} else if (errno == EINTR) {
+			continue;
+		} else if (errno == EAGAIN) {
+			if (waitWritable (out_fd) < 0) break;
+		} else if (!usePipe && (errno == EINVAL || errno == ENOSYS) &&
+			fstat (out_fd,&oStat) == 0 && S_ISFIFO (oStat.st_mode)) {
+			usePipe = 1;
+		} else {
+			break;
+		}
+	}
+
+	return (sent);
+}
+#endif
+
+static
+ssize_t bufferCopy (int out_fd, int fd, off_t offset, size_t length) {
+char *buf, *p;
+size_t sent=0, chunk;
+ssize_t nRead, nWritten;
+
+	if (! (buf = malloc (STREAM_BUF_SIZE)) ) return (-1);
+
+	while (sent < length) {
+		chunk = length - sent > STREAM_BUF_SIZE ? STREAM_BUF_SIZE : length - sent;
+		if ( (nRead = pread (fd,buf,chunk,offset+sent)) < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		if (nRead == 0) break;
+
+		for (p = buf; nRead > 0; ) {
+			if ( (nWritten = write (out_fd,p,nRead)) < 0) {
+				if (errno == EINTR) continue;
+				if (errno == EAGAIN && waitWritable (out_fd) == 0) continue;
+				free (buf);
+				return (sent);
+			}
+			p += nWritten;
+			nRead -= nWritten;
+			sent += nWritten;
+		}
+	}
+
+	free (buf);
+	return (sent);
+}
+
+/*
+  Sends length bytes of fd, starting at offset, to the out stream.
+  Anything already buffered in out is flushed first, since the data
+  bypasses stdio.  Uses sendfile()/splice() where the kernel supports them,
+  so the data never passes through user space, and falls back to large
+  buffered reads and writes otherwise.
+  Returns the number of bytes sent, or -1 if nothing could be set up.
+*/
+ssize_t streamFD (FILE *out, int fd, off_t offset, size_t length) {
+int out_fd;
+size_t sent = 0;
+ssize_t n;
+
+	if (fflush (out) != 0) return (-1);
+	out_fd = fileno (out);
+
+#ifdef __linux__
+	sent = kernelCopy (out_fd,fd,offset,length);
+	if (sent == length) return (sent);
+#endif
+
+	if ( (n = bufferCopy (out_fd,fd,offset+sent,length-sent)) < 0)
+		return (sent ? (ssize_t) sent : -1);
+	return (sent + n);
+}
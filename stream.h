@@ -0,0 +1,44 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifndef stream_h
+#define stream_h
+
+#include <stdio.h>
+#include <sys/types.h>
+
+/* Buffer used when the kernel can't copy from file to output for us */
+#define STREAM_BUF_SIZE (1024*1024)
+
+/* Largest single sendfile()/splice() request */
+#define STREAM_CHUNK_SIZE (64*1024*1024)
+
+ssize_t streamFD (FILE *out, int fd, off_t offset, size_t length);
+
+#endif
@@ -0,0 +1,258 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif  /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/param.h>
+
+#include "Pixels.h"
+#include "OMEIS_Error.h"
+#include "cgi.h"
+#include "stream.h"
+#include "thumbcache.h"
+
+/*
+  Run DoThumb with stdout pointed at cache_path.  REQUEST_METHOD is
+  cleared for the duration so that no HTTP headers end up in the file.
+  The thumbnail is written to a temporary file and renamed into place, so
+  concurrent requests never see a partial one.
+*/
+static int
+fillThumbCache (OID ID, FILE *thumb, int sizeX, int sizeY, const char *cache_path)
+{
+	char tmp_path[MAXPATHLEN+16];
+	char *req_method;
+	int fd, saved_fd, result;
+
+	snprintf (tmp_path,sizeof(tmp_path),"%s.%d",cache_path,(int)getpid());
+	if ( (fd = open (tmp_path, O_CREAT|O_TRUNC|O_WRONLY, 0600)) < 0)
+		return (-1);
+
+	fflush (stdout);
+	if ( (saved_fd = dup (STDOUT_FILENO)) < 0 ) {
+		close (fd);
+		unlink (tmp_path);
+		return (-1);
+	}
+	dup2 (fd,STDOUT_FILENO);
+	close (fd);
+
+	if ( (req_method = getenv ("REQUEST_METHOD")) )
+		req_method = strdup (req_method);
+	unsetenv ("REQUEST_METHOD");
+
+	result = DoThumb (ID,thumb,sizeX,sizeY);
+
+	fflush (stdout);
+	if (req_method) {
+		setenv ("REQUEST_METHOD",req_method,1);
+		free (req_method);
+	}
+	dup2 (saved_fd,STDOUT_FILENO);
+	close (saved_fd);
+
+	if (result < 0 || rename (tmp_path,cache_path) != 0) {
+		unlink (tmp_path);
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+  Opens the directory holding pix_path and sets *base to the Pixels file's
+  name within it, for walking its cached thumbnails.
+*/
+static DIR *
+openThumbDir (const char *pix_path, char *dir_path, char **base)
+{
+	strcpy (dir_path,pix_path);
+	if ( !(*base = strrchr (dir_path,'/')) ) return (NULL);
+	*(*base)++ = '\0';
+	return (opendir (dir_path));
+}
+
+/*
+  Returns the size part of a cached thumbnail's name if name is one for
+  base, NULL otherwise.  Temporary files have a further '.' in it.
+*/
+static const char *
+thumbCacheSize (const char *name, const char *base, size_t baseLen)
+{
+	if (strncmp (name,base,baseLen) ||
+		strncmp (name + baseLen,THUMB_CACHE_SUFFIX,strlen (THUMB_CACHE_SUFFIX)))
+		return (NULL);
+	return (name + baseLen + strlen (THUMB_CACHE_SUFFIX));
+}
+
+/*
+  Makes room for one more cached size by removing the least recently sent
+  ones until fewer than THUMB_CACHE_MAX_SIZES are left.
+*/
+static void
+evictThumbCache (const char *pix_path)
+{
+	char dir_path[MAXPATHLEN],cache_path[MAXPATHLEN],oldest[MAXPATHLEN];
+	char *base;
+	const char *size;
+	size_t baseLen;
+	int nCached;
+	time_t oldestTime;
+	DIR *dir;
+	struct dirent *entry;
+	struct stat cacheStat;
+
+	do {
+		if ( !(dir = openThumbDir (pix_path,dir_path,&base)) ) return;
+		baseLen = strlen (base);
+		nCached = 0;
+		oldestTime = 0;
+		while ( (entry = readdir (dir)) ) {
+			if ( !(size = thumbCacheSize (entry->d_name,base,baseLen)) || strchr (size,'.') )
+				continue;
+			snprintf (cache_path,sizeof(cache_path),"%s/%s",dir_path,entry->d_name);
+			if (stat (cache_path,&cacheStat) != 0) continue;
+			nCached++;
+			if (nCached == 1 || cacheStat.st_atime < oldestTime) {
+				oldestTime = cacheStat.st_atime;
+				strcpy (oldest,cache_path);
+			}
+		}
+		closedir (dir);
+	} while (nCached >= THUMB_CACHE_MAX_SIZES && unlink (oldest) == 0);
+}
+
+/*
+  Sends the thumbnail for ID scaled to sizeX by sizeY, scaling and caching
+  it first if there is no current cached copy.
+*/
+int
+getCachedThumb (OID ID, int sizeX, int sizeY)
+{
+	char pix_path[MAXPATHLEN],thumb_path[MAXPATHLEN],cache_path[MAXPATHLEN];
+	struct stat pixStat, thumbStat, cacheStat;
+	struct timespec sentTime[2];
+	FILE *thumb;
+	int fd;
+
+	strcpy (pix_path,"Pixels/");
+	if (! getRepPath (ID,pix_path,0)) {
+		OMEIS_ReportError ("GetThumb", "PixelsID", ID, "Could not get repository path");
+		return (-1);
+	}
+	snprintf (thumb_path,sizeof(thumb_path),"%s.thumb",pix_path);
+	snprintf (cache_path,sizeof(cache_path),"%s%s%dx%d",pix_path,THUMB_CACHE_SUFFIX,sizeX,sizeY);
+
+	if ( stat (thumb_path,&thumbStat) != 0 ) {
+		OMEIS_ReportError ("GetThumb", "PixelsID", ID,"Could not get information for thumbnail at %s",thumb_path);
+		return (-1);
+	}
+
+	if ( stat (cache_path,&cacheStat) != 0 ||
+		cacheStat.st_mtime <= thumbStat.st_mtime ||
+		(stat (pix_path,&pixStat) == 0 && cacheStat.st_mtime <= pixStat.st_mtime) ) {
+
+		if ( !(thumb = fopen (thumb_path, "r")) ) {
+			OMEIS_ReportError ("GetThumb", "PixelsID", ID,"Could not open thumbnail at %s",thumb_path);
+			return (-1);
+		}
+
+		/* Scale straight to the client as before if this size isn't cached,
+		   or if the cache can't be written */
+		if (sizeX > THUMB_CACHE_MAX_DIM || sizeY > THUMB_CACHE_MAX_DIM ||
+			(evictThumbCache (pix_path), fillThumbCache (ID,thumb,sizeX,sizeY,cache_path) < 0) ) {
+			rewind (thumb);
+			if (DoThumb (ID,thumb,sizeX,sizeY) < 0) {
+				OMEIS_ReportError ("GetThumb", "PixelsID", ID,"Could not get thumbnail at %s",thumb_path);
+				fclose (thumb);
+				return (-1);
+			}
+			fclose (thumb);
+			return (0);
+		}
+		fclose (thumb);
+
+		if ( stat (cache_path,&cacheStat) != 0 ) {
+			OMEIS_ReportError ("GetThumb", "PixelsID", ID,"Could not get information for thumbnail at %s",cache_path);
+			return (-1);
+		}
+	}
+
+	if ( (fd = open (cache_path, O_RDONLY)) < 0 ) {
+		OMEIS_ReportError ("GetThumb", "PixelsID", ID,"Could not open thumbnail at %s",cache_path);
+		return (-1);
+	}
+
+	/* The access time orders eviction; the modification time must stay put */
+	sentTime[0].tv_nsec = UTIME_NOW;
+	sentTime[1].tv_nsec = UTIME_OMIT;
+	futimens (fd,sentTime);
+
+	HTTP_ResultType ("image/jpeg");
+	streamFD (stdout,fd,0,cacheStat.st_size);
+	close (fd);
+
+	return (0);
+}
+
+/*
+  Removes every cached thumbnail for ID.
+*/
+void
+purgeThumbCache (OID ID)
+{
+	char pix_path[MAXPATHLEN],dir_path[MAXPATHLEN],cache_path[MAXPATHLEN];
+	char *base;
+	size_t baseLen;
+	DIR *dir;
+	struct dirent *entry;
+
+	strcpy (pix_path,"Pixels/");
+	if (! getRepPath (ID,pix_path,0)) return;
+
+	if ( !(dir = openThumbDir (pix_path,dir_path,&base)) ) return;
+	baseLen = strlen (base);
+	while ( (entry = readdir (dir)) ) {
+		if ( !thumbCacheSize (entry->d_name,base,baseLen) )
+			continue;
+		snprintf (cache_path,sizeof(cache_path),"%s/%s",dir_path,entry->d_name);
+		unlink (cache_path);
+	}
+	closedir (dir);
+}
@@ -0,0 +1,51 @@
+/*------------------------------------------------------------------------------
+ *
+ *  Copyright (C) 2003 Open Microscopy Environment
+ *      Massachusetts Institute of Technology,
+ *      National Institutes of Health,
+ *      University of Dundee
+ *
+ *
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2.1 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *------------------------------------------------------------------------------
+ */
+
+
+
+
+#ifndef thumbcache_h
+#define thumbcache_h
+
+#include "Pixels.h"
+
+/*
+  Scaled thumbnails are cached next to the Pixels file as
+  <path>.thumb.<sizeX>x<sizeY>.  A cached thumbnail is only used while it
+  is strictly newer than both the .thumb it was scaled from (which carries the
+  rendering settings) and the Pixels file.
+  Only sizes up to THUMB_CACHE_MAX_DIM on each side are cached, and at most
+  THUMB_CACHE_MAX_SIZES of them per Pixels; past that the least recently
+  sent one is removed.  Other sizes are scaled straight to the client.
+*/
+#define THUMB_CACHE_SUFFIX ".thumb."
+#define THUMB_CACHE_MAX_DIM 512
+#define THUMB_CACHE_MAX_SIZES 8
+
+int getCachedThumb (OID ID, int sizeX, int sizeY);
+void purgeThumbCache (OID ID);
+
+#endif